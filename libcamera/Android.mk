@@ -15,9 +15,16 @@ LOCAL_SRC_FILES:= \
 	CameraFactory.cpp \
 	CameraHal.cpp \
 	CameraHardware.cpp \
+	CameraConfig.cpp \
+	CameraMotion.cpp \
+	CameraStats.cpp \
+	CameraTrace.cpp \
 	Converter.cpp \
 	Utils.cpp \
 	V4L2Camera.cpp \
+	V4L2CapsCache.cpp \
+	V4L2Device.cpp \
+	V4L2Replay.cpp \
 	SurfaceDesc.cpp \
 	SurfaceSize.cpp 
 
@@ -29,5 +36,51 @@ LOCAL_MODULE_TAGS:= optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+# Host benchmark of the converters and the JPEG codecs. Uses the libjpeg
+#  of the host
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS:=-O2 -fno-short-enums -DHAVE_CONFIG_H 
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)
+
+LOCAL_SRC_FILES:= \
+	tools/CameraBench.cpp \
+	Converter.cpp \
+	Utils.cpp
+
+LOCAL_STATIC_LIBRARIES:= liblog libcutils
+LOCAL_LDLIBS:= -ljpeg -lrt -lpthread
+
+LOCAL_MODULE:= camera_bench
+LOCAL_MODULE_TAGS:= optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# Host correctness suite of the converters and the JPEG codecs
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS:=-fno-short-enums -DHAVE_CONFIG_H 
+
+LOCAL_C_INCLUDES += \
+	$(LOCAL_PATH)
+
+LOCAL_SRC_FILES:= \
+	tools/CameraVerify.cpp \
+	CameraMotion.cpp \
+	Converter.cpp \
+	Utils.cpp \
+	V4L2Device.cpp \
+	V4L2Replay.cpp
+
+LOCAL_STATIC_LIBRARIES:= libutils liblog libcutils
+LOCAL_LDLIBS:= -ljpeg -lm -lpthread
+
+LOCAL_MODULE:= camera_verify
+LOCAL_MODULE_TAGS:= optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
 endif # not BUILD_TINY_ANDROID
 
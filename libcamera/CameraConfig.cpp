@@ -0,0 +1,211 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#define LOG_TAG "CameraConfig"
+#include <utils/Log.h>
+
+#include <string.h>
+#include "CameraConfig.h"
+#include "Converter.h"
+
+namespace android {
+
+CameraConfig::CameraConfig() :
+	previewWidth(0),
+	previewHeight(0),
+	previewFmt(PIXEL_FORMAT_UNKNOWN),
+	previewFps(0),
+	pictureWidth(0),
+	pictureHeight(0),
+	videoWidth(0),
+	videoHeight(0),
+	videoFmt(PIXEL_FORMAT_UNKNOWN),
+	jpegQuality(0),
+	jpegRotation(0),
+	zoom(0),
+	effect(YUYV_EFFECT_NONE)
+{
+}
+
+int CameraConfig::parsePreviewFormat(const char* fmt)
+{
+	if (fmt == NULL)
+		return PIXEL_FORMAT_UNKNOWN;
+		
+	if (!strcmp(fmt,"yuv422i-yuyv"))
+		return PIXEL_FORMAT_YCrCb_422_I;
+		
+	if (!strcmp(fmt,"yuv422sp"))
+		return PIXEL_FORMAT_YCbCr_422_SP;
+		
+	if (!strcmp(fmt,"yuv420sp"))
+		return PIXEL_FORMAT_YCbCr_420_SP;
+		
+	if (!strcmp(fmt,"yuv420p"))
+		return PIXEL_FORMAT_YV12;
+		
+	return PIXEL_FORMAT_UNKNOWN;
+}
+
+int CameraConfig::parseEffect(const char* effect)
+{
+	// An unset effect means no effect at all
+	if (effect == NULL || !strcmp(effect, CameraParameters::EFFECT_NONE))
+		return YUYV_EFFECT_NONE;
+		
+	if (!strcmp(effect, CameraParameters::EFFECT_MONO))
+		return YUYV_EFFECT_MONO;
+		
+	if (!strcmp(effect, CameraParameters::EFFECT_SEPIA))
+		return YUYV_EFFECT_SEPIA;
+		
+	if (!strcmp(effect, CameraParameters::EFFECT_NEGATIVE))
+		return YUYV_EFFECT_NEGATIVE;
+		
+	if (!strcmp(effect, CameraParameters::EFFECT_SOLARIZE))
+		return YUYV_EFFECT_SOLARIZE;
+		
+	return -1;
+}
+
+int CameraConfig::frameSize(int fmt, int width, int height)
+{
+	switch (fmt) {
+	case PIXEL_FORMAT_YCrCb_422_I:
+		return width * height << 1; // 2 bytes per pixel
+		
+	case PIXEL_FORMAT_YCbCr_422_SP:
+	case PIXEL_FORMAT_YCbCr_420_SP:
+		return (width * height * 3) >> 1; // 1.5 bytes per pixel
+		
+	case PIXEL_FORMAT_YV12:
+	{
+		/*
+		 * This format assumes
+		 * - an even width
+		 * - an even height
+		 * - a horizontal stride multiple of 16 pixels
+		 * - a vertical stride equal to the height
+		 *
+		 *   y_size = stride * height
+		 *   c_size = ALIGN(stride/2, 16) * height/2
+		 *   cr_offset = y_size
+		 *   cb_offset = y_size + c_size 
+		 *   size = y_size + c_size * 2
+		 */
+		int stride 		= (width + 15) & (-16); 		// Round to 16 pixels
+		int y_size  	= stride * height;
+		int c_stride 	= ((stride >> 1) + 15) & (-16); // Round to 16 pixels
+		int c_size		= c_stride * height >> 1;
+		return y_size + (c_size << 1);
+	}
+	}
+	
+	return 0;
+}
+
+status_t CameraConfig::parse(const CameraParameters& params)
+{
+	int pfmt = parsePreviewFormat(params.getPreviewFormat());
+	if (pfmt == PIXEL_FORMAT_UNKNOWN) {
+        LOGE("CameraConfig::parse: Unsupported format '%s' for preview",params.getPreviewFormat());
+        return BAD_VALUE;
+	}
+	
+	const char* pictFmt = params.getPictureFormat();
+    if (pictFmt == NULL || strcmp(pictFmt, CameraParameters::PIXEL_FORMAT_JPEG)) {
+        LOGE("CameraConfig::parse: Only jpeg still pictures are supported");
+        return BAD_VALUE;
+    }
+	
+	int vfmt = parsePreviewFormat(params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT));
+	if (vfmt == PIXEL_FORMAT_UNKNOWN) {
+        LOGE("CameraConfig::parse: Unsupported format '%s' for recording",params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT));
+        return BAD_VALUE;
+	}
+
+	// An unset rotation means no rotation at all
+	int rot = params.getInt(CameraParameters::KEY_ROTATION);
+	if (rot < 0)
+		rot = 0;
+	if (rot != 0 && rot != 90 && rot != 180 && rot != 270) {
+        LOGE("CameraConfig::parse: Unsupported rotation %d",rot);
+        return BAD_VALUE;
+	}
+
+	int z = params.getInt(CameraParameters::KEY_ZOOM);
+	int maxZoom = params.getInt(CameraParameters::KEY_MAX_ZOOM);
+	if (z < 0)
+		z = 0;
+	if (maxZoom >= 0 && z > maxZoom) {
+        LOGE("CameraConfig::parse: Zoom %d out of range (max %d)",z,maxZoom);
+        return BAD_VALUE;
+	}
+	
+	int fx = parseEffect(params.get(CameraParameters::KEY_EFFECT));
+	if (fx < 0) {
+        LOGE("CameraConfig::parse: Unsupported effect '%s'",params.get(CameraParameters::KEY_EFFECT));
+        return BAD_VALUE;
+	}
+
+	previewFmt = pfmt;
+	videoFmt = vfmt;
+	jpegRotation = rot;
+	zoom = z;
+	effect = fx;
+	params.getPreviewSize(&previewWidth, &previewHeight);
+	previewFps = params.getPreviewFrameRate();
+	params.getPictureSize(&pictureWidth, &pictureHeight);
+	params.getVideoSize(&videoWidth, &videoHeight);
+	jpegQuality = params.getInt(CameraParameters::KEY_JPEG_QUALITY);
+	
+	return NO_ERROR;
+}
+
+uint32_t CameraConfig::diff(const CameraConfig& other) const
+{
+	uint32_t changed = 0;
+	
+	if (previewWidth != other.previewWidth || previewHeight != other.previewHeight)
+		changed |= CHANGED_PREVIEW_SIZE;
+	if (previewFmt != other.previewFmt)
+		changed |= CHANGED_PREVIEW_FORMAT;
+	if (previewFps != other.previewFps)
+		changed |= CHANGED_PREVIEW_FPS;
+	if (pictureWidth != other.pictureWidth || pictureHeight != other.pictureHeight)
+		changed |= CHANGED_PICTURE_SIZE;
+	if (videoWidth != other.videoWidth || videoHeight != other.videoHeight)
+		changed |= CHANGED_VIDEO_SIZE;
+	if (videoFmt != other.videoFmt)
+		changed |= CHANGED_VIDEO_FORMAT;
+	if (jpegQuality != other.jpegQuality)
+		changed |= CHANGED_JPEG_QUALITY;
+	if (jpegRotation != other.jpegRotation)
+		changed |= CHANGED_JPEG_ROTATION;
+	if (zoom != other.zoom)
+		changed |= CHANGED_ZOOM;
+	if (effect != other.effect)
+		changed |= CHANGED_EFFECT;
+		
+	return changed;
+}
+
+}; // namespace android
@@ -0,0 +1,168 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef __CAMERACONFIG_H
+#define __CAMERACONFIG_H
+
+#include <stdint.h>
+#include <camera/CameraParameters.h>
+#include <utils/Errors.h>
+
+#ifndef PIXEL_FORMAT_RGB_888
+#define PIXEL_FORMAT_RGB_888 3 /* */
+#endif
+
+#ifndef PIXEL_FORMAT_RGBA_8888
+#define PIXEL_FORMAT_RGBA_8888 1 /* [ov] */
+#endif
+
+#ifndef PIXEL_FORMAT_RGBX_8888
+#define PIXEL_FORMAT_RGBX_8888 2 
+#endif
+
+#ifndef PIXEL_FORMAT_BGRA_8888
+#define PIXEL_FORMAT_BGRA_8888 5 /* [ov] */
+#endif
+
+#ifndef PIXEL_FORMAT_RGB_565
+#define PIXEL_FORMAT_RGB_565  4 /* [ov] */
+#endif
+
+// We need this format to allow special preview modes
+#ifndef PIXEL_FORMAT_YCrCb_422_I
+#define PIXEL_FORMAT_YCrCb_422_I 100
+#endif
+
+#ifndef PIXEL_FORMAT_YCbCr_422_SP
+#define PIXEL_FORMAT_YCbCr_422_SP 0x10    /* NV16  [ov] */
+#endif
+
+#ifndef PIXEL_FORMAT_YCbCr_420_SP
+#define PIXEL_FORMAT_YCbCr_420_SP 0x21    /* NV12 */
+#endif
+
+#ifndef PIXEL_FORMAT_UNKNOWN
+#define PIXEL_FORMAT_UNKNOWN 0
+#endif
+
+    /*
+     * Android YUV format:
+     *
+     * This format is exposed outside of the HAL to software
+     * decoders and applications.
+     * EGLImageKHR must support it in conjunction with the
+     * OES_EGL_image_external extension.
+     *
+     * YV12 is 4:2:0 YCrCb planar format comprised of a WxH Y plane followed
+     * by (W/2) x (H/2) Cr and Cb planes.
+     *
+     * This format assumes
+     * - an even width
+     * - an even height
+     * - a horizontal stride multiple of 16 pixels
+     * - a vertical stride equal to the height
+     *
+     *   y_size = stride * height
+     *   c_size = ALIGN(stride/2, 16) * height/2
+     *   size = y_size + c_size * 2
+     *   cr_offset = y_size
+     *   cb_offset = y_size + c_size
+     *
+     */
+#ifndef PIXEL_FORMAT_YV12
+#define PIXEL_FORMAT_YV12  0x32315659 /* YCrCb 4:2:0 Planar */
+#endif
+
+#ifndef PIXEL_FORMAT_YV16
+#define PIXEL_FORMAT_YV16  0x36315659 /* YCrCb 4:2:2 Planar */
+#endif
+
+
+namespace android {
+
+/* Camera configuration, decoded from the CameraParameters strings.
+ *
+ * It is built once per setParameters call, so the rest of the driver can
+ * use plain ints and pixel format enums instead of parsing the parameters
+ * again each time they are needed.
+ */
+class CameraConfig {
+public:
+	// Bits of the change mask returned by diff()
+	enum {
+		CHANGED_PREVIEW_SIZE	= 1 << 0,
+		CHANGED_PREVIEW_FORMAT	= 1 << 1,
+		CHANGED_PREVIEW_FPS		= 1 << 2,
+		CHANGED_PICTURE_SIZE	= 1 << 3,
+		CHANGED_VIDEO_SIZE		= 1 << 4,
+		CHANGED_VIDEO_FORMAT	= 1 << 5,
+		CHANGED_JPEG_QUALITY	= 1 << 6,
+		CHANGED_JPEG_ROTATION	= 1 << 7,
+		CHANGED_ZOOM			= 1 << 8,
+		CHANGED_EFFECT			= 1 << 9,
+		
+		CHANGED_PREVIEW			= CHANGED_PREVIEW_SIZE | CHANGED_PREVIEW_FORMAT,
+		CHANGED_VIDEO			= CHANGED_VIDEO_SIZE | CHANGED_VIDEO_FORMAT,
+		CHANGED_ALL				= 0xFFFFFFFF
+	};
+
+	CameraConfig();
+	
+	/* Decodes the parameters. Returns BAD_VALUE if any of the formats is
+	 * not supported, leaving this object untouched */
+	status_t parse(const CameraParameters& params);
+	
+	/* Returns the mask of the settings that differ from the given config */
+	uint32_t diff(const CameraConfig& other) const;
+	
+	/* Converts a CameraParameters preview/video format to a pixel format.
+	 * Returns PIXEL_FORMAT_UNKNOWN if not supported */
+	static int parsePreviewFormat(const char* fmt);
+	
+	/* Converts a CameraParameters color effect to a YUYV_EFFECT_xxx value.
+	 * Returns -1 if not supported */
+	static int parseEffect(const char* effect);
+	
+	/* Size in bytes of a frame of the given pixel format and size */
+	static int frameSize(int fmt, int width, int height);
+
+	int previewWidth;
+	int previewHeight;
+	int previewFmt;
+	int previewFps;
+	
+	int pictureWidth;
+	int pictureHeight;
+	
+	int videoWidth;
+	int videoHeight;
+	int videoFmt;
+	
+	int jpegQuality;
+	int jpegRotation;		// Clockwise, in degrees
+	
+	int zoom;				// Index into the zoom ratios
+	int effect;				// YUYV_EFFECT_xxx
+};
+
+}; // namespace android
+
+#endif
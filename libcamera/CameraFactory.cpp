@@ -24,9 +24,15 @@
 #include <cutils/log.h>
 #include <cutils/properties.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include "CameraFactory.h"
 
+// Class holding all the video4linux devices
+#define V4L2_SYSFS_CLASS	"/sys/class/video4linux"
+
 extern camera_module_t HAL_MODULE_INFO_SYM;
 
 /* A global instance of CameraFactory is statically instantiated and
@@ -37,7 +43,8 @@ android::CameraFactory  gCameraFactory;
 namespace android {
 
 CameraFactory::CameraFactory()
-        : mCamera(NULL)
+        : mScanned(false),
+		  mLegacy(false)
 {
 	LOGD("CameraFactory::CameraFactory");
 }
@@ -45,10 +52,264 @@ CameraFactory::CameraFactory()
 CameraFactory::~CameraFactory()
 {
 	LOGD("CameraFactory::~CameraFactory");
-    if (mCamera != NULL) {
-        delete mCamera;
-		mCamera = NULL;
-    }
+	for (size_t i = 0; i < mCameras.size(); i++) {
+		if (mCameras[i].hw != NULL) {
+			delete mCameras[i].hw;
+		}
+	}
+	mCameras.clear();
+}
+
+/* Get the number of a video node from its name, or -1 if not a video node */
+static int videoNodeNumber(const char* name)
+{
+	if (strncmp(name, "video", 5) || name[5] < '0' || name[5] > '9')
+		return -1;
+	return atoi(name + 5);
+}
+
+/* Sort video node numbers in descending order */
+static int compareNodesDesc(const void* a, const void* b)
+{
+	return *(const int*)b - *(const int*)a;
+}
+
+void CameraFactory::scanCamerasLocked()
+{
+	// List all the video nodes
+	int nodes[32];
+	int count = 0;
+	DIR* dir = opendir(V4L2_SYSFS_CLASS);
+	if (dir) {
+		struct dirent* de;
+		while ((de = readdir(dir)) != NULL && count < 32) {
+			int n = videoNodeNumber(de->d_name);
+			if (n >= 0) {
+				nodes[count++] = n;
+			}
+		}
+		closedir(dir);
+	}
+	
+	// Newer nodes first: That way, when 2 cameras are found, the 
+	//  back camera is /dev/video1 and the front one /dev/video0, as
+	//  it has always been
+	qsort(nodes, count, sizeof(int), compareNodesDesc);
+	
+	// A recorded stream can be exposed as one more camera, so the whole
+	//  pipeline can be exercised without a real device
+	char replay[PROPERTY_VALUE_MAX];
+	property_get("debug.camera.replay", replay, "");
+	
+	// Query each node: A camera plugged in after another one was unplugged
+	//  can get the same node number, so the numbers alone are not enough
+	//  to tell if something changed
+	String8 devices[32];
+	String8 keys[32];
+	int found = 0;
+	for (int i = 0; i < count; i++) {
+		char device[64];
+		snprintf(device, sizeof(device), "/dev/video%d", nodes[i]);
+		
+		// A legacy camera we powered on is not a new camera
+		if (isLegacyDeviceLocked(device))
+			continue;
+			
+		int fd = ::open(device, O_RDWR);
+		if (fd < 0) {
+			LOGD("CameraFactory::scanCamerasLocked: unable to open %s", device);
+			continue;
+		}
+		
+		// Only consider devices able to stream captured video
+		struct v4l2_capability cap;
+		memset(&cap, 0, sizeof(cap));
+		int ret = ioctl(fd, VIDIOC_QUERYCAP, &cap);
+		::close(fd);
+		
+		if (ret < 0 ||
+			!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+			!(cap.capabilities & V4L2_CAP_STREAMING)) {
+			LOGD("CameraFactory::scanCamerasLocked: %s is not a capture device", device);
+			continue;
+		}
+		
+		devices[found] = device;
+		keys[found].appendFormat("%s|%s", (const char*)cap.bus_info, (const char*)cap.card);
+		found++;
+	}
+	
+	String8 signature;
+	for (int i = 0; i < found; i++) {
+		signature.appendFormat("%s=%s,", devices[i].string(), keys[i].string());
+	}
+	if (replay[0]) {
+		signature.appendFormat("%s,", replay);
+	}
+	
+	// If nothing changed, no need to rescan
+	if (mScanned && signature == mScanSignature)
+		return;
+		
+	LOGD("CameraFactory::scanCamerasLocked: cameras: %s", signature.string());
+	mScanSignature = signature;
+	
+	// Assume all the known cameras are gone, except the legacy ones, and
+	//  the ones we powered off while idle: Their nodes are back on open
+	for (size_t i = 0; i < mCameras.size(); i++) {
+		CameraNode& node = mCameras.editItemAt(i);
+		bool idle = node.hw != NULL && V4L2Device::isNodeName(node.device.string()) &&
+					node.hw->isIdlePoweredOff();
+		if (!node.legacy && !idle) {
+			node.present = false;
+		}
+	}
+	
+	for (int i = 0; i < found; i++) {
+		addCameraLocked(devices[i].string(), keys[i]);
+	}
+	
+	if (replay[0]) {
+		String8 device;
+		if (strncmp(replay, "replay", 6))
+			device.appendFormat("replay:%s", replay);
+		else
+			device.setTo(replay);
+			
+		String8 key;
+		key.appendFormat("replay|%s", device.string());
+		addCameraLocked(device.string(), key);
+	}
+	
+	// The internal cameras are powered off until opened. Expose them with
+	//  the legacy layout if no camera is found, or if they were powered off
+	//  when the HAL was loaded. Cameras plugged later are still added
+	if (!mLegacy) {
+		bool present = false;
+		for (size_t i = 0; i < mCameras.size() && !present; i++) {
+			present = mCameras[i].present;
+		}
+		if (!present || (!mScanned && CameraHardware::isBoardCameraPoweredOff())) {
+			setupLegacyCamerasLocked();
+		}
+	}
+	
+	mScanned = true;
+}
+
+void CameraFactory::addCameraLocked(const char* device, const String8& key)
+{
+	// If this camera was already known, keep its id
+	size_t j;
+	for (j = 0; j < mCameras.size(); j++) {
+		if (mCameras[j].key == key)
+			break;
+	}
+	
+	if (j < mCameras.size()) {
+		CameraNode& node = mCameras.editItemAt(j);
+		
+		// If it was renumbered, the camera hardware must be rebuilt
+		if (node.device != device) {
+			releaseHardwareLocked(node);
+		}
+		node.device = device;
+		node.present = true;
+		LOGI("Camera %d: %s (%s)", j, device, key.string());
+		
+	} else {
+		CameraNode node;
+		node.device = device;
+		node.key = key;
+		node.present = true;
+		node.legacy = false;
+		node.hw = NULL;
+		node.stale = false;
+		mCameras.add(node);
+		LOGI("Camera %d: %s (%s), new", mCameras.size() - 1, device, key.string());
+	}
+}
+
+void CameraFactory::setupLegacyCamerasLocked()
+{
+	LOGI("Internal cameras powered off, adding the legacy camera layout");
+	
+	mLegacy = true;
+	
+	// Back camera first, then the front camera. The device nodes are only
+	//  known when opened, as other cameras can take them meanwhile
+	CameraNode node;
+	node.present = true;
+	node.legacy = true;
+	node.hw = NULL;
+	node.stale = false;
+	
+	node.key = "legacy-back";
+	node.device = legacyDeviceLocked(node);
+	mCameras.add(node);
+	LOGI("Camera %d: %s (%s)", mCameras.size() - 1, node.device.string(), node.key.string());
+	
+	node.key = "legacy-front";
+	node.device = legacyDeviceLocked(node);
+	mCameras.add(node);
+	LOGI("Camera %d: %s (%s)", mCameras.size() - 1, node.device.string(), node.key.string());
+}
+
+bool CameraFactory::isLegacyDeviceLocked(const char* device) const
+{
+	for (size_t i = 0; i < mCameras.size(); i++) {
+		const CameraNode& node = mCameras[i];
+		if (node.legacy && node.hw != NULL && node.device == device)
+			return true;
+	}
+	return false;
+}
+
+String8 CameraFactory::legacyDeviceLocked(const CameraNode& node) const
+{
+	// The internal cameras take the first video nodes not used by other
+	//  cameras. If there is only one of them, all the legacy ids refer to
+	//  it: The back camera is the second node, if it exists
+	int nodes[2] = { 0, 0 };
+	int count = 0;
+	char device[64];
+	for (int n = 0; n < 32 && count < 2; n++) {
+		snprintf(device, sizeof(device), "/dev/video%d", n);
+		
+		bool taken = false;
+		for (size_t i = 0; i < mCameras.size() && !taken; i++) {
+			const CameraNode& other = mCameras[i];
+			taken = !other.legacy && other.present && other.device == device;
+		}
+		if (!taken)
+			nodes[count++] = n;
+	}
+	
+	int n = nodes[0];
+	snprintf(device, sizeof(device), "/dev/video%d", nodes[1]);
+	if (node.key == "legacy-back" && access(device, F_OK) == 0) {
+		n = nodes[1];
+	}
+	snprintf(device, sizeof(device), "/dev/video%d", n);
+	return String8(device);
+}
+
+void CameraFactory::releaseHardwareLocked(CameraNode& node)
+{
+	if (node.hw == NULL)
+		return;
+		
+	// The camera service still uses it: it will be rebuilt once closed
+	if (node.hw->isOpened()) {
+		LOGI("Camera %s changed while opened, rebuilding it on next open", 
+			node.device.string());
+		node.stale = true;
+		return;
+	}
+	
+	delete node.hw;
+	node.hw = NULL;
+	node.stale = false;
 }
 
 /****************************************************************************
@@ -65,36 +326,51 @@ int CameraFactory::cameraDeviceOpen(const hw_module_t* module,int camera_id, hw_
 
 	*device = NULL;
 
-	if (camera_id < 0 || camera_id >= getCameraNum()) {
+	Mutex::Autolock lock(mLock);
+	
+	// Pick up any camera plugged or unplugged since the last time
+	scanCamerasLocked();
+
+	if (camera_id < 0 || camera_id >= (int)mCameras.size()) {
 		LOGE("%s: Camera id %d is out of bounds (%d)",
-			__FUNCTION__, camera_id, getCameraNum());
+			__FUNCTION__, camera_id, mCameras.size());
 		return -EINVAL;
 	}
-
-	/* Lets destroy the cam so we can use a new /dev/videoX */
-	if (mCamera != NULL) {
-		delete mCamera;
-		mCamera = NULL;
+	
+	CameraNode& node = mCameras.editItemAt(camera_id);
+	if (!node.present) {
+		LOGE("%s: Camera id %d (%s) is not plugged", __FUNCTION__, camera_id, node.device.string());
+		return -ENODEV;
 	}
-
-	int handle = ::open("/dev/video1", O_RDONLY);
-	if (handle >= 0) {
-		::close(handle);
-		LOGI("Using 2 cameras!");
-		if (camera_id==0) {
-			LOGI("Returning /dev/video1");
-			mCamera = new CameraHardware(module, "/dev/video1");
-		} else {
-			LOGI("Returning /dev/video0");
-			mCamera = new CameraHardware(module, "/dev/video0");
+	
+	// The node of a legacy camera depends on the cameras plugged now. 
+	//  Keep it while we have it powered, as it is already there
+	if (node.legacy && (node.hw == NULL || node.hw->isIdlePoweredOff())) {
+		String8 legacyDevice = legacyDeviceLocked(node);
+		if (legacyDevice != node.device) {
+			releaseHardwareLocked(node);
+			node.device = legacyDevice;
 		}
-	} else {
-		LOGI("Using 1 camera!");
-		LOGI("Returning /dev/video0");
-		mCamera = new CameraHardware(module, "/dev/video0");
+	}
+	
+	// A camera hardware built for a previous device node can only be
+	//  replaced once the camera service closed it
+	if (node.stale) {
+		releaseHardwareLocked(node);
+		if (node.hw != NULL) {
+			LOGE("%s: Camera id %d is still opened", __FUNCTION__, camera_id);
+			return -EBUSY;
+		}
+	}
+
+	// Reuse the camera hardware if already created. That way, the
+	//  camera is not constructed and power cycled on each open
+	if (node.hw == NULL) {
+		LOGI("Creating camera %d: %s", camera_id, node.device.string());
+		node.hw = new CameraHardware(module, node.device.string());
 	}
 
-	return mCamera->connectCamera(device);
+	return node.hw->connectCamera(device);
 }
 
 /* Returns the number of available cameras */
@@ -102,7 +378,9 @@ int CameraFactory::getCameraNum()
 {
 	LOGD("CameraFactory::getCameraNum");
 
-	return 2;
+	Mutex::Autolock lock(mLock);
+	scanCamerasLocked();
+	return mCameras.size();
 }
 
 
@@ -110,15 +388,27 @@ int CameraFactory::getCameraInfo(int camera_id, struct camera_info* info)
 {
     LOGD("CameraFactory::getCameraInfo: id = %d,info = %p", camera_id,info);
 
-    if (camera_id < 0 || camera_id >= getCameraNum()) {
+	Mutex::Autolock lock(mLock);
+	scanCamerasLocked();
+	
+    if (camera_id < 0 || camera_id >= (int)mCameras.size()) {
         LOGE("%s: Camera id %d is out of bounds (%d)",
-             __FUNCTION__, camera_id, getCameraNum());
+             __FUNCTION__, camera_id, mCameras.size());
         return -EINVAL;
     }
 	
+	// The legacy layout knows where each camera is
+	const CameraNode& node = mCameras[camera_id];
+	if (node.legacy) {
+		info->facing = (node.key == "legacy-back") ? CAMERA_FACING_BACK : CAMERA_FACING_FRONT;
+		info->orientation = 0;
+		return NO_ERROR;
+	}
 
+	// Otherwise, unless the board tells otherwise, assume an external 
+	//  camera facing the user
 	LOGD("CameraFactory::getCameraInfo: about to fetch info");
-    return CameraHardware::getCameraInfo(camera_id, info);
+    return CameraHardware::getCameraInfo(node.device.string(), CAMERA_FACING_FRONT, info);
 }
 
 /****************************************************************************
@@ -20,6 +20,9 @@
 #include <string.h>
 #include <hardware/hardware.h>
 #include <hardware/camera.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
 #include "CameraHardware.h"
 
 namespace android {
@@ -72,11 +75,11 @@ public:
     /* Gets emulated camera information.
      * This method is called in response to camera_module_t::get_camera_info callback.
      */
-    static int getCameraInfo(int camera_id, struct camera_info *info);
+    int getCameraInfo(int camera_id, struct camera_info *info);
 
 	
 	/* Returns the number of available cameras */
-	static int getCameraNum();
+	int getCameraNum();
 	
     /****************************************************************************
      * Camera HAL API callbacks.
@@ -97,8 +100,60 @@ private:
 
 private:
 
-    /* Camera hardware */
-    CameraHardware* mCamera;
+	/* A camera found while scanning the video4linux class */
+	struct CameraNode {
+		String8			device;		// Device node (/dev/videoN), or recording to replay
+		String8			key;		// Bus info and card name, stable across rescans
+		bool			present;	// If the device is currently plugged
+		bool			legacy;		// Internal camera, only found once powered
+		CameraHardware*	hw;			// Camera hardware, created on first open
+		bool			stale;		// hw was built for another device node
+	};
+
+	/* Drops the camera hardware of a node whose device changed. If it is
+	 * still opened, it is only marked stale and rebuilt on the next open.
+	 * NOTE: Must be called with mLock held.
+	 */
+	void releaseHardwareLocked(CameraNode& node);
+
+	/* Scans the video4linux class for capture devices, if something changed
+	 * since the last scan. Camera ids of already known devices are kept.
+	 * NOTE: Must be called with mLock held.
+	 */
+	void scanCamerasLocked();
+	
+	/* Marks a camera found by the scan as present, keeping its id if it
+	 * was already known.
+	 * NOTE: Must be called with mLock held.
+	 */
+	void addCameraLocked(const char* device, const String8& key);
+	
+	/* Adds the cameras of the legacy layout, as the internal cameras are
+	 * powered off until opened and can't be found by the scan.
+	 * NOTE: Must be called with mLock held.
+	 */
+	void setupLegacyCamerasLocked();
+	
+	/* Returns true if the device node belongs to a legacy camera we powered.
+	 * NOTE: Must be called with mLock held.
+	 */
+	bool isLegacyDeviceLocked(const char* device) const;
+	
+	/* Gets the device node a legacy camera shows up as once powered.
+	 * NOTE: Must be called with mLock held.
+	 */
+	String8 legacyDeviceLocked(const CameraNode& node) const;
+
+	/* Protects the cameras list */
+	Mutex				mLock;
+	
+	/* The index in this vector is the camera id */
+	Vector<CameraNode>	mCameras;
+	
+	/* Devices and keys of the cameras found on the last scan */
+	String8				mScanSignature;
+	bool				mScanned;
+	bool				mLegacy;		// If the legacy cameras were added
 
 public:
     /* Contains device open entry point, as required by HAL API. */
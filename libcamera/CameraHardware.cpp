@@ -20,139 +20,308 @@
 extern "C" {
 #include <utils/Log.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/mman.h>
+#include <sys/inotify.h>
 
 	
 #include <fcntl.h>
 #include <sys/stat.h> /* for mode definitions */
 };
 
+#include <cutils/atomic.h>
+#include <cutils/atomic-inline.h>
+#include <cutils/properties.h>
 #include <ui/Rect.h>
 #include <ui/GraphicBufferMapper.h>
 #include "CameraHardware.h"
 #include "Converter.h"
+#include "CameraTrace.h"
 
 #define MIN_WIDTH  		320
 #define MIN_HEIGHT 		240
 
-#ifndef PIXEL_FORMAT_RGB_888
-#define PIXEL_FORMAT_RGB_888 3 /* */
-#endif
-
-#ifndef PIXEL_FORMAT_RGBA_8888
-#define PIXEL_FORMAT_RGBA_8888 1 /* [ov] */
-#endif
-
-#ifndef PIXEL_FORMAT_RGBX_8888
-#define PIXEL_FORMAT_RGBX_8888 2 
-#endif
-
-#ifndef PIXEL_FORMAT_BGRA_8888
-#define PIXEL_FORMAT_BGRA_8888 5 /* [ov] */
-#endif
-
-#ifndef PIXEL_FORMAT_RGB_565
-#define PIXEL_FORMAT_RGB_565  4 /* [ov] */
-#endif
+// File to control camera power
+#define CAMERA_POWER	    "/sys/devices/platform/shuttle-pm-camera/power_on"
 
-// We need this format to allow special preview modes
-#ifndef PIXEL_FORMAT_YCrCb_422_I
-#define PIXEL_FORMAT_YCrCb_422_I 100
-#endif
+// Maximum time to wait for the camera to show up after powering it on
+#define CAMERA_POWER_TIMEOUT_MS	5000
 
-#ifndef PIXEL_FORMAT_YCbCr_422_SP
-#define PIXEL_FORMAT_YCbCr_422_SP 0x10    /* NV16  [ov] */
-#endif
+// Directory where the default parameters of each camera are persisted
+#define CAMERA_PARAMS_SNAPSHOT_DIR	"/data/misc/camera"
 
-#ifndef PIXEL_FORMAT_YCbCr_420_SP
-#define PIXEL_FORMAT_YCbCr_420_SP 0x21    /* NV12 */
-#endif
+// Mean luma variation under which the exposure is considered stable (5% 
+//  of the full range), and frames it must stay stable for
+#define LUMA_STABLE_THRESH		12
+#define LUMA_STABLE_FRAMES		4
 
-#ifndef PIXEL_FORMAT_UNKNOWN
-#define PIXEL_FORMAT_UNKNOWN 0
-#endif
+// Static frames reused in a row before converting one anyway, so the
+//  outputs are refreshed at least once per second
+#define STATIC_MAX_RUN			30
 
-    /*
-     * Android YUV format:
-     *
-     * This format is exposed outside of the HAL to software
-     * decoders and applications.
-     * EGLImageKHR must support it in conjunction with the
-     * OES_EGL_image_external extension.
-     *
-     * YV12 is 4:2:0 YCrCb planar format comprised of a WxH Y plane followed
-     * by (W/2) x (H/2) Cr and Cb planes.
-     *
-     * This format assumes
-     * - an even width
-     * - an even height
-     * - a horizontal stride multiple of 16 pixels
-     * - a vertical stride equal to the height
-     *
-     *   y_size = stride * height
-     *   c_size = ALIGN(stride/2, 16) * height/2
-     *   size = y_size + c_size * 2
-     *   cr_offset = y_size
-     *   cb_offset = y_size + c_size
-     *
-     */
-#ifndef PIXEL_FORMAT_YV12
-#define PIXEL_FORMAT_YV12  0x32315659 /* YCrCb 4:2:0 Planar */
-#endif
+// Digital zoom ratios go from 1.0x to 4.0x in 0.1x steps
+#define CAMERA_MAX_ZOOM			30
+#define CAMERA_ZOOM_RATIO(z)	(100 + (z) * 10)
 
-#ifndef PIXEL_FORMAT_YV16
-#define PIXEL_FORMAT_YV16  0x36315659 /* YCrCb 4:2:2 Planar */
-#endif
 
-// File to control camera power
-#define CAMERA_POWER	    "/sys/devices/platform/shuttle-pm-camera/power_on"
+namespace android {
 
+// The power control is shared by all the cameras, so keep a count of 
+//  the cameras that need it
+static Mutex sPowerLock;
+static int sPowerRefs = 0;
 
-namespace android {
+/* Make a destination show the zoomed image, instead of the source. The 
+   area of the destination, that is in coordinates of the zoomed image (of
+   the same size as the source), is mapped to the area of the source it
+   comes from, and resampled back to its size by the converter */
+static void applyZoom(struct yuyv_fanout_dst* d, int width, int height, int zoom)
+{
+	int ratio = CAMERA_ZOOM_RATIO(zoom);
+	if (ratio <= 100)
+		return;
+		
+	// Area of the source shown when zoomed, centered
+	int zw = (width  * 100 / ratio) & (-2);
+	int zh = (height * 100 / ratio) & (-2);
+	int zx = ((width  - zw) >> 1) & (-2);
+	int zy = ((height - zh) >> 1) & (-2);
+	
+	d->outWidth  = d->width;
+	d->outHeight = d->height;
+	d->srcX   = (zx + d->srcX * zw / width ) & (-2);
+	d->srcY   = (zy + d->srcY * zh / height) & (-2);
+	d->width  = (d->width  * zw / width ) & (-2);
+	d->height = (d->height * zh / height) & (-2);
+	if (d->width < 2)
+		d->width = 2;
+	if (d->height < 2)
+		d->height = 2;
+}
+
+/* Wait until the given device node exists and can be opened, or timed out.
+   Instead of polling, we watch the directory holding the node: ueventd 
+   creates the node and then fixes its permissions, so both creations and
+   attribute changes trigger a new open attempt */
+static bool waitForDeviceNode(const char* device, int timeoutMs)
+{
+	// Get the directory the node will be created into
+	char dir[64];
+	strncpy(dir, device, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = 0;
+	char* slash = strrchr(dir, '/');
+	if (slash && slash != dir) {
+		*slash = 0;
+	} else {
+		strcpy(dir, "/dev");
+	}
+	
+	// Start watching before the first try, so no event can be lost
+	int ifd = inotify_init();
+	if (ifd >= 0 && inotify_add_watch(ifd, dir, IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0) {
+		LOGE("Unable to watch %s", dir);
+		::close(ifd);
+		ifd = -1;
+	}
+	
+	nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + milliseconds_to_nanoseconds(timeoutMs);
+	bool found = false;
+	
+	while (true) {
+		// Try to open the video capture device
+		int handle = ::open(device, O_RDWR);
+		if (handle >= 0) {
+			::close(handle);
+			found = true;
+			break;
+		}
 
-char videodevice[64];
+		int remaining = (int)nanoseconds_to_milliseconds(deadline - systemTime(SYSTEM_TIME_MONOTONIC));
+		if (remaining <= 0)
+			break;
+		
+		if (ifd >= 0) {
+			// Sleep until something changes in the directory
+			struct pollfd pfd;
+			pfd.fd = ifd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (::poll(&pfd, 1, remaining) > 0) {
+				// Discard the events, we will just retry
+				char events[512];
+				::read(ifd, events, sizeof(events));
+			}
+		} else {
+			// No inotify available, fall back to polling
+			::usleep(10000);
+		}
+	}
+	
+	if (ifd >= 0)
+		::close(ifd);
+		
+	return found;
+}
 
 bool CameraHardware::PowerOn()
 {
 	LOGD("CameraHardware::PowerOn: Power ON camera.");
 	
-	// power on camera
-	int handle = ::open(CAMERA_POWER,O_RDWR);
-	if (handle >= 0) {
-		::write(handle,"1\n",2);
-		::close(handle);
-	} else {
-		LOGE("Could not open %s for writing.", CAMERA_POWER);
-		return false;
+	// A recording being replayed needs no power, and is always there
+	if (!V4L2Device::isNodeName(mVideoDevice)) {
+		LOGD("CameraHardware::PowerOn: %s is not a device node", mVideoDevice);
+		return true;
+	}
+	
+	// power on camera, if no other camera did it. The reference is only
+	//  taken once powered, so the next camera retries if this failed
+	{
+		Mutex::Autolock lock(sPowerLock);
+		if (sPowerRefs == 0) {
+			int handle = ::open(CAMERA_POWER,O_RDWR);
+			if (handle >= 0) {
+				::write(handle,"1\n",2);
+				::close(handle);
+			} else {
+				LOGE("Could not open %s for writing.", CAMERA_POWER);
+				return false;
+			}
+		}
+		sPowerRefs++;
+		mPowerRef = true;
     } 
 	
 	// Wait until the camera is recognized or timed out
-	int timeOut = 500;
-	do {
-		// Try to open the video capture device
-		handle = ::open(videodevice,O_RDWR);
-		if (handle >= 0)
-			break;
-		// Wait a bit
-		::usleep(10000);
-	} while (--timeOut > 0);
-	
-	if (handle >= 0) {
+	if (waitForDeviceNode(mVideoDevice, CAMERA_POWER_TIMEOUT_MS)) {
 		LOGD("Camera powered on");
-		::close(handle);
 		return true;
-	} else {
-		LOGE("Unable to power camera");
 	}
 	
+	LOGE("Unable to power camera");
+	return false;
+}
+
+CameraHardware::PowerOnThread::PowerOnThread(CameraHardware* hw) :
+	Thread(false),
+	mHardware(hw) 
+{ 
+}
+
+void CameraHardware::PowerOnThread::onFirstRef() 
+{
+	run("CameraPowerOnThread", PRIORITY_DEFAULT);
+}
+
+bool CameraHardware::PowerOnThread::threadLoop() 
+{
+	mHardware->powerOnThread();
+	// Only run once
+	return false;
+}
+
+void CameraHardware::powerOnThread()
+{
+	bool on = PowerOn();
+	
+	{
+		Mutex::Autolock lock(mPowerLock);
+		mPowerState = on ? POWER_ON : POWER_FAILED;
+		mPowerCond.broadcast();
+	}
+	
+	// If initializing asynchronously, enumerate the device now that it
+	//  is powered. This refreshes the snapshot of the defaults, if any.
+	//  Once enumerated, powering on again after being idle is enough
+	bool enumerate;
+	{
+		Mutex::Autolock lock(mLock);
+		enumerate = mEnumerating;
+	}
+	if (mAsyncInit && enumerate) {
+		initDefaultParameters();
+	}
+}
+
+CameraHardware::PowerOffThread::PowerOffThread(CameraHardware* hw) :
+	Thread(false),
+	mHardware(hw) 
+{ 
+}
+
+void CameraHardware::PowerOffThread::onFirstRef() 
+{
+	run("CameraPowerOffThread", PRIORITY_DEFAULT);
+}
+
+bool CameraHardware::PowerOffThread::threadLoop() 
+{
+	mHardware->powerOffThread();
+	// Only run once
 	return false;
 }
 
+/* Power off the camera once no client used it for mPowerOffDelayMs, unless
+   a client connects meanwhile */
+void CameraHardware::powerOffThread()
+{
+	{
+		Mutex::Autolock lock(mPowerLock);
+		nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + milliseconds_to_nanoseconds(mPowerOffDelayMs);
+		while (mPowerOffPending) {
+			nsecs_t remaining = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+			if (remaining <= 0)
+				break;
+			mPowerCond.waitRelative(mPowerLock, remaining);
+		}
+		if (!mPowerOffPending)
+			return;
+		mPowerOffPending = false;
+	}
+	
+	// The power on sequence, and the enumeration that follows it, must be
+	//  over before taking the power away
+	waitForPowerOn();
+	{
+		Mutex::Autolock lock(mLock);
+		waitForEnumerationLocked();
+		camera.Close();
+	}
+	
+	LOGD("CameraHardware::powerOffThread: idle for %d ms, powering off", mPowerOffDelayMs);
+	PowerOff();
+	
+	Mutex::Autolock lock(mPowerLock);
+	mPowerState = POWER_OFF;
+}
+
+/* Wait until the asynchronous power on sequence has finished. Returns
+   if the camera was succesfully powered on */
+bool CameraHardware::waitForPowerOn()
+{
+	Mutex::Autolock lock(mPowerLock);
+	while (mPowerState == POWER_PENDING) {
+		LOGD("CameraHardware::waitForPowerOn: waiting for the camera to power on");
+		mPowerCond.wait(mPowerLock);
+	}
+	return mPowerState == POWER_ON;
+}
+
 bool CameraHardware::PowerOff()
 {
 	LOGD("CameraHardware::PowerOff: Power OFF camera.");
 	
-	// power on camera
+	// Only power off the camera when no other camera is using it
+	Mutex::Autolock lock(sPowerLock);
+	if (!mPowerRef) {
+		return true;
+	}
+	mPowerRef = false;
+	if (--sPowerRefs > 0) {
+		LOGD("CameraHardware::PowerOff: still in use by %d cameras", sPowerRefs);
+		return true;
+	}
+	
+	// power off camera
 	int handle = ::open(CAMERA_POWER,O_RDWR);
 	if (handle >= 0) {
 		::write(handle,"0\n",2);
@@ -172,6 +341,8 @@ CameraHardware::CameraHardware(const hw_module_t* module, const char* videodev)
 		mPreviewWinHeight(0),
 
 		mParameters(),
+		mMountTransform(YUYV_ROTATE_0),
+		mOpened(0),
 		
 		mRawPreviewHeap(0),
 		mRawPreviewFrameSize(0),
@@ -187,14 +358,25 @@ CameraHardware::CameraHardware(const hw_module_t* module, const char* videodev)
 		mRawPictureBufferSize(0),
 		
         mRecordingHeap(0),
+		mRecBufferCount(kBufferCount),
+		mRecDropPolicy(RECORD_DROP_WHEN_FULL),
 		mRecordingFrameSize(0),
 		mRecFmt(PIXEL_FORMAT_UNKNOWN),
 		
+		mStoreMetaData(false),
+		mMetaDataAllowed(false),
+		mRecordingMetaHeap(0),
+		
         mJpegPictureHeap(0),
 		mJpegPictureBufferSize(0),
 		
 		mRecordingEnabled(0),		
 		
+		mMailboxPending(-1),
+		mMailboxRendering(-1),
+		mWinFramesRendered(0),
+		mWinFramesDropped(0),
+		
         mNotifyCb(0),
         mDataCb(0),
         mDataCbTimestamp(0),
@@ -203,14 +385,41 @@ CameraHardware::CameraHardware(const hw_module_t* module, const char* videodev)
 		
         mMsgEnabled(0),
         mCurrentPreviewFrame(0),
-        mCurrentRecordingFrame(0)	
+        mCurrentRecordingFrame(0),
+		mPreviewConfigSeq(0),
+
+		mPowerState(POWER_PENDING),
+		mPowerOffPending(false),
+		mPowerOffDelayMs(-1),
+		mPowerRef(false),
+		
+		mZoom(0),
+		mZoomTarget(0),
+		mSmoothZoom(false),
+		
+		mAsyncInit(true),
+		mParamsReady(false),
+		mParamsChanged(false),
+		mEnumerating(true)
 		
 {
     /*
      * Initialize camera_device descriptor for this object.
      */
     LOGI("Using camera %s", videodev);
-    strncpy(videodevice, videodev, sizeof(videodevice));
+    strncpy(mVideoDevice, videodev, sizeof(mVideoDevice) - 1);
+	mVideoDevice[sizeof(mVideoDevice) - 1] = 0;
+	memset(mRecBufferBusy, 0, sizeof(mRecBufferBusy));
+	memset(mMailboxZoom, 0, sizeof(mMailboxZoom));
+	mRecInFlight = 0;
+	mRecDroppedLast = false;
+	memset(&mRecStats, 0, sizeof(mRecStats));
+	memset(&mSceneStats, 0, sizeof(mSceneStats));
+	mPreviewLumaStableFor = 0;
+	mStaticRefValid = false;
+	mStaticRun = 0;
+	mLastPreviewBufferIdx = -1;
+	camera.setStats(&mStats);
 
     /* Common header */
     common.tag = HARDWARE_DEVICE_TAG;
@@ -222,16 +431,199 @@ CameraHardware::CameraHardware(const hw_module_t* module, const char* videodev)
     ops = &mDeviceOps;
     priv = this;
 
-	// Power on camera
-	PowerOn();
+	// Decide if the parameters must be initialized in background
+	char value[PROPERTY_VALUE_MAX];
+	property_get("ro.camera.async_init", value, "1");
+	mAsyncInit = atoi(value) != 0;
+	
+	// How long to keep the camera powered once closed, in ms. -1 keeps it
+	//  powered until the camera is destroyed
+	property_get("ro.camera.power_off_delay", value, "10000");
+	mPowerOffDelayMs = atoi(value);
+	if (mPowerOffDelayMs < 0)
+		mPowerOffDelayMs = -1;
+	
+	// Depth of the recording pool. Deeper pools absorb longer encoder stalls
+	//  at the cost of memory
+	property_get("ro.camera.record_buffers", value, "4");
+	mRecBufferCount = atoi(value);
+	if (mRecBufferCount < kMinRecBufferCount)
+		mRecBufferCount = kMinRecBufferCount;
+	if (mRecBufferCount > kMaxRecBufferCount)
+		mRecBufferCount = kMaxRecBufferCount;
+	
+	// And what to do when the encoder can't keep up
+	property_get("ro.camera.record_drop", value, "full");
+	mRecDropPolicy = !strcmp(value, "adaptive") 
+					? RECORD_DROP_ADAPTIVE 
+					: RECORD_DROP_WHEN_FULL;
+	LOGD("Using %d recording buffers, drop policy: %s", mRecBufferCount, value);
+	
+	// Only encoders built for this HAL understand RecordingMetadata
+	property_get("ro.camera.record_metadata", value, "0");
+	mMetaDataAllowed = atoi(value) != 0;
+	
+	// Kiosks and video calls often look at a static scene. If enabled, 
+	//  frames that did not change by more than this many luma levels in 
+	//  any area are not converted nor displayed again
+	property_get("ro.camera.skip_static", value, "0");
+	mStaticThresh = atoi(value);
+	if (mStaticThresh < 0)
+		mStaticThresh = 0;
+	if (mStaticThresh > LUMA_STABLE_THRESH)
+		mStaticThresh = LUMA_STABLE_THRESH;
+	LOGD("Static frame threshold: %d", mStaticThresh);
+	
+	// Correction of the way the sensor is mounted, applied to the preview
+	//  window and to the pictures: ro.camera.<node>.rotation is the 
+	//  clockwise rotation, and ro.camera.<node>.mirror flips it horizontally
+	const char* node = strrchr(mVideoDevice, '/');
+	node = (node) ? node + 1 : mVideoDevice;
+	char key[PROPERTY_KEY_MAX];
+	snprintf(key, sizeof(key), "ro.camera.%s.rotation", node);
+	property_get(key, value, "0");
+	mMountTransform = rotationToTransform(atoi(value));
+	snprintf(key, sizeof(key), "ro.camera.%s.mirror", node);
+	property_get(key, value, "0");
+	if (atoi(value) != 0) {
+		mMountTransform |= YUYV_MIRROR;
+	}
+	LOGD("Mounting correction of %s: 0x%x", node, mMountTransform);
+
+	// In asynchronous mode, serve the defaults from the snapshot taken the
+	//  last time the device was enumerated, if available. If not, clients
+	//  will wait for the enumeration to complete when accessing them
+	if (mAsyncInit) {
+		CameraParameters p;
+		if (loadParametersSnapshot(p)) {
+			Mutex::Autolock lock(mLock);
+			if (setParametersLocked(p) == NO_ERROR) {
+				mDefaultParameters = p;
+				mParamsReady = true;
+			}
+		}
+	}
+
+	// Power on camera. This is done asynchronously, as it can take
+	//  several seconds until the camera is recognized. In asynchronous
+	//  mode, the default parameters are initialized by that thread
+	mPowerOnThread = new PowerOnThread(this);
 
 	// Init default parameters
-    initDefaultParameters();
+	if (!mAsyncInit) {
+		initDefaultParameters();
+	}
+}
+
+/* Get the path of the file used to persist the default parameters. There
+   is one file per video node */
+void CameraHardware::getParametersSnapshotPath(String8& path) const
+{
+	const char* node = strrchr(mVideoDevice, '/');
+	node = (node) ? node + 1 : mVideoDevice;
+	
+	path = CAMERA_PARAMS_SNAPSHOT_DIR "/params_";
+	path.append(node);
+}
+
+bool CameraHardware::loadParametersSnapshot(CameraParameters& p) const
+{
+	String8 path;
+	getParametersSnapshotPath(path);
+	
+	FILE* f = fopen(path.string(), "r");
+	if (!f) {
+		LOGD("No parameters snapshot found at %s", path.string());
+		return false;
+	}
+
+	// The snapshot is a single line holding the flattened parameters
+	String8 params;
+	char buf[512];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		params.append(buf, n);
+	}
+	fclose(f);
+	
+	if (params.isEmpty()) 
+		return false;
+	
+	p.unflatten(params);
+	
+	LOGD("Using parameters snapshot from %s", path.string());
+	return true;
+}
+
+void CameraHardware::saveParametersSnapshot(const CameraParameters& p) const
+{
+	String8 path;
+	getParametersSnapshotPath(path);
+	
+	// Write to a temporary file and rename it, so a crash never leaves
+	//  a truncated snapshot behind
+	String8 tmpPath(path);
+	tmpPath.append(".tmp");
+	
+	FILE* f = fopen(tmpPath.string(), "w");
+	if (!f) {
+		LOGE("Unable to write parameters snapshot %s", tmpPath.string());
+		return;
+	}
+	
+	String8 params = p.flatten();
+	fwrite(params.string(), 1, params.length(), f);
+	fclose(f);
+	
+	if (rename(tmpPath.string(), path.string()) < 0) {
+		LOGE("Unable to replace parameters snapshot %s", path.string());
+		unlink(tmpPath.string());
+	}
+}
+
+/* Wait until the default parameters are available.
+   NOTE: Must be called with mLock held. */
+void CameraHardware::waitForParametersLocked()
+{
+	while (!mParamsReady) {
+		LOGD("CameraHardware::waitForParametersLocked: waiting for the default parameters");
+		mParamsCond.wait(mLock);
+	}
+}
+
+/* Wait until initDefaultParameters is done with the device, as the
+   parameters could be served from the snapshot before that.
+   NOTE: Must be called with mLock held. */
+void CameraHardware::waitForEnumerationLocked()
+{
+	while (mEnumerating) {
+		LOGD("CameraHardware::waitForEnumerationLocked: waiting for the device enumeration");
+		mParamsCond.wait(mLock);
+	}
 }
 
 CameraHardware::~CameraHardware()
 {
     LOGD("CameraHardware::destruct");
+	
+	// Cancel the idle power off: it would use a half destroyed object.
+	//  We are powering off anyway
+	{
+		Mutex::Autolock lock(mPowerLock);
+		mPowerOffPending = false;
+		mPowerCond.broadcast();
+	}
+	if (mPowerOffThread != 0) {
+		mPowerOffThread->requestExitAndWait();
+		mPowerOffThread.clear();
+	}
+	
+	// Make sure the power on sequence is not running anymore
+	if (mPowerOnThread != 0) {
+		mPowerOnThread->requestExitAndWait();
+		mPowerOnThread.clear();
+	}
+	
     if (mPreviewThread != 0) {
         stopPreview();
     }
@@ -256,12 +648,20 @@ CameraHardware::~CameraHardware()
 		mRecordingHeap->release(mRecordingHeap);
 		mRecordingHeap = NULL;
 	}
+	
+	if (mRecordingMetaHeap) {
+		mRecordingMetaHeap->release(mRecordingMetaHeap);
+		mRecordingMetaHeap = NULL;
+	}
 
 	if (mJpegPictureHeap) {
 		mJpegPictureHeap->release(mJpegPictureHeap);
 		mJpegPictureHeap = NULL;
 	}
 	
+	// Release the capture device
+	camera.Close();
+	
 	// Power off camera
 	PowerOff();
 }
@@ -273,9 +673,19 @@ bool CameraHardware::NegotiatePreviewFormat(struct preview_stream_ops* win)
 	// Get the preview size... If we are recording, use the recording video size instead of the preview size
 	int pw, ph;
 	if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
-		mParameters.getVideoSize(&pw, &ph);
+		pw = mConfig.videoWidth;
+		ph = mConfig.videoHeight;
 	} else {
-		mParameters.getPreviewSize(&pw, &ph);
+		pw = mConfig.previewWidth;
+		ph = mConfig.previewHeight;
+	}
+			
+	// If the mounting correction rotates the image 90 or 270 degrees, the
+	//  window must be as tall as the frames are wide
+	if (mMountTransform & 1) {
+		int t = pw;
+		pw = ph;
+		ph = t;
 	}
 			
 	LOGD("Trying to set preview window geometry to %dx%d",pw,ph);
@@ -305,6 +715,37 @@ status_t CameraHardware::connectCamera(hw_device_t** device)
 {
 	LOGD("CameraHardware::connectCamera");
 
+	android_atomic_release_store(1, &mOpened);
+	
+	// Cancel the idle power off, and wait until it is either cancelled
+	//  or done. Then, if it was done, power on again
+	sp<PowerOffThread> powerOffThread;
+	{
+		Mutex::Autolock lock(mPowerLock);
+		mPowerOffPending = false;
+		mPowerCond.broadcast();
+		powerOffThread = mPowerOffThread;
+		mPowerOffThread.clear();
+	}
+	if (powerOffThread != 0) {
+		powerOffThread->requestExitAndWait();
+	}
+	
+	bool powerOn = false;
+	{
+		Mutex::Autolock lock(mPowerLock);
+		if (mPowerState == POWER_OFF) {
+			mPowerState = POWER_PENDING;
+			powerOn = true;
+		}
+	}
+	if (powerOn) {
+		if (mPowerOnThread != 0) {
+			mPowerOnThread->requestExitAndWait();
+		}
+		mPowerOnThread = new PowerOnThread(this);
+	}
+	
     *device = &common;
     return NO_ERROR;
 }
@@ -313,20 +754,73 @@ status_t CameraHardware::closeCamera()
 {
 	LOGD("CameraHardware::closeCamera");
 	releaseCamera();
+	
+	// The hardware is reused by the next client, that must find it as if
+	//  it was just created
+	{
+		Mutex::Autolock lock(mLock);
+		resetClientStateLocked();
+	}
+	
+	// Keep the camera powered for a while, as it is often reopened soon,
+	//  but don't keep it powered for the life of the mediaserver
+	if (mPowerOffDelayMs >= 0) {
+		Mutex::Autolock lock(mPowerLock);
+		if (mPowerOffThread == 0) {
+			mPowerOffPending = true;
+			mPowerOffThread = new PowerOffThread(this);
+		}
+	}
+	
+	// Only once everything is released, so the factory can destroy us
+	android_atomic_release_store(0, &mOpened);
     return NO_ERROR;
 }
 
-status_t CameraHardware::getCameraInfo(int camera_id, struct camera_info* info)
+bool CameraHardware::isOpened() const
 {
-    LOGD("CameraHardware::getCameraInfo");
+	return android_atomic_acquire_load(&mOpened) != 0;
+}
 
-    if (camera_id == 0) {
-	info->facing = CAMERA_FACING_BACK;
-	info->orientation = 0;
-    } else {
-	info->facing = CAMERA_FACING_FRONT;
+bool CameraHardware::isIdlePoweredOff()
+{
+	Mutex::Autolock lock(mPowerLock);
+	return mPowerState == POWER_OFF;
+}
+
+bool CameraHardware::isBoardCameraPoweredOff()
+{
+	int handle = ::open(CAMERA_POWER, O_RDONLY);
+	if (handle < 0)
+		return false;
+	
+	char state[8];
+	int len = ::read(handle, state, sizeof(state));
+	::close(handle);
+	return len > 0 && state[0] == '0';
+}
+
+status_t CameraHardware::getCameraInfo(const char* videoDevice, int defaultFacing,
+									   struct camera_info* info)
+{
+    LOGD("CameraHardware::getCameraInfo: %s", videoDevice);
+
+	// Same naming as the mounting correction properties
+	const char* node = strrchr(videoDevice, '/');
+	node = (node) ? node + 1 : videoDevice;
+	char key[PROPERTY_KEY_MAX];
+	char value[PROPERTY_VALUE_MAX];
+	snprintf(key, sizeof(key), "ro.camera.%s.facing", node);
+	property_get(key, value, "");
+	
+	if (!strcmp(value, "back")) {
+		info->facing = CAMERA_FACING_BACK;
+	} else if (!strcmp(value, "front")) {
+		info->facing = CAMERA_FACING_FRONT;
+	} else {
+		info->facing = defaultFacing;
+	}
 	info->orientation = 0;
-    }
 
     return NO_ERROR;
 }
@@ -350,8 +844,14 @@ status_t CameraHardware::setPreviewWindow(struct preview_stream_ops* window)
 			}
 		}
 		
+		// The preview thread could be using the previous window
+		Mutex::Autolock winLock(mWinLock);
+		
 		mWin = window;
 		
+		// A new window must get a frame, even if the scene is static
+		publishPreviewConfigLocked();
+		
 		// setup the preview window geometry to be able to use the full preview window
 		if (mPreviewThread != 0 && mWin != 0) {
 			
@@ -396,9 +896,13 @@ void CameraHardware::enableMsgType(int32_t msgType)
 			(mMsgEnabled ^ old) & CAMERA_MSG_VIDEO_FRAME && mRecordingEnabled) {
 			
 			// Recreate the heaps if toggling recording changes the raw preview size
-			//  and also restart the preview so we use the new size if needed
-			initHeapLocked();
+			//  and also restart the preview so we use the new size if needed.
+			//  As only the consumer changed, scaling the current mode is fine
+			initHeapLocked(true);
 		}
+		
+		// Let the preview thread know about the new messages
+		publishPreviewConfigLocked();
     }
 }
 
@@ -417,9 +921,13 @@ void CameraHardware::disableMsgType(int32_t msgType)
 			(mMsgEnabled ^ old) & CAMERA_MSG_VIDEO_FRAME && mRecordingEnabled) {
 			
 			// Recreate the heaps if toggling recording changes the raw preview size
-			//  and also restart the preview so we use the new size if needed
-			initHeapLocked();
+			//  and also restart the preview so we use the new size if needed.
+			//  As only the consumer changed, scaling the current mode is fine
+			initHeapLocked(true);
 		}
+		
+		// Let the preview thread know about the new messages
+		publishPreviewConfigLocked();
 	}
 }
 
@@ -458,7 +966,25 @@ bool CameraHardware::PreviewThread::threadLoop()
 	return true;
 }
 
-status_t CameraHardware::startPreviewLocked()
+CameraHardware::WindowThread::WindowThread(CameraHardware* hw) :
+	Thread(false),
+	mHardware(hw) 
+{ 
+}
+
+void CameraHardware::WindowThread::onFirstRef() 
+{
+	run("CameraWindowThread", PRIORITY_DISPLAY);
+}
+
+bool CameraHardware::WindowThread::threadLoop() 
+{
+	mHardware->windowThread();
+	// loop until we need to quit
+	return true;
+}
+
+status_t CameraHardware::startPreviewLocked(bool allowScale)
 {
     LOGD("CameraHardware::startPreviewLocked");
 
@@ -467,28 +993,46 @@ status_t CameraHardware::startPreviewLocked()
         return NO_ERROR;
     }
 
+	// We need the parameters to know the size to use
+	waitForParametersLocked();
+
     int width, height;
 	
 	// If we are recording, use the recording video size instead of the preview size
 	if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
-		mParameters.getVideoSize(&width, &height);
+		width = mConfig.videoWidth;
+		height = mConfig.videoHeight;
 	} else {
-		mParameters.getPreviewSize(&width, &height);
+		width = mConfig.previewWidth;
+		height = mConfig.previewHeight;
 	}
 	
-	int fps = mParameters.getPreviewFrameRate();
+	int fps = mConfig.previewFps;
 	
-    LOGD("CameraHardware::startPreviewLocked: Open, %dx%d", width, height);
-
-    status_t ret = camera.Open(videodevice);
-	if (ret != NO_ERROR) {
-		LOGE("Failed to initialize Camera");
-		return ret;
+    status_t ret = NO_ERROR;
+	
+	// The device is kept open between sessions, so only open it if needed
+	waitForEnumerationLocked();
+	if (!camera.isOpen()) {
+	
+		// Make sure the camera is powered on before trying to use it
+		if (!waitForPowerOn()) {
+			LOGE("CameraHardware::startPreviewLocked: camera power on failed, trying anyway");
+		}
+		
+		LOGD("CameraHardware::startPreviewLocked: Open, %dx%d", width, height);
+		
+		ret = camera.Open(mVideoDevice);
+		if (ret != NO_ERROR) {
+			LOGE("Failed to initialize Camera");
+			return ret;
+		}
 	}
 
-    LOGD("CameraHardware::startPreviewLocked: Init");
+    LOGD("CameraHardware::startPreviewLocked: Configure");
 
-    ret = camera.Init(width, height, fps);
+	// Only renegotiate the capture format if the current one can't be used
+    ret = camera.Configure(width, height, fps, allowScale);
 	if (ret != NO_ERROR) {
 		LOGE("Failed to setup streaming");
 		return ret;
@@ -504,17 +1048,43 @@ status_t CameraHardware::startPreviewLocked()
 	
 		/* Store it as the video size to use */
 		mParameters.setVideoSize(width, height);
+		mConfig.videoWidth = width;
+		mConfig.videoHeight = height;
 	} else {
 	
 		/* Store it as the preview size to use */
 		mParameters.setPreviewSize(width, height);
+		mConfig.previewWidth = width;
+		mConfig.previewHeight = height;
 	}
 
 	/* And reinit the memory heaps to reflect the real used size if needed */
 	initHeapLocked();
 
+	// Record the raw frames of the session, so they can be replayed later
+	//  through debug.camera.replay, if requested
+	char rawDump[PROPERTY_VALUE_MAX];
+	property_get("debug.camera.raw_dump", rawDump, "");
+	camera.setRawDumpFile(rawDump[0] ? rawDump : NULL);
+	
+	// Emit the systrace markers of the frame path, if requested
+	CameraTrace::refresh();
+
     LOGD("CameraHardware::startPreviewLocked: StartStreaming");
 
+	// Stats always refer to the current capture configuration
+	mStats.reset();
+	{
+		Mutex::Autolock sceneLock(mSceneLock);
+		mPreviewLumaStableFor = 0;
+	}
+	mStaticRefValid = false;
+	mLastPreviewBufferIdx = -1;
+	{
+		Mutex::Autolock motionLock(mMotionLock);
+		mMotion.reset();
+	}
+	
     ret = camera.StartStreaming();
 	if (ret != NO_ERROR) {
 		LOGE("Failed to start streaming");
@@ -522,13 +1092,21 @@ status_t CameraHardware::startPreviewLocked()
 	}
 
 	// setup the preview window geometry in order to use it to zoom the image
-	if (mWin != 0) {
-		LOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
-		NegotiatePreviewFormat(mWin);
+	{
+		Mutex::Autolock winLock(mWinLock);
+		if (mWin != 0) {
+			LOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
+			NegotiatePreviewFormat(mWin);
+		}
 	}
 	
+	// Make sure the preview thread starts with the current configuration
+	publishPreviewConfigLocked();
+	
     LOGD("CameraHardware::startPreviewLocked: starting PreviewThread");
 
+	// The window stage must be ready to accept frames before capturing
+	startWindowThreadLocked();
     mPreviewThread = new PreviewThread(this);
 
     LOGD("CameraHardware::startPreviewLocked: O - this:0x%p",this);
@@ -545,22 +1123,68 @@ status_t CameraHardware::startPreview()
 }
 
 
-void CameraHardware::stopPreviewLocked()
+void CameraHardware::stopPreviewThreadLocked()
 {
-    LOGD("CameraHardware::stopPreviewLocked");
-
     if (mPreviewThread != 0) {
-        LOGD("CameraHardware::stopPreviewLocked: stopping PreviewThread");
+        LOGD("CameraHardware::stopPreviewThreadLocked: stopping PreviewThread");
 
         mPreviewThread->requestExitAndWait();
 		mPreviewThread.clear();	
+    }
+	
+	// And once no more frames are posted, the window stage
+	stopWindowThreadLocked();
+}
+
+void CameraHardware::startWindowThreadLocked()
+{
+	if (mWindowThread != 0)
+		return;
+		
+	// Start with an empty mailbox
+	{
+		Mutex::Autolock lock(mMailboxLock);
+		mMailboxPending = -1;
+		mMailboxRendering = -1;
+		mWinFramesRendered = 0;
+		mWinFramesDropped = 0;
+	}
+	
+    LOGD("CameraHardware::startWindowThreadLocked: starting WindowThread");
+	mWindowThread = new WindowThread(this);
+}
+
+void CameraHardware::stopWindowThreadLocked()
+{
+	if (mWindowThread == 0)
+		return;
+		
+    LOGD("CameraHardware::stopWindowThreadLocked: stopping WindowThread");
+	
+	// Wake it up if waiting for a frame
+	mWindowThread->requestExit();
+	{
+		Mutex::Autolock lock(mMailboxLock);
+		mMailboxCond.broadcast();
+	}
+	mWindowThread->requestExitAndWait();
+	mWindowThread.clear();
+	
+	LOGD("Preview window: %u frames rendered, %u stale frames dropped",
+		 mWinFramesRendered, mWinFramesDropped);
+}
+
+void CameraHardware::stopPreviewLocked()
+{
+    LOGD("CameraHardware::stopPreviewLocked");
+
+    if (mPreviewThread != 0) {
+		stopPreviewThreadLocked();
 
-        LOGD("CameraHardware::stopPreviewLocked: Uninit");
-        camera.Uninit();
+		// Keep the device open and its buffers allocated, so the next
+		//  preview or picture does not have to renegotiate the format
         LOGD("CameraHardware::stopPreviewLocked: StopStreaming");
         camera.StopStreaming();
-        LOGD("CameraHardware::stopPreviewLocked: Close");
-        camera.Close();
     }
 
     LOGD("CameraHardware::stopPreviewLocked: OK");
@@ -590,11 +1214,27 @@ status_t CameraHardware::storeMetaDataInBuffers(int value)
 {
     LOGD("CameraHardware::storeMetaDataInBuffers: %d", value);
 	
-	// Do not accept to store metadata in buffers - We will always store
-	//  YUV data on video buffers. Metadata, in the case of Nvidia Tegra2
-	//  is a descriptor of an OpenMax endpoint that was filled with the
-	//  data.
-    return (value) ? INVALID_OPERATION : NO_ERROR;
+	// When storing metadata in buffers, the encoder gets a RecordingMetadata
+	//  descriptor of each frame instead of a copy of it, and reads the frame
+	//  directly from the recording pool.
+	Mutex::Autolock lock(mLock);
+	
+	// Unless the encoder is known to understand the descriptors, let
+	//  the camera service fall back to copies of the frames
+	if (value && !mMetaDataAllowed) {
+		LOGD("Metadata in recording buffers is not enabled");
+		return INVALID_OPERATION;
+	}
+	
+	// The mode can't be switched while frames are being delivered
+	if (mRecordingEnabled) {
+		LOGE("Unable to change the recording buffers mode while recording");
+		return INVALID_OPERATION;
+	}
+	
+	mStoreMetaData = (value != 0);
+	publishPreviewConfigLocked();
+    return NO_ERROR;
 }
 
 status_t CameraHardware::startRecording()
@@ -605,14 +1245,21 @@ status_t CameraHardware::startRecording()
 		if (!mRecordingEnabled) {
 			mRecordingEnabled = true;
 			
+			// A new recording session: The encoder owns no buffers
+			resetRecordingBuffers();
+			
 			// If something changed related to the starting or stopping of
 			//  the recording process...
 			if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
 				
 				// Recreate the heaps if toggling recording changes the raw preview size
-				//  and also restart the preview so we use the new size if needed
-				initHeapLocked();
+				//  and also restart the preview so we use the new size if needed.
+				//  As only the consumer changed, scaling the current mode is fine
+				initHeapLocked(true);
 			}
+			
+			// Let the preview thread know recording state changed
+			publishPreviewConfigLocked();
 		}
     }
     return NO_ERROR;
@@ -626,14 +1273,21 @@ void CameraHardware::stopRecording()
 		if (mRecordingEnabled) {
 			mRecordingEnabled = false;
 			
+			// Report how the encoder kept up during this session
+			logRecordingStats();
+			
 			// If something changed related to the starting or stopping of
 			//  the recording process...
 			if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
 				
 				// Recreate the heaps if toggling recording changes the raw preview size
-				//  and also restart the preview so we use the new size if needed
-				initHeapLocked();
+				//  and also restart the preview so we use the new size if needed.
+				//  As only the consumer changed, scaling the current mode is fine
+				initHeapLocked(true);
 			}
+			
+			// Let the preview thread know recording state changed
+			publishPreviewConfigLocked();
 		}
     }
 }
@@ -651,7 +1305,99 @@ int CameraHardware::isRecordingEnabled()
 
 void CameraHardware::releaseRecordingFrame(const void* mem)
 {
-    LOGD("CameraHardware::releaseRecordingFrame");
+    LOGV("CameraHardware::releaseRecordingFrame: %p", mem);
+	
+	// This can be called from the preview thread itself, if the encoder
+	//  drops the frame we are delivering, so mLock must not be taken here
+	PreviewConfig cfg;
+	readPreviewConfig(cfg);
+	
+	// Find out which recording buffer is being returned. Depending on the
+	//  mode, the encoder owns the frame itself or its descriptor
+	int idx = -1;
+	const uint8_t* p = (const uint8_t*) mem;
+	if (cfg.recordingMetaHeap && 
+		p >= (const uint8_t*) cfg.recordingMetaHeap->data &&
+		p < (const uint8_t*) cfg.recordingMetaHeap->data + cfg.recBufferCount * sizeof(RecordingMetadata)) {
+		idx = (p - (const uint8_t*) cfg.recordingMetaHeap->data) / sizeof(RecordingMetadata);
+	} else 
+	if (cfg.recordingHeap && cfg.recordingFrameSize > 0 &&
+		p >= (const uint8_t*) cfg.recordingHeap->data &&
+		p < (const uint8_t*) cfg.recordingHeap->data + cfg.recBufferCount * cfg.recordingFrameSize) {
+		idx = (p - (const uint8_t*) cfg.recordingHeap->data) / cfg.recordingFrameSize;
+	}
+	
+	if (idx < 0) {
+		LOGW("Released recording frame %p does not belong to the recording pool", mem);
+		return;
+	}
+	
+	Mutex::Autolock lock(mRecBufLock);
+	if (!mRecBufferBusy[idx]) {
+		LOGW("Recording buffer %d released twice", idx);
+		return;
+	}
+	mRecBufferBusy[idx] = false;
+	mRecInFlight--;
+	mRecStats.released++;
+}
+
+/* Get the next recording buffer not owned by the encoder, and mark it as
+   owned. Returns -1 if the frame must be dropped, as the encoder fell behind */
+int CameraHardware::acquireRecordingBuffer()
+{
+	Mutex::Autolock lock(mRecBufLock);
+	
+	// With a single free buffer left, the adaptive policy halves the frame
+	//  rate until the encoder releases some of them, instead of stalling
+	//  completely when the last one is taken
+	if (mRecDropPolicy == RECORD_DROP_ADAPTIVE && 
+		mRecInFlight == mRecBufferCount - 1) {
+		mRecDroppedLast = !mRecDroppedLast;
+		if (mRecDroppedLast) {
+			mRecStats.droppedAdaptive++;
+			return -1;
+		}
+	} else {
+		mRecDroppedLast = false;
+	}
+	
+	for (int i = 0; i < mRecBufferCount; i++) {
+		int idx = (mCurrentRecordingFrame + i) % mRecBufferCount;
+		if (!mRecBufferBusy[idx]) {
+			mRecBufferBusy[idx] = true;
+			mCurrentRecordingFrame = (idx + 1) % mRecBufferCount;
+			mRecInFlight++;
+			if (mRecInFlight > mRecStats.maxInFlight)
+				mRecStats.maxInFlight = mRecInFlight;
+			mRecStats.delivered++;
+			return idx;
+		}
+	}
+	
+	mRecStats.dropped++;
+	return -1;
+}
+
+/* Mark all the recording buffers as not owned by the encoder, and start
+   a new counting session */
+void CameraHardware::resetRecordingBuffers()
+{
+	Mutex::Autolock lock(mRecBufLock);
+	memset(mRecBufferBusy, 0, sizeof(mRecBufferBusy));
+	mCurrentRecordingFrame = 0;
+	mRecInFlight = 0;
+	mRecDroppedLast = false;
+	memset(&mRecStats, 0, sizeof(mRecStats));
+}
+
+void CameraHardware::logRecordingStats()
+{
+	Mutex::Autolock lock(mRecBufLock);
+	LOGI("Recording session: %u frames delivered, %u released, %u dropped (encoder busy), "
+		 "%u dropped (adaptive), %d/%d max buffers in flight",
+		 mRecStats.delivered, mRecStats.released, mRecStats.dropped, 
+		 mRecStats.droppedAdaptive, mRecStats.maxInFlight, mRecBufferCount);
 }
 
 
@@ -695,50 +1441,54 @@ status_t CameraHardware::setParameters(const char* parms)
 	
     Mutex::Autolock lock(mLock);
 	
-	// If no changes, trivially accept it!
-	if (params.flatten() == mParameters.flatten()) {
-		LOGD("Trivially accept it. No changes detected");
-		return NO_ERROR;
-	}
+	// Wait until the defaults are known
+	waitForParametersLocked();
 
-	if (strcmp(params.getPreviewFormat(),"yuv422i-yuyv") && 
-		strcmp(params.getPreviewFormat(),"yuv422sp") && 
-		strcmp(params.getPreviewFormat(),"yuv420sp") && 
-		strcmp(params.getPreviewFormat(),"yuv420p")) {
-        LOGE("CameraHardware::setParameters: Unsupported format '%s' for preview",params.getPreviewFormat());
-        return BAD_VALUE;
-    }
-
-    if (strcmp(params.getPictureFormat(), CameraParameters::PIXEL_FORMAT_JPEG)) {
-        LOGE("CameraHardware::setParameters: Only jpeg still pictures are supported");
-        return BAD_VALUE;
-    }
+	status_t ret = setParametersLocked(params);
+	if (ret == NO_ERROR) {
+		// From now on, the parameters belong to the client
+		mParamsChanged = true;
+	}
+	return ret;
+}
 
-	if (strcmp(params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv422i-yuyv") &&
-		strcmp(params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv422sp") && 
-		strcmp(params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv420sp") && 
-		strcmp(params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv420p")) {
-        LOGE("CameraHardware::setParameters: Unsupported format '%s' for recording",params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT));
-        return BAD_VALUE;
-	}	
+status_t CameraHardware::setParametersLocked(const CameraParameters& params)
+{
+	// Decode the parameters once. This also validates the formats
+	CameraConfig cfg;
+	status_t ret = cfg.parse(params);
+	if (ret != NO_ERROR) {
+		return ret;
+	}
 	
-    int w, h;
-
-    params.getPreviewSize(&w, &h);
-    LOGD("CameraHardware::setParameters: PREVIEW: Size %dx%d, %d fps, format: %s", w, h, params.getPreviewFrameRate(), params.getPreviewFormat());
-
-    params.getPictureSize(&w, &h);
-    LOGD("CameraHardware::setParameters: PICTURE: Size %dx%d, format: %s", w, h, params.getPictureFormat());
-
-    params.getVideoSize(&w, &h);
-    LOGD("CameraHardware::setParameters: VIDEO: Size %dx%d, format: %s", w, h, params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT));
+    LOGD("CameraHardware::setParameters: PREVIEW: Size %dx%d, %d fps, format: %s", cfg.previewWidth, cfg.previewHeight, cfg.previewFps, params.getPreviewFormat());
+    LOGD("CameraHardware::setParameters: PICTURE: Size %dx%d, format: %s", cfg.pictureWidth, cfg.pictureHeight, params.getPictureFormat());
+    LOGD("CameraHardware::setParameters: VIDEO: Size %dx%d, format: %s", cfg.videoWidth, cfg.videoHeight, params.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT));
+	
+	// Find out what changed
+	uint32_t changed = cfg.diff(mConfig);
 	
 	// Store the new parameters
     mParameters = params;
+	mConfig = cfg;
+	
+	// A new zoom takes effect from the next frame on, and cancels any 
+	//  smooth zoom in progress
+	if (changed & CameraConfig::CHANGED_ZOOM) {
+		Mutex::Autolock lock(mZoomLock);
+		mZoom = mZoomTarget = cfg.zoom;
+		mSmoothZoom = false;
+	}
 
 	// Recreate the heaps if toggling recording changes the raw preview size
-	//  and also restart the preview so we use the new size if needed
-	initHeapLocked();
+	//  and also restart the preview so we use the new size if needed.
+	//  If nothing relevant to the heaps changed, there is nothing to do
+	if (changed & (CameraConfig::CHANGED_PREVIEW | CameraConfig::CHANGED_VIDEO | CameraConfig::CHANGED_PICTURE_SIZE)) {
+		initHeapLocked(false, changed);
+	} else if (changed) {
+		// Let the preview thread know about the new framerate or effect
+		publishPreviewConfigLocked();
+	}
 	
     LOGD("CameraHardware::setParameters: OK");
 
@@ -755,6 +1505,15 @@ char* CameraHardware::getParameters()
     String8 params;
     {
         Mutex::Autolock lock(mLock);
+		waitForParametersLocked();
+		
+		// Report the zoom reached by smooth zooming
+		{
+			Mutex::Autolock zoomLock(mZoomLock);
+			mConfig.zoom = mZoom;
+		}
+		mParameters.set(CameraParameters::KEY_ZOOM, mConfig.zoom);
+		
 		params = mParameters.flatten();
     }
     
@@ -782,7 +1541,49 @@ void CameraHardware::putParameters(char* params)
 
 status_t CameraHardware::sendCommand(int32_t command, int32_t arg1, int32_t arg2)
 {
-    LOGD("CameraHardware::sendCommand");
+    LOGD("CameraHardware::sendCommand: %d, %d, %d", command, arg1, arg2);
+	
+	switch (command) {
+	case CAMERA_CMD_START_SMOOTH_ZOOM:
+	{
+		if (arg1 < 0 || arg1 > CAMERA_MAX_ZOOM) {
+			LOGE("Invalid smooth zoom target %d", arg1);
+			return BAD_VALUE;
+		}
+		
+		// The preview thread moves one step per frame towards the target, 
+		//  reporting each one of them
+		Mutex::Autolock lock(mZoomLock);
+		mZoomTarget = arg1;
+		mSmoothZoom = true;
+		return NO_ERROR;
+	}
+	
+	case CAMERA_CMD_STOP_SMOOTH_ZOOM:
+	{
+		// Stop at the current step. The preview thread will report it
+		Mutex::Autolock lock(mZoomLock);
+		mZoomTarget = mZoom;
+		return NO_ERROR;
+	}
+	
+	case CAMERA_CMD_START_MOTION_DETECTION:
+	{
+		// The preview thread looks for motion on each frame, and reports
+		//  it at a low rate through CAMERA_MSG_MOTION
+		Mutex::Autolock lock(mMotionLock);
+		mMotion.start(arg1, arg2);
+		return NO_ERROR;
+	}
+	
+	case CAMERA_CMD_STOP_MOTION_DETECTION:
+	{
+		Mutex::Autolock lock(mMotionLock);
+		mMotion.stop();
+		return NO_ERROR;
+	}
+	}
+	
     return 0;
 }
 
@@ -792,12 +1593,69 @@ void CameraHardware::releaseCamera()
     if (mPreviewThread != 0) {
         stopPreview();
     }
+	
+	// Motion detection was requested by this client only
+	{
+		Mutex::Autolock lock(mMotionLock);
+		mMotion.stop();
+	}
+	
+	// The client is gone: Release the capture device, so other
+	//  clients can use it
+	Mutex::Autolock lock(mLock);
+	waitForEnumerationLocked();
+	camera.Close();
 }
 
 status_t CameraHardware::dumpCamera(int fd)
 {
     LOGD("dump");
-    return -EINVAL;
+	
+	// Don't take mLock: The dump must work even if a control call is stuck
+	PreviewConfig cfg;
+	readPreviewConfig(cfg);
+	
+	String8 out;
+	out.appendFormat("Camera %s\n", mVideoDevice);
+	out.appendFormat("  Capture: %dx%d @ %d fps, preview %dx%d, recording %s\n",
+		cfg.rawWidth, cfg.rawHeight, cfg.frameRate, cfg.previewWidth, cfg.previewHeight,
+		cfg.recordingEnabled ? "on" : "off");
+	
+	mStats.dump(out);
+	
+	{
+		Mutex::Autolock lock(mSceneLock);
+		out.appendFormat("  Scene: mean luma %u, block means:\n", mSceneStats.mean);
+		for (int y = 0; y < YUYV_STATS_GRID; y++) {
+			out.append("   ");
+			for (int x = 0; x < YUYV_STATS_GRID; x++) {
+				out.appendFormat(" %3u", mSceneStats.grid[y * YUYV_STATS_GRID + x]);
+			}
+			out.append("\n");
+		}
+	}
+	
+	{
+		Mutex::Autolock lock(mMotionLock);
+		mMotion.dump(out);
+	}
+	
+	{
+		Mutex::Autolock lock(mMailboxLock);
+		out.appendFormat("  Preview window: %u frames rendered, %u stale frames dropped\n",
+			mWinFramesRendered, mWinFramesDropped);
+	}
+	
+	{
+		Mutex::Autolock lock(mRecBufLock);
+		out.appendFormat("  Recording: %u frames delivered, %u released, %u dropped (encoder busy), "
+			"%u dropped (adaptive), %d/%d max buffers in flight\n",
+			mRecStats.delivered, mRecStats.released, mRecStats.dropped, 
+			mRecStats.droppedAdaptive, mRecStats.maxInFlight, mRecBufferCount);
+	}
+	
+	write(fd, out.string(), out.size());
+    return NO_ERROR;
 }
 
 // ---------------------------------------------------------------------------
@@ -806,6 +1664,12 @@ void CameraHardware::initDefaultParameters()
 {
     LOGD("CameraHardware::initDefaultParameters");
 	
+	// The device can only be enumerated once it is powered
+	waitForPowerOn();
+	
+	// Until mEnumerating is cleared nobody else touches the device, so 
+	//  it is enumerated without holding mLock. That way, the parameters
+	//  served from the snapshot stay available meanwhile
 	CameraParameters p;
 	unsigned int i;
 	
@@ -817,7 +1681,7 @@ void CameraHardware::initDefaultParameters()
 	SortedVector<SurfaceSize> avSizes;
 	SortedVector<int> avFps;
 	
-    if (camera.Open(videodevice) != NO_ERROR) {
+    if (!camera.isOpen() && camera.Open(mVideoDevice) != NO_ERROR) {
 	    LOGE("cannot open device.");
 
     } else {
@@ -909,7 +1773,7 @@ void CameraHardware::initDefaultParameters()
 	p.set(CameraParameters::KEY_ANTIBANDING,"auto");
 	
 	// Effects
-	p.set(CameraParameters::KEY_SUPPORTED_EFFECTS,"none"); // "none,mono,sepia,negative,solarize"
+	p.set(CameraParameters::KEY_SUPPORTED_EFFECTS,"none,mono,sepia,negative,solarize");
 	p.set(CameraParameters::KEY_EFFECT,"none");
 	
 	// Flash modes
@@ -951,7 +1815,7 @@ void CameraHardware::initDefaultParameters()
     p.set("preferred-preview-size-for-video", "640x480");
 	
 	// supported rotations
-	p.set("rotation-values","0");
+	p.set("rotation-values","0,90,180,270");
 	p.set(CameraParameters::KEY_ROTATION,"0");
 	
 	// scenes modes
@@ -962,26 +1826,106 @@ void CameraHardware::initDefaultParameters()
 	p.set(CameraParameters::KEY_SUPPORTED_WHITE_BALANCE,"auto");
 	p.set(CameraParameters::KEY_WHITE_BALANCE,"auto");
 
-	// zoom
-	p.set(CameraParameters::KEY_SMOOTH_ZOOM_SUPPORTED,"false");
-	p.set("max-video-continuous-zoom", 0 );
+	// zoom - Digital zoom, done while converting the frames, so it can
+	//  be changed at any time, even smoothly and while recording
+	String8 zoomRatios;
+	for (int z = 0; z <= CAMERA_MAX_ZOOM; z++) {
+		if (z) zoomRatios.append(",");
+		zoomRatios.appendFormat("%d", CAMERA_ZOOM_RATIO(z));
+	}
+	p.set(CameraParameters::KEY_SMOOTH_ZOOM_SUPPORTED,"true");
+	p.set("max-video-continuous-zoom", CAMERA_MAX_ZOOM );
 	p.set(CameraParameters::KEY_ZOOM, "0");
-    p.set(CameraParameters::KEY_MAX_ZOOM, "100");
-    p.set(CameraParameters::KEY_ZOOM_RATIOS, "100");
-    p.set(CameraParameters::KEY_ZOOM_SUPPORTED, "false");
+    p.set(CameraParameters::KEY_MAX_ZOOM, CAMERA_MAX_ZOOM);
+    p.set(CameraParameters::KEY_ZOOM_RATIOS, zoomRatios.string());
+    p.set(CameraParameters::KEY_ZOOM_SUPPORTED, "true");
+
+	// Remember them, so next time they can be served without waiting
+	//  for the device to be enumerated. Don't persist the fallback
+	//  parameters used when the device is not available
+	bool enumerated = camera.isOpen();
+	if (enumerated) {
+		saveParametersSnapshot(p);
+	}
+	
+	Mutex::Autolock lock(mLock);
+	
+	// Give the device back, and wake up everybody waiting for it or
+	//  for the parameters
+	mEnumerating = false;
+	mParamsCond.broadcast();
+	
+	// These are the defaults restored for the next clients, unless the
+	//  snapshot is better than the fallback parameters
+	if (enumerated || !mParamsReady) {
+		mDefaultParameters = p;
+	}
+	
+	// If the client already changed the parameters served from the 
+	//  snapshot, keep them. Also prefer the snapshot over the fallback
+	//  parameters if the device could not be enumerated
+	if (mParamsChanged || (mParamsReady && !enumerated)) {
+		LOGD("CameraHardware::initDefaultParameters: Keeping the current parameters");
+		return;
+	}
 
-    if (setParameters(p.flatten()) != NO_ERROR) {
+    if (setParametersLocked(p) != NO_ERROR) {
         LOGE("CameraHardware::initDefaultParameters: Failed to set default parameters.");
     }
+	
+	mParamsReady = true;
+}
+
+/* Forget everything the last client set up: the camera service does not
+   stop the recording of a client that died, and the next one expects the
+   default parameters. Motion detection is stopped by releaseCamera.
+   NOTE: Must be called with mLock held, and the preview stopped. */
+void CameraHardware::resetClientStateLocked()
+{
+	LOGD("CameraHardware::resetClientStateLocked");
+	
+	if (mRecordingEnabled) {
+		mRecordingEnabled = false;
+		logRecordingStats();
+	}
+	resetRecordingBuffers();
+	
+	mMsgEnabled = 0;
+	mStoreMetaData = false;
+	
+	{
+		Mutex::Autolock winLock(mWinLock);
+		mWin = 0;
+	}
+	{
+		Mutex::Autolock zoomLock(mZoomLock);
+		mZoom = mZoomTarget = 0;
+		mSmoothZoom = false;
+	}
+	
+	// The defaults are only known once served or enumerated. Until then,
+	//  the client could not have changed them
+	if (mParamsChanged) {
+		mParamsChanged = false;
+		if (setParametersLocked(mDefaultParameters) != NO_ERROR) {
+			LOGE("CameraHardware::resetClientStateLocked: Failed to restore the default parameters");
+		}
+	}
+	
+	publishPreviewConfigLocked();
 }
 
-void CameraHardware::initHeapLocked()
+void CameraHardware::initHeapLocked(bool consumerSwitch, uint32_t changed)
 {
-    LOGD("CameraHardware::initHeapLocked");
+    LOGD("CameraHardware::initHeapLocked: changed: 0x%08x", changed);
 
-    int preview_width, preview_height;
-    int picture_width, picture_height;
-	int video_width, video_height;
+	// Use the already decoded configuration
+    int preview_width	= mConfig.previewWidth;
+	int preview_height 	= mConfig.previewHeight;
+    int picture_width	= mConfig.pictureWidth;
+	int picture_height	= mConfig.pictureHeight;
+	int video_width		= mConfig.videoWidth;
+	int video_height	= mConfig.videoHeight;
 
 	if (!mRequestMemory) {	
 		LOGE("No memory allocator available");
@@ -989,10 +1933,6 @@ void CameraHardware::initHeapLocked()
 	}
 	
 	bool restart_preview = false;
-	
-    mParameters.getPreviewSize(&preview_width, &preview_height);
-    mParameters.getPictureSize(&picture_width, &picture_height);
-	mParameters.getVideoSize(&video_width, &video_height);
 
     LOGD("CameraHardware::initHeapLocked: preview size=%dx%d", preview_width, preview_height);
     LOGD("CameraHardware::initHeapLocked: picture size=%dx%d", picture_width, picture_height);
@@ -1011,7 +1951,7 @@ void CameraHardware::initHeapLocked()
 			// Stop the preview thread if needed
 			if (mPreviewThread != 0) {
 				restart_preview	= true;
-				stopPreviewLocked();
+				stopPreviewThreadLocked();
 				LOGD("Stopping preview to allow changes");
 			}
 			
@@ -1030,7 +1970,7 @@ void CameraHardware::initHeapLocked()
 			// Stop the preview thread if needed
 			if (mPreviewThread != 0) {
 				restart_preview	= true;
-				stopPreviewLocked();
+				stopPreviewThreadLocked();
 				LOGD("Stopping preview to allow changes");
 			}
 		
@@ -1045,7 +1985,7 @@ void CameraHardware::initHeapLocked()
 		// Stop the preview thread if needed
 		if (!restart_preview && mPreviewThread != 0) {
 			restart_preview	= true;
-			stopPreviewLocked();
+			stopPreviewThreadLocked();
 			LOGD("Stopping preview to allow changes");
 		}
 
@@ -1058,7 +1998,8 @@ void CameraHardware::initHeapLocked()
 		}
 		mRawPreviewBuffer = NULL;
 
-		mRawPreviewHeap = mRequestMemory(-1,mRawPreviewFrameSize,1,mCallbackCookie);
+		// One raw frame per slot of the preview window mailbox
+		mRawPreviewHeap = mRequestMemory(-1,mRawPreviewFrameSize,kWindowSlotCount,mCallbackCookie);
 		if (mRawPreviewHeap) { 
 			mRawPreviewBuffer = mRawPreviewHeap->data;
 		} else {
@@ -1069,45 +2010,12 @@ void CameraHardware::initHeapLocked()
     }
 	
 
-	int how_preview_big = 0;
-	if (!strcmp(mParameters.getPreviewFormat(),"yuv422i-yuyv")) {
-		mPreviewFmt = PIXEL_FORMAT_YCrCb_422_I;
-		how_preview_big = preview_width * preview_height << 1; // 2 bytes per pixel
-	} else
-	if (!strcmp(mParameters.getPreviewFormat(),"yuv422sp")) {
-		mPreviewFmt = PIXEL_FORMAT_YCbCr_422_SP;
-		how_preview_big = (preview_width * preview_height * 3) >> 1; // 1.5 bytes per pixel
-	} else
-	if (!strcmp(mParameters.getPreviewFormat(),"yuv420sp")) {
-		mPreviewFmt = PIXEL_FORMAT_YCbCr_420_SP;
-		how_preview_big = (preview_width * preview_height * 3) >> 1; // 1.5 bytes per pixel
-	} else
-	if (!strcmp(mParameters.getPreviewFormat(),"yuv420p")) {
-		mPreviewFmt = PIXEL_FORMAT_YV12;
-		
-		/*
-		 * This format assumes
-		 * - an even width
-		 * - an even height
-		 * - a horizontal stride multiple of 16 pixels
-		 * - a vertical stride equal to the height
-		 *
-		 *   y_size = stride * height
-		 *   c_size = ALIGN(stride/2, 16) * height/2
-		 *   cr_offset = y_size
-		 *   cb_offset = y_size + c_size 
-		 *   size = y_size + c_size * 2
-		 */
-		 
-		int stride 		= (preview_width + 15) & (-16); // Round to 16 pixels
-		int y_size  	= stride * preview_height;
-		int c_stride 	= ((stride >> 1) + 15) & (-16); // Round to 16 pixels
-		int c_size		= c_stride * preview_height >> 1;
-		int cr_offset	= y_size;
-		int cb_offset	= y_size + c_size;
-		int size		= y_size + (c_size << 1);
-		
-		how_preview_big = size;
+	// Only reallocate the preview heap if the preview changed, or if it
+	//  was never allocated
+	mPreviewFmt = mConfig.previewFmt;
+	int how_preview_big = mPreviewFrameSize;
+	if ((changed & CameraConfig::CHANGED_PREVIEW) || !mPreviewHeap) {
+		how_preview_big = CameraConfig::frameSize(mPreviewFmt, preview_width, preview_height);
 	}
 	
     if (how_preview_big != mPreviewFrameSize) {
@@ -1115,7 +2023,7 @@ void CameraHardware::initHeapLocked()
 		// Stop the preview thread if needed
 		if (!restart_preview && mPreviewThread != 0) {
 			restart_preview	= true;
-			stopPreviewLocked();
+			stopPreviewThreadLocked();
 			LOGD("Stopping preview to allow changes");
 		}
 	
@@ -1142,53 +2050,20 @@ void CameraHardware::initHeapLocked()
         LOGD("CameraHardware::initHeapLocked: preview heap allocated");
     }
 	
-	int how_recording_big = 0;
-	if (!strcmp(mParameters.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv422i-yuyv")) {
-		mRecFmt = PIXEL_FORMAT_YCrCb_422_I;
-		how_recording_big = video_width * video_height << 1; // 2 bytes per pixel
-	} else
-	if (!strcmp(mParameters.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv422sp")) {
-		mRecFmt = PIXEL_FORMAT_YCbCr_422_SP;
-		how_recording_big = (video_width * video_height * 3) >> 1; // 1.5 bytes per pixel
-	} else
-	if (!strcmp(mParameters.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv420sp")) {
-		mRecFmt = PIXEL_FORMAT_YCbCr_420_SP;
-		how_recording_big = (video_width * video_height * 3) >> 1; // 1.5 bytes per pixel
-	} else
-	if (!strcmp(mParameters.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv420p")) {
-		mRecFmt = PIXEL_FORMAT_YV12;
-		
-		/*
-		 * This format assumes
-		 * - an even width
-		 * - an even height
-		 * - a horizontal stride multiple of 16 pixels
-		 * - a vertical stride equal to the height
-		 *
-		 *   y_size = stride * height
-		 *   c_size = ALIGN(stride/2, 16) * height/2
-		 *   cr_offset = y_size
-		 *   cb_offset = y_size + c_size 
-		 *   size = y_size + c_size * 2
-		 */
-		 
-		int stride 		= (video_width + 15) & (-16); 	// Round to 16 pixels
-		int y_size  	= stride * video_height;
-		int c_stride 	= ((stride >> 1) + 15) & (-16); // Round to 16 pixels
-		int c_size		= c_stride * video_height >> 1;
-		int cr_offset	= y_size;
-		int cb_offset	= y_size + c_size;
-		int size		= y_size + (c_size << 1);
-		
-		how_recording_big = size;
-	}	
+	// Only reallocate the recording heap if the video changed, or if it
+	//  was never allocated
+	mRecFmt = mConfig.videoFmt;
+	int how_recording_big = mRecordingFrameSize;
+	if ((changed & CameraConfig::CHANGED_VIDEO) || !mRecordingHeap) {
+		how_recording_big = CameraConfig::frameSize(mRecFmt, video_width, video_height);
+	}
 	
 	if (how_recording_big != mRecordingFrameSize) {
 
 		// Stop the preview thread if needed
 		if (!restart_preview && mPreviewThread != 0) {
 			restart_preview	= true;
-			stopPreviewLocked();
+			stopPreviewThreadLocked();
 			LOGD("Stopping preview to allow changes");
 		}
 	
@@ -1198,14 +2073,37 @@ void CameraHardware::initHeapLocked()
 			mRecordingHeap->release(mRecordingHeap);
 			mRecordingHeap = NULL;
 		}
+		if (mRecordingMetaHeap) {
+			mRecordingMetaHeap->release(mRecordingMetaHeap);
+			mRecordingMetaHeap = NULL;
+		}
 		memset(mRecBuffers,0,sizeof(mRecBuffers));
+		
+		// Frames owned by the encoder belong to the old pool
+		resetRecordingBuffers();
 
-		mRecordingHeap = mRequestMemory(-1,mRecordingFrameSize,kBufferCount,mCallbackCookie);
+		mRecordingHeap = mRequestMemory(-1,mRecordingFrameSize,mRecBufferCount,mCallbackCookie);
 		if (mRecordingHeap) { 
 			// Make an IMemory for each frame so that we can reuse them in callbacks.
-			for (int i = 0; i < kBufferCount; i++) {
+			for (int i = 0; i < mRecBufferCount; i++) {
 				mRecBuffers[i] = (char*)mRecordingHeap->data + (i * mRecordingFrameSize);
 			}
+			
+			// And the descriptors of those frames, used in metadata mode. They
+			//  never change while the pool is alive
+			mRecordingMetaHeap = mRequestMemory(-1,sizeof(RecordingMetadata),mRecBufferCount,mCallbackCookie);
+			if (mRecordingMetaHeap) {
+				RecordingMetadata* md = (RecordingMetadata*) mRecordingMetaHeap->data;
+				for (int i = 0; i < mRecBufferCount; i++) {
+					md[i].type = RECORDING_METADATA_TYPE_POOL;
+					md[i].index = i;
+					md[i].offset = i * mRecordingFrameSize;
+					md[i].size = mRecordingFrameSize;
+					md[i].data = mRecBuffers[i];
+				}
+			} else {
+				LOGE("Unable to allocate memory for Recording metadata");
+			}
 		} else {
 			LOGE("Unable to allocate memory for Recording");
 		}
@@ -1261,10 +2159,13 @@ void CameraHardware::initHeapLocked()
         LOGD("CameraHardware::initHeapLocked: Jpeg picture heap allocated");
     }
 
+	// Let the preview thread use the new buffers and sizes
+	publishPreviewConfigLocked();
+	
 	// Don't forget to restart the preview if it was stopped...
 	if (restart_preview) {
 		LOGD("Restarting preview");
-		startPreviewLocked();
+		startPreviewLocked(consumerSwitch);
 	}
 	
     LOGD("CameraHardware::initHeapLocked: OK");
@@ -1274,7 +2175,14 @@ int CameraHardware::previewThread()
 {
     LOGV("CameraHardware::previewThread: this=%p",this);
 
-    int previewFrameRate = mParameters.getPreviewFrameRate();
+	// Get the configuration to use for this frame. This never blocks, so
+	//  control calls can't stall the frame delivery
+	PreviewConfig cfg;
+	int32_t cfgSeq = readPreviewConfig(cfg);
+	
+    int previewFrameRate = cfg.frameRate;
+	if (previewFrameRate <= 0)
+		previewFrameRate = 30;
 
     // Calculate how long to wait between frames.
     int delay = (int)(1000000 / previewFrameRate);
@@ -1289,178 +2197,284 @@ int CameraHardware::previewThread()
 	// Get the current timestamp
 	nsecs_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
 
-	// We must avoid a race condition here when destroying the thread...
-	//  So, if we fail to lock the mutex, just retry a bit later, but
-	//  let the android thread end if requested!
-	if (mLock.tryLock() == NO_ERROR)
-    {
+	// If no raw preview buffer, we can't do anything...
+	if (cfg.rawBuffer == 0) {
+		LOGE("No Raw preview buffer!");
+		usleep(delay);
+		return NO_ERROR;
+	}
 
-		// If no raw preview buffer, we can't do anything...
-		if (mRawPreviewBuffer == 0) {
-			LOGE("No Raw preview buffer!");
-			mLock.unlock();
-			return NO_ERROR;
-		}
+	// Get the preview buffer for the current frame		
+	// This is always valid, even if the client died -- the memory
+	// is still mapped in our process.
+	uint8_t *frame = (uint8_t *)cfg.previewBuffer[mCurrentPreviewFrame];
+	
+	// If no preview buffer, we cant do anything...
+	if (frame == 0) {
+		LOGE("No preview buffer!");
+		usleep(delay);
+		return NO_ERROR;
+	}
 
-        // Get the preview buffer for the current frame		
-		// This is always valid, even if the client died -- the memory
-		// is still mapped in our process.
-		uint8_t *frame = (uint8_t *)mPreviewBuffer[mCurrentPreviewFrame];
-		
-		// If no preview buffer, we cant do anything...
-		if (frame == 0) {
-			LOGE("No preview buffer!");
-			mLock.unlock();
-			return NO_ERROR;
-		}
+	bool recording = cfg.recordingEnabled && (cfg.msgEnabled & CAMERA_MSG_VIDEO_FRAME);
+	
+	CameraTrace::begin("previewFrame");
+	
+	// Get the zoom to apply to this frame
+	bool zoomNotify = false;
+	bool zoomStopped = false;
+	int zoom = stepZoom(zoomNotify, zoomStopped);
+
+	// Get the raw frame slot that will be handed to the window stage
+	int winSlot = acquireWindowSlot();
+	uint8_t* winFrame = (uint8_t*)cfg.rawBuffer + winSlot * cfg.rawFrameSize;
+
+	//  Get a pointer to the memory area to use... In case of previewing in YUV422I, we
+	// can save a buffer copy by directly using the output buffer. But ONLY if NOT recording
+	// or, in case of recording, when size matches
+	// or, in case of recording, when size matches. And, of course, when not zooming
+	// nor applying a color effect
+	uint8_t* rawBase = (cfg.previewFmt == PIXEL_FORMAT_YCrCb_422_I && zoom == 0 &&
+						cfg.effect == YUYV_EFFECT_NONE &&
+						(!cfg.recordingEnabled || cfg.rawFrameSize == cfg.previewFrameSize)) 
+						? frame
+						: winFrame;
+						
+	// Grab a frame in the raw format YUYV, metering it on the way. If it
+	//  failed, there are no stats to learn anything from
+	struct yuyv_luma_stats stats;
+	bool grabbed = camera.GrabRawFrame(rawBase, cfg.rawFrameSize, &stats);
+	if (grabbed)
+		setSceneStats(stats, true);
+	
+	// If the scene did not change since the last converted frame, its
+	//  outputs are still valid, and this frame needs no conversion
+	bool staticFrame = grabbed && isStaticFrame(stats, cfgSeq, zoom, recording);
+	
+	// Look for motion in the scene, using the same stats
+	CameraMotion::Region motion[CAMERA_MOTION_MAX_REGIONS];
+	int motionRegions = 0;
+	bool motionReport = false;
+	if (grabbed) {
+		Mutex::Autolock lock(mMotionLock);
+		motionReport = mMotion.update(stats, timestamp, motion, motionRegions);
+	}
 
+	// Destinations of the conversion of this frame. All of them are 
+	//  written in a single pass over the raw frame
+	struct yuyv_fanout_dst dsts[YUYV_FANOUT_MAX_DST];
+	int ndsts = 0;
 
-		//  Get a pointer to the memory area to use... In case of previewing in YUV422I, we
-		// can save a buffer copy by directly using the output buffer. But ONLY if NOT recording
-		// or, in case of recording, when size matches
-		uint8_t* rawBase = (mPreviewFmt == PIXEL_FORMAT_YCrCb_422_I && 
-							(!mRecordingEnabled || mRawPreviewFrameSize == mPreviewFrameSize)) 
-							? frame
-							:(uint8_t*)mRawPreviewBuffer;
-							
-		// Grab a frame in the raw format YUYV
-		camera.GrabRawFrame(rawBase, mRawPreviewFrameSize);
-
-		// If the recording is enabled...
-		if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
-			//LOGD("CameraHardware::previewThread: posting video frame...");
-
-			// Get the video size. We are warrantied here that the current capture
-			// size IS exacty equal to the video size, as this condition is enforced
-			// by this driver, that priorizes recording size over preview size requirements
-			
-			uint8_t *recFrame = (uint8_t *) mRecBuffers[mCurrentRecordingFrame];
-			if (recFrame != 0) {
+	// If the recording is enabled...
+	if (recording) {
+		//LOGD("CameraHardware::previewThread: posting video frame...");
 
-				// Convert from our raw frame to the one the Record requires
-				switch (mRecFmt) {
-				
-				// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
-				// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
-				case PIXEL_FORMAT_YCbCr_422_SP:
-					yuyv_to_yvu420sp(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
-					
-				case PIXEL_FORMAT_YCbCr_420_SP:
-					yuyv_to_yvu420sp(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
-				
-				case PIXEL_FORMAT_YV12:
-					/* OMX recorder needs YUV */
-					yuyv_to_yuv420p(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
-				
-				case PIXEL_FORMAT_YCrCb_422_I:
-					memcpy(recFrame, rawBase, mRecordingFrameSize);
-					break; 
-				}
-				
-				// Remember we must schedule the callback
-				record = true;
-				
-				// Advance the buffer pointer.
-				recBufferIdx = mCurrentRecordingFrame;
-				mCurrentRecordingFrame = (mCurrentRecordingFrame + 1) % kBufferCount;
-			}
+		// Get the video size. We are warrantied here that the current capture
+		// size IS exacty equal to the video size, as this condition is enforced
+		// by this driver, that priorizes recording size over preview size requirements
+		
+		// Never overwrite a frame the encoder still owns
+		int recIdx = acquireRecordingBuffer();
+		uint8_t *recFrame = (recIdx >= 0) ? (uint8_t *) cfg.recBuffers[recIdx] : NULL;
+		if (recIdx < 0) {
+			LOGV("All recording buffers are owned by the encoder - Dropping video frame");
 		}
-
-		if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
-			//LOGD("CameraHardware::previewThread: posting preview frame...");
-
-			// Here we could eventually have a problem: If we are recording, the recording size
-			//  takes precedence over the preview size. So, the rawBase buffer could be of a 
-			//  different size than the preview buffer. Handle this situation by centering/cropping
-			//  if needed.
+		if (recFrame != 0) {
+
+			// Convert from our raw frame to the one the Record requires
+			struct yuyv_fanout_dst* d = &dsts[ndsts++];
+			memset(d, 0, sizeof(*d));
+			d->dst 			= recFrame;
+			d->dstStride 	= cfg.rawWidth;
+			d->dstHeight 	= cfg.rawHeight;
+			d->width 		= cfg.rawWidth;
+			d->height 		= cfg.rawHeight;
 			
-			// Get the preview size
-			int width = 0, height = 0;
-			mParameters.getPreviewSize(&width,&height);
+			switch (cfg.recFmt) {
 			
-			// Assume we will be able to copy at least those pixels
-			int cwidth = width;
-			int cheight = height;
-			
-			// If we are trying to display a preview larger than the effective capture, truncate to it
-			if (cwidth > mRawPreviewWidth)
-				cwidth = mRawPreviewWidth;
-			if (cheight > mRawPreviewHeight)
-				cheight = mRawPreviewHeight;
-
-			// Convert from our raw frame to the one the Preview requires
-			switch (mPreviewFmt) {
-			
-				// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
-				// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
-			case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
-				yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
-				break;
-				
+			// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
+			// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
+			case PIXEL_FORMAT_YCbCr_422_SP:
 			case PIXEL_FORMAT_YCbCr_420_SP:
-				yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
+				d->fmt = YUYV_FANOUT_YVU420SP;
 				break;
-
+			
 			case PIXEL_FORMAT_YV12:
-				yuyv_to_yvu420p(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
+				/* OMX recorder needs YUV */
+				d->fmt = YUYV_FANOUT_YUV420P;
 				break;
-				
+			
 			case PIXEL_FORMAT_YCrCb_422_I:
-				// Nothing to do here. Is is handled as a special case without buffer copies...
-				//  but ONLY in special cases... Otherwise, handle the copy!
-				if (mRecordingEnabled && mRawPreviewFrameSize != mPreviewFrameSize) {
-					// We need to copy ... do it
-					uint8_t* dst = frame;
-					uint8_t* src = rawBase;
-					int h;
-					for (h = 0; h < cheight; h++) {
-						memcpy(dst,src,cwidth<<1);
-						dst += width << 1;
-						src += mRawPreviewWidth<<1;
-					}
-				}
+				d->fmt = YUYV_FANOUT_YUYV;
+				d->dstStride = cfg.rawWidth << 1;
 				break; 
-				
-			default:
-				LOGE("Unhandled pixel format");
-
 			}
 			
 			// Remember we must schedule the callback
-			preview = true;
+			record = true;
 			
-			// Advance the buffer pointer.
-			previewBufferIdx = mCurrentPreviewFrame;
-			mCurrentPreviewFrame = (mCurrentPreviewFrame + 1) % kBufferCount;
+			recBufferIdx = recIdx;
 		}
+	}
+
+	if ((cfg.msgEnabled & CAMERA_MSG_PREVIEW_FRAME) && staticFrame && 
+		rawBase != frame && mLastPreviewBufferIdx >= 0) {
+		// Send the preview buffer of the last converted frame again. If the 
+		//  frame was captured in place, it is sent as usual
+		preview = true;
+		previewBufferIdx = mLastPreviewBufferIdx;
+		
+	} else if (cfg.msgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
+		//LOGD("CameraHardware::previewThread: posting preview frame...");
 
-		// Display the preview image
-		fillPreviewWindow(rawBase, mRawPreviewWidth, mRawPreviewHeight);
+		// Here we could eventually have a problem: If we are recording, the recording size
+		//  takes precedence over the preview size. So, the rawBase buffer could be of a 
+		//  different size than the preview buffer. Handle this situation by centering/cropping
+		//  if needed.
 		
-		// Release the lock
-		mLock.unlock();
+		// Get the preview size
+		int width = cfg.previewWidth;
+		int height = cfg.previewHeight;
 		
-    } else {
+		// Assume we will be able to copy at least those pixels
+		int cwidth = width;
+		int cheight = height;
+		
+		// If we are trying to display a preview larger than the effective capture, truncate to it
+		if (cwidth > cfg.rawWidth)
+			cwidth = cfg.rawWidth;
+		if (cheight > cfg.rawHeight)
+			cheight = cfg.rawHeight;
+
+		// Convert from our raw frame to the one the Preview requires
+		struct yuyv_fanout_dst* d = &dsts[ndsts];
+		memset(d, 0, sizeof(*d));
+		d->dst 			= frame;
+		d->dstStride 	= width;
+		d->dstHeight 	= height;
+		d->width 		= cwidth;
+		d->height 		= cheight;
+		
+		switch (cfg.previewFmt) {
+		
+			// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
+			// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
+		case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
+		case PIXEL_FORMAT_YCbCr_420_SP:
+			d->fmt = YUYV_FANOUT_YVU420SP;
+			ndsts++;
+			break;
+
+		case PIXEL_FORMAT_YV12:
+			d->fmt = YUYV_FANOUT_YVU420P;
+			ndsts++;
+			break;
+			
+		case PIXEL_FORMAT_YCrCb_422_I:
+			// Nothing to do here. Is is handled as a special case without buffer copies...
+			//  but ONLY in special cases... Otherwise, handle the copy!
+			if (rawBase != frame) {
+				d->fmt = YUYV_FANOUT_YUYV;
+				d->dstStride = width << 1;
+				ndsts++;
+			}
+			break; 
+			
+		default:
+			LOGE("Unhandled pixel format");
+
+		}
+		
+		// Remember we must schedule the callback
+		preview = true;
+		
+		// Advance the buffer pointer.
+		previewBufferIdx = mCurrentPreviewFrame;
+		mLastPreviewBufferIdx = previewBufferIdx;
+		mCurrentPreviewFrame = (mCurrentPreviewFrame + 1) % kBufferCount;
+	}
+
+	// The recording and the preview callbacks get the zoomed frame, with
+	//  the color effect applied while converting it
+	for (int i = 0; i < ndsts; i++) {
+		applyZoom(&dsts[i], cfg.rawWidth, cfg.rawHeight, zoom);
+		dsts[i].effect = cfg.effect;
+	}
+	
+	// If the frame was not captured into the window slot, copy it there
+	//  in the same pass. It is kept as captured: The window stage applies 
+	//  the effect itself while converting it. Static frames are not 
+	//  displayed again, the window keeps showing the last one
+	if (!staticFrame && rawBase != winFrame) {
+		struct yuyv_fanout_dst* d = &dsts[ndsts++];
+		memset(d, 0, sizeof(*d));
+		d->fmt 			= YUYV_FANOUT_YUYV;
+		d->dst 			= winFrame;
+		d->dstStride 	= cfg.rawWidth << 1;
+		d->dstHeight 	= cfg.rawHeight;
+		d->width 		= cfg.rawWidth;
+		d->height 		= cfg.rawHeight;
+	}
+	
+	// Convert the frame to all the destinations at once. Static frames 
+	//  usually have nothing to convert
+	nsecs_t t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+	nsecs_t t1 = t0;
+	if (ndsts > 0) {
+		CameraTrace::begin("yuyv_fanout");
+		yuyv_fanout(rawBase, cfg.rawWidth << 1, cfg.rawWidth, cfg.rawHeight, dsts, ndsts);
+		CameraTrace::end();
+		t1 = systemTime(SYSTEM_TIME_MONOTONIC);
+		mStats.addStage(CameraStats::STAGE_FANOUT, t1 - t0);
+	}
 	
-		// Delay a little ... and reattempt the lock on the next iteration
-		delay >>= 7;
+	// And let the window stage display it. This never blocks, so a slow
+	//  compositor can't stall the capture
+	if (staticFrame) {
+		mStats.addStaticFrame();
+	} else {
+		postWindowFrame(winSlot, zoom);
 	}
 
-	// We must schedule the callbacks Outside the lock, or the caller
-	//  could call us and cause a deadlock!
+	// We must schedule the callbacks without holding any lock, or the 
+	//  caller could call us and cause a deadlock!
 	if (preview) {
-	    mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, previewBufferIdx, NULL, mCallbackCookie);
+		CameraTrace::begin("previewCallback");
+	    mDataCb(CAMERA_MSG_PREVIEW_FRAME, cfg.previewHeap, previewBufferIdx, NULL, mCallbackCookie);
+		CameraTrace::end();
+		t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+		mStats.addStage(CameraStats::STAGE_PREVIEW_CB, t0 - t1);
+		t1 = t0;
 	}
 	
 	if (record) {
-		// Record callback uses a timestamped frame
-        mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, mRecordingHeap, recBufferIdx, mCallbackCookie);
+		// Record callback uses a timestamped frame. In metadata mode, the
+		//  encoder gets the descriptor of the frame instead of the frame
+		camera_memory_t* recHeap = (cfg.storeMetaData && cfg.recordingMetaHeap) 
+							? cfg.recordingMetaHeap 
+							: cfg.recordingHeap;
+		CameraTrace::begin("videoCallback");
+        mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, recHeap, recBufferIdx, mCallbackCookie);
+		CameraTrace::end();
+		t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+		mStats.addStage(CameraStats::STAGE_VIDEO_CB, t0 - t1);
+		t1 = t0;
+	}
+	
+	// Report the progress of smooth zooming
+	if (zoomNotify && (cfg.msgEnabled & CAMERA_MSG_ZOOM)) {
+		mNotifyCb(CAMERA_MSG_ZOOM, zoom, zoomStopped, mCallbackCookie);
+	}
+	
+	// And the motion in the scene, if due
+	if (motionReport) {
+		notifyMotion(motion, motionRegions);
 	}
 
     LOGV("previewThread OK");
+	
+	mStats.addStage(CameraStats::STAGE_FRAME, systemTime(SYSTEM_TIME_MONOTONIC) - timestamp);
+	CameraTrace::end();
 
     // Wait for it...
     usleep(delay);
@@ -1468,158 +2482,431 @@ int CameraHardware::previewThread()
     return NO_ERROR;
 }
 
-void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeight) 
+/* Get a raw frame slot not used by the window stage, to capture the next
+   frame into it. With 3 slots there is always one available */
+int CameraHardware::acquireWindowSlot()
+{
+	Mutex::Autolock lock(mMailboxLock);
+	for (int i = 0; i < kWindowSlotCount; i++) {
+		if (i != mMailboxPending && i != mMailboxRendering)
+			return i;
+	}
+	return 0;
+}
+
+/* Post a captured frame to the window stage, replacing the pending one
+   if it was not rendered yet */
+void CameraHardware::postWindowFrame(int slot, int zoom)
+{
+	Mutex::Autolock lock(mMailboxLock);
+	if (mMailboxPending >= 0) {
+		mWinFramesDropped++;
+	}
+	mMailboxPending = slot;
+	mMailboxZoom[slot] = zoom;
+	mMailboxCond.signal();
+}
+
+/* Publish the luma stats of the last captured frame. For preview frames,
+   also track how long the exposure has been stable, so a picture can be
+   taken without waiting for it to settle again */
+void CameraHardware::setSceneStats(const struct yuyv_luma_stats& stats, bool preview)
+{
+	if (stats.samples == 0)
+		return;
+	Mutex::Autolock lock(mSceneLock);
+	if (preview) {
+		int dif = (int)stats.mean - (int)mSceneStats.mean;
+		if (dif < 0) dif = -dif;
+		if (mPreviewLumaStableFor == 0 || dif > LUMA_STABLE_THRESH) {
+			mPreviewLumaStableFor = 1;
+		} else {
+			mPreviewLumaStableFor++;
+		}
+	}
+	mSceneStats = stats;
+}
+
+/* Decide if a preview frame can reuse the outputs of the last converted
+   one, as the scene did not change since then. A frame that must be 
+   converted becomes the new reference, so a slow drift is noticed too */
+bool CameraHardware::isStaticFrame(const struct yuyv_luma_stats& stats, int32_t cfgSeq, int zoom, bool recording)
+{
+	if (mStaticThresh <= 0)
+		return false;
+		
+	// Every recorded frame must reach the encoder, and the outputs can only
+	//  be reused if converted with the same configuration and zoom
+	if (!recording && mStaticRefValid && mStaticRefSeq == cfgSeq && 
+		mStaticRefZoom == zoom && mStaticRun < STATIC_MAX_RUN) {
+		int delta = yuyv_stats_delta(&stats, &mStaticRef);
+		if (delta >= 0 && delta <= mStaticThresh) {
+			mStaticRun++;
+			return true;
+		}
+	}
+	
+	mStaticRef = stats;
+	mStaticRefValid = true;
+	mStaticRefSeq = cfgSeq;
+	mStaticRefZoom = zoom;
+	mStaticRun = 0;
+	return false;
+}
+
+/* Report the regions of the scene where motion was found, one notification
+   per region. A report without regions tells the motion stopped. Must be 
+   called without holding any lock */
+void CameraHardware::notifyMotion(const CameraMotion::Region* regions, int count)
+{
+	// Detection could have been stopped since the frame was analyzed
+	{
+		Mutex::Autolock lock(mMotionLock);
+		if (!mMotion.isActive())
+			return;
+	}
+	
+	CameraTrace::counter("cameraMotionScore", count ? regions[0].score : 0);
+	
+	int32_t ext1, ext2;
+	if (count == 0) {
+		CameraMotion::pack(NULL, 0, 0, ext1, ext2);
+		mNotifyCb(CAMERA_MSG_MOTION, ext1, ext2, mCallbackCookie);
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		CameraMotion::pack(&regions[i], i, count, ext1, ext2);
+		mNotifyCb(CAMERA_MSG_MOTION, ext1, ext2, mCallbackCookie);
+	}
+}
+
+/* Get the zoom to use for the next frame. While zooming smoothly, it
+   also moves one step towards the target, and reports if it must be
+   notified, and if the target was reached */
+int CameraHardware::stepZoom(bool& notify, bool& stopped)
+{
+	Mutex::Autolock lock(mZoomLock);
+	notify = false;
+	stopped = false;
+	if (mSmoothZoom) {
+		if (mZoom < mZoomTarget) {
+			mZoom++;
+		} else if (mZoom > mZoomTarget) {
+			mZoom--;
+		}
+		notify = true;
+		if (mZoom == mZoomTarget) {
+			stopped = true;
+			mSmoothZoom = false;
+		}
+	}
+	return mZoom;
+}
+
+/* Render the latest captured frame in the preview window */
+int CameraHardware::windowThread()
+{
+	int slot;
+	int zoom;
+	{
+		Mutex::Autolock lock(mMailboxLock);
+		
+		// Wait for a frame. Don't wait forever, to be able to exit
+		if (mMailboxPending < 0) {
+			mMailboxCond.waitRelative(mMailboxLock, 100000000LL);
+		}
+		if (mMailboxPending < 0) {
+			return NO_ERROR;
+		}
+		
+		// Take it, so the capture stage won't reuse its slot
+		slot = mMailboxPending;
+		zoom = mMailboxZoom[slot];
+		mMailboxPending = -1;
+		mMailboxRendering = slot;
+	}
+	
+	// Buffers are only reallocated with this thread stopped
+	PreviewConfig cfg;
+	readPreviewConfig(cfg);
+	uint8_t* src = (uint8_t*)cfg.rawBuffer + slot * cfg.rawFrameSize;
+	
+	CameraTrace::begin("windowFrame");
+	
+	// Display the preview image. The window lock is only contended
+	//  when the preview window is being replaced
+	{
+		nsecs_t t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+		CameraTrace::begin("windowLock");
+		Mutex::Autolock lock(mWinLock);
+		CameraTrace::end();
+		nsecs_t t1 = systemTime(SYSTEM_TIME_MONOTONIC);
+		mStats.addStage(CameraStats::STAGE_WIN_LOCK, t1 - t0);
+		
+		buffer_handle_t* winBuf = NULL;
+		struct yuyv_fanout_dst d;
+		bool dequeued = dequeuePreviewWindowBuffer(&winBuf, &d, cfg.rawWidth, cfg.rawHeight);
+		t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+		mStats.addStage(CameraStats::STAGE_WIN_DEQUEUE, t0 - t1);
+		
+		if (dequeued) {
+			applyZoom(&d, cfg.rawWidth, cfg.rawHeight, zoom);
+			d.effect = cfg.effect;
+			CameraTrace::begin("yuyv_fanout");
+			yuyv_fanout(src, cfg.rawWidth << 1, cfg.rawWidth, cfg.rawHeight, &d, 1);
+			CameraTrace::end();
+			t1 = systemTime(SYSTEM_TIME_MONOTONIC);
+			mStats.addStage(CameraStats::STAGE_WIN_CONVERT, t1 - t0);
+			
+			enqueuePreviewWindowBuffer(winBuf);
+			mStats.addStage(CameraStats::STAGE_WIN_ENQUEUE, systemTime(SYSTEM_TIME_MONOTONIC) - t1);
+		}
+	}
+	
+	uint32_t rendered;
+	{
+		Mutex::Autolock lock(mMailboxLock);
+		mMailboxRendering = -1;
+		rendered = ++mWinFramesRendered;
+	}
+	
+	CameraTrace::counter("cameraWindowFrame", rendered);
+	CameraTrace::end();
+	
+	return NO_ERROR;
+}
+
+/* Publish the configuration used by the preview thread. It is implemented
+   as a seqlock: The sequence number is odd while the configuration is being
+   updated, and readers retry if it changed while they were copying it.
+   NOTE: Must be called with mLock held, that serializes the writers. */
+void CameraHardware::publishPreviewConfigLocked()
+{
+	PreviewConfig cfg;
+	
+	cfg.msgEnabled 			= mMsgEnabled;
+	cfg.recordingEnabled 	= mRecordingEnabled;
+	cfg.frameRate 			= mConfig.previewFps;
+	cfg.effect 				= mConfig.effect;
+	
+	cfg.rawBuffer 			= mRawPreviewBuffer;
+	cfg.rawFrameSize 		= mRawPreviewFrameSize;
+	cfg.rawWidth 			= mRawPreviewWidth;
+	cfg.rawHeight 			= mRawPreviewHeight;
+	
+	cfg.previewHeap 		= mPreviewHeap;
+	cfg.previewFrameSize 	= mPreviewFrameSize;
+	cfg.previewFmt 			= mPreviewFmt;
+	cfg.previewWidth 		= mConfig.previewWidth;
+	cfg.previewHeight 		= mConfig.previewHeight;
+	
+	cfg.recordingHeap 		= mRecordingHeap;
+	cfg.recordingFrameSize 	= mRecordingFrameSize;
+	cfg.recFmt 				= mRecFmt;
+	
+	cfg.storeMetaData 		= mStoreMetaData;
+	cfg.recordingMetaHeap 	= mRecordingMetaHeap;
+	
+	for (int i = 0; i < kBufferCount; i++) {
+		cfg.previewBuffer[i] = mPreviewBuffer[i];
+	}
+	for (int i = 0; i < kMaxRecBufferCount; i++) {
+		cfg.recBuffers[i] = mRecBuffers[i];
+	}
+	cfg.recBufferCount 		= mRecBufferCount;
+	
+	android_atomic_inc(&mPreviewConfigSeq);
+	android_memory_barrier();
+	mPreviewConfig = cfg;
+	android_atomic_inc(&mPreviewConfigSeq);
+}
+
+/* Get a consistent copy of the preview configuration, without locking.
+   Returns its sequence number, that changes each time it is published */
+int32_t CameraHardware::readPreviewConfig(PreviewConfig& cfg) const
+{
+	int32_t seq;
+	do {
+		seq = android_atomic_acquire_load(&mPreviewConfigSeq);
+		cfg = mPreviewConfig;
+	} while ((seq & 1) || seq != android_atomic_release_load(&mPreviewConfigSeq));
+	return seq;
+}
+
+/* Convert a clockwise rotation in degrees to a converter transform */
+int CameraHardware::rotationToTransform(int degrees)
+{
+	switch (((degrees % 360) + 360) % 360) {
+	case 90:
+		return YUYV_ROTATE_90;
+	case 180:
+		return YUYV_ROTATE_180;
+	case 270:
+		return YUYV_ROTATE_270;
+	}
+	return YUYV_ROTATE_0;
+}
+
+/* Get a buffer of the preview window to fill, and describe it as a 
+   destination of the frame conversion. Returns false if no buffer could
+   be obtained.
+   NOTE: Must be called with mWinLock held. */
+bool CameraHardware::dequeuePreviewWindowBuffer(buffer_handle_t** pbuf, struct yuyv_fanout_dst* d, int srcWidth, int srcHeight) 
 {
+	*pbuf = NULL;
+	
 	// Preview to a preview window...
 	if (mWin == 0) {
 		LOGE("%s: No preview window",__FUNCTION__);
-		return;
+		return false;
 	}
 	
 	// Get a videobuffer
 	buffer_handle_t* buf = NULL;
 	int stride = 0;
+	CameraTrace::begin("dequeue_buffer");
 	status_t res = mWin->dequeue_buffer(mWin, &buf, &stride);
+	CameraTrace::end();
 	if (res != NO_ERROR || buf == NULL) {
         LOGE("%s: Unable to dequeue preview window buffer: %d -> %s",
             __FUNCTION__, -res, strerror(-res));
-        return;
+        return false;
 	}
 
     /* Let the preview window to lock the buffer. */
+	CameraTrace::begin("lock_buffer");
     res = mWin->lock_buffer(mWin, buf);
+	CameraTrace::end();
     if (res != NO_ERROR) {
         LOGE("%s: Unable to lock preview window buffer: %d -> %s",
              __FUNCTION__, -res, strerror(-res));
         mWin->cancel_buffer(mWin, buf);
-        return;
+        return false;
     }
 		
     /* Now let the graphics framework to lock the buffer, and provide
      * us with the framebuffer data address. */
 	void* vaddr = NULL;
     
-    const Rect bounds(srcWidth, srcHeight);
+    const Rect bounds(mPreviewWinWidth, mPreviewWinHeight);
     GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
+	CameraTrace::begin("gralloc lock");
     res = grbuffer_mapper.lock(*buf, GRALLOC_USAGE_SW_WRITE_OFTEN, bounds, &vaddr);
+	CameraTrace::end();
     if (res != NO_ERROR || vaddr == NULL) {
         LOGE("%s: grbuffer_mapper.lock failure: %d -> %s",
              __FUNCTION__, res, strerror(res));
         mWin->cancel_buffer(mWin, buf);
-        return;
+        return false;
     }
-		
-	// Calculate the source stride...
-	int srcStride = srcWidth<<1;
-	uint8_t* src  = (uint8_t*)yuyv;
-
-	// Center into the preview surface if needed
-	int xStart = (mPreviewWinWidth   - srcWidth ) >> 1;
-	int yStart = (mPreviewWinHeight  - srcHeight) >> 1;
-
-	// Make sure not to overflow the preview surface
-	if (xStart < 0 || yStart < 0) {
-		LOGE("Preview window is smaller than video preview size - Cropping image.");
-		
-		if (xStart < 0) {
-			srcWidth += xStart;
-			src += ((-xStart) >> 1) << 1; 		// Center the crop rectangle
-			xStart = 0;
-		}
-		
-		if (yStart < 0) {
-			srcHeight += yStart;
-			src += ((-yStart) >> 1) * srcStride; // Center the crop rectangle
-			yStart = 0;
-		}
-	} 		
 	
-	// Calculate the bytes per pixel
-	int bytesPerPixel = 2;
-	if (mPreviewWinFmt == PIXEL_FORMAT_YCbCr_422_SP ||
-		mPreviewWinFmt == PIXEL_FORMAT_YCbCr_420_SP ||
-		mPreviewWinFmt == PIXEL_FORMAT_YV12 ||
-		mPreviewWinFmt == PIXEL_FORMAT_YV16 ) {
-		bytesPerPixel = 1; // Planar Y
-	} else
-	if (mPreviewWinFmt == PIXEL_FORMAT_RGB_888) {
-		bytesPerPixel = 3;
-	} else
-	if (mPreviewWinFmt == PIXEL_FORMAT_RGBA_8888 ||
-		mPreviewWinFmt == PIXEL_FORMAT_RGBX_8888 ||
-		mPreviewWinFmt == PIXEL_FORMAT_BGRA_8888) {
-		bytesPerPixel = 4;
-	} else
-	if (mPreviewWinFmt == PIXEL_FORMAT_YCrCb_422_I) {
-		bytesPerPixel = 2;
-	}
-
-	LOGV("ANativeWindow: bits:%p, stride in pixels:%d, w:%d, h: %d, format: %d",vaddr,stride,mPreviewWinWidth,mPreviewWinHeight,mPreviewWinFmt);
-
 	// Based on the destination pixel type, we must convert from YUYV to it
-	int dstStride = bytesPerPixel * stride;
-	uint8_t* dst  = ((uint8_t*)vaddr) + (xStart * bytesPerPixel) + (dstStride * yStart);
-
+	int bytesPerPixel = 2;
+	int fmt = YUYV_FANOUT_YUYV;
 	switch (mPreviewWinFmt) {
 	case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
-		yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
-		
 	case PIXEL_FORMAT_YCbCr_420_SP:
-		yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight,src, srcStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_YVU420SP;
+		bytesPerPixel = 1; // Planar Y
 		break;
 		
 	case PIXEL_FORMAT_YV12:
-		yuyv_to_yvu420p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_YVU420P;
+		bytesPerPixel = 1; // Planar Y
 		break;
 
 	case PIXEL_FORMAT_YV16:
-		yuyv_to_yvu422p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_YVU422P;
+		bytesPerPixel = 1; // Planar Y
 		break;
 		
 	case PIXEL_FORMAT_YCrCb_422_I:
-	{
-		// We need to copy ... do it
-		uint8_t* pdst = dst;
-		uint8_t* psrc = src;
-		int h;
-		for (h = 0; h < srcHeight; h++) {
-			memcpy(pdst,psrc,srcWidth<<1);
-			pdst += dstStride;
-			psrc += srcStride;
-		}
-		break; 
-	}
+		fmt = YUYV_FANOUT_YUYV;
+		bytesPerPixel = 2;
+		break;
 	
 	case PIXEL_FORMAT_RGB_888:
-		yuyv_to_rgb24(src, srcStride, dst, dstStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_RGB24;
+		bytesPerPixel = 3;
 		break;
 			
 	case PIXEL_FORMAT_RGBA_8888:
-		yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
-			
 	case PIXEL_FORMAT_RGBX_8888:
-		yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_RGB32;
+		bytesPerPixel = 4;
 		break;
 			
 	case PIXEL_FORMAT_BGRA_8888:
-		yuyv_to_bgr32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_BGR32;
+		bytesPerPixel = 4;
 		break; 				
 		
 	case PIXEL_FORMAT_RGB_565:
-		yuyv_to_rgb565(src, srcStride, dst, dstStride, srcWidth, srcHeight);
+		fmt = YUYV_FANOUT_RGB565;
+		bytesPerPixel = 2;
 		break;
 		
 	default:
 		LOGE("Unhandled pixel format");
+		grbuffer_mapper.unlock(*buf);
+		mWin->cancel_buffer(mWin, buf);
+		return false;
 	}
-				
+
+	LOGV("ANativeWindow: bits:%p, stride in pixels:%d, w:%d, h: %d, format: %d",vaddr,stride,mPreviewWinWidth,mPreviewWinHeight,mPreviewWinFmt);
+	
+	// The frame is displayed with the mounting correction applied, so
+	//  when rotating 90 or 270 degrees, it is as tall as the source is wide
+	bool swap = (mMountTransform & 1) != 0;
+	int outWidth  = swap ? srcHeight : srcWidth;
+	int outHeight = swap ? srcWidth  : srcHeight;
+	
+	// Center into the preview surface if needed, cropping the image if
+	//  the preview surface is smaller. Keep everything even, as chroma
+	//  is subsampled
+	int width  = (outWidth  < mPreviewWinWidth ) ? outWidth  : mPreviewWinWidth;
+	int height = (outHeight < mPreviewWinHeight) ? outHeight : mPreviewWinHeight;
+	width  &= -2;
+	height &= -2;
+	
+	if (width < outWidth || height < outHeight) {
+		LOGV("Preview window is smaller than video preview size - Cropping image.");
+	}
+	
+	// Size of the cropped area in the source
+	int cropWidth  = swap ? height : width;
+	int cropHeight = swap ? width  : height;
+	
+	memset(d, 0, sizeof(*d));
+	d->fmt 			= fmt;
+	d->dst 			= (uint8_t*)vaddr;
+	d->dstStride 	= bytesPerPixel * stride;
+	d->dstHeight 	= mPreviewWinHeight;
+	d->dstX 		= ((mPreviewWinWidth  - width ) >> 1) & (-2);
+	d->dstY 		= ((mPreviewWinHeight - height) >> 1) & (-2);
+	d->srcX 		= ((srcWidth  - cropWidth ) >> 1) & (-2);
+	d->srcY 		= ((srcHeight - cropHeight) >> 1) & (-2);
+	d->width 		= cropWidth;
+	d->height 		= cropHeight;
+	d->transform 	= mMountTransform;
+	
+	*pbuf = buf;
+	return true;
+}
+
+/* Show a filled preview window buffer.
+   NOTE: Must be called with mWinLock held. */
+void CameraHardware::enqueuePreviewWindowBuffer(buffer_handle_t* buf)
+{
 	/* Show it. */
+	CameraTrace::begin("enqueue_buffer");
 	mWin->enqueue_buffer(mWin, buf);
+	CameraTrace::end();
 				
 	// Post the filled buffer!
-	grbuffer_mapper.unlock(*buf);
+	CameraTrace::begin("gralloc unlock");
+	GraphicBufferMapper::get().unlock(*buf);
+	CameraTrace::end();
 }
 
 int CameraHardware::beginAutoFocusThread(void *cookie)
@@ -1655,8 +2942,8 @@ int CameraHardware::pictureThread()
     {
         Mutex::Autolock lock(mLock);
 
-        int w, h;
-        mParameters.getPictureSize(&w, &h);
+        int w = mConfig.pictureWidth;
+		int h = mConfig.pictureHeight;
 		LOGD("CameraHardware::pictureThread: taking picture of %dx%d", w, h);
 
 		/* Make sure to remember if the shutter must be enabled or not */
@@ -1664,15 +2951,38 @@ int CameraHardware::pictureThread()
 			shutter = true;
 		}
 		
-		/* The camera application will restart preview ... */
-        if (mPreviewThread != 0) {
-            stopPreviewLocked();
+		/* If the preview exposure had settled, the picture can reuse it */
+		bool previewRunning = mPreviewThread != 0;
+		bool previewSettled = false;
+		int previewLuma = 0;
+		if (previewRunning) {
+			Mutex::Autolock sceneLock(mSceneLock);
+			previewSettled = mPreviewLumaStableFor >= LUMA_STABLE_FRAMES;
+			previewLuma = mSceneStats.mean;
+		}
+		
+		/* The camera application will restart preview ... Keep the device
+		   streaming, in case the picture can be taken in the same mode */
+        if (previewRunning) {
+            stopPreviewThreadLocked();
         }
+		
+		CameraTrace::refresh();
+		CameraTrace::begin("pictureCapture");
 
 		LOGD("CameraHardware::pictureThread: taking picture (%d x %d)", w, h);
 
-		if (camera.Open(videodevice) == NO_ERROR) {
-			camera.Init(w, h, 1);
+		/* Reuse the already open device if possible */
+		waitForEnumerationLocked();
+		if (camera.isOpen() || camera.Open(mVideoDevice) == NO_ERROR) {
+		
+			/* Only renegotiate the format if the current one is not suitable */
+			uint32_t streamStarts = camera.getStreamStarts();
+			camera.Configure(w, h, 1, false);
+			
+			/* If the preview stream was kept, the device never stopped 
+			   adjusting to the scene */
+			bool streamKept = previewRunning && camera.getStreamStarts() == streamStarts;
 			
 			/* Retrieve the real size being used */
 			camera.getSize(w,h);
@@ -1681,34 +2991,36 @@ int CameraHardware::pictureThread()
 
 			/* Store it as the picture size to use */
 			mParameters.setPictureSize(w, h);
+			mConfig.pictureWidth = w;
+			mConfig.pictureHeight = h;
 
 			/* And reinit the capture heap to reflect the real used size if needed */
 			initHeapLocked();
 
+			/* Keep the recording of the preview: don't overwrite it */
+			camera.setRawDumpFile(NULL);
 			camera.StartStreaming();
 			
 			LOGD("CameraHardware::pictureThread: waiting until camera picture stabilizes...");
+			CameraTrace::begin("pictureSettle");
 	
 			int maxFramesToWait = 8;
 			int luminanceStableFor = 0;
 			int prevLuminance = 0;
-			int prevDif = -1;
-			int stride = w << 1;
-			int thresh = (w >> 4) * (h >> 4) * 12; // 5% of full range
+			int thresh = LUMA_STABLE_THRESH;
 	
-			while (maxFramesToWait > 0 && luminanceStableFor < 4) {
+			while (maxFramesToWait > 0 && luminanceStableFor < LUMA_STABLE_FRAMES) {
 				uint8_t* ptr = (uint8_t *)mRawBuffer;
 				
-				// Get the image
-				camera.GrabRawFrame(ptr, (w * h << 1)); // Always YUYV
-			
-				// luminance metering points
-				int luminance = 0;
-				for (int x = 0; x < (w<<1); x += 32) {
-					for (int y = 0; y < h*stride; y += 16*stride) {
-						luminance += ptr[y + x];
-					}
+				// Get the image, metered while it is converted. A failed
+				//  grab tells nothing about the exposure
+				struct yuyv_luma_stats stats;
+				if (!camera.GrabRawFrame(ptr, (w * h << 1), &stats)) { // Always YUYV
+					maxFramesToWait--;
+					continue;
 				}
+				setSceneStats(stats, false);
+				int luminance = stats.mean;
 			  
 				// Calculate variation of luminance
 				int dif = prevLuminance - luminance;
@@ -1725,8 +3037,22 @@ int CameraHardware::pictureThread()
 				maxFramesToWait--;
 	    
 				LOGD("luminance: %4d, dif: %4d, thresh: %d, stableFor: %d, maxWait: %d", luminance, dif, thresh, luminanceStableFor, maxFramesToWait);
+				
+				// The exposure already converged during the preview. If the 
+				//  stream was kept, the frame is good as is. Otherwise, the
+				//  stream has settled once it is as bright as the preview was
+				if (previewSettled) {
+					int pdif = luminance - previewLuma;
+					if (pdif < 0) pdif = -pdif;
+					if (streamKept || pdif <= thresh) {
+						LOGD("CameraHardware::pictureThread: matches the preview exposure (luminance: %d, preview: %d, stream kept: %d)",
+							 luminance, previewLuma, streamKept);
+						break;
+					}
+				}
 			}
 	
+			CameraTrace::end();
 			LOGD("CameraHardware::pictureThread: picture taken"); 			
 			
 			if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) {
@@ -1737,13 +3063,29 @@ int CameraHardware::pictureThread()
 			
 	        if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
 			
-				int quality = mParameters.getInt(CameraParameters::KEY_JPEG_QUALITY);
+				int quality = mConfig.jpegQuality;
 
 				uint8_t* jpegBuff = (uint8_t*) malloc(mJpegPictureBufferSize);
 				if (jpegBuff) {
 					
 					// Compress the raw captured image to our buffer
-					int fileSize = yuyv_to_jpeg((uint8_t *)mRawBuffer, jpegBuff, mJpegPictureBufferSize, w, h, w << 1,quality);
+					// The requested rotation is applied after the mounting correction
+					int transform = (mMountTransform & YUYV_MIRROR) | 
+									((mMountTransform + rotationToTransform(mConfig.jpegRotation)) & YUYV_ROTATE_MASK);
+					
+					// Compress the zoomed area, resampled back to the picture size
+					struct yuyv_fanout_dst area;
+					memset(&area, 0, sizeof(area));
+					area.width = w;
+					area.height = h;
+					{
+						Mutex::Autolock zoomLock(mZoomLock);
+						applyZoom(&area, w, h, mZoom);
+					}
+					uint8_t* src = (uint8_t *)mRawBuffer + area.srcY * (w << 1) + (area.srcX << 1);
+					CameraTrace::begin("yuyv_to_jpeg");
+					int fileSize = yuyv_to_jpeg(src, jpegBuff, mJpegPictureBufferSize, area.width, area.height, w << 1, w, h, quality,transform,mConfig.effect);
+					CameraTrace::end();
 					
 					// Create a buffer with the exact compressed size
 					if (mJpegPictureHeap) {
@@ -1768,30 +3110,37 @@ int CameraHardware::pictureThread()
 				
 			}
 			
-			camera.Uninit();
+			/* Keep the device open and configured for the next capture */
 			camera.StopStreaming();
-			camera.Close();
 		
 		} else {
 			LOGE("CameraHardware::pictureThread: failed to grab image");
 		}
+		
+		CameraTrace::end();
     }
 	
 	/* All this callbacks can potentially call one of our methods. 
 	   Make sure to dispatch them OUTSIDE the lock! */
 	if (shutter) {
 		LOGD("Sending the Shutter message");
+		CameraTrace::begin("shutterCallback");
 		mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
+		CameraTrace::end();
 	}
 
     if (raw) {
 		LOGD("Sending the raw message");
+		CameraTrace::begin("rawPictureCallback");
         mDataCb(CAMERA_MSG_RAW_IMAGE, mRawPictureHeap, 0, NULL, mCallbackCookie);
+		CameraTrace::end();
     }
 
     if (jpeg) {
 		LOGD("Sending the jpeg message");
+		CameraTrace::begin("jpegPictureCallback");
         mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mJpegPictureHeap, 0, NULL, mCallbackCookie);
+		CameraTrace::end();
     }
 
     LOGD("CameraHardware::pictureThread OK");
@@ -23,9 +23,34 @@
 #include <utils/threads.h>
 #include <utils/threads.h>
 #include "V4L2Camera.h"
+#include "CameraConfig.h"
+#include "CameraStats.h"
+#include "CameraMotion.h"
+#include "Converter.h"
 
 namespace android {
 
+/* Type tag of the metadata recording buffers. The stagefright encoders
+   expect a buffer_handle_t after kMetadataBufferTypeCameraSource (0), so
+   a private value is used: an encoder not knowing this layout rejects 
+   the buffers instead of misreading them */
+#define RECORDING_METADATA_TYPE_POOL	0x4c4f4f50	// 'POOL'
+
+/* Layout of each recording buffer delivered to the encoder when it asks
+ * to store metadata in buffers. Instead of a copy of the frame, it
+ * describes where the frame lives in the recording pool. The pool is
+ * allocated in the mediaserver process, where the encoder runs, and each
+ * frame stays untouched until the encoder releases its buffer.
+ * Only offered when ro.camera.record_metadata is set, as the stock 
+ * encoders don't know this layout */
+struct RecordingMetadata {
+	uint32_t	type;		// RECORDING_METADATA_TYPE_POOL
+	uint32_t	index;		// Index of the frame in the pool
+	uint32_t	offset;		// Offset of the frame in the pool
+	uint32_t	size;		// Size of the frame in bytes
+	void*		data;		// Address of the frame
+};
+
 class CameraHardware : public camera_device {
 
 public:
@@ -173,6 +198,7 @@ private:
 
 	bool PowerOn();
 	bool PowerOff();
+	bool waitForPowerOn();
 	bool NegotiatePreviewFormat(struct preview_stream_ops* win);
 
 public:
@@ -206,20 +232,106 @@ public:
      */
     status_t closeCamera();
 
+    /* Returns true between connectCamera and closeCamera, while the camera
+     * service holds this device and the object must not be destroyed.
+     */
+    bool isOpened() const;
+	
+	/* Returns true if the camera was powered off after being idle, so its
+	 * device node is gone until the next client connects.
+	 */
+	bool isIdlePoweredOff();
+	
+	/* Returns true if the board powers its internal cameras on demand, and
+	 * they are currently powered off, so they can't be found in sysfs.
+	 */
+	static bool isBoardCameraPoweredOff();
+
     /* Gets camera information.
      * This method is called in response to camera_module_t::get_camera_info
-     * callback.
-     * NOTE: When this method is called the object is locked.
+     * callback. The facing comes from the ro.camera.<node>.facing property
+     * ("back" or "front") of the given device, or defaultFacing if unset.
      * Note that failures in this method are reported as negave EXXX statuses.
      */
-    static status_t getCameraInfo(int camera_id, struct camera_info* info);
+    static status_t getCameraInfo(const char* videoDevice, int defaultFacing,
+                                  struct camera_info* info);
 	
 private:
 
     static const int kBufferCount = 4;
+	
+	// Raw frames exchanged between the capture and the window stages: one
+	//  being captured, one waiting to be rendered and one being rendered
+    static const int kWindowSlotCount = 3;
+	
+	// Limits of the configurable depth of the recording buffer pool
+    static const int kMinRecBufferCount = 2;
+    static const int kMaxRecBufferCount = 16;
+	
+	// What to do when the encoder falls behind
+	enum {
+		RECORD_DROP_WHEN_FULL,		// Drop frames only if all buffers are owned
+		RECORD_DROP_ADAPTIVE		// Also drop every other frame when a single
+									//  buffer is left, to let the encoder recover
+	};
+	
+	// Per recording session counters, protected by mRecBufLock
+	struct RecordingStats {
+		uint32_t			delivered;		// Frames sent to the encoder
+		uint32_t			released;		// Frames returned by the encoder
+		uint32_t			dropped;		// Frames dropped as encoder held the buffers
+		uint32_t			droppedAdaptive;// Frames dropped by the adaptive policy
+		int					maxInFlight;	// Max frames owned at once by the encoder
+	};
+
+	/* Per-frame configuration used by the preview thread. It is published
+	 * as a whole by the control calls, and read by the preview thread 
+	 * without taking mLock, so control calls never stall frame delivery.
+	 * Buffers are only reallocated while the preview thread is stopped */
+	struct PreviewConfig {
+		int32_t				msgEnabled;
+		bool				recordingEnabled;
+		int					frameRate;
+		int					effect;
+		
+		void*				rawBuffer;
+		int					rawFrameSize;
+		int					rawWidth;
+		int					rawHeight;
+		
+		camera_memory_t*	previewHeap;
+		void*				previewBuffer[kBufferCount];
+		int					previewFrameSize;
+		int					previewFmt;
+		int					previewWidth;
+		int					previewHeight;
+		
+		camera_memory_t*	recordingHeap;
+		void*				recBuffers[kMaxRecBufferCount];
+		int					recBufferCount;
+		int					recordingFrameSize;
+		int					recFmt;
+		
+		bool				storeMetaData;
+		camera_memory_t*	recordingMetaHeap;
+	};
+	
+	void publishPreviewConfigLocked();
+	int32_t readPreviewConfig(PreviewConfig& cfg) const;
+	
+	int  acquireRecordingBuffer();
+	void resetRecordingBuffers();
+	void logRecordingStats();
 
     void initDefaultParameters();
-    void initHeapLocked();
+	void getParametersSnapshotPath(String8& path) const;
+	bool loadParametersSnapshot(CameraParameters& p) const;
+	void saveParametersSnapshot(const CameraParameters& p) const;
+	void waitForParametersLocked();
+	void waitForEnumerationLocked();
+	void resetClientStateLocked();
+	status_t setParametersLocked(const CameraParameters& params);
+    void initHeapLocked(bool consumerSwitch = false, uint32_t changed = CameraConfig::CHANGED_ALL);
 
 	class PreviewThread : public Thread {
 		CameraHardware* mHardware;
@@ -230,10 +342,51 @@ private:
 		virtual bool threadLoop();
 	};
 
-    status_t startPreviewLocked();
+	class WindowThread : public Thread {
+		CameraHardware* mHardware;
+		
+	public:
+		WindowThread(CameraHardware* hw);
+		virtual void onFirstRef();
+		virtual bool threadLoop();
+	};
+
+	class PowerOnThread : public Thread {
+		CameraHardware* mHardware;
+		
+	public:
+		PowerOnThread(CameraHardware* hw);
+		virtual void onFirstRef();
+		virtual bool threadLoop();
+	};
+
+	class PowerOffThread : public Thread {
+		CameraHardware* mHardware;
+		
+	public:
+		PowerOffThread(CameraHardware* hw);
+		virtual void onFirstRef();
+		virtual bool threadLoop();
+	};
+
+    void powerOnThread();
+    void powerOffThread();
+
+    status_t startPreviewLocked(bool allowScale = false);
     void 	 stopPreviewLocked();
+    void 	 stopPreviewThreadLocked();
 	
     int previewThread();
+    int windowThread();
+	
+	int  acquireWindowSlot();
+	void postWindowFrame(int slot, int zoom);
+	int  stepZoom(bool& notify, bool& stopped);
+	void setSceneStats(const struct yuyv_luma_stats& stats, bool preview);
+	bool isStaticFrame(const struct yuyv_luma_stats& stats, int32_t cfgSeq, int zoom, bool recording);
+	void notifyMotion(const CameraMotion::Region* regions, int count);
+	void startWindowThreadLocked();
+	void stopWindowThreadLocked();
 
     static int beginAutoFocusThread(void *cookie);
     int autoFocusThread();
@@ -241,16 +394,26 @@ private:
     static int beginPictureThread(void *cookie);
     int pictureThread();
 
-    void fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeight);
+    static int rotationToTransform(int degrees);
+    bool dequeuePreviewWindowBuffer(buffer_handle_t** pbuf, struct yuyv_fanout_dst* d, int srcWidth, int srcHeight);
+    void enqueuePreviewWindowBuffer(buffer_handle_t* buf);
 
     mutable Mutex       mLock;
 
+	// Protects the preview window, that is used by the preview thread
+	Mutex				mWinLock;
     preview_stream_ops*	mWin;
 	int					mPreviewWinFmt;
 	int					mPreviewWinWidth;
 	int					mPreviewWinHeight;
 
     CameraParameters    mParameters;
+	CameraParameters	mDefaultParameters;		// Restored when the client closes the camera
+	CameraConfig		mConfig;				// Decoded mParameters
+	
+	char				mVideoDevice[64];		// V4L2 device node of this camera
+	int					mMountTransform;		// Correction of the sensor mounting
+	volatile int32_t	mOpened;				// Connected to the camera service
 
 
     camera_memory_t*  	mRawPreviewHeap;
@@ -269,10 +432,25 @@ private:
 	int					mRawPictureBufferSize;
     
 	camera_memory_t*  	mRecordingHeap;
-    void*		        mRecBuffers[kBufferCount];
+    void*		        mRecBuffers[kMaxRecBufferCount];
+	int					mRecBufferCount;		// Depth of the recording pool
+	int					mRecDropPolicy;
 	int                 mRecordingFrameSize;
 	int					mRecFmt;
 	
+	// Metadata mode: The encoder gets descriptors of the recording frames
+	bool				mStoreMetaData;
+	bool				mMetaDataAllowed;		// The encoder knows RecordingMetadata
+	camera_memory_t*  	mRecordingMetaHeap;
+	
+	// Recording buffers currently owned by the encoder, protected by
+	//  mRecBufLock. A frame is never overwritten until released
+	Mutex				mRecBufLock;
+	bool				mRecBufferBusy[kMaxRecBufferCount];
+	int					mRecInFlight;
+	bool				mRecDroppedLast;
+	RecordingStats		mRecStats;
+	
     camera_memory_t*  	mJpegPictureHeap;
 	int					mJpegPictureBufferSize;
 
@@ -281,6 +459,38 @@ private:
     
     // protected by mLock
     sp<PreviewThread>   mPreviewThread;
+    sp<WindowThread>    mWindowThread;
+	
+	// Mailbox of raw frames to render in the preview window. Only the
+	//  latest frame is kept: If the window stage is still busy when a new 
+	//  frame arrives, the pending one is dropped. Protected by mMailboxLock
+	Mutex				mMailboxLock;
+	Condition			mMailboxCond;
+	int					mMailboxPending;		// Slot waiting to be rendered, or -1
+	int					mMailboxRendering;		// Slot being rendered, or -1
+	int					mMailboxZoom[kWindowSlotCount];	// Zoom of the frame of each slot
+	uint32_t			mWinFramesRendered;
+	uint32_t			mWinFramesDropped;
+	
+	// Latencies of the stages of the frame pipeline, reported by dump
+	CameraStats			mStats;
+	
+	// Luma stats of the last captured frame, gathered while converting
+	//  it. Protected by mSceneLock
+	Mutex				mSceneLock;
+	struct yuyv_luma_stats mSceneStats;
+	int					mPreviewLumaStableFor;	// Preview frames the mean luma was stable for
+	
+	// Static scene detection, only used by the preview thread. A frame 
+	//  whose small blocks are all within mStaticThresh luma levels of the
+	//  last converted frame reuses its outputs instead of being converted
+	int					mStaticThresh;			// 0 if disabled
+	struct yuyv_luma_stats mStaticRef;			// Stats of the last converted frame
+	bool				mStaticRefValid;
+	int32_t				mStaticRefSeq;			// Preview config it was converted with
+	int					mStaticRefZoom;			// And its zoom
+	int					mStaticRun;				// Frames reused since then
+	int					mLastPreviewBufferIdx;	// Preview buffer of the last converted frame
 
     camera_notify_callback    	mNotifyCb;
     camera_data_callback      	mDataCb;
@@ -294,6 +504,47 @@ private:
     int                 mCurrentPreviewFrame;
     int                 mCurrentRecordingFrame;
 	
+	// Snapshot of the configuration used by the preview thread
+	PreviewConfig		mPreviewConfig;
+	volatile int32_t	mPreviewConfigSeq;
+
+	enum {
+		POWER_PENDING,
+		POWER_ON,
+		POWER_FAILED,
+		POWER_OFF			// Powered off while no client was connected
+	};
+	
+	// Asynchronous power on and idle power off state, protected by mPowerLock
+	Mutex				mPowerLock;
+	Condition			mPowerCond;
+	int					mPowerState;
+	sp<PowerOnThread>	mPowerOnThread;
+	sp<PowerOffThread>	mPowerOffThread;
+	bool				mPowerOffPending;		// Until a client connects again
+	int					mPowerOffDelayMs;		// Idle time before powering off, -1 never
+	bool				mPowerRef;				// Counted in sPowerRefs, protected by sPowerLock
+	
+	// Current digital zoom, and smooth zoom progress. Protected by mZoomLock, 
+	//  as the preview thread updates it while zooming smoothly
+	Mutex				mZoomLock;
+	int					mZoom;
+	int					mZoomTarget;
+	bool				mSmoothZoom;
+	
+	// Motion detection on the luma stats of the preview frames. Protected
+	//  by mMotionLock, as it is started and stopped by commands
+	Mutex				mMotionLock;
+	CameraMotion		mMotion;
+	
+	// Default parameters initialization, protected by mLock. While
+	//  mEnumerating, the device belongs to initDefaultParameters
+	bool				mAsyncInit;
+	bool				mParamsReady;
+	bool				mParamsChanged;
+	bool				mEnumerating;
+	Condition			mParamsCond;
+	
     /****************************************************************************
      * Camera API callbacks as defined by camera_device_ops structure.
      * See hardware/libhardware/include/hardware/camera.h for information on
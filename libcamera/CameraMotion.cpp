@@ -0,0 +1,247 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+
+#define LOG_TAG "CameraMotion"
+#include <utils/Log.h>
+
+extern "C" {
+#include <stdio.h>
+#include <string.h>
+};
+
+#include "CameraMotion.h"
+
+// Defaults of the start command
+#define MOTION_DEFAULT_THRESH	16
+#define MOTION_DEFAULT_RATE		2
+
+// Adaptation speed of the background, as a shift: Still blocks follow the
+//  scene in about 8 frames, moving ones in about 64, so an object that
+//  stops becomes part of the background after a few seconds
+#define MOTION_ADAPT_STILL		3
+#define MOTION_ADAPT_MOVING		6
+
+// Luma change that scores 100
+#define MOTION_FULL_SCORE		64
+
+namespace android {
+
+CameraMotion::CameraMotion()
+{
+	mActive = false;
+	mThresh = MOTION_DEFAULT_THRESH;
+	mInterval = 1000000000LL / MOTION_DEFAULT_RATE;
+	reset();
+}
+
+void CameraMotion::start(int thresh, int rate)
+{
+	if (thresh <= 0)
+		thresh = MOTION_DEFAULT_THRESH;
+	if (thresh > 255)
+		thresh = 255;
+	if (rate <= 0)
+		rate = MOTION_DEFAULT_RATE;
+	if (rate > 30)
+		rate = 30;
+		
+	LOGD("Motion detection started: threshold %d, %d reports per second", thresh, rate);
+	mThresh = thresh;
+	mInterval = 1000000000LL / rate;
+	if (!mActive) {
+		mActive = true;
+		reset();
+	}
+}
+
+void CameraMotion::stop()
+{
+	LOGD("Motion detection stopped");
+	mActive = false;
+}
+
+void CameraMotion::reset()
+{
+	mLastReport = 0;
+	mMoving = false;
+	mHaveBackground = false;
+	mWidth = 0;
+	mHeight = 0;
+	mFrames = 0;
+	mMotionFrames = 0;
+	mReports = 0;
+	mLastScore = 0;
+}
+
+bool CameraMotion::update(const struct yuyv_luma_stats& stats, nsecs_t now, Region* regions, int& count)
+{
+	count = 0;
+	if (!mActive || stats.samples == 0)
+		return false;
+		
+	int i;
+	
+	// The first frame, or the first one of a new size, is the background
+	if (!mHaveBackground || stats.width != mWidth || stats.height != mHeight) {
+		for (i = 0; i < YUYV_STATS_BLOCKS; i++)
+			mBackground[i] = stats.blocks[i] << 4;
+		mHaveBackground = true;
+		mWidth = stats.width;
+		mHeight = stats.height;
+		return false;
+	}
+	mFrames++;
+	
+	// Change of brightness of the whole scene, to discount it
+	int shift = 0;
+	for (i = 0; i < YUYV_STATS_BLOCKS; i++)
+		shift += (stats.blocks[i] << 4) - mBackground[i];
+	shift /= YUYV_STATS_BLOCKS;
+	
+	uint8_t moving[YUYV_STATS_BLOCKS];
+	uint8_t diff[YUYV_STATS_BLOCKS];
+	for (i = 0; i < YUYV_STATS_BLOCKS; i++) {
+		int cur = stats.blocks[i] << 4;
+		int d = (cur - mBackground[i] - shift) / 16;
+		if (d < 0) d = -d;
+		diff[i] = (d > 255) ? 255 : d;
+		moving[i] = d > mThresh;
+		
+		mBackground[i] += (cur - mBackground[i]) / (1 << (moving[i] ? MOTION_ADAPT_MOVING : MOTION_ADAPT_STILL));
+	}
+	
+	Region found[CAMERA_MOTION_MAX_REGIONS];
+	int n = findRegions(moving, diff, found);
+	mLastScore = n ? found[0].score : 0;
+	if (n)
+		mMotionFrames++;
+		
+	// Report at a low rate, and once more when the motion stops
+	if ((n == 0 && !mMoving) || now - mLastReport < mInterval)
+		return false;
+		
+	memcpy(regions, found, n * sizeof(Region));
+	count = n;
+	mMoving = n > 0;
+	mLastReport = now;
+	mReports++;
+	return true;
+}
+
+/* Label the connected areas of moving blocks, keeping the largest ones,
+   sorted by size. Returns how many were kept */
+int CameraMotion::findRegions(const uint8_t* moving, const uint8_t* diff, Region* regions)
+{
+	uint8_t seen[YUYV_STATS_BLOCKS];
+	uint16_t stack[YUYV_STATS_BLOCKS];
+	int n = 0;
+	
+	memset(seen, 0, sizeof(seen));
+	for (int start = 0; start < YUYV_STATS_BLOCKS; start++) {
+		if (!moving[start] || seen[start])
+			continue;
+			
+		// Flood fill the area, tracking its bounds
+		int x0 = YUYV_STATS_BLOCKS_X, y0 = YUYV_STATS_BLOCKS_Y, x1 = 0, y1 = 0;
+		int blocks = 0;
+		int sum = 0;
+		int sp = 0;
+		stack[sp++] = start;
+		seen[start] = 1;
+		while (sp > 0) {
+			int i = stack[--sp];
+			int x = i % YUYV_STATS_BLOCKS_X;
+			int y = i / YUYV_STATS_BLOCKS_X;
+			if (x < x0) x0 = x;
+			if (x > x1) x1 = x;
+			if (y < y0) y0 = y;
+			if (y > y1) y1 = y;
+			blocks++;
+			sum += diff[i];
+			
+			int next[4] = { 
+				x > 0 ? i - 1 : -1,
+				x < YUYV_STATS_BLOCKS_X - 1 ? i + 1 : -1,
+				y > 0 ? i - YUYV_STATS_BLOCKS_X : -1,
+				y < YUYV_STATS_BLOCKS_Y - 1 ? i + YUYV_STATS_BLOCKS_X : -1
+			};
+			for (int k = 0; k < 4; k++) {
+				int j = next[k];
+				if (j >= 0 && moving[j] && !seen[j]) {
+					seen[j] = 1;
+					stack[sp++] = j;
+				}
+			}
+		}
+		
+		Region r;
+		r.left   = x0 * 256 / YUYV_STATS_BLOCKS_X;
+		r.top    = y0 * 256 / YUYV_STATS_BLOCKS_Y;
+		r.right  = (x1 + 1) * 256 / YUYV_STATS_BLOCKS_X - 1;
+		r.bottom = (y1 + 1) * 256 / YUYV_STATS_BLOCKS_Y - 1;
+		r.score  = sum * 100 / (blocks * MOTION_FULL_SCORE);
+		if (r.score < 1) r.score = 1;
+		if (r.score > 100) r.score = 100;
+		r.blocks = blocks;
+		
+		// Insert it by size, dropping the smallest one if full
+		int pos = n;
+		while (pos > 0 && regions[pos - 1].blocks < blocks)
+			pos--;
+		if (pos >= CAMERA_MOTION_MAX_REGIONS)
+			continue;
+		int last = (n < CAMERA_MOTION_MAX_REGIONS) ? n : CAMERA_MOTION_MAX_REGIONS - 1;
+		for (int k = last; k > pos; k--)
+			regions[k] = regions[k - 1];
+		regions[pos] = r;
+		if (n < CAMERA_MOTION_MAX_REGIONS)
+			n++;
+	}
+	return n;
+}
+
+void CameraMotion::pack(const Region* r, int index, int count, int32_t& ext1, int32_t& ext2)
+{
+	if (r == NULL || count == 0) {
+		ext1 = 0;
+		ext2 = 0;
+		return;
+	}
+	ext1 = r->score | (index << 8) | (count << 16);
+	ext2 = (int32_t)((uint32_t)r->left | ((uint32_t)r->top << 8) | 
+					 ((uint32_t)r->right << 16) | ((uint32_t)r->bottom << 24));
+}
+
+void CameraMotion::dump(String8& out) const
+{
+	if (!mActive) {
+		out.append("  Motion detection: off\n");
+		return;
+	}
+	out.appendFormat("  Motion detection: threshold %d, report every %lld ms\n",
+		mThresh, (long long)(mInterval / 1000000));
+	out.appendFormat("    %u frames, %u with motion, %u reports, last score %d\n",
+		mFrames, mMotionFrames, mReports, mLastScore);
+}
+
+}; // namespace android
@@ -0,0 +1,113 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef __CAMERAMOTION_H
+#define __CAMERAMOTION_H
+
+#include <stdint.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include "Converter.h"
+
+// Commands of the motion detector, out of the range used by the framework
+//  START: arg1 is the luma change of a moving block (0 for the default),
+//         arg2 the maximum reports per second (0 for the default)
+#define CAMERA_CMD_START_MOTION_DETECTION	0x4D00
+#define CAMERA_CMD_STOP_MOTION_DETECTION	0x4D01
+
+// Notification of the motion detector, out of CAMERA_MSG_ALL_MSGS so it is
+//  only sent when requested by CAMERA_CMD_START_MOTION_DETECTION. Each 
+//  report is a notification per moving region, or a single one with a
+//  region count of 0 when the motion stops:
+//   ext1: score (1-100) | index << 8 | region count << 16
+//   ext2: left | top << 8 | right << 16 | bottom << 24, inclusive and in 
+//         1/256 of the frame size
+#define CAMERA_MSG_MOTION					0x10000
+
+// Regions reported at most per report, the largest ones
+#define CAMERA_MOTION_MAX_REGIONS			4
+
+namespace android {
+
+/* Motion detector working on the small block means of the luma stats,
+ * that the converters gather while they write each frame. It never 
+ * touches the frame itself.
+ *
+ * A slowly adapting background of the block means is kept, and the 
+ * connected areas of blocks that moved away from it are reported. A 
+ * change of brightness of the whole scene is not motion. 
+ *
+ * It is not thread safe: The caller must serialize the calls.
+ */
+class CameraMotion {
+public:
+	struct Region {
+		int left;			// In 1/256 of the frame size, inclusive
+		int top;
+		int right;
+		int bottom;
+		int score;			// 1 to 100
+		int blocks;			// Number of moving blocks
+	};
+
+	CameraMotion();
+
+	/* Starts detecting motion. See CAMERA_CMD_START_MOTION_DETECTION */
+	void start(int thresh, int rate);
+	void stop();
+	bool isActive() const { return mActive; }
+
+	/* Forgets the background, as the scene could have changed */
+	void reset();
+
+	/* Accounts the stats of a frame. Returns true if a report is due, and
+	   fills the regions to report (count can be 0 if the motion stopped) */
+	bool update(const struct yuyv_luma_stats& stats, nsecs_t now, Region* regions, int& count);
+
+	/* Packs a region of a report into the arguments of its notification */
+	static void pack(const Region* r, int index, int count, int32_t& ext1, int32_t& ext2);
+
+	void dump(String8& out) const;
+
+private:
+	int findRegions(const uint8_t* moving, const uint8_t* diff, Region* regions);
+
+	bool mActive;
+	int mThresh;				// Luma change of a moving block
+	nsecs_t mInterval;			// Minimum time between reports
+	nsecs_t mLastReport;
+	bool mMoving;				// If the last report had motion
+
+	bool mHaveBackground;
+	int mWidth;					// Size of the frames of the background
+	int mHeight;
+	uint16_t mBackground[YUYV_STATS_BLOCKS];	// In 1/16 luma levels
+
+	uint32_t mFrames;			// Frames accounted
+	uint32_t mMotionFrames;		// Frames with motion
+	uint32_t mReports;
+	int mLastScore;				// Score of the largest region of the last frame
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,239 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#define LOG_TAG "CameraStats"
+#include <utils/Log.h>
+
+extern "C" {
+#include <stdio.h>
+#include <string.h>
+};
+
+#include "CameraStats.h"
+
+// Length of the window used to measure the achieved frame rate
+#define RATE_WINDOW_NS		1000000000LL
+
+namespace android {
+
+static const char* const kStageNames[CameraStats::STAGE_COUNT] = {
+	"dqbuf wait",
+	"scale",
+	"fanout",
+	"preview cb",
+	"video cb",
+	"frame",
+	"win lock",
+	"win dequeue",
+	"win convert",
+	"win enqueue"
+};
+
+void LatencyHistogram::reset()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+void LatencyHistogram::add(nsecs_t ns)
+{
+	if (ns < 0)
+		ns = 0;
+
+	// Find the bucket: the position of the highest bit of the microseconds
+	uint32_t us = (ns > 0xFFFFFFFFLL * 1000) ? 0xFFFFFFFF : (uint32_t)(ns / 1000);
+	int b = 0;
+	while (us && b < CAMERA_STATS_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+	bucket[b]++;
+
+	if (count == 0 || ns < min)
+		min = ns;
+	if (ns > max)
+		max = ns;
+	total += ns;
+	count++;
+}
+
+/* Upper bound of the bucket holding the given percentile */
+nsecs_t LatencyHistogram::percentile(int pct) const
+{
+	if (count == 0)
+		return 0;
+
+	uint32_t target = (uint32_t)(((uint64_t)count * pct + 99) / 100);
+	uint32_t seen = 0;
+	for (int b = 0; b < CAMERA_STATS_BUCKETS - 1; b++) {
+		seen += bucket[b];
+		if (seen >= target) {
+			nsecs_t upper = (1LL << b) * 1000;
+			return (upper < max) ? upper : max;
+		}
+	}
+	return max;
+}
+
+void LatencyHistogram::dump(String8& out, const char* name) const
+{
+	if (count == 0)
+		return;
+
+	out.appendFormat("    %-16s n=%-7u avg=%-7lld min=%-7lld max=%-7lld p50<=%-7lld p90<=%-7lld p99<=%lld us\n",
+		name, count,
+		(long long)(total / count / 1000), (long long)(min / 1000), (long long)(max / 1000),
+		(long long)(percentile(50) / 1000), (long long)(percentile(90) / 1000),
+		(long long)(percentile(99) / 1000));
+
+	// And the non empty buckets, by their upper bound
+	out.append("      ");
+	for (int b = 0; b < CAMERA_STATS_BUCKETS; b++) {
+		if (bucket[b] == 0)
+			continue;
+		if (b == CAMERA_STATS_BUCKETS - 1)
+			out.appendFormat(" >%u:%u", 1U << (b - 1), bucket[b]);
+		else
+			out.appendFormat(" <%u:%u", 1U << b, bucket[b]);
+	}
+	out.append("\n");
+}
+
+CameraStats::CameraStats()
+{
+	reset();
+}
+
+void CameraStats::reset()
+{
+	Mutex::Autolock lock(mLock);
+	for (int i = 0; i < STAGE_COUNT; i++)
+		mStages[i].reset();
+	for (int i = 0; i < CAMERA_STATS_MAX_KERNELS; i++) {
+		mKernelFmt[i] = 0;
+		mKernels[i].reset();
+	}
+	mKernelCount = 0;
+	mFrames = 0;
+	mDropped = 0;
+	mStatic = 0;
+	mHaveSequence = false;
+	mLastSequence = 0;
+	mStartTime = 0;
+	mLastTime = 0;
+	mRateStart = 0;
+	mRateFrames = 0;
+	mRate = 0;
+}
+
+void CameraStats::addStage(int stage, nsecs_t ns)
+{
+	if (stage < 0 || stage >= STAGE_COUNT)
+		return;
+
+	Mutex::Autolock lock(mLock);
+	mStages[stage].add(ns);
+}
+
+void CameraStats::addConversion(uint32_t pixfmt, nsecs_t ns)
+{
+	Mutex::Autolock lock(mLock);
+	int i;
+	for (i = 0; i < mKernelCount; i++) {
+		if (mKernelFmt[i] == pixfmt)
+			break;
+	}
+	if (i == mKernelCount) {
+		// The format only changes when the capture is reconfigured, so
+		//  the table never fills up in practice. If it does, reuse the last slot
+		if (mKernelCount == CAMERA_STATS_MAX_KERNELS) {
+			i = CAMERA_STATS_MAX_KERNELS - 1;
+			mKernels[i].reset();
+		} else {
+			mKernelCount++;
+		}
+		mKernelFmt[i] = pixfmt;
+	}
+	mKernels[i].add(ns);
+}
+
+void CameraStats::addFrame(uint32_t sequence)
+{
+	nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+	Mutex::Autolock lock(mLock);
+
+	// The sequence restarts when streaming is restarted: don't count it as drops
+	if (mHaveSequence && sequence > mLastSequence) {
+		mDropped += sequence - mLastSequence - 1;
+	}
+	mHaveSequence = true;
+	mLastSequence = sequence;
+
+	if (mFrames == 0) {
+		mStartTime = now;
+		mRateStart = now;
+	}
+	mFrames++;
+	mLastTime = now;
+
+	mRateFrames++;
+	if (now - mRateStart >= RATE_WINDOW_NS) {
+		mRate = (int)((int64_t)mRateFrames * 100 * 1000000000LL / (now - mRateStart));
+		mRateStart = now;
+		mRateFrames = 0;
+	}
+}
+
+void CameraStats::addStaticFrame()
+{
+	Mutex::Autolock lock(mLock);
+	mStatic++;
+}
+
+void CameraStats::dump(String8& out) const
+{
+	Mutex::Autolock lock(mLock);
+
+	int avgRate = 0;
+	if (mFrames > 1 && mLastTime > mStartTime) {
+		avgRate = (int)((int64_t)(mFrames - 1) * 100 * 1000000000LL / (mLastTime - mStartTime));
+	}
+
+	out.appendFormat("  Frames: %u captured, %u dropped by the device, %u skipped as static\n", 
+		mFrames, mDropped, mStatic);
+	out.appendFormat("  Frame rate: %d.%02d fps (average %d.%02d fps)\n",
+		mRate / 100, mRate % 100, avgRate / 100, avgRate % 100);
+
+	out.append("  Latencies:\n");
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		mStages[i].dump(out, kStageNames[i]);
+	}
+	for (int i = 0; i < mKernelCount; i++) {
+		char name[32];
+		uint32_t f = mKernelFmt[i];
+		snprintf(name, sizeof(name), "convert %c%c%c%c",
+			f & 0xFF, (f >> 8) & 0xFF, (f >> 16) & 0xFF, (f >> 24) & 0xFF);
+		mKernels[i].dump(out, name);
+	}
+}
+
+}; // namespace android
@@ -0,0 +1,118 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef __CAMERASTATS_H
+#define __CAMERASTATS_H
+
+#include <stdint.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+// Latency buckets: bucket 0 holds samples under 1us, bucket n holds samples
+//  from 2^(n-1) up to 2^n us. The last one also holds all the longer ones
+#define CAMERA_STATS_BUCKETS		20
+
+// Distinct capture formats whose conversion is timed separately
+#define CAMERA_STATS_MAX_KERNELS	4
+
+namespace android {
+
+/* Histogram of the latency of a stage of the frame pipeline */
+struct LatencyHistogram {
+	uint32_t count;
+	nsecs_t total;
+	nsecs_t min;
+	nsecs_t max;
+	uint32_t bucket[CAMERA_STATS_BUCKETS];
+
+	void reset();
+	void add(nsecs_t ns);
+	nsecs_t percentile(int pct) const;
+	void dump(String8& out, const char* name) const;
+};
+
+/* Per-stage counters and latency histograms of the frame pipeline.
+ *
+ * Every stage adds a single sample per frame under an uncontended lock,
+ * so the instrumentation is always on. The stats are reset each time the
+ * preview is started, and are printed by dumpsys media.camera.
+ */
+class CameraStats {
+public:
+	enum Stage {
+		STAGE_DQBUF = 0,		// Waiting for the device to fill a buffer
+		STAGE_SCALE,			// Software crop/scale of the captured frame
+		STAGE_FANOUT,			// Conversion to the callback, recording and window buffers
+		STAGE_PREVIEW_CB,		// Preview frame callback
+		STAGE_VIDEO_CB,			// Video frame callback
+		STAGE_FRAME,			// Whole capture of a frame, excluding the frame pacing
+		STAGE_WIN_LOCK,			// Waiting for the preview window lock
+		STAGE_WIN_DEQUEUE,		// Dequeueing and locking a preview window buffer
+		STAGE_WIN_CONVERT,		// Conversion to the preview window buffer
+		STAGE_WIN_ENQUEUE,		// Unlocking and enqueueing it
+		STAGE_COUNT
+	};
+
+	CameraStats();
+
+	void reset();
+
+	/* Adds the time a stage took to process a frame */
+	void addStage(int stage, nsecs_t ns);
+
+	/* Adds the time it took to convert a frame captured as pixfmt to YUYV */
+	void addConversion(uint32_t pixfmt, nsecs_t ns);
+
+	/* Counts a frame dequeued from the device. Gaps in the sequence numbers
+	   are frames the device had to drop because no buffer was queued */
+	void addFrame(uint32_t sequence);
+
+	/* Counts a frame that was not converted nor displayed, as the scene
+	   did not change */
+	void addStaticFrame();
+
+	void dump(String8& out) const;
+
+private:
+	mutable Mutex mLock;
+
+	LatencyHistogram mStages[STAGE_COUNT];
+	uint32_t mKernelFmt[CAMERA_STATS_MAX_KERNELS];
+	LatencyHistogram mKernels[CAMERA_STATS_MAX_KERNELS];
+	int mKernelCount;
+
+	uint32_t mFrames;			// Frames dequeued
+	uint32_t mDropped;			// Frames dropped by the device
+	uint32_t mStatic;			// Frames skipped as static
+	bool mHaveSequence;
+	uint32_t mLastSequence;
+	nsecs_t mStartTime;			// Time of the first frame
+	nsecs_t mLastTime;			// Time of the last frame
+	nsecs_t mRateStart;			// Start of the current frame rate window
+	uint32_t mRateFrames;		// Frames in the current frame rate window
+	int mRate;					// Frame rate of the last complete window, in 1/100 fps
+};
+
+}; // namespace android
+
+#endif
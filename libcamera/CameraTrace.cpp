@@ -0,0 +1,95 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#define LOG_TAG "CameraTrace"
+#include <utils/Log.h>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+};
+
+#include <cutils/properties.h>
+#include <utils/threads.h>
+#include "CameraTrace.h"
+
+namespace android {
+
+volatile bool CameraTrace::sEnabled = false;
+int CameraTrace::sFd = -1;
+int CameraTrace::sPid = 0;
+
+static Mutex sTraceLock;
+
+void CameraTrace::refresh()
+{
+	Mutex::Autolock lock(sTraceLock);
+
+	char value[PROPERTY_VALUE_MAX];
+	property_get("debug.camera.trace", value, "0");
+	bool enable = atoi(value) != 0;
+
+	// The marker file is never closed once open, so threads still
+	//  writing markers never write to a reused descriptor
+	if (enable && sFd < 0) {
+		sFd = open(CAMERA_TRACE_MARKER, O_WRONLY);
+		if (sFd < 0) {
+			LOGE("Unable to open %s: %s", CAMERA_TRACE_MARKER, strerror(errno));
+			enable = false;
+		}
+		sPid = getpid();
+	}
+
+	if (enable != sEnabled) {
+		LOGD("Camera tracing %s", enable ? "enabled" : "disabled");
+	}
+	sEnabled = enable;
+}
+
+void CameraTrace::writeBegin(const char* name)
+{
+	char buf[128];
+	int len = snprintf(buf, sizeof(buf), "B|%d|%s", sPid, name);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	write(sFd, buf, len);
+}
+
+void CameraTrace::writeEnd()
+{
+	write(sFd, "E", 1);
+}
+
+void CameraTrace::writeCounter(const char* name, int32_t value)
+{
+	char buf[128];
+	int len = snprintf(buf, sizeof(buf), "C|%d|%s|%d", sPid, name, value);
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	write(sFd, buf, len);
+}
+
+}; // namespace android
@@ -0,0 +1,92 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef __CAMERATRACE_H
+#define __CAMERATRACE_H
+
+#include <stdint.h>
+
+// Where the trace markers are written to
+#define CAMERA_TRACE_MARKER		"/sys/kernel/debug/tracing/trace_marker"
+
+namespace android {
+
+/* Systrace markers of the frame path, written to the ftrace marker file.
+ *
+ * Tracing is enabled by setting the debug.camera.trace property to 1 and
+ * restarting the preview. While disabled, each marker costs a single test
+ * of a flag. Names must be static strings.
+ */
+class CameraTrace {
+public:
+	/* Rereads debug.camera.trace, and opens the marker file if needed */
+	static void refresh();
+
+	static inline bool isEnabled() { return sEnabled; }
+
+	/* Begins a section of the calling thread. Sections can be nested */
+	static inline void begin(const char* name) {
+		if (sEnabled)
+			writeBegin(name);
+	}
+
+	/* Ends the innermost section of the calling thread */
+	static inline void end() {
+		if (sEnabled)
+			writeEnd();
+	}
+
+	/* Sets the value of a counter track */
+	static inline void counter(const char* name, int32_t value) {
+		if (sEnabled)
+			writeCounter(name, value);
+	}
+
+private:
+	static void writeBegin(const char* name);
+	static void writeEnd();
+	static void writeCounter(const char* name, int32_t value);
+
+	static volatile bool sEnabled;
+	static int sFd;
+	static int sPid;
+};
+
+/* Traces the scope it is declared in */
+class CameraTraceScope {
+public:
+	CameraTraceScope(const char* name) : mActive(CameraTrace::isEnabled()) {
+		if (mActive)
+			CameraTrace::begin(name);
+	}
+	~CameraTraceScope() {
+		if (mActive)
+			CameraTrace::end();
+	}
+
+private:
+	bool mActive;
+};
+
+}; // namespace android
+
+#endif
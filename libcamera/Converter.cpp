@@ -43,10 +43,10 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <jpeglib.h>
 };
 #include "Converter.h"
-#include "V4L2Camera.h"
 
 /*clip value between 0 and 255*/
 #define CLIP(value) (uint8_t)(((value)>0xFF)?0xff:(((value)<0)?0:(value)))
@@ -215,6 +215,140 @@ void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 }
 
 
+/* Start gathering luma stats */
+void yuyv_stats_begin(struct yuyv_luma_stats* st, int width, int height)
+{
+	memset(st, 0, sizeof(*st));
+	st->width = width;
+	st->height = height;
+}
+
+/* Account some rows of the frame. Each block row is walked block by 
+   block, so no division is needed per sample. The blocks of the grid are
+   made of whole small blocks, as BLOCKS_X is a multiple of GRID */
+void yuyv_stats_rows(struct yuyv_luma_stats* st, const uint8_t *src, int srcStride, int y, int count)
+{
+	if (st->width < YUYV_STATS_GRID * 2 || st->height < YUYV_STATS_GRID)
+		return;
+		
+	const int perGrid = YUYV_STATS_BLOCKS_X / YUYV_STATS_GRID;
+	int r, bx;
+	for (r = 0; r < count; r++, y++, src += srcStride) {
+		if ((y & 1) || y >= st->height)
+			continue;
+			
+		int gy = (y * YUYV_STATS_GRID) / st->height;
+		int by = (y * YUYV_STATS_BLOCKS_Y) / st->height;
+		uint32_t* gsum = &st->gridSum[gy * YUYV_STATS_GRID];
+		uint32_t* gcnt = &st->gridCount[gy * YUYV_STATS_GRID];
+		uint32_t* bsum = &st->blockSum[by * YUYV_STATS_BLOCKS_X];
+		uint32_t* bcnt = &st->blockCount[by * YUYV_STATS_BLOCKS_X];
+		uint32_t rowSum = 0;
+		int x0 = 0;
+		
+		for (bx = 0; bx < YUYV_STATS_BLOCKS_X; bx++) {
+			int x1 = (((bx + 1) * st->width) / YUYV_STATS_BLOCKS_X) & (-2);
+			const uint8_t* p = src + (x0 << 1);
+			const uint8_t* e = src + (x1 << 1);
+			uint32_t sum = 0;
+			for (; p < e; p += 4) {
+				sum += p[0];
+				st->hist[p[0] >> 2]++;
+			}
+			bsum[bx] += sum;
+			bcnt[bx] += (x1 - x0) >> 1;
+			gsum[bx / perGrid] += sum;
+			gcnt[bx / perGrid] += (x1 - x0) >> 1;
+			rowSum += sum;
+			x0 = x1;
+		}
+		
+		st->sum += rowSum;
+		st->samples += st->width >> 1;
+	}
+}
+
+/* Compute the means */
+void yuyv_stats_end(struct yuyv_luma_stats* st)
+{
+	int i;
+	st->mean = st->samples ? (uint32_t)(st->sum / st->samples) : 0;
+	for (i = 0; i < YUYV_STATS_GRID * YUYV_STATS_GRID; i++) {
+		st->grid[i] = st->gridCount[i] ? st->gridSum[i] / st->gridCount[i] : 0;
+	}
+	for (i = 0; i < YUYV_STATS_BLOCKS; i++) {
+		st->blocks[i] = st->blockCount[i] ? st->blockSum[i] / st->blockCount[i] : 0;
+	}
+}
+
+/* Compare the small blocks of two frames. Block means average out the
+   sensor noise, but still move when anything changes in the block */
+int yuyv_stats_delta(const struct yuyv_luma_stats* a, const struct yuyv_luma_stats* b)
+{
+	if (a->samples == 0 || a->width != b->width || a->height != b->height)
+		return -1;
+		
+	int i;
+	int delta = 0;
+	for (i = 0; i < YUYV_STATS_BLOCKS; i++) {
+		int d = (int)a->blocks[i] - (int)b->blocks[i];
+		if (d < 0) d = -d;
+		if (d > delta)
+			delta = d;
+	}
+	return delta;
+}
+
+/* Scale an YUYV image using nearest neighbour sampling. Pixels are sampled 
+   at their centers, so the source of the pixel i is (2i+1)*src/(2*dst). 
+   It is tracked as an integer part plus a remainder, so it is exact at any
+   size. Chroma is taken from the macropixel the first luma sample of each
+   destination macropixel belongs to, so U and V are never mixed up */
+void yuyv_scale(uint8_t *dst, int dstStride, int dstWidth, int dstHeight, uint8_t *src, int srcStride, int srcWidth, int srcHeight,
+				struct yuyv_luma_stats* stats)
+{
+	// Integer and fractional (in 1/(2*dst) units) steps
+	int xden = dstWidth << 1;
+	int xint = srcWidth / dstWidth;
+	int xfrac = (srcWidth % dstWidth) << 1;
+	int yden = dstHeight << 1;
+	int yint = srcHeight / dstHeight;
+	int yfrac = (srcHeight % dstHeight) << 1;
+	
+	int h=0;
+	int w=0;
+	int sy = srcHeight / yden;
+	int ry = srcHeight % yden;
+	for (h = 0; h < dstHeight; h++) {
+		uint8_t* s = src + sy * srcStride;
+		uint8_t* d = dst;
+		int sx = srcWidth / xden;
+		int rx = srcWidth % xden;
+		for (w = 0; w < dstWidth; w += 2) {
+			int x0 = sx;
+			sx += xint;
+			rx += xfrac;
+			if (rx >= xden) { rx -= xden; sx++; }
+			int x1 = sx;
+			sx += xint;
+			rx += xfrac;
+			if (rx >= xden) { rx -= xden; sx++; }
+			uint8_t* m = s + ((x0 & (-2)) << 1);
+			d[0] = s[x0 << 1];	// Y0
+			d[1] = m[1];		// U
+			d[2] = s[x1 << 1];	// Y1
+			d[3] = m[3];		// V
+			d += 4;
+		}
+		if (stats)
+			yuyv_stats_rows(stats, dst, dstStride, h, 1);
+		dst += dstStride;
+		sy += yint;
+		ry += yfrac;
+		if (ry >= yden) { ry -= yden; sy++; }
+	}
+}
+
 /*convert y16 (grey) to yuyv (packed)
 * args: 
 *      dst: pointer to frame buffer (yuyv)
@@ -237,13 +371,13 @@ void y16_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int w
 		for(w=0;w<width;w+=2) 
 		{
 			/* Y0 */
-			*dst++ = (uint8_t) (ptmp[0] & 0xFF00) >> 8;
+			*dst++ = (uint8_t) (ptmp[0] >> 8);
 			/* U */
-			*dst++ = 0x7F;
+			*dst++ = 0x80;
 			/* Y1 */
-			*dst++ = (uint8_t) (ptmp[1] & 0xFF00) >> 8;
+			*dst++ = (uint8_t) (ptmp[1] >> 8);
 			/* V */
-			*dst++ = 0x7F;
+			*dst++ = 0x80;
 			
 			ptmp += 2;
 		}
@@ -371,386 +505,175 @@ void yvyu_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int
 	}
 }
 
-/*convert yuv 420 planar (yu12) to yuv 422
+/*convert 3 plane yuv 420 to yuv 422
 * args: 
 *      dst: pointer to frame buffer (yuyv)
 *      dstStride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 planar data frame
+*      y/u/v: luma and chroma planes
 *      width: picture width
 *      height: picture height
 */
-void yuv420_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height) 
+static void yuv420p_planes_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane* y, 
+					const struct yuv_plane* u, const struct yuv_plane* v, int width, int height) 
 {
-	uint8_t *py;
-	uint8_t *pu;
-	uint8_t *pv;
-	
-	int linesize = width * 2;
-	int uvlinesize = width / 2;
-	int offsety=0;
-	int offsetuv=0;
-	int dw = dstStride - (width << 1);
-	
-	py=src;
-	pu=py+(width*height);
-	pv=pu+(width*height/4);
+	uint8_t *py = y->data;
+	uint8_t *pu = u->data;
+	uint8_t *pv = v->data;
 	
 	int h=0;
 	int w=0;
 	
-	int wy=0;
-	int wuv=0;
-	
-	offsety = 0;
-	offsetuv = 0;
-	
 	for(h=0;h<height;h+=2) 
 	{
-		wy=0;
-		wuv=0;
+		uint8_t *d0 = dst;
+		uint8_t *d1 = dst + dstStride;
+		uint8_t *py0 = py;
+		uint8_t *py1 = py + y->stride;
 		
-		for(w=0;w<linesize;w+=4) 
+		for(w=0;w<(width>>1);w++) 
 		{
-			/*y00*/
-			*dst++        = py[wy + offsety];
-			/*y10*/
-			dst[dstStride-1] = py[wy + offsety + width];
-			
-			/*u0*/
-			uint8_t u0 = pu[wuv + offsetuv];
-			*dst++        = u0;
-			/*u0*/
-			dst[dstStride-1] = u0;
+			uint8_t u0 = pu[w];
+			uint8_t v0 = pv[w];
 			
-			/*y01*/
-			*dst++        = py[(wy + 1) + offsety];
-			/*y11*/
-			dst[dstStride-1] = py[(wy + 1) + offsety + width];
+			/*y00 u0 y01 v0*/
+			*d0++ = *py0++;
+			*d0++ = u0;
+			*d0++ = *py0++;
+			*d0++ = v0;
 			
-			/*v0*/
-			uint8_t u1 = pv[wuv + offsetuv];
-			*dst++        = u1;
-			/*v0*/
-			dst[dstStride-1] = u1;
-			
-			wuv++;
-			wy+=2;
+			/*y10 u0 y11 v0*/
+			*d1++ = *py1++;
+			*d1++ = u0;
+			*d1++ = *py1++;
+			*d1++ = v0;
 		}
 		
-		dst += dstStride + dw;
-		offsety  += width * 2;
-		offsetuv += uvlinesize;
+		dst += dstStride << 1;
+		py  += y->stride << 1;
+		pu  += u->stride;
+		pv  += v->stride;
 	}
 }
 
-/*convert yvu 420 planar (yv12) to yuv 422
+/*convert 2 plane (chroma interleaved) yuv 420 or 422 to yuv 422
 * args: 
 *      dst: pointer to frame buffer (yuyv)
 *      dstStride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 planar data frame
+*      y/uv: luma and interleaved chroma planes
+*      uoff: offset of u into each chroma pair (0 for uv, 1 for vu)
+*      vsub: vertical chroma subsampling (2 for 420, 1 for 422)
 *      width: picture width
 *      height: picture height
 */
-void yvu420_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height) 
+static void nv_planes_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane* y, 
+					const struct yuv_plane* uv, int uoff, int vsub, int width, int height) 
 {
-	uint8_t *py;
-	uint8_t *pv;
-	uint8_t *pu;
-	
-	int linesize = width * 2;
-	int uvlinesize = width / 2;
-	int offsety=0;
-	int offsetuv=0;
-	int dw = dstStride - (width << 1);
-	
-	py=src;
-	pv=py+(width*height);
-	pu=pv+((width*height)/4);
+	uint8_t *py = y->data;
+	uint8_t *puv = uv->data;
+	int voff = uoff ^ 1;
 	
 	int h=0;
 	int w=0;
 	
-	int wy=0;
-	int wuv=0;
-
-	offsety = 0;
-	offsetuv = 0;
-
-	for(h=0;h<height;h+=2) 
+	for(h=0;h<height;h++) 
 	{
-		wy=0;
-		wuv=0;
+		uint8_t *d = dst;
+		uint8_t *ps = py;
+		uint8_t *pc = puv;
 		
-		for(w=0;w<linesize;w+=4) 
+		for(w=0;w<(width>>1);w++) 
 		{
-			/*y00*/
-			*dst++ = py[wy + offsety];
-			/*y10*/
-			dst[dstStride-1] = py[wy + offsety + width];
-			
-			/*u0*/
-			uint8_t u0 = pu[wuv + offsetuv];
-			*dst++ = u0;
-			/*u0*/
-			dst[dstStride-1] = u0;
-			
-			/*y01*/
-			*dst++ = py[(wy + 1) + offsety];
-			/*y11*/
-			dst[dstStride-1] = py[(wy + 1) + offsety +  width];
-			
-			/*v0*/
-			uint8_t v0 = pv[wuv + offsetuv];
-			*dst++ = v0;
-			/*v0*/
-			dst[dstStride-1] = v0;
-			
-			wuv++;
-			wy+=2;
+			/*y00 u0 y01 v0*/
+			*d++ = *ps++;
+			*d++ = pc[uoff];
+			*d++ = *ps++;
+			*d++ = pc[voff];
+			pc += 2;
 		}
-		dst += dstStride + dw;
-		offsety += width * 2;
-		offsetuv += uvlinesize;
-				
+		
+		dst += dstStride;
+		py  += y->stride;
+		if (((h + 1) % vsub) == 0)
+			puv += uv->stride;
 	}
 }
 
-/*convert yuv 420 planar (uv interleaved) (nv12) to yuv 422
+/*convert yuv 420 planar (yu12) to yuv 422
 * args: 
 *      dst: pointer to frame buffer (yuyv)
 *      dstStride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 (nv12) planar data frame
+*      src: Y, U and V planes
 *      width: picture width
 *      height: picture height
 */
-void nv12_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height) 
+void yuv420_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height) 
 {
-	uint8_t *py;
-	uint8_t *puv;
-	
-	int linesize = width * 2;
-	int offsety=0;
-	int offsetuv=0;
-	int dw = dstStride - (width << 1);
-	
-	py=src;
-	puv=py+(width*height);
-	
-	int h=0;
-	int w=0;
-	
-	int wy=0;
-	int wuv=0;
-	
-	for(h=0;h<height;h+=2) 
-	{
-		wy=0;
-		wuv=0;
+	yuv420p_planes_to_yuyv(dst, dstStride, &src[0], &src[1], &src[2], width, height);
+}
 
-		for(w=0;w<linesize;w+=4) 
-		{
-			/*y00*/
-			*dst++ = py[wy + offsety];
-			/*y10*/
-			dst[dstStride-1] = py[wy + offsety + width];
-			
-			/*u0*/
-			uint8_t u0 = puv[wuv + offsetuv];
-			*dst++ = u0;
-			/*u0*/
-			dst[dstStride-1] = u0;
-			
-			/*y01*/
-			*dst++ = py[(wy + 1) + offsety];
-			/*y11*/
-			dst[dstStride-1] = py[(wy + 1) + offsety + width];
-			
-			/*v0*/
-			uint8_t v0 = puv[(wuv + 1) + offsetuv];
-			*dst++ = v0;
-			/*v0*/
-			dst[dstStride-1] = v0;
-			
-			wuv+=2;
-			wy+=2;
-		}
-		
-		dst += dstStride + dw;
-		offsety += width * 2;
-		offsetuv +=  width;
-	}
+/*convert yvu 420 planar (yv12) to yuv 422
+* args: 
+*      dst: pointer to frame buffer (yuyv)
+*      dstStride: stride of framebuffer
+*      src: Y, V and U planes
+*      width: picture width
+*      height: picture height
+*/
+void yvu420_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height) 
+{
+	yuv420p_planes_to_yuyv(dst, dstStride, &src[0], &src[2], &src[1], width, height);
 }
 
-/*convert yuv 420 planar (vu interleaved) (nv21) to yuv 422
+/*convert yuv 420 planar (uv interleaved) (nv12) to yuv 422
 * args: 
 *      dst: pointer to frame buffer (yuyv)
 *      dstStride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 (nv21) planar data frame
+*      src: Y and interleaved UV planes
 *      width: picture width
 *      height: picture height
 */
-void nv21_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height) 
+void nv12_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height) 
 {
-	uint8_t *py;
-	uint8_t *puv;
-	
-	int linesize = width * 2;
-	int offsety=0;
-	int offsetuv=0;
-	int dw = dstStride - (width << 1);
-	
-	py=src;
-	puv=py+(width*height);
-	
-	int h=0;
-	int w=0;
-	
-	int wy=0;
-	int wuv=0;
-	
-	for(h=0;h<height;h+=2) 
-	{
-		wy=0;
-		wuv=0;
-		
-		for(w=0;w<linesize;w+=4) 
-		{
-			/*y00*/
-			*dst++ = py[wy + offsety];
-			/*y10*/
-			dst[dstStride-1] = py[wy + offsety + width];
-			
-			/*u0*/
-			uint8_t u0 = puv[(wuv + 1) + offsetuv];
-			*dst++ = u0;
-			/*u0*/
-			dst[dstStride-1] = u0;
-		
-			/*y01*/
-			*dst++ = py[(wy + 1) + offsety];
-			
-			/*y11*/
-			dst[dstStride-1] = py[(wy + 1) + offsety + width];
-			
-			/*v0*/
-			uint8_t v0 = puv[wuv + offsetuv];
-			*dst++ = v0;
-			/*v0*/
-			dst[dstStride-1] = v0;
-			
-			wuv+=2;
-			wy+=2;
-		}
-		
-		dst += dstStride + dw;
-		offsety += width * 2;		
-		offsetuv += width;
+	nv_planes_to_yuyv(dst, dstStride, &src[0], &src[1], 0, 2, width, height);
+}
 
-	}
+/*convert yuv 420 planar (vu interleaved) (nv21) to yuv 422
+* args: 
+*      dst: pointer to frame buffer (yuyv)
+*      dstStride: stride of framebuffer
+*      src: Y and interleaved VU planes
+*      width: picture width
+*      height: picture height
+*/
+void nv21_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height) 
+{
+	nv_planes_to_yuyv(dst, dstStride, &src[0], &src[1], 1, 2, width, height);
 }
 
 /*convert yuv 422 planar (uv interleaved) (nv16) to yuv 422
 * args: 
 *      dst: pointer to frame buffer (yuyv)
 *      dstStride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv422 (nv16) planar data frame
+*      src: Y and interleaved UV planes
 *      width: picture width
 *      height: picture height
 */
-void nv16_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height)
+void nv16_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height)
 {
-	uint8_t *py;
-	uint8_t *puv;
-	
-	int linesize = width * 2;
-	int offsety=0;
-	int offsetuv=0;
-	int dw = dstStride - (width << 1);
-	
-	py=src;
-	puv=py+(width*height);
-	
-	int h=0;
-	int w=0;
-	
-	int wy=0;
-	int wuv=0;
-	
-	for(h=0;h<height;h++) 
-	{
-		wy=0;
-		wuv=0;
-
-		for(w=0;w<linesize;w+=4) 
-		{
-			/*y00*/
-			*dst++ = py[wy + offsety];
-			/*u0*/
-			*dst++ = puv[wuv + offsetuv];
-			/*y01*/
-			*dst++ = py[(wy + 1) + offsety];
-			/*v0*/
-			*dst++ = puv[(wuv + 1) + offsetuv];
-			
-			wuv+=2;
-			wy+=2;
-		}
-		dst += dw;
-		offsety += width;
-		offsetuv += width;
-	}
+	nv_planes_to_yuyv(dst, dstStride, &src[0], &src[1], 0, 1, width, height);
 }
 
 /*convert yuv 422 planar (vu interleaved) (nv61) to yuv 422
 * args: 
 *      dst: pointer to frame buffer (yuyv)
 *      dstStride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv422 (nv61) planar data frame
+*      src: Y and interleaved VU planes
 *      width: picture width
 *      height: picture height
 */
-void nv61_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height)
+void nv61_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height)
 {
-	uint8_t *py;
-	uint8_t *puv;
-	
-	int linesize = width * 2;
-	int offsety=0;
-	int offsetuv=0;
-	int dw = dstStride - (width << 1);
-	
-	py=src;
-	puv=py+(width*height);
-	
-	int h=0;
-	int w=0;
-	
-	int wy=0;
-	int wuv=0;
-	
-	for(h=0;h<height;h++) 
-	{
-		wy=0;
-		wuv=0;
-		for(w=0;w<linesize;w+=4) 
-		{
-			/*y00*/
-			*dst++ = py[wy + offsety];
-			/*u0*/
-			*dst++ = puv[(wuv + 1) + offsetuv];
-			/*y01*/
-			*dst++ = py[(wy + 1) + offsety];
-			/*v0*/
-			*dst++ = puv[wuv + offsetuv];
-			
-			wuv+=2;
-			wy+=2;
-		}
-		dst += dw;
-		offsety += width;
-		offsetuv += width;
-		
-	}
+	nv_planes_to_yuyv(dst, dstStride, &src[0], &src[1], 1, 1, width, height);
 }
 
 /*convert yuv 411 packed (y41p) to yuv 422
@@ -1325,15 +1248,15 @@ void rgb_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *prgb, int srcStride, int
 		for(i=0;i<(width*3);i=i+6) 
 		{
 			/* y */ 
-			*pyuv++ =CLIP(0.299 * (prgb[i] - 128) + 0.587 * (prgb[i+1] - 128) + 0.114 * (prgb[i+2] - 128) + 128);
+			*pyuv++ =CLIP(0.299 * (prgb[i] - 128) + 0.587 * (prgb[i+1] - 128) + 0.114 * (prgb[i+2] - 128) + 128.5);
 			/* u */
-			*pyuv++ =CLIP(((- 0.147 * (prgb[i] - 128) - 0.289 * (prgb[i+1] - 128) + 0.436 * (prgb[i+2] - 128) + 128) +
-				(- 0.147 * (prgb[i+3] - 128) - 0.289 * (prgb[i+4] - 128) + 0.436 * (prgb[i+5] - 128) + 128))/2);
+			*pyuv++ =CLIP(((- 0.168736 * (prgb[i] - 128) - 0.331264 * (prgb[i+1] - 128) + 0.5 * (prgb[i+2] - 128) + 128) +
+				(- 0.168736 * (prgb[i+3] - 128) - 0.331264 * (prgb[i+4] - 128) + 0.5 * (prgb[i+5] - 128) + 128))/2 + 0.5);
 			/* y1 */ 
-			*pyuv++ =CLIP(0.299 * (prgb[i+3] - 128) + 0.587 * (prgb[i+4] - 128) + 0.114 * (prgb[i+5] - 128) + 128); 
+			*pyuv++ =CLIP(0.299 * (prgb[i+3] - 128) + 0.587 * (prgb[i+4] - 128) + 0.114 * (prgb[i+5] - 128) + 128.5); 
 			/* v*/
-			*pyuv++ =CLIP(((0.615 * (prgb[i] - 128) - 0.515 * (prgb[i+1] - 128) - 0.100 * (prgb[i+2] - 128) + 128) +
-				(0.615 * (prgb[i+3] - 128) - 0.515 * (prgb[i+4] - 128) - 0.100 * (prgb[i+5] - 128) + 128))/2);
+			*pyuv++ =CLIP(((0.5 * (prgb[i] - 128) - 0.418688 * (prgb[i+1] - 128) - 0.081312 * (prgb[i+2] - 128) + 128) +
+				(0.5 * (prgb[i+3] - 128) - 0.418688 * (prgb[i+4] - 128) - 0.081312 * (prgb[i+5] - 128) + 128))/2 + 0.5);
 		}
 		pyuv += dw;
 		prgb += srcStride;
@@ -1349,15 +1272,15 @@ void bgr_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *pbgr, int srcStride, int
 		for(i=0;i<(width*3);i=i+6) 
 		{
 			/* y */ 
-			*pyuv++ =CLIP(0.299 * (pbgr[i+2] - 128) + 0.587 * (pbgr[i+1] - 128) + 0.114 * (pbgr[i] - 128) + 128);
+			*pyuv++ =CLIP(0.299 * (pbgr[i+2] - 128) + 0.587 * (pbgr[i+1] - 128) + 0.114 * (pbgr[i] - 128) + 128.5);
 			/* u */
-			*pyuv++ =CLIP(((- 0.147 * (pbgr[i+2] - 128) - 0.289 * (pbgr[i+1] - 128) + 0.436 * (pbgr[i] - 128) + 128) +
-				(- 0.147 * (pbgr[i+5] - 128) - 0.289 * (pbgr[i+4] - 128) + 0.436 * (pbgr[i+3] - 128) + 128))/2);
+			*pyuv++ =CLIP(((- 0.168736 * (pbgr[i+2] - 128) - 0.331264 * (pbgr[i+1] - 128) + 0.5 * (pbgr[i] - 128) + 128) +
+				(- 0.168736 * (pbgr[i+5] - 128) - 0.331264 * (pbgr[i+4] - 128) + 0.5 * (pbgr[i+3] - 128) + 128))/2 + 0.5);
 			/* y1 */ 
-			*pyuv++ =CLIP(0.299 * (pbgr[i+5] - 128) + 0.587 * (pbgr[i+4] - 128) + 0.114 * (pbgr[i+3] - 128) + 128); 
+			*pyuv++ =CLIP(0.299 * (pbgr[i+5] - 128) + 0.587 * (pbgr[i+4] - 128) + 0.114 * (pbgr[i+3] - 128) + 128.5); 
 			/* v*/
-			*pyuv++ =CLIP(((0.615 * (pbgr[i+2] - 128) - 0.515 * (pbgr[i+1] - 128) - 0.100 * (pbgr[i] - 128) + 128) +
-				(0.615 * (pbgr[i+5] - 128) - 0.515 * (pbgr[i+4] - 128) - 0.100 * (pbgr[i+3] - 128) + 128))/2);
+			*pyuv++ =CLIP(((0.5 * (pbgr[i+2] - 128) - 0.418688 * (pbgr[i+1] - 128) - 0.081312 * (pbgr[i] - 128) + 128) +
+				(0.5 * (pbgr[i+5] - 128) - 0.418688 * (pbgr[i+4] - 128) - 0.081312 * (pbgr[i+3] - 128) + 128))/2 + 0.5);
 		}
 		pyuv += dw;
 		pbgr += srcStride;
@@ -1563,16 +1486,14 @@ void yuyv_to_bgr24_line (uint8_t *pyuv, uint8_t *pbgr, int width)
 		/* logitech: b = y0 + 1.732446 (u-128) */
 
 		int y0 = pyuv[0];
-		*pbgr++ = clip(y0 + ri);
-		*pbgr++ = clip(y0 + gi);
 		*pbgr++ = clip(y0 + bi);
-		pbgr++;
+		*pbgr++ = clip(y0 + gi);
+		*pbgr++ = clip(y0 + ri);
 		
 		int y1 = pyuv[2];
-		*pbgr++ = clip(y1 + ri);
-		*pbgr++ = clip(y1 + gi);
 		*pbgr++ = clip(y1 + bi);
-		pbgr++;
+		*pbgr++ = clip(y1 + gi);
+		*pbgr++ = clip(y1 + ri);
 		
 		pyuv += 4;
 	}
@@ -1612,15 +1533,15 @@ void yuyv_to_bgr32_line (uint8_t *pyuv, uint8_t *pbgr, int width)
 		/* logitech: b = y0 + 1.732446 (u-128) */
 
 		int y0 = pyuv[0];
-		*pbgr++ = clip(y0 + ri);
-		*pbgr++ = clip(y0 + gi);
 		*pbgr++ = clip(y0 + bi);
+		*pbgr++ = clip(y0 + gi);
+		*pbgr++ = clip(y0 + ri);
 		pbgr++;
 		
 		int y1 = pyuv[2];
-		*pbgr++ = clip(y1 + ri);
-		*pbgr++ = clip(y1 + gi);
 		*pbgr++ = clip(y1 + bi);
+		*pbgr++ = clip(y1 + gi);
+		*pbgr++ = clip(y1 + ri);
 		pbgr++;
 		
 		pyuv += 4;
@@ -1640,6 +1561,619 @@ void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride
 	}
 }
 
+/* Row pair kernels of the multiple output converter. Each one of them 
+   converts 2 consecutive YUYV rows, starting at s0, to a destination format */
+static void fanout_rows_yvu420sp(uint8_t *s0, int srcStride, uint8_t *y0, int yStride, uint8_t *vu, int width)
+{
+	uint8_t* s1 = s0 + srcStride;
+	uint8_t* y1 = y0 + yStride;
+	int w;
+	for (w = 0; w < width; w += 2) {
+		y0[0] = s0[0];						// Y0
+		y0[1] = s0[2];						// Y1
+		y1[0] = s1[0];						// Y0 (next row)
+		y1[1] = s1[2];						// Y1 (next row)
+		vu[0] = (s0[3] + s1[3]) >> 1;		// V
+		vu[1] = (s0[1] + s1[1]) >> 1;		// U
+		s0 += 4;
+		s1 += 4;
+		y0 += 2;
+		y1 += 2;
+		vu += 2;
+	}
+}
+
+static void fanout_rows_420p(uint8_t *s0, int srcStride, uint8_t *y0, int yStride, uint8_t *u, uint8_t *v, int width)
+{
+	uint8_t* s1 = s0 + srcStride;
+	uint8_t* y1 = y0 + yStride;
+	int w;
+	for (w = 0; w < width; w += 2) {
+		y0[0] = s0[0];						// Y0
+		y0[1] = s0[2];						// Y1
+		y1[0] = s1[0];						// Y0 (next row)
+		y1[1] = s1[2];						// Y1 (next row)
+		*u++  = (s0[1] + s1[1]) >> 1;		// U
+		*v++  = (s0[3] + s1[3]) >> 1;		// V
+		s0 += 4;
+		s1 += 4;
+		y0 += 2;
+		y1 += 2;
+	}
+}
+
+static void fanout_rows_422p(uint8_t *s0, int srcStride, uint8_t *y0, int yStride, uint8_t *u0, uint8_t *v0, int cStride, int width)
+{
+	int r, w;
+	for (r = 0; r < 2; r++) {
+		uint8_t* s = s0;
+		uint8_t* y = y0;
+		uint8_t* u = u0;
+		uint8_t* v = v0;
+		for (w = 0; w < width; w += 2) {
+			*y++ = s[0];	// Y0
+			*u++ = s[1];	// U
+			*y++ = s[2];	// Y1
+			*v++ = s[3];	// V
+			s += 4;
+		}
+		s0 += srcStride;
+		y0 += yStride;
+		u0 += cStride;
+		v0 += cStride;
+	}
+}
+
+/* Chroma of the sepia effect: a warm brown tint */
+#define EFFECT_SEPIA_U	108
+#define EFFECT_SEPIA_V	148
+
+/* Luma above which the solarize effect inverts it */
+#define EFFECT_SOLARIZE_THRESH 128
+
+/* Apply a color effect to count luma samples, step bytes apart */
+static void effect_luma(uint8_t *y, int count, int step, int effect)
+{
+	int i;
+	switch (effect) {
+	case YUYV_EFFECT_NEGATIVE:
+		for (i = 0; i < count; i++, y += step)
+			*y = 255 - *y;
+		break;
+		
+	case YUYV_EFFECT_SOLARIZE:
+		for (i = 0; i < count; i++, y += step) {
+			if (*y >= EFFECT_SOLARIZE_THRESH)
+				*y = 255 - *y;
+		}
+		break;
+	}
+}
+
+/* Apply a color effect to count chroma samples, step bytes apart. sepia
+   is the value of this chroma component for the sepia effect */
+static void effect_chroma(uint8_t *c, int count, int step, int effect, uint8_t sepia)
+{
+	int i;
+	switch (effect) {
+	case YUYV_EFFECT_MONO:
+		for (i = 0; i < count; i++, c += step)
+			*c = 0x80;
+		break;
+		
+	case YUYV_EFFECT_SEPIA:
+		for (i = 0; i < count; i++, c += step)
+			*c = sepia;
+		break;
+		
+	case YUYV_EFFECT_NEGATIVE:
+		for (i = 0; i < count; i++, c += step)
+			*c = 255 - *c;
+		break;
+	}
+}
+
+/* Apply a color effect, in place, to rows of YUYV pixels */
+static void effect_yuyv_rows(uint8_t *p, int stride, int width, int rows, int effect)
+{
+	int r;
+	for (r = 0; r < rows; r++, p += stride) {
+		effect_luma(p, width, 2, effect);
+		effect_chroma(p + 1, width >> 1, 4, effect, EFFECT_SEPIA_U);
+		effect_chroma(p + 3, width >> 1, 4, effect, EFFECT_SEPIA_V);
+	}
+}
+
+/* Per destination state of the multiple output converter */
+typedef struct {
+	const struct yuyv_fanout_dst* d;
+	uint8_t* fx;		// Row pair the color effect is applied to, if any
+	uint8_t* y;			// Current row of the luma (or packed) plane
+	uint8_t* u;			// Current row of the U (or interleaved VU) plane
+	uint8_t* v;			// Current row of the V plane
+	int cStride;		// Stride of the chroma planes
+	int cRowStep;		// Chroma rows to advance per row pair
+} fanout_state;
+
+/* Locate the planes of the pixel x,y (even) of the area of a destination.
+   Returns 0 if the format is not supported */
+static int fanout_locate(fanout_state* s, const struct yuyv_fanout_dst* d, int x, int y)
+{
+	s->d = d;
+	s->fx = NULL;
+	s->u = s->v = NULL;
+	s->cStride = 0;
+	s->cRowStep = 0;
+	
+	x += d->dstX;
+	y += d->dstY;
+	
+	uint8_t* chroma = d->dst + d->dstStride * d->dstHeight;
+	switch (d->fmt) {
+	case YUYV_FANOUT_YVU420SP:
+		s->y = d->dst + y * d->dstStride + x;
+		s->cStride = d->dstStride;
+		s->cRowStep = 1;
+		s->u = chroma + (y >> 1) * s->cStride + x;
+		break;
+		
+	case YUYV_FANOUT_YVU420P:
+	case YUYV_FANOUT_YUV420P:
+	{
+		s->y = d->dst + y * d->dstStride + x;
+		s->cStride = ((d->dstStride >> 1) + 15) & (-16);
+		s->cRowStep = 1;
+		uint8_t* first  = chroma + (y >> 1) * s->cStride + (x >> 1);
+		uint8_t* second = first + (s->cStride * d->dstHeight >> 1);
+		if (d->fmt == YUYV_FANOUT_YVU420P) {
+			s->v = first;
+			s->u = second;
+		} else {
+			s->u = first;
+			s->v = second;
+		}
+		break;
+	}
+	
+	case YUYV_FANOUT_YVU422P:
+		s->y = d->dst + y * d->dstStride + x;
+		s->cStride = ((d->dstStride >> 1) + 15) & (-16);
+		s->cRowStep = 2;
+		s->v = chroma + y * s->cStride + (x >> 1);
+		s->u = s->v + s->cStride * d->dstHeight;
+		break;
+		
+	case YUYV_FANOUT_YUYV:
+	case YUYV_FANOUT_RGB565:
+		s->y = d->dst + y * d->dstStride + (x << 1);
+		break;
+		
+	case YUYV_FANOUT_RGB24:
+		s->y = d->dst + y * d->dstStride + x * 3;
+		break;
+		
+	case YUYV_FANOUT_RGB32:
+	case YUYV_FANOUT_BGR32:
+		s->y = d->dst + y * d->dstStride + (x << 2);
+		break;
+		
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+/* Write a row pair of YUYV pixels, starting at s0, to a destination, and
+   advance it to the next row pair */
+static void fanout_emit(fanout_state* s, uint8_t* s0, int srcStride, int width)
+{
+	const struct yuyv_fanout_dst* d = s->d;
+	
+	// The source is shared by all the destinations, so the color effect
+	//  is applied to a copy of the row pair, while it is in the cache
+	if (s->fx) {
+		memcpy(s->fx, s0, width << 1);
+		memcpy(s->fx + (width << 1), s0 + srcStride, width << 1);
+		effect_yuyv_rows(s->fx, width << 1, width, 2, d->effect);
+		s0 = s->fx;
+		srcStride = width << 1;
+	}
+	
+	switch (d->fmt) {
+	case YUYV_FANOUT_YVU420SP:
+		fanout_rows_yvu420sp(s0, srcStride, s->y, d->dstStride, s->u, width);
+		break;
+		
+	case YUYV_FANOUT_YVU420P:
+	case YUYV_FANOUT_YUV420P:
+		fanout_rows_420p(s0, srcStride, s->y, d->dstStride, s->u, s->v, width);
+		break;
+		
+	case YUYV_FANOUT_YVU422P:
+		fanout_rows_422p(s0, srcStride, s->y, d->dstStride, s->u, s->v, s->cStride, width);
+		break;
+		
+	case YUYV_FANOUT_YUYV:
+		memcpy(s->y, s0, width << 1);
+		memcpy(s->y + d->dstStride, s0 + srcStride, width << 1);
+		break;
+		
+	case YUYV_FANOUT_RGB565:
+		yuyv_to_rgb565_line(s0, s->y, width);
+		yuyv_to_rgb565_line(s0 + srcStride, s->y + d->dstStride, width);
+		break;
+		
+	case YUYV_FANOUT_RGB24:
+		yuyv_to_rgb24_line(s0, s->y, width);
+		yuyv_to_rgb24_line(s0 + srcStride, s->y + d->dstStride, width);
+		break;
+		
+	case YUYV_FANOUT_RGB32:
+		yuyv_to_rgb32_line(s0, s->y, width);
+		yuyv_to_rgb32_line(s0 + srcStride, s->y + d->dstStride, width);
+		break;
+		
+	case YUYV_FANOUT_BGR32:
+		yuyv_to_bgr32_line(s0, s->y, width);
+		yuyv_to_bgr32_line(s0 + srcStride, s->y + d->dstStride, width);
+		break;
+	}
+	
+	// Advance to the next row pair
+	s->y += d->dstStride << 1;
+	if (s->u) s->u += s->cStride * s->cRowStep;
+	if (s->v) s->v += s->cStride * s->cRowStep;
+}
+
+/* Size of the square tiles used to transform images. A tile of YUYV 
+   pixels (2Kb) and the source rows it touches fit in the L1 cache */
+#define YUYV_TILE 32
+
+/* Fill the area x,y,w,h (all even) of the transformed image with YUYV
+   pixels. The image of width x height pixels at src is first mirrored, if
+   requested, and then rotated clockwise. The area is filled in square 
+   tiles, so the rotated reads walk a small block of the source instead 
+   of a whole column of it */
+static void yuyv_transform_rect(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, 
+								int width, int height, int x, int y, int w, int h, int transform)
+{
+	// Byte offsets into the source of the pixel 0,0 of the transformed
+	//  image, and of the steps of one pixel to the right and one down
+	int org, ox, oy;
+	int W = width - 1;
+	int H = height - 1;
+	switch (transform & YUYV_ROTATE_MASK) {
+	default:
+	case YUYV_ROTATE_0:
+		org = 0;
+		ox = 2;
+		oy = srcStride;
+		break;
+	case YUYV_ROTATE_90:
+		org = H * srcStride;
+		ox = -srcStride;
+		oy = 2;
+		break;
+	case YUYV_ROTATE_180:
+		org = H * srcStride + (W << 1);
+		ox = -2;
+		oy = -srcStride;
+		break;
+	case YUYV_ROTATE_270:
+		org = W << 1;
+		ox = srcStride;
+		oy = -2;
+		break;
+	}
+	
+	// Mirroring reverses the horizontal component of everything
+	if (transform & YUYV_MIRROR) {
+		int r = org % srcStride;
+		org += (W << 1) - (r << 1);
+		if (ox == 2 || ox == -2) ox = -ox;
+		if (oy == 2 || oy == -2) oy = -oy;
+	}
+	
+	int tx, ty, bx, by;
+	for (ty = 0; ty < h; ty += YUYV_TILE) {
+		int th = (h - ty < YUYV_TILE) ? h - ty : YUYV_TILE;
+		for (tx = 0; tx < w; tx += YUYV_TILE) {
+			int tw = (w - tx < YUYV_TILE) ? w - tx : YUYV_TILE;
+			
+			for (by = ty; by < ty + th; by += 2) {
+				uint8_t* d0 = dst + by * dstStride + (tx << 1);
+				uint8_t* d1 = d0 + dstStride;
+				uint8_t* p = src + org + (x + tx) * ox + (y + by) * oy;
+				
+				for (bx = 0; bx < tw; bx += 2) {
+				
+					// The 4 pixels of the block always come from the same
+					//  2x2 block of the source
+					uint8_t* p00 = p;
+					uint8_t* p10 = p + ox;
+					uint8_t* p01 = p + oy;
+					uint8_t* p11 = p10 + oy;
+					
+					// Its top left pixel holds the chroma of both rows
+					uint8_t* c = p00;
+					if (p10 < c) c = p10;
+					if (p01 < c) c = p01;
+					if (p11 < c) c = p11;
+					uint8_t u = (c[1] + c[1 + srcStride]) >> 1;
+					uint8_t v = (c[3] + c[3 + srcStride]) >> 1;
+					
+					d0[0] = *p00;
+					d0[1] = u;
+					d0[2] = *p10;
+					d0[3] = v;
+					d1[0] = *p01;
+					d1[1] = u;
+					d1[2] = *p11;
+					d1[3] = v;
+					
+					d0 += 4;
+					d1 += 4;
+					p += ox << 1;
+				}
+			}
+		}
+	}
+}
+
+/* Maps the pixels of a scaled and transformed image to the source. The 
+   source area is first resampled to the scaled size, then mirrored if
+   requested, and then rotated clockwise */
+typedef struct {
+	uint8_t* src;
+	int srcStride;
+	int width;			// Size of the source area
+	int height;
+	int outWidth;		// Size of the scaled image
+	int outHeight;
+	int transform;
+	int* xmap;			// Source column of each column of the scaled image
+	int* ymap;			// Source row of each row of the scaled image
+	int ax, axx, axy;	// Scaled column of the transformed pixel x,y: ax + axx*x + axy*y
+	int ay, ayx, ayy;	// Scaled row of the transformed pixel x,y: ay + ayx*x + ayy*y
+} yuyv_resampler;
+
+static int resampler_init(yuyv_resampler* r, uint8_t* src, int srcStride, int width, int height, 
+						  int outWidth, int outHeight, int transform)
+{
+	int i;
+	
+	r->src = src;
+	r->srcStride = srcStride;
+	r->width = width;
+	r->height = height;
+	r->outWidth = outWidth;
+	r->outHeight = outHeight;
+	r->transform = transform;
+	r->xmap = r->ymap = NULL;
+	
+	// If not scaling, the faster direct transform is used
+	if (outWidth == width && outHeight == height)
+		return 1;
+	
+	r->xmap = (int*) malloc((outWidth + outHeight) * sizeof(int));
+	if (!r->xmap)
+		return 0;
+	r->ymap = r->xmap + outWidth;
+	
+	// Sample at the center of each scaled pixel
+	for (i = 0; i < outWidth; i++) 
+		r->xmap[i] = ((2 * i + 1) * width) / (2 * outWidth);
+	for (i = 0; i < outHeight; i++) 
+		r->ymap[i] = ((2 * i + 1) * height) / (2 * outHeight);
+	
+	int W = outWidth - 1;
+	int H = outHeight - 1;
+	switch (transform & YUYV_ROTATE_MASK) {
+	default:
+	case YUYV_ROTATE_0:
+		r->ax = 0; r->axx =  1; r->axy =  0;
+		r->ay = 0; r->ayx =  0; r->ayy =  1;
+		break;
+	case YUYV_ROTATE_90:
+		r->ax = 0; r->axx =  0; r->axy =  1;
+		r->ay = H; r->ayx = -1; r->ayy =  0;
+		break;
+	case YUYV_ROTATE_180:
+		r->ax = W; r->axx = -1; r->axy =  0;
+		r->ay = H; r->ayx =  0; r->ayy = -1;
+		break;
+	case YUYV_ROTATE_270:
+		r->ax = W; r->axx =  0; r->axy = -1;
+		r->ay = 0; r->ayx =  1; r->ayy =  0;
+		break;
+	}
+	if (transform & YUYV_MIRROR) {
+		r->ax = W - r->ax;
+		r->axx = -r->axx;
+		r->axy = -r->axy;
+	}
+	return 1;
+}
+
+static void resampler_free(yuyv_resampler* r)
+{
+	free(r->xmap);
+	r->xmap = r->ymap = NULL;
+}
+
+/* Fill the area x,y,w,h (all even) of the scaled and transformed image 
+   with YUYV pixels, tile by tile */
+static void resampler_rect(yuyv_resampler* r, uint8_t *dst, int dstStride, int x, int y, int w, int h)
+{
+	if (!r->xmap) {
+		yuyv_transform_rect(dst, dstStride, r->src, r->srcStride, r->width, r->height, x, y, w, h, r->transform);
+		return;
+	}
+	
+	int srcStride = r->srcStride;
+	int tx, ty, bx, by, i;
+	for (ty = 0; ty < h; ty += YUYV_TILE) {
+		int th = (h - ty < YUYV_TILE) ? h - ty : YUYV_TILE;
+		for (tx = 0; tx < w; tx += YUYV_TILE) {
+			int tw = (w - tx < YUYV_TILE) ? w - tx : YUYV_TILE;
+			
+			for (by = ty; by < ty + th; by += 2) {
+				uint8_t* d0 = dst + by * dstStride + (tx << 1);
+				uint8_t* d1 = d0 + dstStride;
+				
+				for (bx = tx; bx < tx + tw; bx += 2) {
+					int px = x + bx;
+					int py = y + by;
+					
+					// Source pixels of the 4 pixels of the block
+					uint8_t* p[4];
+					int minX = r->width, minY = r->height;
+					for (i = 0; i < 4; i++) {
+						int qx = px + (i & 1);
+						int qy = py + (i >> 1);
+						int sx = r->xmap[r->ax + r->axx * qx + r->axy * qy];
+						int sy = r->ymap[r->ay + r->ayx * qx + r->ayy * qy];
+						if (sx < minX) minX = sx;
+						if (sy < minY) minY = sy;
+						p[i] = r->src + sy * srcStride + (sx << 1);
+					}
+					
+					// Take the chroma from the 2x2 source block of the top left one
+					uint8_t* c = r->src + (minY & (-2)) * srcStride + ((minX & (-2)) << 1);
+					uint8_t u = (c[1] + c[1 + srcStride]) >> 1;
+					uint8_t v = (c[3] + c[3 + srcStride]) >> 1;
+					
+					d0[0] = *p[0];
+					d0[1] = u;
+					d0[2] = *p[1];
+					d0[3] = v;
+					d1[0] = *p[2];
+					d1[1] = u;
+					d1[2] = *p[3];
+					d1[3] = v;
+					
+					d0 += 4;
+					d1 += 4;
+				}
+			}
+		}
+	}
+}
+
+/* Convert the area of the source to a scaled or transformed destination, 
+   tile by tile, so the rotated accesses never thrash the cache */
+static void fanout_transformed(uint8_t *src, int srcStride, const struct yuyv_fanout_dst* d)
+{
+	uint8_t tile[YUYV_TILE * YUYV_TILE * 2];
+	fanout_state s;
+	yuyv_resampler rs;
+	
+	int ow = d->outWidth  ? d->outWidth  : d->width;
+	int oh = d->outHeight ? d->outHeight : d->height;
+	
+	uint8_t* area = src + d->srcY * srcStride + (d->srcX << 1);
+	if (!resampler_init(&rs, area, srcStride, d->width, d->height, ow, oh, d->transform))
+		return;
+	
+	// Size of the transformed area
+	int w = ow;
+	int h = oh;
+	if (d->transform & 1) {
+		w = oh;
+		h = ow;
+	}
+	
+	int tx, ty, r;
+	for (ty = 0; ty < h; ty += YUYV_TILE) {
+		int th = (h - ty < YUYV_TILE) ? h - ty : YUYV_TILE;
+		for (tx = 0; tx < w; tx += YUYV_TILE) {
+			int tw = (w - tx < YUYV_TILE) ? w - tx : YUYV_TILE;
+			
+			resampler_rect(&rs, tile, YUYV_TILE << 1, tx, ty, tw, th);
+			
+			// The tile is private, so the effect can be applied in place
+			if (d->effect)
+				effect_yuyv_rows(tile, YUYV_TILE << 1, tw, th, d->effect);
+								
+			if (!fanout_locate(&s, d, tx, ty))
+				break;
+			for (r = 0; r < th; r += 2) {
+				fanout_emit(&s, tile + r * (YUYV_TILE << 1), YUYV_TILE << 1, tw);
+			}
+		}
+	}
+	
+	resampler_free(&rs);
+}
+
+/* Convert an YUYV image to several destinations at once, reading each
+   source row pair only once */
+void yuyv_fanout(uint8_t *src, int srcStride, int width, int height, const struct yuyv_fanout_dst* dsts, int count)
+{
+	fanout_state st[YUYV_FANOUT_MAX_DST];
+	int n = 0;
+	int i;
+	int firstRow = height;
+	int lastRow = 0;
+	
+	if (count > YUYV_FANOUT_MAX_DST)
+		count = YUYV_FANOUT_MAX_DST;
+	
+	// Prepare the plane pointers of all the destinations
+	for (i = 0; i < count; i++) {
+		const struct yuyv_fanout_dst* d = &dsts[i];
+		if (d->dst == NULL || d->width <= 0 || d->height <= 0)
+			continue;
+			
+		// Never read outside the source image
+		if (d->srcX + d->width > width || d->srcY + d->height > height)
+			continue;
+			
+		// Scaled or transformed destinations are not written by rows, but by tiles
+		if (d->transform || 
+			(d->outWidth  && d->outWidth  != d->width) || 
+			(d->outHeight && d->outHeight != d->height)) {
+			fanout_transformed(src, srcStride, d);
+			continue;
+		}
+		
+		if (!fanout_locate(&st[n], d, 0, 0))
+			continue;
+			
+		if (d->effect) {
+			st[n].fx = (uint8_t*) malloc(d->width << 2);
+			if (!st[n].fx)
+				continue;
+		}
+		
+		if (d->srcY < firstRow)
+			firstRow = d->srcY;
+		if (d->srcY + d->height > lastRow)
+			lastRow = d->srcY + d->height;
+		n++;
+	}
+	
+	// Walk the source once, and write all the destinations that need 
+	//  each row pair while it is still in the cache
+	int row;
+	for (row = firstRow & (-2); row < lastRow; row += 2) {
+		uint8_t* srow = src + row * srcStride;
+		
+		for (i = 0; i < n; i++) {
+			fanout_state* s = &st[i];
+			const struct yuyv_fanout_dst* d = s->d;
+			
+			if (row < d->srcY || row >= d->srcY + d->height)
+				continue;
+				
+			fanout_emit(s, srow + (d->srcX << 1), srcStride, d->width);
+		}
+	}
+	
+	for (i = 0; i < n; i++)
+		free(st[i].fx);
+}
+
 /*	This a custom destination manager for jpeglib that
 	enables the use of memory to memory compression.
 	See IJG documentation for details.
@@ -1715,16 +2249,42 @@ static GLOBAL(void) jpeg_memory_dest (j_compress_ptr cinfo,void* buf,int sz)
 
 /* yuyv_to_jpeg
  *  converts an input image in the YUYV format into a jpeg image and puts
- * it in a memory buffer.
+ * it in a memory buffer. The image can be scaled, mirrored, rotated and 
+ * have a color effect applied while compressing it.
  */
-int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,int stride,int quality)
+int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int srcwidth, int srcheight,int srcstride,int outwidth,int outheight,int quality,int transform,int effect)
 {
+	// Get the size of the scaled and transformed image
+	int width = outwidth;
+	int height = outheight;
+	if (transform & 1) {
+		width = outheight;
+		height = outwidth;
+	}
+	
 	// Round height to a multiple of 16:
 	height &= (-16);
 	
 	// Round width to a multiple of 16
 	width &= (-16);
 	
+	// If scaling or transforming, each strip of 16 rows is built in a 
+	//  temporary buffer just before compressing it, instead of processing
+	//  the whole image in an extra pass
+	uint8_t* strip = NULL;
+	int stride = srcstride;
+	yuyv_resampler rs;
+	if (transform || outwidth != srcwidth || outheight != srcheight) {
+		if (!resampler_init(&rs, src, srcstride, srcwidth, srcheight, outwidth, outheight, transform))
+			return 0;
+		strip = (uint8_t*) malloc(width * 16 * 2);
+		if (!strip) {
+			resampler_free(&rs);
+			return 0;
+		}
+		stride = width << 1;
+	}
+	
 	// Calculate deltaStride
 	int dstride = stride - (width << 1);
 
@@ -1782,6 +2342,11 @@ int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,
 	
 	for (j=0; j<height; j+=16) {
 	
+		if (strip) {
+			resampler_rect(&rs, strip, stride, 0, j, width, 16);
+			yuyv = strip;
+		}
+	
 		JSAMPROW pcb = cb[0];
 		JSAMPROW pcr = cr[0];
 		JSAMPROW py  = y[0];
@@ -1805,6 +2370,13 @@ int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,
 			}
 			yuyv += dstride;
 		}
+		
+		// Apply the color effect to the strip, still in the cache
+		if (effect) {
+			effect_luma(y[0], width * 16, 1, effect);
+			effect_chroma(cb[0], (width >> 1) * 8, 1, effect, EFFECT_SEPIA_U);
+			effect_chroma(cr[0], (width >> 1) * 8, 1, effect, EFFECT_SEPIA_V);
+		}
 		jpeg_write_raw_data(&cinfo, data, 8*2);
 	}
 
@@ -1814,6 +2386,10 @@ int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,
 	free(y[0]);
 	free(cb[0]);
 	free(cr[0]);
+	if (strip) {
+		free(strip);
+		resampler_free(&rs);
+	}
 
 	// Create a buffer with the compressed data
     int fileSize = ((mem_dest_ptr)cinfo.dest)->datasize;
@@ -56,6 +56,140 @@ void yuyv_to_yuv420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 /* YV16: This format is basically a version of YV12 with higher chroma resolution. It comprises an NxM Y plane followed by (N/2)xM V and U planes. */
 void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height);
 
+/* Luma statistics of a frame, gathered by the converters as they write 
+   each strip of it, while it is still in the cache. The luma of the first
+   pixel of each pixel pair of the even rows is sampled */
+#define YUYV_STATS_BINS		64		// Histogram bins, of 4 luma levels each
+#define YUYV_STATS_GRID		8		// The frame is split in GRID x GRID blocks
+#define YUYV_STATS_BLOCKS_X	32		// And in BLOCKS_X x BLOCKS_Y small blocks, 
+#define YUYV_STATS_BLOCKS_Y	24		//  that are a thumbnail of the frame luma
+#define YUYV_STATS_BLOCKS	(YUYV_STATS_BLOCKS_X * YUYV_STATS_BLOCKS_Y)
+
+struct yuyv_luma_stats {
+	int width;									// Size of the frame
+	int height;
+	uint32_t samples;							// Luma samples taken
+	uint32_t mean;								// Mean luma of the frame
+	uint32_t hist[YUYV_STATS_BINS];				// Luma histogram
+	uint32_t grid[YUYV_STATS_GRID * YUYV_STATS_GRID];	// Mean luma of each block, by rows
+	uint8_t blocks[YUYV_STATS_BLOCKS];			// Mean luma of each small block, by rows
+	
+	// Accumulators
+	uint64_t sum;
+	uint32_t gridSum[YUYV_STATS_GRID * YUYV_STATS_GRID];
+	uint32_t gridCount[YUYV_STATS_GRID * YUYV_STATS_GRID];
+	uint32_t blockSum[YUYV_STATS_BLOCKS];
+	uint32_t blockCount[YUYV_STATS_BLOCKS];
+};
+
+/* Start gathering the stats of a width x height frame */
+void yuyv_stats_begin(struct yuyv_luma_stats* st, int width, int height);
+
+/* Account the rows y to y+count-1 of the frame (yuyv). src points to row y */
+void yuyv_stats_rows(struct yuyv_luma_stats* st, const uint8_t *src, int srcStride, int y, int count);
+
+/* Compute the means once all the rows have been accounted */
+void yuyv_stats_end(struct yuyv_luma_stats* st);
+
+/* Largest difference between the mean luma of the same small block of 
+   two frames, or -1 if the frames can't be compared */
+int yuyv_stats_delta(const struct yuyv_luma_stats* a, const struct yuyv_luma_stats* b);
+
+/* Scale an YUYV image to a different size, using nearest neighbour sampling
+* args: 
+*      dst: pointer to the destination buffer (yuyv)
+*      dstStride: stride of the destination buffer
+*      dstWidth/dstHeight: size of the destination image
+*      src: pointer to the source buffer (yuyv)
+*      srcStride: stride of the source buffer
+*      srcWidth/srcHeight: size of the source image
+*      stats: where to account the scaled image, or NULL
+*/
+void yuyv_scale(uint8_t *dst, int dstStride, int dstWidth, int dstHeight, uint8_t *src, int srcStride, int srcWidth, int srcHeight,
+				struct yuyv_luma_stats* stats = 0);
+
+
+/* Transforms the converters can apply. The image is first mirrored, if
+   requested, and then rotated clockwise */
+enum {
+	YUYV_ROTATE_0		= 0,
+	YUYV_ROTATE_90		= 1,
+	YUYV_ROTATE_180		= 2,
+	YUYV_ROTATE_270		= 3,
+	YUYV_ROTATE_MASK	= 3,
+	YUYV_MIRROR			= 4		// Horizontal mirroring
+};
+
+/* Destination formats of the multiple output converter */
+enum {
+	YUYV_FANOUT_YVU420SP,	// Y plane, then interleaved VU plane (NV21)
+	YUYV_FANOUT_YVU420P,	// Y plane, then V and U planes (YV12)
+	YUYV_FANOUT_YUV420P,	// Y plane, then U and V planes (I420)
+	YUYV_FANOUT_YVU422P,	// Y plane, then V and U planes, full height (YV16)
+	YUYV_FANOUT_YUYV,		// Packed copy
+	YUYV_FANOUT_RGB565,
+	YUYV_FANOUT_RGB24,
+	YUYV_FANOUT_RGB32,
+	YUYV_FANOUT_BGR32
+};
+
+/* Color effects applied while converting. They only touch the pixels of
+   the row pair (or strip) being converted, so they never need an extra 
+   pass over the frame */
+enum {
+	YUYV_EFFECT_NONE = 0,
+	YUYV_EFFECT_MONO,
+	YUYV_EFFECT_SEPIA,
+	YUYV_EFFECT_NEGATIVE,
+	YUYV_EFFECT_SOLARIZE,
+	YUYV_EFFECT_COUNT
+};
+
+/* Maximum number of destinations of the multiple output converter */
+#define YUYV_FANOUT_MAX_DST 4
+
+/* Destination of the multiple output converter
+*      fmt: format of the destination (YUYV_FANOUT_xxx)
+*      dst: pointer to the destination buffer
+*      dstStride: stride of the destination buffer (of the luma plane for planar formats)
+*      dstHeight: height of the destination buffer, used to locate the chroma planes
+*      dstX/dstY: where to place the converted area into the destination (even)
+*      srcX/srcY: top left corner of the area of the source to convert (even)
+*      width/height: size of the area to convert (even)
+*      outWidth/outHeight: size to resample the area to (even), or 0 to keep it
+*      transform: YUYV_ROTATE_xxx | YUYV_MIRROR to apply to the resampled area. 
+*                 dstX/dstY locate the transformed area, that is outHeight x 
+*                 outWidth pixels when rotating 90 or 270 degrees
+*      effect: YUYV_EFFECT_xxx to apply to the converted pixels
+*/
+struct yuyv_fanout_dst {
+	int fmt;
+	uint8_t *dst;
+	int dstStride;
+	int dstHeight;
+	int dstX;
+	int dstY;
+	int srcX;
+	int srcY;
+	int width;
+	int height;
+	int outWidth;
+	int outHeight;
+	int transform;
+	int effect;
+};
+
+/* Convert an YUYV image to several destinations in a single pass. Each
+*  source row pair is read once and written to all the destinations that
+*  need it, so the source is only pulled from memory once per frame
+* args: 
+*      src: pointer to the source buffer (yuyv)
+*      srcStride: stride of the source buffer
+*      width/height: size of the source image
+*      dsts: destinations to write
+*      count: number of destinations (up to YUYV_FANOUT_MAX_DST)
+*/
+void yuyv_fanout(uint8_t *src, int srcStride, int width, int height, const struct yuyv_fanout_dst* dsts, int count);
 
 /*convert yuyv to rgb24/32/565
 * args: 
@@ -65,6 +199,10 @@ void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 *      height: picture height
 */
 void yuyv_to_rgb565 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height);
+void yuyv_to_rgb565_line (uint8_t *pyuv, uint8_t *prgb, int width);
+void yuyv_to_rgb24_line (uint8_t *pyuv, uint8_t *prgb, int width);
+void yuyv_to_rgb32_line (uint8_t *pyuv, uint8_t *prgb, int width);
+void yuyv_to_bgr32_line (uint8_t *pyuv, uint8_t *pbgr, int width);
 void yuyv_to_rgb24 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height);
 void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height);
 
@@ -81,65 +219,75 @@ void yuyv_to_bgr24 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride
 void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height);
 
 
+/* A plane of a captured image. Planar formats are described by an array
+*  of planes, in the order they are stored by the format
+*      data: pointer to the first pixel of the plane
+*      stride: bytes per line of the plane
+*/
+struct yuv_plane {
+	uint8_t *data;
+	int stride;
+};
+
 /*convert yuv 420 planar (yu12) to yuv 422
 * args: 
 *      framebuffer: pointer to frame buffer (yuyv)
 *      stride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 planar data frame
+*      src: Y, U and V planes
 *      width: picture width
 *      height: picture height
 */
-void yuv420_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height);
+void yuv420_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height);
 
 /*convert yvu 420 planar (yv12) to yuv 422 (yuyv)
 * args: 
 *      framebuffer: pointer to frame buffer (yuyv)
 *      stride: stride of framebuffer
-*      src: pointer to temp buffer containing yvu420 planar data frame
+*      src: Y, V and U planes
 *      width: picture width
 *      height: picture height
 */
-void yvu420_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height);
+void yvu420_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height);
 
 /*convert yuv 420 planar (uv interleaved) (nv12) to yuv 422
 * args: 
 *      framebuffer: pointer to frame buffer (yuyv)
 *      stride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 (nv12) planar data frame
+*      src: Y and interleaved UV planes
 *      width: picture width
 *      height: picture height
 */
-void nv12_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height);
+void nv12_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height);
 
 /*convert yuv 420 planar (vu interleaved) (nv21) to yuv 422
 * args: 
 *      framebuffer: pointer to frame buffer (yuyv)
 *      stride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv420 (nv21) planar data frame
+*      src: Y and interleaved VU planes
 *      width: picture width
 *      height: picture height
 */
-void nv21_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height);
+void nv21_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height);
 
 /*convert yuv 422 planar (uv interleaved) (nv16) to yuv 422
 * args: 
 *      framebuffer: pointer to frame buffer (yuyv)
 *      stride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv422 (nv16) planar data frame
+*      src: Y and interleaved UV planes
 *      width: picture width
 *      height: picture height
 */
-void nv16_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height);
+void nv16_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height);
 
 /*convert yuv 422 planar (vu interleaved) (nv61) to yuv 422
 * args: 
 *      framebuffer: pointer to frame buffer (yuyv)
 *      stride: stride of framebuffer
-*      src: pointer to temp buffer containing yuv422 (nv61) planar data frame
+*      src: Y and interleaved VU planes
 *      width: picture width
 *      height: picture height
 */
-void nv61_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int width, int height);
+void nv61_to_yuyv (uint8_t *dst,int dstStride, const struct yuv_plane *src, int width, int height);
 
 /*convert y16 (grey) to yuyv (packed)
 * args: 
@@ -269,9 +417,12 @@ void bgr_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int w
 
 /* yuyv_to_jpeg
  *  converts an input image in the YUYV format into a jpeg image and puts
- * it in a memory buffer.
+ * it in a memory buffer. The image is resampled to outwidth x outheight,
+ * and then transformed as requested by transform (YUYV_ROTATE_xxx | 
+ * YUYV_MIRROR) while compressing it. The color effect (YUYV_EFFECT_xxx)
+ * is applied to each strip just before compressing it.
  */
-int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int srcwidth, int srcheight, int srcstride, int quality);
+int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int srcwidth, int srcheight, int srcstride, int outwidth, int outheight, int quality, int transform, int effect = 0);
 
 
 #endif
@@ -40,6 +40,7 @@
  */
 
 #include "Utils.h"
+#include "Converter.h"
 extern "C" {
 #include <malloc.h>
 #include <string.h>
@@ -148,7 +149,7 @@ static void yuv422pto422(int * out,uint8_t *pic,int stride)
 			outv1 += 1; outu1 += 1;
 			outy1 +=2; outy2 +=2;
 		}
-		outy += 16;outu +=8; outv +=8;
+		outy += 16;outu +=16; outv +=16;
 		outv1 = 0; outu1=0;
 		outy1 = 0;
 		outy2 = 8;
@@ -559,8 +560,9 @@ static int dec_checkmarker(struct ctx* ctx)
 *      buf:  pointer to input data ( compressed jpeg )
 *      with: picture width 
 *      height: picture height
+*      stats: where to account the decoded picture, or NULL
 */
-int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int width, int height)
+int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int width, int height, struct yuyv_luma_stats* stats)
 {
 	struct ctx ctx;
 	struct jpeg_decdata *decdata;
@@ -589,6 +591,7 @@ int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int width, int height)
 		goto error;
 	}
 	ctx.datap = buf;
+	ctx.info.dri = 0; /* no restart interval, unless the frame defines one */
 	/*check SOI (0xFFD8)*/
 	if (getbyte(&ctx) != 0xff) 
 	{
@@ -842,6 +845,13 @@ int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int width, int height)
 			} // switch enc411
 			convert(decdata->out,pic+y+x,stride); //convert to 422
 		}
+		
+		// Account the strip just decoded
+		if (stats) 
+		{
+			int rows = ypitch / stride;
+			yuyv_stats_rows(stats, pic + y, stride, my * rows, rows);
+		}
 	}
 
 	m = dec_readmarker(&ctx.in);
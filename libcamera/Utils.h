@@ -47,7 +47,11 @@ extern "C" {
 #include <stdint.h>
 };
 
-int jpeg_decode(uint8_t *pic,int stride, uint8_t *buf, int width, int height);
+struct yuyv_luma_stats;
+
+/* Decodes a JPEG frame to YUYV. If stats is not NULL, the luma stats of 
+   each decoded strip are gathered while it is still in the cache */
+int jpeg_decode(uint8_t *pic,int stride, uint8_t *buf, int width, int height, struct yuyv_luma_stats* stats = 0);
 
 /*******Error codes *******/
 #define ERR_NO_SOI 1
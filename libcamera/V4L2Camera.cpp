@@ -24,8 +24,10 @@ extern "C" {
 };
 
 #include "V4L2Camera.h"
+#include "V4L2CapsCache.h"
 #include "Utils.h"
 #include "Converter.h"
+#include "CameraTrace.h"
 
 #define HEADERFRAME1 0xaf
 
@@ -40,7 +42,7 @@ extern "C" {
 namespace android {
 
 V4L2Camera::V4L2Camera ()
-        : fd(-1), nQueued(0), nDequeued(0)
+        : dev(NULL), nQueued(0), nDequeued(0), m_Configured(false), m_Stats(NULL), m_StreamStarts(0)
 {
     videoIn = (struct vdIn *) calloc (1, sizeof (struct vdIn));
 }
@@ -60,44 +62,90 @@ int V4L2Camera::Open (const char *device)
 	
     memset(videoIn, 0, sizeof (struct vdIn));
 
-    if ((fd = open(device, O_RDWR)) == -1) {
+	dev = V4L2Device::create(device);
+    if (dev->open(device) < 0) {
         LOGE("ERROR opening V4L interface: %s", strerror(errno));
+		delete dev;
+		dev = NULL;
         return -1;
     }
 
-    ret = ioctl (fd, VIDIOC_QUERYCAP, &videoIn->cap);
+    ret = dev->ioctl(VIDIOC_QUERYCAP, &videoIn->cap);
     if (ret < 0) {
         LOGE("Error opening device: unable to query device.");
+        Close();
         return -1;
     }
 
+	/* Newer bridges deliver each plane of planar formats in its own buffer
+	   through the multi-planar API. Use it if the device supports it */
+	videoIn->bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	videoIn->numPlanes = 1;
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if (videoIn->cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+		LOGD("Using the multi-planar API");
+		videoIn->bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	} else
+#endif
     if ((videoIn->cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) == 0) {
         LOGE("Error opening device: video capture not supported.");
+        Close();
         return -1;
     }
 
     if (!(videoIn->cap.capabilities & V4L2_CAP_STREAMING)) {
         LOGE("Capture device does not support streaming i/o");
+        Close();
         return -1;
     }
 	
-	/* Enumerate all available frame formats */
-	EnumFrameFormats();
+	/* Find out if the device can crop in hardware, and undo any cropping
+	   left behind by a previous user of the device */
+	ProbeHardwareCrop();
+	if (videoIn->hwCropApi != HWCROP_NONE) {
+		videoIn->hwCrop = true;
+		ResetHardwareCrop();
+	}
+	
+	/* Enumerate all available frame formats, unless we already know them.
+	   Recordings being replayed are cheap to enumerate, and can change */
+	if (!dev->isNode()) {
+		EnumFrameFormats();
+	} else {
+		String8 key = V4L2CapsCache::makeKey(device, videoIn->cap);
+		if (V4L2CapsCache::lookup(key, m_AllFmts)) {
+			SelectBestFormats();
+		} else {
+			EnumFrameFormats();
+			V4L2CapsCache::store(key, m_AllFmts);
+		}
+	}
 
     return ret;
 }
 
 void V4L2Camera::Close ()
 {
+	/* Release the capture buffers, if still configured */
+	if (m_Configured) {
+		StopStreaming();
+		Uninit();
+	}
+
 	/* Release the temporary buffer, if any */
 	if (videoIn->tmpBuffer)
 		free(videoIn->tmpBuffer);
 	videoIn->tmpBuffer = NULL;
 
-	/* Close the file descriptor */
-	if (fd > 0)
-		close(fd);
-	fd = -1;
+	/* Stop recording, if doing it */
+	m_RawDump.close();
+
+	/* Close the device */
+	if (dev) {
+		dev->close();
+		delete dev;
+	}
+	dev = NULL;
 }
 
 static int my_abs(int x)
@@ -105,6 +153,43 @@ static int my_abs(int x)
 	return (x < 0) ? -x : x;
 }
 
+/* Find the device mode that best fits the requested size and fps: The
+ * smallest mode that is bigger or equal to the requested size, and then
+ * the one with the closest fps */
+bool V4L2Camera::FindClosestMode(int width, int height, int fps, SurfaceDesc& closest) const
+{
+	int closestDArea = -1;
+	int closestDFps = -1;
+	unsigned int i;
+	int area = width * height;
+	for (i = 0; i < m_AllFmts.size(); i++) {
+		SurfaceDesc sd = m_AllFmts[i];
+		
+		// Always choose a bigger or equal surface
+		if (sd.getWidth() >= width &&
+			sd.getHeight() >= height) {
+
+			int difArea = sd.getArea() - area;
+			int difFps = my_abs(sd.getFps() - fps);
+	
+			LOGD("Trying format: (%d x %d), Fps: %d [difArea:%d, difFps:%d, cDifArea:%d, cDifFps:%d]",sd.getWidth(),sd.getHeight(),sd.getFps(), difArea, difFps, closestDArea, closestDFps);	
+			if (closestDArea < 0 || 
+				difArea < closestDArea ||
+				(difArea == closestDArea && difFps < closestDFps)) {
+			
+				// Store approximation
+				closestDArea = difArea;
+				closestDFps = difFps;
+				
+				// And the new surface descriptor
+				closest = sd;
+			}
+		}
+	}
+	
+	return closestDArea != -1;
+}
+
 int V4L2Camera::Init(int width, int height, int fps)
 {
 	LOGD("V4L2Camera::Init");
@@ -124,11 +209,17 @@ int V4L2Camera::Init(int width, int height, int fps)
 		{V4L2_PIX_FMT_SPCA505,	2,0,0},
 		{V4L2_PIX_FMT_SPCA508,	2,0,0},
 		{V4L2_PIX_FMT_YUV420,	0,1,0},
+		{V4L2_PIX_FMT_YUV420M,	0,1,0},
 		{V4L2_PIX_FMT_YVU420,	0,1,0},
+		{V4L2_PIX_FMT_YVU420M,	0,1,0},
 		{V4L2_PIX_FMT_NV12,		0,1,0},
+		{V4L2_PIX_FMT_NV12M,	0,1,0},
 		{V4L2_PIX_FMT_NV21,		0,1,0},
+		{V4L2_PIX_FMT_NV21M,	0,1,0},
 		{V4L2_PIX_FMT_NV16,		0,1,0},
+		{V4L2_PIX_FMT_NV16M,	0,1,0},
 		{V4L2_PIX_FMT_NV61,		0,1,0},
+		{V4L2_PIX_FMT_NV61M,	0,1,0},
 		{V4L2_PIX_FMT_Y41P,		0,0,0},
 		{V4L2_PIX_FMT_SGBRG8,	0,0,0},
 		{V4L2_PIX_FMT_SGRBG8,	0,0,0},
@@ -152,36 +243,7 @@ int V4L2Camera::Init(int width, int height, int fps)
 
 	// Try to get the closest match ... 
 	SurfaceDesc closest;
-	int closestDArea = -1;
-	int closestDFps = -1;
-	unsigned int i;
-	int area = width * height;
-	for (i = 0; i < m_AllFmts.size(); i++) {
-		SurfaceDesc sd = m_AllFmts[i];
-		
-		// Always choose a bigger or equal surface
-		if (sd.getWidth() >= width &&
-			sd.getHeight() >= height) {
-
-			int difArea = sd.getArea() - area;
-			int difFps = my_abs(sd.getFps() - fps);
-	
-			LOGD("Trying format: (%d x %d), Fps: %d [difArea:%d, difFps:%d, cDifArea:%d, cDifFps:%d]",sd.getWidth(),sd.getHeight(),sd.getFps(), difArea, difFps, closestDArea, closestDFps);	
-			if (closestDArea < 0 || 
-				difArea < closestDArea ||
-				(difArea == closestDArea && difFps < closestDFps)) {
-			
-				// Store approximation
-				closestDArea = difArea;
-				closestDFps = difFps;
-				
-				// And the new surface descriptor
-				closest = sd;
-			}
-		}
-	}
-	
-	if (closestDArea == -1) {
+	if (!FindClosestMode(width, height, fps, closest)) {
 		LOGE("Size not available: (%d x %d)",width,height);
 		return -1;
 	}
@@ -191,56 +253,91 @@ int V4L2Camera::Init(int width, int height, int fps)
 	// Check if we will have to crop the captured image
 	bool crop = width != closest.getWidth() || height != closest.getHeight();
 	
-	// Iterate through pixel formats from best to worst
-	ret = -1;
-	for (i=0; i < (sizeof(pixFmtsOrder) / sizeof(pixFmtsOrder[0])); i++) {
+	// Undo the hardware cropping of the previous configuration, if any
+	ResetHardwareCrop();
+	
+	// Try to have the device crop for us. That saves bandwidth, and any
+	//  pixel format can be used. If not possible, crop in software
+	bool hwCrop = crop && SetupHardwareCrop(width, height, closest);
 	
-		// If we will need to crop, make sure to only select formats we can crop...
-		if (!crop || pixFmtsOrder[i].allowscrop) {
+	unsigned int i;
+	for (;;) {
+		int capWidth  = hwCrop ? width  : closest.getWidth();
+		int capHeight = hwCrop ? height : closest.getHeight();
+	
+		// Iterate through pixel formats from best to worst
+		ret = -1;
+		for (i=0; i < (sizeof(pixFmtsOrder) / sizeof(pixFmtsOrder[0])); i++) {
 		
-			memset(&videoIn->format,0,sizeof(videoIn->format));
-			videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			videoIn->format.fmt.pix.width = closest.getWidth();
-			videoIn->format.fmt.pix.height = closest.getHeight();
-			videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
-
-			ret = ioctl(fd, VIDIOC_TRY_FMT, &videoIn->format);
-			if (ret >= 0) {
-				break;
+			// If we will need to crop, make sure to only select formats we can crop...
+			if (!crop || hwCrop || pixFmtsOrder[i].allowscrop) {
+			
+				memset(&videoIn->format,0,sizeof(videoIn->format));
+				videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				videoIn->format.fmt.pix.width = capWidth;
+				videoIn->format.fmt.pix.height = capHeight;
+				videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
+
+				ret = FormatIoctl(VIDIOC_TRY_FMT);
+				if (ret >= 0) {
+					break;
+				}
 			}
 		}
-	}
-    if (ret < 0) {
-        LOGE("Open: VIDIOC_TRY_FMT Failed: %s", strerror(errno));
-        return ret;
-    }
+		if (ret < 0) {
+			if (hwCrop) {
+				LOGD("No format for hardware cropping, cropping in software");
+				ResetHardwareCrop();
+				hwCrop = false;
+				continue;
+			}
+			LOGE("Open: VIDIOC_TRY_FMT Failed: %s", strerror(errno));
+			return ret;
+		}
 
-	/* Set the format */
-	memset(&videoIn->format,0,sizeof(videoIn->format));
-	videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	videoIn->format.fmt.pix.width = closest.getWidth();
-	videoIn->format.fmt.pix.height = closest.getHeight();
-	videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
-	ret = ioctl(fd, VIDIOC_S_FMT, &videoIn->format);
-    if (ret < 0) {
-        LOGE("Open: VIDIOC_S_FMT Failed: %s", strerror(errno));
-        return ret;
-    }
+		/* Set the format */
+		memset(&videoIn->format,0,sizeof(videoIn->format));
+		videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		videoIn->format.fmt.pix.width = capWidth;
+		videoIn->format.fmt.pix.height = capHeight;
+		videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
+		ret = FormatIoctl(VIDIOC_S_FMT);
+		if (ret < 0) {
+			LOGE("Open: VIDIOC_S_FMT Failed: %s", strerror(errno));
+			return ret;
+		}
 
-	
-	/* Query for the effective video format used */
-	memset(&videoIn->format,0,sizeof(videoIn->format));
-	videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	ret = ioctl(fd, VIDIOC_G_FMT, &videoIn->format);
-    if (ret < 0) {
-        LOGE("Open: VIDIOC_G_FMT Failed: %s", strerror(errno));
-        return ret;
-    }
+		
+		/* Query for the effective video format used */
+		memset(&videoIn->format,0,sizeof(videoIn->format));
+		videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		ret = FormatIoctl(VIDIOC_G_FMT);
+		if (ret < 0) {
+			LOGE("Open: VIDIOC_G_FMT Failed: %s", strerror(errno));
+			return ret;
+		}
+		
+		/* The device must deliver exactly the requested size when cropping
+		   in hardware. If it does not, fall back to software cropping */
+		if (hwCrop && 
+			((int)videoIn->format.fmt.pix.width != width || 
+			 (int)videoIn->format.fmt.pix.height != height)) {
+			LOGD("Device captures %dx%d instead of %dx%d, cropping in software",
+				videoIn->format.fmt.pix.width, videoIn->format.fmt.pix.height,
+				width, height);
+			ResetHardwareCrop();
+			hwCrop = false;
+			continue;
+		}
+		break;
+	}
 	
 	/* Note VIDIOC_S_FMT may change width and height. */
 
-	/* Buggy driver paranoia. */
-	unsigned int min = videoIn->format.fmt.pix.width * 2;
+	/* Buggy driver paranoia. Planar and compressed formats have no bytes
+	   per pixel: Their first plane has at least one byte per pixel */
+	unsigned int min = videoIn->format.fmt.pix.width * 
+		(pixFmtsOrder[i].bpp ? pixFmtsOrder[i].bpp : 1);
 	if (videoIn->format.fmt.pix.bytesperline < min)
 		videoIn->format.fmt.pix.bytesperline = min;
 	min = videoIn->format.fmt.pix.bytesperline * videoIn->format.fmt.pix.height;
@@ -248,72 +345,53 @@ int V4L2Camera::Init(int width, int height, int fps)
 		videoIn->format.fmt.pix.sizeimage = min;
 
 	/* Store the pixel formats we will use */
-	videoIn->outWidth 			= width;
-	videoIn->outHeight 			= height;
-	videoIn->outFrameSize 		= width * height << 1; // Calculate the expected output framesize in YUYV
 	videoIn->capBytesPerPixel	= pixFmtsOrder[i].bpp;
+	videoIn->capCanCrop			= pixFmtsOrder[i].allowscrop;
 	
-	/* Now calculate cropping margins, if needed, rounding to even */
-	int startX = ((closest.getWidth() - width) >> 1) & (-2);
-	int startY = ((closest.getHeight() - height) >> 1) & (-2);
-	
-	/* Avoid crashing if the mode found is smaller than the requested */
-	if (startX < 0) {
-		videoIn->outWidth += startX;
-		startX = 0;
-	}
-	if (startY < 0) {
-		videoIn->outHeight += startY;
-		startY = 0;
+	/* Now calculate cropping margins, if needed */
+	ret = SetupOutputGeometry(width, height, false);
+	if (ret < 0) {
+		return ret;
 	}
 	
-	/* Calculate the starting offset into each captured frame */
-	videoIn->capCropOffset = (startX * videoIn->capBytesPerPixel) +
-			(videoIn->format.fmt.pix.bytesperline * startY);	
-	
-	LOGI("Cropping from origin: %dx%d - size: %dx%d  (offset:%d)", 
-		startX,startY,
-		videoIn->outWidth,videoIn->outHeight,
-		videoIn->capCropOffset);
-	
 	/* sets video device frame rate */
 	memset(&videoIn->params,0,sizeof(videoIn->params));
-	videoIn->params.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	videoIn->params.type = videoIn->bufType;
 	videoIn->params.parm.capture.timeperframe.numerator = 1;
 	videoIn->params.parm.capture.timeperframe.denominator = closest.getFps();
 
 	/* Set the framerate. If it fails, it wont be fatal */
-	if (ioctl(fd,VIDIOC_S_PARM,&videoIn->params) < 0) 
+	if (dev->ioctl(VIDIOC_S_PARM,&videoIn->params) < 0) 
 	{
 		LOGE("VIDIOC_S_PARM error: Unable to set %d fps", closest.getFps());
 	} 
 	
 	/* Gets video device defined frame rate (not real - consider it a maximum value) */
-	if (ioctl(fd,VIDIOC_G_PARM,&videoIn->params) < 0) 
+	if (dev->ioctl(VIDIOC_G_PARM,&videoIn->params) < 0) 
 	{
 		LOGE("VIDIOC_G_PARM - Unable to get timeperframe");
 	} 
 	
-	LOGI("Actual format: (%d x %d), Fps: %d, pixfmt: '%c%c%c%c', bytesperline: %d",
+	LOGI("Actual format: (%d x %d), Fps: %d, pixfmt: '%c%c%c%c', bytesperline: %d, planes: %d",
 		videoIn->format.fmt.pix.width,
 		videoIn->format.fmt.pix.height,
 		videoIn->params.parm.capture.timeperframe.denominator,
 		videoIn->format.fmt.pix.pixelformat & 0xFF, (videoIn->format.fmt.pix.pixelformat >> 8) & 0xFF,
 		(videoIn->format.fmt.pix.pixelformat >> 16) & 0xFF, (videoIn->format.fmt.pix.pixelformat >> 24) & 0xFF,
-		videoIn->format.fmt.pix.bytesperline);
+		videoIn->format.fmt.pix.bytesperline, videoIn->numPlanes);
 
 	/* Configure JPEG quality, if dealing with those formats */
 	if (videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_JPEG ||
 		videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
 
 		/* Get the compression format */
-		ioctl(fd,VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp);
+		dev->ioctl(VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp);
 
 		/* Set to maximum */
 		videoIn->jpegcomp.quality = 100;
 		
 		/* Try to set it */
-		if(ioctl(fd,VIDIOC_S_JPEGCOMP, &videoIn->jpegcomp) >= 0)
+		if(dev->ioctl(VIDIOC_S_JPEGCOMP, &videoIn->jpegcomp) >= 0)
 		{
 			LOGE("VIDIOC_S_COMP:");
 			if(errno == EINVAL)
@@ -324,7 +402,7 @@ int V4L2Camera::Init(int width, int height, int fps)
 		}
 
 		/* gets video stream jpeg compression parameters */
-		if(ioctl(fd,VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp) >= 0)
+		if(dev->ioctl(VIDIOC_G_JPEGCOMP, &videoIn->jpegcomp) >= 0)
 		{
 			LOGD("VIDIOC_G_COMP:\n");
 			LOGD("    quality:      %i\n", videoIn->jpegcomp.quality);
@@ -348,11 +426,11 @@ int V4L2Camera::Init(int width, int height, int fps)
 	
     /* Check if camera can handle NB_BUFFER buffers */
 	memset(&videoIn->rb,0,sizeof(videoIn->rb));
-    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.type = videoIn->bufType;
     videoIn->rb.memory = V4L2_MEMORY_MMAP;
     videoIn->rb.count = NB_BUFFER;
 
-    ret = ioctl(fd, VIDIOC_REQBUFS, &videoIn->rb);
+    ret = dev->ioctl(VIDIOC_REQBUFS, &videoIn->rb);
     if (ret < 0) {
         LOGE("Init: VIDIOC_REQBUFS failed: %s", strerror(errno));
         return ret;
@@ -360,30 +438,35 @@ int V4L2Camera::Init(int width, int height, int fps)
 
     for (int i = 0; i < NB_BUFFER; i++) {
 
-        memset (&videoIn->buf, 0, sizeof (struct v4l2_buffer));
-        videoIn->buf.index = i;
-        videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        videoIn->buf.memory = V4L2_MEMORY_MMAP;
+		PrepareBuffer(i);
 
-        ret = ioctl (fd, VIDIOC_QUERYBUF, &videoIn->buf);
+        ret = dev->ioctl(VIDIOC_QUERYBUF, &videoIn->buf);
         if (ret < 0) {
             LOGE("Init: Unable to query buffer (%s)", strerror(errno));
             return ret;
         }
 
-        videoIn->mem[i] = mmap (0,
-                                videoIn->buf.length,
-                                PROT_READ | PROT_WRITE,
-                                MAP_SHARED,
-                                fd,
-                                videoIn->buf.m.offset);
+		/* Map each one of the planes of the buffer */
+		for (int p = 0; p < videoIn->numPlanes; p++) {
+			size_t length = videoIn->buf.length;
+			off_t offset = videoIn->buf.m.offset;
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+			if (videoIn->bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+				length = videoIn->planes[p].length;
+				offset = videoIn->planes[p].m.mem_offset;
+			}
+#endif
+			videoIn->memLength[i][p] = length;
+			videoIn->mem[i][p] = dev->mmap(length, offset);
 
-        if (videoIn->mem[i] == MAP_FAILED) {
-            LOGE("Init: Unable to map buffer (%s)", strerror(errno));
-            return -1;
-        }
+			if (videoIn->mem[i][p] == MAP_FAILED) {
+				videoIn->mem[i][p] = NULL;
+				LOGE("Init: Unable to map buffer (%s)", strerror(errno));
+				return -1;
+			}
+		}
 
-        ret = ioctl(fd, VIDIOC_QBUF, &videoIn->buf);
+        ret = dev->ioctl(VIDIOC_QBUF, &videoIn->buf);
         if (ret < 0) {
             LOGE("Init: VIDIOC_QBUF Failed");
             return -1;
@@ -392,6 +475,10 @@ int V4L2Camera::Init(int width, int height, int fps)
         nQueued++;
     }
 	
+	/* Remember the mode we are using, so we can avoid renegotiating it */
+	m_CurMode = closest;
+	m_Configured = true;
+	
 	// Reserve temporary buffers, if they will be needed
 	size_t tmpbuf_size=0;
 	switch (videoIn->format.fmt.pix.pixelformat) 
@@ -408,6 +495,12 @@ int V4L2Camera::Init(int width, int height, int fps)
 		case V4L2_PIX_FMT_NV21:
 		case V4L2_PIX_FMT_NV16:
 		case V4L2_PIX_FMT_NV61:
+		case V4L2_PIX_FMT_YUV420M:
+		case V4L2_PIX_FMT_YVU420M:
+		case V4L2_PIX_FMT_NV12M:
+		case V4L2_PIX_FMT_NV21M:
+		case V4L2_PIX_FMT_NV16M:
+		case V4L2_PIX_FMT_NV61M:
 		case V4L2_PIX_FMT_SPCA501:
 		case V4L2_PIX_FMT_SPCA505:
 		case V4L2_PIX_FMT_SPCA508:
@@ -457,19 +550,147 @@ int V4L2Camera::Init(int width, int height, int fps)
     return 0;
 }
 
+/* Check if the device is able to crop (and scale) the captured frames in
+ * hardware. The selection API is preferred, the older cropping API is used
+ * if it is not available */
+void V4L2Camera::ProbeHardwareCrop()
+{
+	videoIn->hwCropApi = HWCROP_NONE;
+
+#ifdef VIDIOC_S_SELECTION
+	struct v4l2_selection sel;
+	memset(&sel,0,sizeof(sel));
+	sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	sel.target = V4L2_SEL_TGT_CROP_BOUNDS;
+	if (dev->ioctl(VIDIOC_G_SELECTION, &sel) >= 0) {
+		videoIn->cropBounds = sel.r;
+		sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+		if (dev->ioctl(VIDIOC_G_SELECTION, &sel) < 0)
+			sel.r = videoIn->cropBounds;
+		videoIn->cropDefault = sel.r;
+		videoIn->hwCropApi = HWCROP_SELECTION;
+	}
+#endif
+
+	if (videoIn->hwCropApi == HWCROP_NONE) {
+		struct v4l2_cropcap cropcap;
+		memset(&cropcap,0,sizeof(cropcap));
+		cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (dev->ioctl(VIDIOC_CROPCAP, &cropcap) >= 0) {
+			videoIn->cropBounds = cropcap.bounds;
+			videoIn->cropDefault = cropcap.defrect;
+			videoIn->hwCropApi = HWCROP_CROP;
+		}
+	}
+	
+	/* Some drivers answer CROPCAP with empty rectangles: They can't crop */
+	if (videoIn->cropDefault.width <= 0 || videoIn->cropDefault.height <= 0)
+		videoIn->hwCropApi = HWCROP_NONE;
+
+	if (videoIn->hwCropApi != HWCROP_NONE) {
+		LOGD("Hardware cropping supported (%s): bounds: %d,%d %dx%d - default: %d,%d %dx%d",
+			(videoIn->hwCropApi == HWCROP_SELECTION) ? "selection" : "crop",
+			videoIn->cropBounds.left, videoIn->cropBounds.top,
+			videoIn->cropBounds.width, videoIn->cropBounds.height,
+			videoIn->cropDefault.left, videoIn->cropDefault.top,
+			videoIn->cropDefault.width, videoIn->cropDefault.height);
+	} else {
+		LOGD("Hardware cropping not supported");
+	}
+}
+
+/* Ask the device to capture the given region of the sensor. The driver may
+ * adjust it: the region actually used is returned in rect */
+bool V4L2Camera::SetHardwareCrop(struct v4l2_rect& rect)
+{
+#ifdef VIDIOC_S_SELECTION
+	if (videoIn->hwCropApi == HWCROP_SELECTION) {
+		struct v4l2_selection sel;
+		memset(&sel,0,sizeof(sel));
+		sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		sel.target = V4L2_SEL_TGT_CROP;
+		sel.r = rect;
+		if (dev->ioctl(VIDIOC_S_SELECTION, &sel) < 0) {
+			LOGD("VIDIOC_S_SELECTION failed: %s", strerror(errno));
+			return false;
+		}
+		rect = sel.r;
+		return true;
+	}
+#endif
+
+	if (videoIn->hwCropApi == HWCROP_CROP) {
+		struct v4l2_crop crop;
+		memset(&crop,0,sizeof(crop));
+		crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		crop.c = rect;
+		if (dev->ioctl(VIDIOC_S_CROP, &crop) < 0) {
+			LOGD("VIDIOC_S_CROP failed: %s", strerror(errno));
+			return false;
+		}
+		
+		/* S_CROP does not return the adjusted region, ask for it */
+		if (dev->ioctl(VIDIOC_G_CROP, &crop) >= 0)
+			rect = crop.c;
+		return true;
+	}
+	
+	return false;
+}
+
+/* Crop in hardware the same centered region of the given mode that the
+ * software cropping would use. The region is expressed in sensor coordinates,
+ * so if the mode is a downscaled one, the device will also do the scaling */
+bool V4L2Camera::SetupHardwareCrop(int width, int height, const SurfaceDesc& mode)
+{
+	if (videoIn->hwCropApi == HWCROP_NONE)
+		return false;
+		
+	const struct v4l2_rect& def = videoIn->cropDefault;
+	struct v4l2_rect rect;
+	rect.width  = (def.width  * width  / mode.getWidth())  & (-2);
+	rect.height = (def.height * height / mode.getHeight()) & (-2);
+	rect.left   = def.left + (((def.width  - rect.width)  >> 1) & (-2));
+	rect.top    = def.top  + (((def.height - rect.height) >> 1) & (-2));
+	
+	struct v4l2_rect wanted = rect;
+	videoIn->hwCrop = true;
+	if (!SetHardwareCrop(rect) ||
+		rect.left != wanted.left || rect.top != wanted.top ||
+		rect.width != wanted.width || rect.height != wanted.height) {
+		LOGD("Hardware cropping to %d,%d %dx%d rejected", 
+			wanted.left, wanted.top, wanted.width, wanted.height);
+		ResetHardwareCrop();
+		return false;
+	}
+	
+	LOGD("Hardware cropping to %d,%d %dx%d", rect.left, rect.top, rect.width, rect.height);
+	return true;
+}
+
+/* Go back to capturing the full frame */
+void V4L2Camera::ResetHardwareCrop()
+{
+	if (!videoIn->hwCrop)
+		return;
+	videoIn->hwCrop = false;
+	
+	struct v4l2_rect rect = videoIn->cropDefault;
+	if (!SetHardwareCrop(rect))
+		LOGE("Unable to restore the default cropping region");
+}
+
 void V4L2Camera::Uninit ()
 {
     int ret;
 
-	memset(&videoIn->buf,0,sizeof(videoIn->buf));
-    videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    videoIn->buf.memory = V4L2_MEMORY_MMAP;
+	PrepareBuffer(0);
 
     /* Dequeue everything */
     int DQcount = nQueued - nDequeued;
 
     for (int i = 0; i < DQcount-1; i++) {
-        ret = ioctl(fd, VIDIOC_DQBUF, &videoIn->buf);
+        ret = dev->ioctl(VIDIOC_DQBUF, &videoIn->buf);
         if (ret < 0)
             LOGE("Uninit: VIDIOC_DQBUF Failed");
     }
@@ -478,16 +699,164 @@ void V4L2Camera::Uninit ()
 
     /* Unmap buffers */
     for (int i = 0; i < NB_BUFFER; i++)
-		if (videoIn->mem[i] != NULL) {
-			if (munmap(videoIn->mem[i], videoIn->buf.length) < 0)
-				LOGE("Uninit: Unmap failed");
-			videoIn->mem[i] = NULL;
-		}
+		for (int p = 0; p < CAP_MAX_PLANES; p++)
+			if (videoIn->mem[i][p] != NULL) {
+				if (dev->munmap(videoIn->mem[i][p], videoIn->memLength[i][p]) < 0)
+					LOGE("Uninit: Unmap failed");
+				videoIn->mem[i][p] = NULL;
+			}
+		
+	/* Release the driver buffers, so the format can be renegotiated
+	   without closing the device */
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = videoIn->bufType;
+    videoIn->rb.memory = V4L2_MEMORY_MMAP;
+    videoIn->rb.count = 0;
+	if (dev->ioctl(VIDIOC_REQBUFS, &videoIn->rb) < 0)
+		LOGE("Uninit: VIDIOC_REQBUFS(0) failed: %s", strerror(errno));
 		
 	if (videoIn->tmpBuffer)
 		free(videoIn->tmpBuffer);
 	videoIn->tmpBuffer = NULL;
+	
+	if (videoIn->scaleBuffer)
+		free(videoIn->scaleBuffer);
+	videoIn->scaleBuffer = NULL;
+	
+	m_Configured = false;
+}
+
+/* Configure the device to capture at the given size. The device is only 
+ * renegotiated if the mode to use changes. If allowScale is true, and the 
+ * current mode is big enough, the captured frames are scaled in software
+ * instead */
+int V4L2Camera::Configure(int width, int height, int fps, bool allowScale)
+{
+	LOGD("V4L2Camera::Configure: %dx%d, %d fps, allowScale: %d", width, height, fps, allowScale);
+
+	if (m_Configured) {
+	
+		// If the same mode would be selected, just change the cropping. If the
+		//  device is cropping in hardware, it must be reprogrammed instead,
+		//  unless the size does not change
+		SurfaceDesc closest;
+		bool sameCrop = videoIn->hwCrop ?
+			(width == (int)videoIn->format.fmt.pix.width && height == (int)videoIn->format.fmt.pix.height) :
+			(videoIn->capCanCrop || (width == m_CurMode.getWidth() && height == m_CurMode.getHeight()));
+		if (FindClosestMode(width, height, fps, closest) && closest == m_CurMode && sameCrop) {
+			LOGD("V4L2Camera::Configure: Same mode, only recropping");
+			return SetupOutputGeometry(width, height, false);
+		}
 		
+		// If we can scale the frames being captured, do it
+		if (allowScale && 
+			(int)videoIn->format.fmt.pix.width >= width && 
+			(int)videoIn->format.fmt.pix.height >= height) {
+			LOGD("V4L2Camera::Configure: Scaling the current mode");
+			return SetupOutputGeometry(width, height, true);
+		}
+	}
+	
+	// We need to renegotiate the mode. Keep the streaming state
+	bool wasStreaming = videoIn->isStreaming;
+	if (m_Configured) {
+		StopStreaming();
+		Uninit();
+	}
+	
+	int ret = Init(width, height, fps);
+	if (ret < 0) 
+		return ret;
+		
+	if (wasStreaming) 
+		ret = StartStreaming();
+		
+	return ret;
+}
+
+/* Calculate the region of the captured frames to use, and how it must be
+ * fitted into the requested output size */
+int V4L2Camera::SetupOutputGeometry(int width, int height, bool scale)
+{
+	int devWidth  = videoIn->format.fmt.pix.width;
+	int devHeight = videoIn->format.fmt.pix.height;
+	
+	/* Release the previous scale buffer, if any */
+	if (videoIn->scaleBuffer)
+		free(videoIn->scaleBuffer);
+	videoIn->scaleBuffer = NULL;
+	videoIn->scaleCropOffset = 0;
+	
+	videoIn->outWidth 	= width;
+	videoIn->outHeight 	= height;
+	
+	int startX, startY;
+	if (!scale) {
+	
+		/* Crop the captured image to the requested size, rounding to even */
+		startX = ((devWidth - width) >> 1) & (-2);
+		startY = ((devHeight - height) >> 1) & (-2);
+	
+		/* Avoid crashing if the mode found is smaller than the requested */
+		if (startX < 0) {
+			videoIn->outWidth += startX << 1;
+			startX = 0;
+		}
+		if (startY < 0) {
+			videoIn->outHeight += startY << 1;
+			startY = 0;
+		}
+		videoIn->capWidth 	= videoIn->outWidth;
+		videoIn->capHeight 	= videoIn->outHeight;
+		
+	} else {
+	
+		/* Use the biggest centered region with the aspect ratio of the output */
+		if (devWidth * height > devHeight * width) {
+			videoIn->capHeight = devHeight;
+			videoIn->capWidth  = (devHeight * width / height) & (-2);
+		} else {
+			videoIn->capWidth  = devWidth;
+			videoIn->capHeight = (devWidth * height / width) & (-2);
+		}
+		startX = ((devWidth - videoIn->capWidth) >> 1) & (-2);
+		startY = ((devHeight - videoIn->capHeight) >> 1) & (-2);
+	}
+	
+	videoIn->outFrameSize = videoIn->outWidth * videoIn->outHeight << 1; // Calculate the expected output framesize in YUYV
+	
+	/* Calculate the starting offset into each captured frame */
+	if (videoIn->capCanCrop) {
+		videoIn->capCropOffset = (startX * videoIn->capBytesPerPixel) +
+				(videoIn->format.fmt.pix.bytesperline * startY);
+	} else {
+		videoIn->capCropOffset = 0;
+	}
+	
+	/* If scaling, we will need an intermediate buffer, unless capturing YUYV.
+	   Formats that can't be cropped are converted full size, then cropped */
+	if (videoIn->capWidth != videoIn->outWidth || videoIn->capHeight != videoIn->outHeight) {
+		size_t sz;
+		if (videoIn->capCanCrop) {
+			sz = videoIn->capWidth * videoIn->capHeight << 1;
+		} else {
+			sz = devWidth * devHeight << 1;
+			videoIn->scaleCropOffset = (startX << 1) + (devWidth << 1) * startY;
+		}
+		videoIn->scaleBuffer = malloc(sz);
+		if (!videoIn->scaleBuffer) {
+			LOGE("Unable to allocate %d bytes for the scale buffer", sz);
+			return -ENOMEM;
+		}
+	}
+	
+	LOGI("Cropping from origin: %dx%d - size: %dx%d  (offset:%d), output: %dx%d", 
+		startX,startY,
+		videoIn->capWidth,videoIn->capHeight,
+		videoIn->capCropOffset,
+		videoIn->outWidth,videoIn->outHeight);
+		
+	return 0;
 }
 
 int V4L2Camera::StartStreaming ()
@@ -496,13 +865,38 @@ int V4L2Camera::StartStreaming ()
     int ret;
 
     if (!videoIn->isStreaming) {
-        type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	
+		/* STREAMOFF returns all the buffers to us. Queue them again */
+		if (nQueued == nDequeued) {
+			nQueued = 0;
+			nDequeued = 0;
+			for (unsigned int i = 0; i < NB_BUFFER; i++) {
+				PrepareBuffer(i);
+				ret = dev->ioctl(VIDIOC_QBUF, &videoIn->buf);
+				if (ret < 0) {
+					LOGE("StartStreaming: VIDIOC_QBUF Failed");
+					return ret;
+				}
+				nQueued++;
+			}
+		}
+		
+        type = (enum v4l2_buf_type)videoIn->bufType;
 
-        ret = ioctl (fd, VIDIOC_STREAMON, &type);
+        ret = dev->ioctl(VIDIOC_STREAMON, &type);
         if (ret < 0) {
             LOGE("StartStreaming: Unable to start capture: %s", strerror(errno));
             return ret;
         }
+		m_StreamStarts++;
+		
+		/* Record the session, if requested */
+		if (!m_RawDumpFile.isEmpty()) {
+			m_RawDump.open(m_RawDumpFile.string(), 
+				SinglePlanarFormat(videoIn->format.fmt.pix.pixelformat),
+				videoIn->format.fmt.pix.width, videoIn->format.fmt.pix.height,
+				videoIn->format.fmt.pix.bytesperline, getFps());
+		}
 
         videoIn->isStreaming = true;
     }
@@ -516,20 +910,45 @@ int V4L2Camera::StopStreaming ()
     int ret;
 
     if (videoIn->isStreaming) {
-        type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        type = (enum v4l2_buf_type)videoIn->bufType;
 
-        ret = ioctl (fd, VIDIOC_STREAMOFF, &type);
+        ret = dev->ioctl(VIDIOC_STREAMOFF, &type);
         if (ret < 0) {
             LOGE("StopStreaming: Unable to stop capture: %s", strerror(errno));
             return ret;
         }
 
+		/* All the buffers were returned to us */
+		nQueued = 0;
+		nDequeued = 0;
         videoIn->isStreaming = false;
+		
+		m_RawDump.close();
     }
 
     return 0;
 }
 
+void V4L2Camera::setRawDumpFile(const char* path)
+{
+	m_RawDumpFile.setTo(path ? path : "");
+}
+
+/* Single planar equivalent of a pixel format, used to record frames of
+ * multi-planar formats with their planes back to back */
+int V4L2Camera::SinglePlanarFormat(int pixfmt)
+{
+	switch (pixfmt) {
+		case V4L2_PIX_FMT_YUV420M:	return V4L2_PIX_FMT_YUV420;
+		case V4L2_PIX_FMT_YVU420M:	return V4L2_PIX_FMT_YVU420;
+		case V4L2_PIX_FMT_NV12M:	return V4L2_PIX_FMT_NV12;
+		case V4L2_PIX_FMT_NV21M:	return V4L2_PIX_FMT_NV21;
+		case V4L2_PIX_FMT_NV16M:	return V4L2_PIX_FMT_NV16;
+		case V4L2_PIX_FMT_NV61M:	return V4L2_PIX_FMT_NV61;
+	}
+	return pixfmt;
+}
+
 /* Returns the effective capture size */
 void V4L2Camera::getSize(int& width, int& height) const
 {
@@ -543,29 +962,182 @@ int V4L2Camera::getFps() const
 	return videoIn->params.parm.capture.timeperframe.denominator;
 }
 
+/* Issue a format ioctl (VIDIOC_TRY_FMT, VIDIOC_S_FMT or VIDIOC_G_FMT) on
+ * videoIn->format. When using the multi-planar API, the format is translated
+ * to it and back, so the rest of the code can keep using the single planar 
+ * description. The bytes per line of each plane are stored apart */
+int V4L2Camera::FormatIoctl(int request)
+{
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if (videoIn->bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		struct v4l2_format mp;
+		memset(&mp,0,sizeof(mp));
+		mp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		mp.fmt.pix_mp.width = videoIn->format.fmt.pix.width;
+		mp.fmt.pix_mp.height = videoIn->format.fmt.pix.height;
+		mp.fmt.pix_mp.pixelformat = videoIn->format.fmt.pix.pixelformat;
+		mp.fmt.pix_mp.field = V4L2_FIELD_ANY;
+		
+		int ret = dev->ioctl(request, &mp);
+		if (ret < 0)
+			return ret;
+			
+		int numPlanes = mp.fmt.pix_mp.num_planes;
+		if (numPlanes < 1 || numPlanes > CAP_MAX_PLANES) {
+			LOGE("Unsupported number of planes: %d", numPlanes);
+			errno = EINVAL;
+			return -1;
+		}
+		
+		memset(&videoIn->format,0,sizeof(videoIn->format));
+		videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		videoIn->format.fmt.pix.width = mp.fmt.pix_mp.width;
+		videoIn->format.fmt.pix.height = mp.fmt.pix_mp.height;
+		videoIn->format.fmt.pix.pixelformat = mp.fmt.pix_mp.pixelformat;
+		videoIn->format.fmt.pix.field = mp.fmt.pix_mp.field;
+		videoIn->format.fmt.pix.colorspace = mp.fmt.pix_mp.colorspace;
+		videoIn->format.fmt.pix.bytesperline = mp.fmt.pix_mp.plane_fmt[0].bytesperline;
+		for (int p = 0; p < numPlanes; p++) {
+			videoIn->planeStride[p] = mp.fmt.pix_mp.plane_fmt[p].bytesperline;
+			videoIn->format.fmt.pix.sizeimage += mp.fmt.pix_mp.plane_fmt[p].sizeimage;
+		}
+		videoIn->numPlanes = numPlanes;
+		return ret;
+	}
+#endif
+
+	videoIn->numPlanes = 1;
+	return dev->ioctl(request, &videoIn->format);
+}
+
+/* Prepare videoIn->buf to query, queue or dequeue a buffer */
+void V4L2Camera::PrepareBuffer(int index)
+{
+	memset(&videoIn->buf,0,sizeof(videoIn->buf));
+	videoIn->buf.index = index;
+	videoIn->buf.type = videoIn->bufType;
+	videoIn->buf.memory = V4L2_MEMORY_MMAP;
+	
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if (videoIn->bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		memset(videoIn->planes,0,sizeof(videoIn->planes));
+		videoIn->buf.m.planes = videoIn->planes;
+		videoIn->buf.length = videoIn->numPlanes;
+	}
+#endif
+}
+
+/* Locate the planes of a dequeued frame. If the device stores all of them
+ * in a single buffer, the chroma planes follow the luma plane, with the 
+ * layout defined by the V4L2 spec for each format */
+void V4L2Camera::GetFramePlanes(int index, struct yuv_plane* planes)
+{
+	memset(planes, 0, sizeof(struct yuv_plane) * CAP_MAX_PLANES);
+	
+	if (videoIn->numPlanes > 1) {
+		for (int p = 0; p < videoIn->numPlanes; p++) {
+			planes[p].data = (uint8_t*)videoIn->mem[index][p];
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+			planes[p].data += videoIn->planes[p].data_offset;
+#endif
+			planes[p].stride = videoIn->planeStride[p];
+		}
+		return;
+	}
+	
+	int stride = videoIn->format.fmt.pix.bytesperline;
+	int height = videoIn->format.fmt.pix.height;
+	
+	planes[0].data = (uint8_t*)videoIn->mem[index][0];
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	if (videoIn->bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		planes[0].data += videoIn->planes[0].data_offset;
+#endif
+	planes[0].stride = stride;
+	
+	switch (videoIn->format.fmt.pix.pixelformat) 
+	{
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			planes[1].data = planes[0].data + stride * height;
+			planes[1].stride = stride >> 1;
+			planes[2].data = planes[1].data + (stride >> 1) * (height >> 1);
+			planes[2].stride = stride >> 1;
+			break;
+			
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV61:
+			planes[1].data = planes[0].data + stride * height;
+			planes[1].stride = stride;
+			break;
+	}
+}
+
 /* Grab frame in YUYV mode */
-void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
+bool V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize, struct yuyv_luma_stats* stats)
 {
 	LOG_FRAME("V4L2Camera::GrabRawFrame: frameBuffer:%p, len:%d",frameBuffer,maxSize);
+	CameraTraceScope trace("GrabRawFrame");
     int ret;
+	bool grabbed = false;
+	
+	// Start with empty stats, so they are never used if no frame is grabbed
+	if (stats)
+		yuyv_stats_begin(stats, videoIn->outWidth, videoIn->outHeight);
 
 	/* DQ */
-	memset(&videoIn->buf,0,sizeof(videoIn->buf));
-    videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    videoIn->buf.memory = V4L2_MEMORY_MMAP;
-	ret = ioctl(fd, VIDIOC_DQBUF, &videoIn->buf);
+	PrepareBuffer(0);
+	nsecs_t t0 = systemTime(SYSTEM_TIME_MONOTONIC);
+	CameraTrace::begin("VIDIOC_DQBUF");
+	ret = dev->ioctl(VIDIOC_DQBUF, &videoIn->buf);
+	CameraTrace::end();
     if (ret < 0) {
         LOGE("GrabPreviewFrame: VIDIOC_DQBUF Failed");
-        return;
+        return false;
     }
 
     nDequeued++;
 	
+	nsecs_t t1 = systemTime(SYSTEM_TIME_MONOTONIC);
+	if (m_Stats) {
+		m_Stats->addStage(CameraStats::STAGE_DQBUF, t1 - t0);
+		m_Stats->addFrame(videoIn->buf.sequence);
+	}
+	CameraTrace::counter("cameraFrame", videoIn->buf.sequence);
+	
 	// Calculate the stride of the output image (YUYV) in bytes
 	int strideOut = videoIn->outWidth << 1;
 	
-	// And the pointer to the start of the image
-	uint8_t* src = (uint8_t*)videoIn->mem[videoIn->buf.index] + videoIn->capCropOffset;
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	// The used size is reported per plane. Only compressed formats care
+	//  about it, and those always have a single plane
+	if (videoIn->bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		videoIn->buf.bytesused = videoIn->planes[0].bytesused - videoIn->planes[0].data_offset;
+#endif
+	
+	// Locate the planes of the image, and the start of the used region
+	struct yuv_plane planes[CAP_MAX_PLANES];
+	GetFramePlanes(videoIn->buf.index, planes);
+	
+	// Record the frame as delivered by the device, if requested
+	if (m_RawDump.isOpen()) {
+		void* data[CAP_MAX_PLANES];
+		size_t sizes[CAP_MAX_PLANES];
+		for (int p = 0; p < videoIn->numPlanes; p++) {
+			data[p] = planes[p].data;
+			sizes[p] = videoIn->buf.bytesused;
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+			if (videoIn->bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+				sizes[p] = videoIn->planes[p].bytesused - videoIn->planes[p].data_offset;
+#endif
+		}
+		m_RawDump.addFrame(videoIn->buf.timestamp, data, sizes, videoIn->numPlanes);
+	}
+	
+	planes[0].data += videoIn->capCropOffset;
+	uint8_t* src = planes[0].data;
 	
 	LOG_FRAME("V4L2Camera::GrabRawFrame - Got Raw frame (%dx%d) (buf:%d@0x%p, len:%d)",videoIn->format.fmt.pix.width,videoIn->format.fmt.pix.height,videoIn->buf.index,src,videoIn->buf.bytesused);
 	
@@ -576,156 +1148,278 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 		
 	} else {
 	
-		switch (videoIn->format.fmt.pix.pixelformat) 
-		{
-			case V4L2_PIX_FMT_JPEG:
-			case V4L2_PIX_FMT_MJPEG:
-				if(videoIn->buf.bytesused <= HEADERFRAME1) 
-				{
-					// Prevent crash on empty image
-					LOGE("Ignoring empty buffer ...\n");
-					break;
-				}
-
-				if (jpeg_decode((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight) < 0) 
-				{
-					LOGE("jpeg decode errors\n");
-					break;
-				}
-				break;
-			
-			case V4L2_PIX_FMT_UYVY:
-				uyvy_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							 src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_YVYU:
-				yvyu_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							 src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_YYUV:
-				yyuv_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							 src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_YUV420:
-				yuv420_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_YVU420:
-				yvu420_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_NV12:
-				nv12_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_NV21:
-				nv21_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_NV16:
-				nv16_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_NV61:
-				nv61_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_Y41P: 
-				y41p_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_GREY:
-				grey_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_Y16:
-				y16_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_SPCA501:
-				s501_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_SPCA505:
-				s505_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_SPCA508:
-				s508_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
-				break;
-			
-			case V4L2_PIX_FMT_YUYV:
-				{
-					int h;
-					uint8_t* pdst = (uint8_t*)frameBuffer;
-					uint8_t* psrc = src;
-					int ss = videoIn->outWidth << 1;
-					for (h = 0; h < videoIn->outHeight; h++) {
-						memcpy(pdst,psrc,ss);
-						pdst += strideOut;
-						psrc += videoIn->format.fmt.pix.bytesperline;
-					}
-				}
-				break;
-				
-			case V4L2_PIX_FMT_SGBRG8: //0
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 0);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_SGRBG8: //1
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 1);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_SBGGR8: //2
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 2);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_SRGGB8: //3
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 3);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_RGB24:
-				rgb_to_yuyv((uint8_t*) frameBuffer, strideOut, 
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
-				
-			case V4L2_PIX_FMT_BGR24:
-				bgr_to_yuyv((uint8_t*) frameBuffer, strideOut, 
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
-				break;
+		// Time of the end of the conversion
+		nsecs_t t2;
+		
+		if (videoIn->scaleBuffer == NULL) {
+		
+			// Convert directly to the output buffer
+			ConvertToYUYV((uint8_t*)frameBuffer, strideOut, planes, videoIn->outWidth, videoIn->outHeight, stats);
+			t2 = systemTime(SYSTEM_TIME_MONOTONIC);
 			
-			default:
-				LOGE("error grabbing: unknown format: %i\n", videoIn->format.fmt.pix.pixelformat);
-				break;
+		} else if (videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
+		
+			// No conversion needed. Scale directly from the captured frame
+			t2 = t1;
+			CameraTrace::begin("yuyv_scale");
+			yuyv_scale((uint8_t*)frameBuffer, strideOut, videoIn->outWidth, videoIn->outHeight,
+						src, videoIn->format.fmt.pix.bytesperline, videoIn->capWidth, videoIn->capHeight, stats);
+			CameraTrace::end();
+						
+		} else if (videoIn->capCanCrop) {
+		
+			// Convert the used region, then scale it
+			int scaleStride = videoIn->capWidth << 1;
+			ConvertToYUYV((uint8_t*)videoIn->scaleBuffer, scaleStride, planes, videoIn->capWidth, videoIn->capHeight, NULL);
+			t2 = systemTime(SYSTEM_TIME_MONOTONIC);
+			CameraTrace::begin("yuyv_scale");
+			yuyv_scale((uint8_t*)frameBuffer, strideOut, videoIn->outWidth, videoIn->outHeight,
+						(uint8_t*)videoIn->scaleBuffer, scaleStride, videoIn->capWidth, videoIn->capHeight, stats);
+			CameraTrace::end();
+						
+		} else {
+		
+			// Convert the full frame, then crop and scale it
+			int scaleStride = videoIn->format.fmt.pix.width << 1;
+			ConvertToYUYV((uint8_t*)videoIn->scaleBuffer, scaleStride, planes, 
+						videoIn->format.fmt.pix.width, videoIn->format.fmt.pix.height, NULL);
+			t2 = systemTime(SYSTEM_TIME_MONOTONIC);
+			CameraTrace::begin("yuyv_scale");
+			yuyv_scale((uint8_t*)frameBuffer, strideOut, videoIn->outWidth, videoIn->outHeight,
+						(uint8_t*)videoIn->scaleBuffer + videoIn->scaleCropOffset, scaleStride, 
+						videoIn->capWidth, videoIn->capHeight, stats);
+			CameraTrace::end();
+		}
+		
+		if (stats)
+			yuyv_stats_end(stats);
+		
+		if (m_Stats) {
+			bool scaled = videoIn->scaleBuffer != NULL;
+			if (!scaled || videoIn->format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV)
+				m_Stats->addConversion(videoIn->format.fmt.pix.pixelformat, t2 - t1);
+			if (scaled)
+				m_Stats->addStage(CameraStats::STAGE_SCALE, systemTime(SYSTEM_TIME_MONOTONIC) - t2);
 		}
 		
 		LOG_FRAME("V4L2Camera::GrabRawFrame - Copied frame to destination 0x%p",frameBuffer);
+		grabbed = true;
 	}
 	
 	/* And Queue the buffer again */
-    ret = ioctl(fd, VIDIOC_QBUF, &videoIn->buf);
+	CameraTrace::begin("VIDIOC_QBUF");
+    ret = dev->ioctl(VIDIOC_QBUF, &videoIn->buf);
+	CameraTrace::end();
     if (ret < 0) {
         LOGE("GrabPreviewFrame: VIDIOC_QBUF Failed");
-        return;
+        return grabbed;
     }
 
     nQueued++;
 	
 	LOG_FRAME("V4L2Camera::GrabRawFrame - Queued buffer");
+	return grabbed;
+}
 
+/* Name of the converter used for each capture format, for tracing */
+static const char* ConverterName(uint32_t pixfmt)
+{
+	switch (pixfmt) {
+		case V4L2_PIX_FMT_JPEG:
+		case V4L2_PIX_FMT_MJPEG:	return "jpeg_decode";
+		case V4L2_PIX_FMT_UYVY:		return "uyvy_to_yuyv";
+		case V4L2_PIX_FMT_YVYU:		return "yvyu_to_yuyv";
+		case V4L2_PIX_FMT_YYUV:		return "yyuv_to_yuyv";
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YUV420M:	return "yuv420_to_yuyv";
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_YVU420M:	return "yvu420_to_yuyv";
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV12M:	return "nv12_to_yuyv";
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_NV21M:	return "nv21_to_yuyv";
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV16M:	return "nv16_to_yuyv";
+		case V4L2_PIX_FMT_NV61:
+		case V4L2_PIX_FMT_NV61M:	return "nv61_to_yuyv";
+		case V4L2_PIX_FMT_Y41P:		return "y41p_to_yuyv";
+		case V4L2_PIX_FMT_GREY:		return "grey_to_yuyv";
+		case V4L2_PIX_FMT_Y16:		return "y16_to_yuyv";
+		case V4L2_PIX_FMT_SPCA501:	return "s501_to_yuyv";
+		case V4L2_PIX_FMT_SPCA505:	return "s505_to_yuyv";
+		case V4L2_PIX_FMT_SPCA508:	return "s508_to_yuyv";
+		case V4L2_PIX_FMT_YUYV:		return "yuyv_copy";
+		case V4L2_PIX_FMT_SGBRG8:
+		case V4L2_PIX_FMT_SGRBG8:
+		case V4L2_PIX_FMT_SBGGR8:
+		case V4L2_PIX_FMT_SRGGB8:	return "bayer_to_yuyv";
+		case V4L2_PIX_FMT_RGB24:	return "rgb_to_yuyv";
+		case V4L2_PIX_FMT_BGR24:	return "bgr_to_yuyv";
+	}
+	return "unknown_to_yuyv";
+}
+
+/* Convert a captured frame to YUYV */
+void V4L2Camera::ConvertToYUYV(uint8_t* dst, int dstStride, const struct yuv_plane* planes, int width, int height, struct yuyv_luma_stats* stats)
+{
+	uint8_t* src = planes[0].data;
+	int srcStride = planes[0].stride;
+	
+	CameraTraceScope trace(ConverterName(videoIn->format.fmt.pix.pixelformat));
+	
+	// If the converter gathered the luma stats by itself
+	bool gathered = false;
+	
+	switch (videoIn->format.fmt.pix.pixelformat) 
+	{
+		case V4L2_PIX_FMT_JPEG:
+		case V4L2_PIX_FMT_MJPEG:
+			if(videoIn->buf.bytesused <= HEADERFRAME1) 
+			{
+				// Prevent crash on empty image
+				LOGE("Ignoring empty buffer ...\n");
+				break;
+			}
+
+			if (jpeg_decode(dst, dstStride, src, width, height, stats) < 0) 
+			{
+				LOGE("jpeg decode errors\n");
+				break;
+			}
+			gathered = true;
+			break;
+		
+		case V4L2_PIX_FMT_UYVY:
+			uyvy_to_yuyv(dst, dstStride,
+						 src, srcStride, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_YVYU:
+			yvyu_to_yuyv(dst, dstStride,
+						 src, srcStride, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_YYUV:
+			yyuv_to_yuyv(dst, dstStride,
+						 src, srcStride, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YUV420M:
+			yuv420_to_yuyv(dst, dstStride, planes, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_YVU420M:
+			yvu420_to_yuyv(dst, dstStride, planes, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV12M:
+			nv12_to_yuyv(dst, dstStride, planes, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_NV21M:
+			nv21_to_yuyv(dst, dstStride, planes, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV16M:
+			nv16_to_yuyv(dst, dstStride, planes, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_NV61:
+		case V4L2_PIX_FMT_NV61M:
+			nv61_to_yuyv(dst, dstStride, planes, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_Y41P: 
+			y41p_to_yuyv(dst, dstStride, src, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_GREY:
+			grey_to_yuyv(dst, dstStride,
+						src, srcStride, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_Y16:
+			y16_to_yuyv(dst, dstStride,
+						src, srcStride, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_SPCA501:
+			s501_to_yuyv(dst, dstStride, src, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_SPCA505:
+			s505_to_yuyv(dst, dstStride, src, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_SPCA508:
+			s508_to_yuyv(dst, dstStride, src, width, height);
+			break;
+		
+		case V4L2_PIX_FMT_YUYV:
+			{
+				int h;
+				uint8_t* pdst = dst;
+				uint8_t* psrc = src;
+				int ss = width << 1;
+				for (h = 0; h < height; h++) {
+					memcpy(pdst,psrc,ss);
+					if (stats)
+						yuyv_stats_rows(stats, pdst, dstStride, h, 1);
+					pdst += dstStride;
+					psrc += srcStride;
+				}
+				gathered = true;
+			}
+			break;
+			
+		case V4L2_PIX_FMT_SGBRG8: //0
+			bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, width, height, 0);
+			rgb_to_yuyv (dst, dstStride, 
+						(uint8_t*)videoIn->tmpBuffer, width*3, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_SGRBG8: //1
+			bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, width, height, 1);
+			rgb_to_yuyv (dst, dstStride, 
+						(uint8_t*)videoIn->tmpBuffer, width*3, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_SBGGR8: //2
+			bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, width, height, 2);
+			rgb_to_yuyv (dst, dstStride, 
+						(uint8_t*)videoIn->tmpBuffer, width*3, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_SRGGB8: //3
+			bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, width, height, 3);
+			rgb_to_yuyv (dst, dstStride, 
+						(uint8_t*)videoIn->tmpBuffer, width*3, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_RGB24:
+			rgb_to_yuyv(dst, dstStride, 
+						src, srcStride, width, height);
+			break;
+			
+		case V4L2_PIX_FMT_BGR24:
+			bgr_to_yuyv(dst, dstStride, 
+						src, srcStride, width, height);
+			break;
+		
+		default:
+			LOGE("error grabbing: unknown format: %i\n", videoIn->format.fmt.pix.pixelformat);
+			break;
+	}
+	
+	// The other converters don't gather the stats. Account their output
+	//  right after writing it, while its last part is still in the cache
+	if (stats && !gathered)
+		yuyv_stats_rows(stats, dst, dstStride, 0, height);
 }
 
 /* enumerate frame intervals (fps)
@@ -748,7 +1442,7 @@ bool V4L2Camera::EnumFrameIntervals(int pixfmt, int width, int height)
 	fival.height = height;
 	
 	LOGD("\tTime interval between frame: ");
-	while (ioctl(fd,VIDIOC_ENUM_FRAMEINTERVALS, &fival) >=0 ) 
+	while (dev->ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &fival) >=0 ) 
 	{
 		fival.index++;
 		if (fival.type == V4L2_FRMIVAL_TYPE_DISCRETE) 
@@ -799,7 +1493,7 @@ bool V4L2Camera::EnumFrameSizes(int pixfmt)
 	memset(&fsize, 0, sizeof(fsize));
 	fsize.index = 0;
 	fsize.pixel_format = pixfmt;
-	while (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fsize) >= 0) 
+	while (dev->ioctl(VIDIOC_ENUM_FRAMESIZES, &fsize) >= 0) 
 	{
 		fsize.index++;
 		if (fsize.type == V4L2_FRMSIZE_TYPE_DISCRETE) 
@@ -858,23 +1552,27 @@ bool V4L2Camera::EnumFrameSizes(int pixfmt)
 			{320,240}
 		};
 		
+		/* Probe through FormatIoctl, as Init does, so multi-planar devices
+		   are handled too. Init negotiates videoIn->format again later */
 		unsigned int i;
 		for (i = 0 ; i < (sizeof(defMode) / sizeof(defMode[0])); i++) {
 		
 			fsizeind++;
-			struct v4l2_format fmt;
-			fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			fmt.fmt.pix.width = defMode[i].w;
-			fmt.fmt.pix.height = defMode[i].h;
-			fmt.fmt.pix.pixelformat = pixfmt;
-			fmt.fmt.pix.field = V4L2_FIELD_ANY;
+			memset(&videoIn->format,0,sizeof(videoIn->format));
+			videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			videoIn->format.fmt.pix.width = defMode[i].w;
+			videoIn->format.fmt.pix.height = defMode[i].h;
+			videoIn->format.fmt.pix.pixelformat = pixfmt;
+			videoIn->format.fmt.pix.field = V4L2_FIELD_ANY;
 			
-			if (ioctl(fd,VIDIOC_TRY_FMT, &fmt) >= 0) 
+			if (FormatIoctl(VIDIOC_TRY_FMT) >= 0) 
 			{
-				LOGD("{ ?GSPCA? : width = %u, height = %u }\n", fmt.fmt.pix.width, fmt.fmt.pix.height);
+				int w = videoIn->format.fmt.pix.width;
+				int h = videoIn->format.fmt.pix.height;
+				LOGD("{ ?GSPCA? : width = %u, height = %u }\n", w, h);
 
 				// Add the mode descriptor
-				m_AllFmts.add( SurfaceDesc( fmt.fmt.pix.width, fmt.fmt.pix.height, 25 ) );
+				m_AllFmts.add( SurfaceDesc( w, h, 25 ) );
 			}
 		}
 	}
@@ -898,9 +1596,9 @@ bool V4L2Camera::EnumFrameFormats()
 	
 	memset(&fmt, 0, sizeof(fmt));
 	fmt.index = 0;
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.type = videoIn->bufType;
 
-	while (ioctl(fd,VIDIOC_ENUM_FMT, &fmt) >= 0) 
+	while (dev->ioctl(VIDIOC_ENUM_FMT, &fmt) >= 0) 
 	{
 		fmt.index++;
 		LOGD("{ pixelformat = '%c%c%c%c', description = '%s' }",
@@ -914,7 +1612,15 @@ bool V4L2Camera::EnumFrameFormats()
 		}
 	};
 	
-	// Now, select the best preview format and the best PictureFormat
+	SelectBestFormats();
+	
+	return true;
+} 
+
+/* Select the best preview format and the best picture format out of
+ * all the available modes */
+void V4L2Camera::SelectBestFormats()
+{
 	m_BestPreviewFmt = SurfaceDesc();
 	m_BestPictureFmt = SurfaceDesc();
 	
@@ -939,9 +1645,7 @@ bool V4L2Camera::EnumFrameFormats()
 		}
 		
 	}
-	
-	return true;
-} 
+}
 
 SortedVector<SurfaceSize> V4L2Camera::getAvailableSizes() const
 {
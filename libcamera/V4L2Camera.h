@@ -10,6 +10,7 @@
 #define _V4L2CAMERA_H
 
 #define NB_BUFFER 4
+#define CAP_MAX_PLANES 3				// Maximum number of memory planes of a captured frame
 
 #include <binder/MemoryBase.h>
 #include <binder/MemoryHeapBase.h>
@@ -18,6 +19,12 @@ extern "C" {
 #include "uvc_compat.h"
 };
 #include "SurfaceDesc.h"
+#include "V4L2Device.h"
+#include "V4L2Replay.h"
+#include "CameraStats.h"
+
+struct yuv_plane;
+struct yuyv_luma_stats;
 
 namespace android {
 
@@ -29,17 +36,41 @@ struct vdIn {
 	struct v4l2_streamparm params;  		// v4l2 stream parameters struct
 	struct v4l2_jpegcompression jpegcomp;	// v4l2 jpeg compression settings 
 	
-    void *mem[NB_BUFFER];
+	int bufType;							// V4L2_BUF_TYPE_VIDEO_CAPTURE, or V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+	int numPlanes;							// Memory planes of each buffer. Always 1 unless multi-planar
+	int planeStride[CAP_MAX_PLANES];		// Bytes per line of each memory plane (multi-planar only)
+#ifdef V4L2_CAP_VIDEO_CAPTURE_MPLANE
+	struct v4l2_plane planes[CAP_MAX_PLANES];	// Planes of buf, when multi-planar
+#endif
+	
+    void *mem[NB_BUFFER][CAP_MAX_PLANES];
+	size_t memLength[NB_BUFFER][CAP_MAX_PLANES];	// Length of each mapped plane
     bool isStreaming;
 	
 	void* tmpBuffer;
+	void* scaleBuffer;						// YUYV intermediate buffer, used when scaling the output
 	
 	int outWidth;							// Requested Output width 
 	int outHeight;							// Requested Output height
 	int outFrameSize;						// The expected output framesize (in YUYV)
 	int capBytesPerPixel;					// Capture bytes per pixel
+	int capCanCrop;							// If the capture format can be cropped just by offsetting into it
+	int capWidth;							// Width of the region of the captured frame being used
+	int capHeight;							// Height of the region of the captured frame being used
 	int capCropOffset;						// The offset in bytes to add to the captured buffer to get to the first pixel
+	int scaleCropOffset;					// The offset in bytes to add to the scale buffer to get to the first pixel
 	
+	int hwCropApi;							// How the device crops in hardware (HWCROP_xxx)
+	struct v4l2_rect cropBounds;			// Area of the sensor that can be captured
+	struct v4l2_rect cropDefault;			// Area captured by default (the full frame of the modes)
+	bool hwCrop;							// If the device is currently cropping in hardware
+};
+
+/* APIs the device can be asked to crop (and scale) through */
+enum {
+	HWCROP_NONE = 0,						// Only software cropping
+	HWCROP_SELECTION,						// VIDIOC_S_SELECTION
+	HWCROP_CROP								// VIDIOC_S_CROP
 };
 
 class V4L2Camera {
@@ -50,14 +81,30 @@ public:
 
     int Open (const char *device);
     void Close ();
+	bool isOpen() const { return dev != NULL; }
 
     int Init (int width, int height, int fps);
     void Uninit ();
+	
+	int Configure (int width, int height, int fps, bool allowScale);
 
     int StartStreaming ();
     int StopStreaming ();
+	
+	/* Times the streaming was started. Tells if a call restarted it */
+	uint32_t getStreamStarts() const { return m_StreamStarts; }
 
-    void GrabRawFrame (void *frameBuffer,int maxSize);
+	/* Grab a frame, converted to YUYV. If stats is not NULL, the luma stats
+	   of the frame are gathered during the conversion. Returns false if no
+	   frame was written, leaving the stats empty */
+    bool GrabRawFrame (void *frameBuffer,int maxSize, struct yuyv_luma_stats* stats = NULL);
+	
+	/* Record the raw frames of the following streaming sessions into the
+	   given file, so they can be replayed later. NULL stops recording */
+	void setRawDumpFile(const char* path);
+	
+	/* Where to account the capture and conversion times. NULL disables it */
+	void setStats(CameraStats* stats) { m_Stats = stats; }
     
 	void getSize(int& width, int& height) const;
 	int getFps() const;  	
@@ -68,14 +115,26 @@ public:
 	const SurfaceDesc& getBestPictureFmt() const; 	
 	
 private:
+	bool FindClosestMode(int width, int height, int fps, SurfaceDesc& closest) const;
+	int SetupOutputGeometry(int width, int height, bool scale);
+	void ProbeHardwareCrop();
+	bool SetHardwareCrop(struct v4l2_rect& rect);
+	bool SetupHardwareCrop(int width, int height, const SurfaceDesc& mode);
+	void ResetHardwareCrop();
+	int FormatIoctl(int request);
+	void PrepareBuffer(int index);
+	void GetFramePlanes(int index, struct yuv_plane* planes);
+	static int SinglePlanarFormat(int pixfmt);
+	void ConvertToYUYV(uint8_t* dst, int dstStride, const struct yuv_plane* src, int width, int height, struct yuyv_luma_stats* stats);
 	bool EnumFrameIntervals(int pixfmt, int width, int height);
 	bool EnumFrameSizes(int pixfmt);
 	bool EnumFrameFormats(); 
+	void SelectBestFormats();
 	int saveYUYVtoJPEG(uint8_t* src, uint8_t* dst, int maxsize, int width, int height, int quality);
 	
 private:
     struct vdIn *videoIn;
-    int fd;
+    V4L2Device* dev;							// Capture backend. NULL if not open
 
     int nQueued;
     int nDequeued;
@@ -83,6 +142,12 @@ private:
 	SortedVector<SurfaceDesc> m_AllFmts;		// Available video modes
 	SurfaceDesc m_BestPreviewFmt;				// Best preview mode. maximum fps with biggest frame
 	SurfaceDesc m_BestPictureFmt;				// Best picture format. maximum size
+	SurfaceDesc m_CurMode;						// Mode the device is currently configured to
+	bool m_Configured;							// If the device has been configured by Init()
+	String8 m_RawDumpFile;						// Where to record the raw frames, if not empty
+	V4L2Recorder m_RawDump;
+	CameraStats* m_Stats;						// Pipeline stats, or NULL
+	uint32_t m_StreamStarts;					// Times the streaming was started
  	
 };
 
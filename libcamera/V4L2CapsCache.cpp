@@ -0,0 +1,197 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#define LOG_TAG "V4L2CapsCache"
+#include <utils/Log.h>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+};
+
+#include "V4L2CapsCache.h"
+
+namespace android {
+
+Mutex V4L2CapsCache::sLock;
+bool V4L2CapsCache::sLoaded = false;
+KeyedVector<String8, SortedVector<SurfaceDesc> > V4L2CapsCache::sCache;
+
+/* Reads the first line of a sysfs attribute, without the trailing newline */
+static bool readSysfsAttr(const char* path, char* value, int size)
+{
+	FILE* f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	bool ok = fgets(value, size, f) != NULL;
+	fclose(f);
+	if (ok) {
+		value[strcspn(value, "\r\n")] = 0;
+	}
+	return ok;
+}
+
+String8 V4L2CapsCache::makeKey(const char* device, const struct v4l2_capability& cap)
+{
+	// Get the name of the node (video0, video1, ...)
+	const char* node = strrchr(device, '/');
+	node = (node) ? node + 1 : device;
+
+	// The device link of the video4linux class points to the USB interface,
+	//  the vendor and product ids are stored in the parent USB device
+	char path[128];
+	char vid[16] = "";
+	char pid[16] = "";
+	snprintf(path, sizeof(path), "/sys/class/video4linux/%s/device/../idVendor", node);
+	readSysfsAttr(path, vid, sizeof(vid));
+	snprintf(path, sizeof(path), "/sys/class/video4linux/%s/device/../idProduct", node);
+	readSysfsAttr(path, pid, sizeof(pid));
+
+	String8 key;
+	key.appendFormat("%s:%s|%s|%s|%s|%08x",
+		vid, pid,
+		(const char*)cap.bus_info, (const char*)cap.card, (const char*)cap.driver,
+		cap.version);
+
+	// Make sure the key can be stored as a single line
+	char* p = key.lockBuffer(key.size());
+	for (; *p; p++) {
+		if (*p == '\n' || *p == '\r' || *p == ']')
+			*p = ' ';
+	}
+	key.unlockBuffer();
+
+	return key;
+}
+
+bool V4L2CapsCache::lookup(const String8& key, SortedVector<SurfaceDesc>& fmts)
+{
+	Mutex::Autolock lock(sLock);
+	loadLocked();
+
+	ssize_t idx = sCache.indexOfKey(key);
+	if (idx < 0) {
+		LOGD("No cached modes for '%s'", key.string());
+		return false;
+	}
+
+	fmts = sCache.valueAt(idx);
+	LOGD("Using %d cached modes for '%s'", fmts.size(), key.string());
+	return true;
+}
+
+void V4L2CapsCache::store(const String8& key, const SortedVector<SurfaceDesc>& fmts)
+{
+	// Never cache a failed enumeration
+	if (fmts.isEmpty())
+		return;
+
+	Mutex::Autolock lock(sLock);
+	loadLocked();
+
+	sCache.add(key, fmts);
+	saveLocked();
+}
+
+/* The cache file is a plain text file with the following layout:
+ *
+ *  [key]
+ *  widthxheight@fps
+ *  ...
+ */
+void V4L2CapsCache::loadLocked()
+{
+	if (sLoaded)
+		return;
+	sLoaded = true;
+
+	FILE* f = fopen(V4L2_CAPS_CACHE_FILE, "r");
+	if (!f) {
+		LOGD("No modes cache file found");
+		return;
+	}
+
+	char line[256];
+	String8 key;
+	SortedVector<SurfaceDesc> fmts;
+	bool haveKey = false;
+
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+
+		if (line[0] == '[') {
+			// Store the previous entry, if any
+			if (haveKey && !fmts.isEmpty())
+				sCache.add(key, fmts);
+
+			char* end = strrchr(line, ']');
+			if (end) *end = 0;
+			key.setTo(line + 1);
+			fmts.clear();
+			haveKey = true;
+		} else {
+			int w, h, fps;
+			if (haveKey && sscanf(line, "%dx%d@%d", &w, &h, &fps) == 3 &&
+				w > 0 && h > 0 && fps > 0) {
+				fmts.add(SurfaceDesc(w, h, fps));
+			}
+		}
+	}
+
+	if (haveKey && !fmts.isEmpty())
+		sCache.add(key, fmts);
+
+	fclose(f);
+
+	LOGD("Loaded modes of %d devices from cache", sCache.size());
+}
+
+void V4L2CapsCache::saveLocked()
+{
+	// Write to a temporary file and rename it, so a crash never leaves
+	//  a truncated cache behind
+	String8 tmpName(V4L2_CAPS_CACHE_FILE ".tmp");
+	FILE* f = fopen(tmpName.string(), "w");
+	if (!f) {
+		LOGE("Unable to write modes cache %s", tmpName.string());
+		return;
+	}
+
+	for (size_t i = 0; i < sCache.size(); i++) {
+		fprintf(f, "[%s]\n", sCache.keyAt(i).string());
+		const SortedVector<SurfaceDesc>& fmts = sCache.valueAt(i);
+		for (size_t j = 0; j < fmts.size(); j++) {
+			fprintf(f, "%dx%d@%d\n", fmts[j].getWidth(), fmts[j].getHeight(), fmts[j].getFps());
+		}
+	}
+
+	fclose(f);
+
+	if (rename(tmpName.string(), V4L2_CAPS_CACHE_FILE) < 0) {
+		LOGE("Unable to replace modes cache %s", V4L2_CAPS_CACHE_FILE);
+		unlink(tmpName.string());
+	}
+}
+
+}; // namespace android
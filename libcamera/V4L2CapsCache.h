@@ -0,0 +1,73 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef __V4L2CAPSCACHE_H
+#define __V4L2CAPSCACHE_H
+
+#include <utils/KeyedVector.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+extern "C" {
+#include "uvc_compat.h"
+};
+#include "SurfaceDesc.h"
+
+// File used to persist the enumerated video modes across processes/boots
+#define V4L2_CAPS_CACHE_FILE	"/data/misc/camera/v4l2_caps.cache"
+
+namespace android {
+
+/* Cache of the video modes enumerated from each V4L2 device.
+ *
+ * Enumerating all the frame formats, sizes and intervals of an UVC camera
+ * takes lots of ioctls, each one of them a USB control transfer. As the
+ * modes a device supports never change, we keep them both in memory (shared
+ * by all the V4L2Camera instances of the process) and in a small file, so
+ * they survive mediaserver restarts and reboots.
+ *
+ * Entries are keyed by the USB VID:PID of the device (when available), its
+ * bus info, card name and driver version, so plugging a different camera
+ * into the same port, or updating the driver, never reuses stale modes.
+ */
+class V4L2CapsCache {
+public:
+	/* Builds the cache key of the device opened as 'device' */
+	static String8 makeKey(const char* device, const struct v4l2_capability& cap);
+
+	/* Retrieves the modes of a device. Returns false if not cached */
+	static bool lookup(const String8& key, SortedVector<SurfaceDesc>& fmts);
+
+	/* Stores the modes of a device, and persists them */
+	static void store(const String8& key, const SortedVector<SurfaceDesc>& fmts);
+
+private:
+	static void loadLocked();
+	static void saveLocked();
+
+	static Mutex sLock;
+	static bool sLoaded;
+	static KeyedVector<String8, SortedVector<SurfaceDesc> > sCache;
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,103 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#define LOG_TAG "V4L2Device"
+#include <utils/Log.h>
+
+extern "C" {
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+};
+
+#include "V4L2Device.h"
+#include "V4L2Replay.h"
+
+namespace android {
+
+#define REPLAY_PREFIX		"replay:"
+#define REPLAY_FAST_PREFIX	"replay-fast:"
+
+V4L2Device* V4L2Device::create(const char* device)
+{
+	if (!strncmp(device, REPLAY_PREFIX, strlen(REPLAY_PREFIX)))
+		return new V4L2ReplayDevice(true);
+	if (!strncmp(device, REPLAY_FAST_PREFIX, strlen(REPLAY_FAST_PREFIX)))
+		return new V4L2ReplayDevice(false);
+	return new V4L2NodeDevice();
+}
+
+bool V4L2Device::isNodeName(const char* device)
+{
+	return strncmp(device, REPLAY_PREFIX, strlen(REPLAY_PREFIX)) &&
+		   strncmp(device, REPLAY_FAST_PREFIX, strlen(REPLAY_FAST_PREFIX));
+}
+
+V4L2NodeDevice::V4L2NodeDevice()
+	: fd(-1)
+{
+}
+
+V4L2NodeDevice::~V4L2NodeDevice()
+{
+	close();
+}
+
+int V4L2NodeDevice::open(const char* device)
+{
+	close();
+	fd = ::open(device, O_RDWR);
+	return (fd < 0) ? -1 : 0;
+}
+
+void V4L2NodeDevice::close()
+{
+	if (fd >= 0)
+		::close(fd);
+	fd = -1;
+}
+
+int V4L2NodeDevice::ioctl(unsigned int request, void* arg)
+{
+	int ret;
+	
+	/* Retry if interrupted by a signal */
+	do {
+		ret = ::ioctl(fd, request, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+void* V4L2NodeDevice::mmap(size_t length, off_t offset)
+{
+	return ::mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+}
+
+int V4L2NodeDevice::munmap(void* addr, size_t length)
+{
+	return ::munmap(addr, length);
+}
+
+}; // namespace android
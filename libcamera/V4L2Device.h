@@ -0,0 +1,85 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef __V4L2DEVICE_H
+#define __V4L2DEVICE_H
+
+#include <sys/types.h>
+
+namespace android {
+
+/* Capture backend used by V4L2Camera.
+ *
+ * V4L2Camera talks to the device only through ioctl() and mmap(), so the
+ * source of the frames can be replaced by anything implementing the subset
+ * of the V4L2 API it uses. The default backend is a V4L2 device node. 
+ *
+ * The device names understood by create() are:
+ *   /dev/videoN          - A V4L2 device node
+ *   replay:<file>        - Frames recorded with V4L2Recorder, delivered at
+ *                          the recorded cadence
+ *   replay-fast:<file>   - The same, but delivered as fast as they are 
+ *                          dequeued, for benchmarking
+ *
+ * All the methods follow the conventions of the system calls they replace:
+ * They return -1 and set errno on errors.
+ */
+class V4L2Device {
+public:
+	virtual ~V4L2Device() {}
+
+	virtual int open(const char* device) = 0;
+	virtual void close() = 0;
+	virtual int ioctl(unsigned int request, void* arg) = 0;
+	virtual void* mmap(size_t length, off_t offset) = 0;	// MAP_FAILED on error
+	virtual int munmap(void* addr, size_t length) = 0;
+	
+	/* If this is a real device node, that can be found in sysfs */
+	virtual bool isNode() const = 0;
+
+	/* Creates the backend able to open the given device name */
+	static V4L2Device* create(const char* device);
+	
+	/* If create() would open the given device name as a device node */
+	static bool isNodeName(const char* device);
+};
+
+/* A V4L2 device node */
+class V4L2NodeDevice : public V4L2Device {
+public:
+	V4L2NodeDevice();
+	virtual ~V4L2NodeDevice();
+
+	virtual int open(const char* device);
+	virtual void close();
+	virtual int ioctl(unsigned int request, void* arg);
+	virtual void* mmap(size_t length, off_t offset);
+	virtual int munmap(void* addr, size_t length);
+	virtual bool isNode() const { return true; }
+	
+private:
+	int fd;
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,470 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#define LOG_TAG "V4L2Replay"
+#include <utils/Log.h>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "v4l2_formats.h"
+};
+
+#include "V4L2Replay.h"
+
+namespace android {
+
+// Most buffers a replay device will allocate
+#define REPLAY_MAX_BUFFERS	16
+
+static int64_t nowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+V4L2ReplayDevice::V4L2ReplayDevice(bool paced)
+	: mFile(NULL), mPaced(paced), mBufferSize(0), mStreaming(false), 
+	  mNextFrame(0), mClockBase(0), mSequence(0)
+{
+	memset(&mHeader, 0, sizeof(mHeader));
+}
+
+V4L2ReplayDevice::~V4L2ReplayDevice()
+{
+	close();
+}
+
+int V4L2ReplayDevice::fail(int err)
+{
+	errno = err;
+	return -1;
+}
+
+/* Opens a recording, and indexes all its frames */
+int V4L2ReplayDevice::open(const char* device)
+{
+	close();
+	
+	// Skip the replay:/replay-fast: prefix
+	const char* path = strchr(device, ':');
+	path = (path) ? path + 1 : device;
+	
+	mFile = fopen(path, "rb");
+	if (!mFile) {
+		LOGE("Unable to open recording %s: %s", path, strerror(errno));
+		return -1;
+	}
+	
+	if (fread(&mHeader, sizeof(mHeader), 1, mFile) != 1 ||
+		mHeader.magic != V4L2_REPLAY_MAGIC ||
+		mHeader.version != V4L2_REPLAY_VERSION ||
+		mHeader.width == 0 || mHeader.height == 0) {
+		LOGE("%s is not a valid recording", path);
+		close();
+		return fail(EINVAL);
+	}
+	if (mHeader.fps == 0)
+		mHeader.fps = 30;
+	
+	// Index the frames. A truncated last frame is ignored
+	size_t maxSize = 0;
+	struct v4l2_replay_frame fh;
+	while (fread(&fh, sizeof(fh), 1, mFile) == 1) {
+		Frame f;
+		f.offset = ftello(mFile);
+		f.timestamp = fh.timestamp;
+		f.size = fh.size;
+		if (fseeko(mFile, fh.size, SEEK_CUR) < 0)
+			break;
+		mFrames.add(f);
+		if (fh.size > maxSize)
+			maxSize = fh.size;
+	}
+	
+	// Check the real end of the file: fseeko allows seeking past it
+	fseeko(mFile, 0, SEEK_END);
+	off_t end = ftello(mFile);
+	while (!mFrames.isEmpty() && 
+		   mFrames[mFrames.size() - 1].offset + (off_t)mFrames[mFrames.size() - 1].size > end) {
+		mFrames.removeAt(mFrames.size() - 1);
+	}
+	
+	if (mFrames.isEmpty()) {
+		LOGE("Recording %s has no frames", path);
+		close();
+		return fail(EINVAL);
+	}
+	
+	// Uncompressed frames always take the full image size
+	size_t imageSize = mHeader.bytesperline * mHeader.height;
+	if (maxSize < imageSize)
+		maxSize = imageSize;
+		
+	long page = sysconf(_SC_PAGESIZE);
+	mBufferSize = (maxSize + page - 1) & ~(page - 1);
+	mName.setTo(path);
+	
+	LOGI("Replaying %s: '%c%c%c%c' %dx%d@%d, %d frames%s", path,
+		mHeader.pixelformat & 0xFF, (mHeader.pixelformat >> 8) & 0xFF,
+		(mHeader.pixelformat >> 16) & 0xFF, (mHeader.pixelformat >> 24) & 0xFF,
+		mHeader.width, mHeader.height, mHeader.fps, mFrames.size(),
+		mPaced ? "" : ", unpaced");
+	return 0;
+}
+
+void V4L2ReplayDevice::close()
+{
+	freeBuffers();
+	mFrames.clear();
+	mStreaming = false;
+	if (mFile)
+		fclose(mFile);
+	mFile = NULL;
+}
+
+void V4L2ReplayDevice::freeBuffers()
+{
+	for (size_t i = 0; i < mBuffers.size(); i++)
+		free(mBuffers[i]);
+	mBuffers.clear();
+	mQueued.clear();
+}
+
+void V4L2ReplayDevice::fillFormat(struct v4l2_format* fmt) const
+{
+	memset(&fmt->fmt.pix, 0, sizeof(fmt->fmt.pix));
+	fmt->fmt.pix.width = mHeader.width;
+	fmt->fmt.pix.height = mHeader.height;
+	fmt->fmt.pix.pixelformat = mHeader.pixelformat;
+	fmt->fmt.pix.field = V4L2_FIELD_NONE;
+	fmt->fmt.pix.bytesperline = mHeader.bytesperline;
+	fmt->fmt.pix.sizeimage = mBufferSize;
+}
+
+int V4L2ReplayDevice::ioctl(unsigned int request, void* arg)
+{
+	if (!mFile)
+		return fail(EBADF);
+		
+	switch (request) {
+		case VIDIOC_QUERYCAP: {
+			struct v4l2_capability* cap = (struct v4l2_capability*)arg;
+			memset(cap, 0, sizeof(*cap));
+			const char* base = strrchr(mName.string(), '/');
+			base = (base) ? base + 1 : mName.string();
+			strncpy((char*)cap->driver, "replay", sizeof(cap->driver) - 1);
+			strncpy((char*)cap->card, base, sizeof(cap->card) - 1);
+			snprintf((char*)cap->bus_info, sizeof(cap->bus_info), "replay:%s", mName.string());
+			cap->version = V4L2_REPLAY_VERSION;
+			cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+			return 0;
+		}
+		
+		case VIDIOC_ENUM_FMT: {
+			struct v4l2_fmtdesc* fd = (struct v4l2_fmtdesc*)arg;
+			if (fd->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || fd->index != 0)
+				return fail(EINVAL);
+			fd->pixelformat = mHeader.pixelformat;
+			fd->flags = (mHeader.pixelformat == V4L2_PIX_FMT_MJPEG ||
+						 mHeader.pixelformat == V4L2_PIX_FMT_JPEG) ? V4L2_FMT_FLAG_COMPRESSED : 0;
+			snprintf((char*)fd->description, sizeof(fd->description), "Replay");
+			return 0;
+		}
+		
+		case VIDIOC_ENUM_FRAMESIZES: {
+			struct v4l2_frmsizeenum* fs = (struct v4l2_frmsizeenum*)arg;
+			if (fs->index != 0 || fs->pixel_format != mHeader.pixelformat)
+				return fail(EINVAL);
+			fs->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+			fs->discrete.width = mHeader.width;
+			fs->discrete.height = mHeader.height;
+			return 0;
+		}
+		
+		case VIDIOC_ENUM_FRAMEINTERVALS: {
+			struct v4l2_frmivalenum* fi = (struct v4l2_frmivalenum*)arg;
+			if (fi->index != 0 || fi->pixel_format != mHeader.pixelformat ||
+				fi->width != mHeader.width || fi->height != mHeader.height)
+				return fail(EINVAL);
+			fi->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+			fi->discrete.numerator = 1;
+			fi->discrete.denominator = mHeader.fps;
+			return 0;
+		}
+		
+		case VIDIOC_TRY_FMT:
+		case VIDIOC_S_FMT: {
+			struct v4l2_format* fmt = (struct v4l2_format*)arg;
+			// Like a strict driver, refuse pixel formats it can't produce
+			if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || 
+				fmt->fmt.pix.pixelformat != mHeader.pixelformat)
+				return fail(EINVAL);
+			if (request == VIDIOC_S_FMT && !mBuffers.isEmpty())
+				return fail(EBUSY);
+			fillFormat(fmt);
+			return 0;
+		}
+		
+		case VIDIOC_G_FMT: {
+			struct v4l2_format* fmt = (struct v4l2_format*)arg;
+			if (fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				return fail(EINVAL);
+			fillFormat(fmt);
+			return 0;
+		}
+		
+		case VIDIOC_S_PARM:
+		case VIDIOC_G_PARM: {
+			struct v4l2_streamparm* parm = (struct v4l2_streamparm*)arg;
+			if (parm->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				return fail(EINVAL);
+			memset(&parm->parm.capture, 0, sizeof(parm->parm.capture));
+			parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+			parm->parm.capture.timeperframe.numerator = 1;
+			parm->parm.capture.timeperframe.denominator = mHeader.fps;
+			return 0;
+		}
+		
+		case VIDIOC_REQBUFS:
+			return requestBuffers((struct v4l2_requestbuffers*)arg);
+		
+		case VIDIOC_QUERYBUF:
+		case VIDIOC_QBUF: {
+			struct v4l2_buffer* buf = (struct v4l2_buffer*)arg;
+			if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || 
+				buf->memory != V4L2_MEMORY_MMAP ||
+				buf->index >= mBuffers.size())
+				return fail(EINVAL);
+			if (request == VIDIOC_QBUF) {
+				for (size_t i = 0; i < mQueued.size(); i++) {
+					if (mQueued[i] == (int)buf->index)
+						return fail(EINVAL);
+				}
+				mQueued.add(buf->index);
+			} else {
+				buf->length = mBufferSize;
+				buf->m.offset = buf->index * mBufferSize;
+			}
+			return 0;
+		}
+		
+		case VIDIOC_DQBUF:
+			return dequeue((struct v4l2_buffer*)arg);
+			
+		case VIDIOC_STREAMON:
+			if (mBuffers.isEmpty())
+				return fail(EINVAL);
+			if (!mStreaming) {
+				// Always start from the first frame, so runs are repeatable
+				mStreaming = true;
+				mNextFrame = 0;
+				mSequence = 0;
+				mClockBase = nowUs();
+			}
+			return 0;
+			
+		case VIDIOC_STREAMOFF:
+			// All the buffers are returned to the application
+			mStreaming = false;
+			mQueued.clear();
+			return 0;
+	}
+	
+	// Anything else (controls, cropping, JPEG compression...) is unsupported
+	return fail(EINVAL);
+}
+
+int V4L2ReplayDevice::requestBuffers(struct v4l2_requestbuffers* rb)
+{
+	if (rb->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || rb->memory != V4L2_MEMORY_MMAP)
+		return fail(EINVAL);
+	if (mStreaming)
+		return fail(EBUSY);
+		
+	freeBuffers();
+	
+	unsigned int count = rb->count;
+	if (count > REPLAY_MAX_BUFFERS)
+		count = REPLAY_MAX_BUFFERS;
+	for (unsigned int i = 0; i < count; i++) {
+		void* mem = calloc(1, mBufferSize);
+		if (!mem) {
+			freeBuffers();
+			return fail(ENOMEM);
+		}
+		mBuffers.add(mem);
+	}
+	rb->count = count;
+	return 0;
+}
+
+int V4L2ReplayDevice::dequeue(struct v4l2_buffer* buf)
+{
+	if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || !mStreaming || mQueued.isEmpty())
+		return fail(EINVAL);
+		
+	const Frame& f = mFrames[mNextFrame];
+	
+	// Wait until the frame is due
+	if (mPaced) {
+		int64_t wait = mClockBase + (f.timestamp - mFrames[0].timestamp) - nowUs();
+		if (wait > 0)
+			usleep(wait);
+	}
+	
+	int index = mQueued[0];
+	mQueued.removeAt(0);
+	
+	size_t size = f.size;
+	if (size > mBufferSize)
+		size = mBufferSize;
+	if (fseeko(mFile, f.offset, SEEK_SET) < 0 ||
+		fread(mBuffers[index], 1, size, mFile) != size) {
+		LOGE("Unable to read frame %d of the recording", (int)mNextFrame);
+		size = 0;
+	}
+		
+	int64_t now = nowUs();
+	memset(buf, 0, sizeof(*buf));
+	buf->index = index;
+	buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf->memory = V4L2_MEMORY_MMAP;
+	buf->bytesused = size;
+	buf->length = mBufferSize;
+	buf->m.offset = index * mBufferSize;
+	buf->flags = V4L2_BUF_FLAG_DONE;
+	buf->field = V4L2_FIELD_NONE;
+	buf->timestamp.tv_sec = now / 1000000;
+	buf->timestamp.tv_usec = now % 1000000;
+	buf->sequence = mSequence++;
+	
+	// At the end of the recording, start over, one frame period after the last frame
+	if (++mNextFrame >= mFrames.size()) {
+		mNextFrame = 0;
+		mClockBase += mFrames[mFrames.size() - 1].timestamp - mFrames[0].timestamp +
+					  1000000 / mHeader.fps;
+	}
+	return 0;
+}
+
+void* V4L2ReplayDevice::mmap(size_t length, off_t offset)
+{
+	size_t index = offset / mBufferSize;
+	if (mBufferSize == 0 || (offset % mBufferSize) != 0 || 
+		index >= mBuffers.size() || length > mBufferSize) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	return mBuffers[index];
+}
+
+int V4L2ReplayDevice::munmap(void* addr, size_t length)
+{
+	// Buffers are owned by the device, and released with REQBUFS or close
+	return 0;
+}
+
+V4L2Recorder::V4L2Recorder()
+	: mFile(NULL), mFirstTimestamp(0), mFrames(0)
+{
+}
+
+V4L2Recorder::~V4L2Recorder()
+{
+	close();
+}
+
+bool V4L2Recorder::open(const char* path, int pixelformat, int width, int height, int bytesperline, int fps)
+{
+	close();
+	
+	mFile = fopen(path, "wb");
+	if (!mFile) {
+		LOGE("Unable to create recording %s: %s", path, strerror(errno));
+		return false;
+	}
+	
+	struct v4l2_replay_header h;
+	memset(&h, 0, sizeof(h));
+	h.magic = V4L2_REPLAY_MAGIC;
+	h.version = V4L2_REPLAY_VERSION;
+	h.pixelformat = pixelformat;
+	h.width = width;
+	h.height = height;
+	h.bytesperline = bytesperline;
+	h.fps = fps;
+	if (fwrite(&h, sizeof(h), 1, mFile) != 1) {
+		LOGE("Unable to write recording %s", path);
+		close();
+		return false;
+	}
+	
+	mFrames = 0;
+	LOGI("Recording raw frames to %s", path);
+	return true;
+}
+
+void V4L2Recorder::close()
+{
+	if (!mFile)
+		return;
+	fclose(mFile);
+	mFile = NULL;
+	LOGI("Recorded %u raw frames", mFrames);
+}
+
+void V4L2Recorder::addFrame(const struct timeval& timestamp, void* const* planes, const size_t* sizes, int count)
+{
+	if (!mFile)
+		return;
+		
+	int64_t ts = (int64_t)timestamp.tv_sec * 1000000LL + timestamp.tv_usec;
+	if (mFrames == 0)
+		mFirstTimestamp = ts;
+		
+	struct v4l2_replay_frame fh;
+	memset(&fh, 0, sizeof(fh));
+	fh.timestamp = ts - mFirstTimestamp;
+	for (int p = 0; p < count; p++)
+		fh.size += sizes[p];
+		
+	bool ok = fwrite(&fh, sizeof(fh), 1, mFile) == 1;
+	for (int p = 0; ok && p < count; p++)
+		ok = fwrite(planes[p], 1, sizes[p], mFile) == sizes[p];
+		
+	// Stop recording on the first error, probably out of space
+	if (!ok) {
+		LOGE("Unable to write frame %u, recording stopped", mFrames);
+		close();
+		return;
+	}
+	mFrames++;
+}
+
+}; // namespace android
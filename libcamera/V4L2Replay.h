@@ -0,0 +1,127 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+#ifndef __V4L2REPLAY_H
+#define __V4L2REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+extern "C" {
+#include "uvc_compat.h"
+};
+#include "V4L2Device.h"
+
+/* Recorded streams are stored as a header, followed by the frames, each
+ * one prefixed by a frame header. All the fields are in host byte order.
+ * Frames are stored exactly as the device delivered them (MJPEG, YUYV, 
+ * NV12, Bayer, ...). Frames of multi-planar formats are stored with
+ * their planes back to back, as the equivalent single planar format */
+#define V4L2_REPLAY_MAGIC		0x524c3456	/* "V4LR" */
+#define V4L2_REPLAY_VERSION		1
+
+struct v4l2_replay_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pixelformat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesperline;
+	uint32_t fps;				// Nominal frame rate
+	uint32_t reserved;
+};
+
+struct v4l2_replay_frame {
+	int64_t timestamp;			// Microseconds since the first frame
+	uint32_t size;				// Bytes of frame data that follow
+	uint32_t reserved;
+};
+
+namespace android {
+
+/* Replays a recorded stream, behaving as a V4L2 device able to capture
+ * only the recorded mode. When the end of the recording is reached, it 
+ * starts over. If paced, frames are delivered at the recorded cadence,
+ * otherwise as soon as they are dequeued */
+class V4L2ReplayDevice : public V4L2Device {
+public:
+	V4L2ReplayDevice(bool paced);
+	virtual ~V4L2ReplayDevice();
+
+	virtual int open(const char* device);
+	virtual void close();
+	virtual int ioctl(unsigned int request, void* arg);
+	virtual void* mmap(size_t length, off_t offset);
+	virtual int munmap(void* addr, size_t length);
+	virtual bool isNode() const { return false; }
+
+private:
+	struct Frame {
+		off_t offset;			// Offset of the frame data into the file
+		int64_t timestamp;
+		uint32_t size;
+	};
+	
+	void fillFormat(struct v4l2_format* fmt) const;
+	int requestBuffers(struct v4l2_requestbuffers* rb);
+	int dequeue(struct v4l2_buffer* buf);
+	void freeBuffers();
+	static int fail(int err);
+	
+	FILE* mFile;
+	bool mPaced;
+	String8 mName;
+	struct v4l2_replay_header mHeader;
+	Vector<Frame> mFrames;
+	size_t mBufferSize;			// Size of each buffer: The biggest frame, page aligned
+	Vector<void*> mBuffers;
+	Vector<int> mQueued;		// Queued buffers, in queueing order
+	bool mStreaming;
+	size_t mNextFrame;
+	int64_t mClockBase;			// When the first frame of the recording is due, in us
+	uint32_t mSequence;
+};
+
+/* Records the frames captured from a device, so they can be replayed 
+ * later by V4L2ReplayDevice */
+class V4L2Recorder {
+public:
+	V4L2Recorder();
+	~V4L2Recorder();
+
+	bool open(const char* path, int pixelformat, int width, int height, int bytesperline, int fps);
+	void close();
+	bool isOpen() const { return mFile != NULL; }
+	
+	/* Appends a frame, given as its planes, that are stored back to back */
+	void addFrame(const struct timeval& timestamp, void* const* planes, const size_t* sizes, int count);
+
+private:
+	FILE* mFile;
+	int64_t mFirstTimestamp;
+	unsigned int mFrames;
+};
+
+}; // namespace android
+
+#endif
@@ -0,0 +1,568 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+/* Host benchmark of the pixel format converters and the JPEG codecs.
+ *
+ * Every kernel is run on a synthetic frame of each one of the standard
+ * sizes, both with packed and with padded rows, and the best time of
+ * several runs is reported as MPix/s (of source pixels). The bytes per
+ * pixel column is the image traffic each kernel must do (bytes read plus
+ * bytes written, padding excluded), and the cycles per pixel are read
+ * from the CPU cycle counter when the kernel allows it.
+ *
+ * Results can be stored as a baseline (-w) and later runs compared against
+ * it (-b): Kernels slower than the baseline by more than the tolerance are
+ * flagged, and the exit status is 1.
+ */
+
+#define LOG_TAG "CameraBench"
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+};
+
+#include "Converter.h"
+#include "Utils.h"
+
+#define BENCH_MAX_WIDTH		1920
+#define BENCH_MAX_HEIGHT	1088
+#define BENCH_ROW_PAD		96		// Bytes added to each row when padding
+#define BENCH_BUF_SIZE		((BENCH_MAX_WIDTH * 4 + BENCH_ROW_PAD) * BENCH_MAX_HEIGHT * 2)
+#define BENCH_JPEG_QUALITY	85
+
+/* Standard sizes, from QCIF to 1080p */
+static const struct {
+	const char* name;
+	int width;
+	int height;
+} benchSizes[] = {
+	{ "QCIF",	176,	144 },
+	{ "QVGA",	320,	240 },
+	{ "CIF",	352,	288 },
+	{ "VGA",	640,	480 },
+	{ "SVGA",	800,	600 },
+	{ "720p",	1280,	720 },
+	{ "1080p",	1920,	1080 },
+};
+
+/* How the source of a kernel must be filled */
+enum {
+	SRC_PACKED,			// Single plane, rows of width * srcPixBytes bytes
+	SRC_RAW,			// Single plane, srcBpp bytes per pixel, no row stride
+	SRC_YUV420P,		// Y, then 2 quarter size chroma planes
+	SRC_NV420,			// Y, then an interleaved half height chroma plane
+	SRC_NV422,			// Y, then an interleaved full height chroma plane
+	SRC_JPEG			// A JPEG image, made with yuyv_to_jpeg
+};
+
+/* A frame to run a kernel on */
+struct BenchFrame {
+	int width;
+	int height;
+	uint8_t* src;
+	int srcStride;				// Of the first plane
+	struct yuv_plane planes[3];
+	uint8_t* dst;
+	int dstStride;				// Of the first plane
+	uint8_t* dst2;				// Second destination, for the fan-out
+	int dst2Stride;
+	int jpegSize;				// Size of the last JPEG image made or decoded
+};
+
+struct BenchKernel {
+	const char* name;
+	int srcFmt;					// SRC_xxx
+	int srcPixBytes;			// Bytes per pixel of the first source plane
+	float srcBpp;				// Bytes per pixel read
+	int dstPixBytes;			// Bytes per pixel of the first destination plane
+	float dstBpp;				// Bytes per pixel written
+	void (*run)(BenchFrame& f);
+};
+
+/* Kernels */
+static void run_yuyv_to_yvu420sp(BenchFrame& f) { yuyv_to_yvu420sp(f.dst, f.dstStride, f.height, f.src, f.srcStride, f.width, f.height); }
+static void run_yuyv_to_yvu420p(BenchFrame& f) { yuyv_to_yvu420p(f.dst, f.dstStride, f.height, f.src, f.srcStride, f.width, f.height); }
+static void run_yuyv_to_yuv420p(BenchFrame& f) { yuyv_to_yuv420p(f.dst, f.dstStride, f.height, f.src, f.srcStride, f.width, f.height); }
+static void run_yuyv_to_yvu422p(BenchFrame& f) { yuyv_to_yvu422p(f.dst, f.dstStride, f.height, f.src, f.srcStride, f.width, f.height); }
+static void run_yuyv_scale(BenchFrame& f) { yuyv_scale(f.dst, f.dstStride, (f.width >> 1) & ~1, (f.height >> 1) & ~1, f.src, f.srcStride, f.width, f.height); }
+static void run_yuyv_to_rgb565(BenchFrame& f) { yuyv_to_rgb565(f.src, f.srcStride, f.dst, f.dstStride, f.width, f.height); }
+static void run_yuyv_to_rgb24(BenchFrame& f) { yuyv_to_rgb24(f.src, f.srcStride, f.dst, f.dstStride, f.width, f.height); }
+static void run_yuyv_to_rgb32(BenchFrame& f) { yuyv_to_rgb32(f.src, f.srcStride, f.dst, f.dstStride, f.width, f.height); }
+static void run_yuyv_to_bgr24(BenchFrame& f) { yuyv_to_bgr24(f.src, f.srcStride, f.dst, f.dstStride, f.width, f.height); }
+static void run_yuyv_to_bgr32(BenchFrame& f) { yuyv_to_bgr32(f.src, f.srcStride, f.dst, f.dstStride, f.width, f.height); }
+
+#define LINE_KERNEL(fn) \
+static void run_##fn(BenchFrame& f) { \
+	for (int y = 0; y < f.height; y++) \
+		fn(f.src + y * f.srcStride, f.dst + y * f.dstStride, f.width); \
+}
+LINE_KERNEL(yuyv_to_rgb565_line)
+LINE_KERNEL(yuyv_to_rgb24_line)
+LINE_KERNEL(yuyv_to_rgb32_line)
+LINE_KERNEL(yuyv_to_bgr32_line)
+
+/* Fan-out as used by the preview: NV21 callback plus RGB565 window */
+static void run_yuyv_fanout(BenchFrame& f)
+{
+	struct yuyv_fanout_dst d[2];
+	memset(d, 0, sizeof(d));
+	d[0].fmt = YUYV_FANOUT_YVU420SP;
+	d[0].dst = f.dst;
+	d[0].dstStride = f.dstStride;
+	d[0].dstHeight = f.height;
+	d[0].width = f.width;
+	d[0].height = f.height;
+	d[1].fmt = YUYV_FANOUT_RGB565;
+	d[1].dst = f.dst2;
+	d[1].dstStride = f.dst2Stride;
+	d[1].dstHeight = f.height;
+	d[1].width = f.width;
+	d[1].height = f.height;
+	yuyv_fanout(f.src, f.srcStride, f.width, f.height, d, 2);
+}
+
+/* Fan-out to a single NV21 destination, rotated 90 degrees */
+static void run_yuyv_fanout_rot90(BenchFrame& f)
+{
+	struct yuyv_fanout_dst d;
+	memset(&d, 0, sizeof(d));
+	d.fmt = YUYV_FANOUT_YVU420SP;
+	d.dst = f.dst;
+	d.dstStride = f.height + (f.dstStride - f.width);
+	d.dstHeight = f.width;
+	d.width = f.width;
+	d.height = f.height;
+	d.transform = YUYV_ROTATE_90;
+	yuyv_fanout(f.src, f.srcStride, f.width, f.height, &d, 1);
+}
+
+static void run_yuv420_to_yuyv(BenchFrame& f) { yuv420_to_yuyv(f.dst, f.dstStride, f.planes, f.width, f.height); }
+static void run_yvu420_to_yuyv(BenchFrame& f) { yvu420_to_yuyv(f.dst, f.dstStride, f.planes, f.width, f.height); }
+static void run_nv12_to_yuyv(BenchFrame& f) { nv12_to_yuyv(f.dst, f.dstStride, f.planes, f.width, f.height); }
+static void run_nv21_to_yuyv(BenchFrame& f) { nv21_to_yuyv(f.dst, f.dstStride, f.planes, f.width, f.height); }
+static void run_nv16_to_yuyv(BenchFrame& f) { nv16_to_yuyv(f.dst, f.dstStride, f.planes, f.width, f.height); }
+static void run_nv61_to_yuyv(BenchFrame& f) { nv61_to_yuyv(f.dst, f.dstStride, f.planes, f.width, f.height); }
+static void run_y16_to_yuyv(BenchFrame& f) { y16_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+static void run_yyuv_to_yuyv(BenchFrame& f) { yyuv_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+static void run_uyvy_to_yuyv(BenchFrame& f) { uyvy_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+static void run_yvyu_to_yuyv(BenchFrame& f) { yvyu_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+static void run_y41p_to_yuyv(BenchFrame& f) { y41p_to_yuyv(f.dst, f.dstStride, f.src, f.width, f.height); }
+static void run_grey_to_yuyv(BenchFrame& f) { grey_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+static void run_s501_to_yuyv(BenchFrame& f) { s501_to_yuyv(f.dst, f.dstStride, f.src, f.width, f.height); }
+static void run_s505_to_yuyv(BenchFrame& f) { s505_to_yuyv(f.dst, f.dstStride, f.src, f.width, f.height); }
+static void run_s508_to_yuyv(BenchFrame& f) { s508_to_yuyv(f.dst, f.dstStride, f.src, f.width, f.height); }
+static void run_bayer_to_rgb24(BenchFrame& f) { bayer_to_rgb24(f.src, f.dst, f.width, f.height, 0); }
+static void run_rgb_to_yuyv(BenchFrame& f) { rgb_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+static void run_bgr_to_yuyv(BenchFrame& f) { bgr_to_yuyv(f.dst, f.dstStride, f.src, f.srcStride, f.width, f.height); }
+
+static void run_yuyv_to_jpeg(BenchFrame& f)
+{
+	f.jpegSize = yuyv_to_jpeg(f.src, f.dst, BENCH_BUF_SIZE, f.width, f.height, f.srcStride, 
+							  f.width, f.height, BENCH_JPEG_QUALITY, YUYV_ROTATE_0);
+}
+
+static void run_jpeg_decode(BenchFrame& f) { jpeg_decode(f.dst, f.dstStride, f.src, f.width, f.height); }
+
+static const BenchKernel benchKernels[] = {
+	{ "yuyv_to_yvu420sp",		SRC_PACKED,	2, 2.0f,	1, 1.5f,	run_yuyv_to_yvu420sp },
+	{ "yuyv_to_yvu420p",		SRC_PACKED,	2, 2.0f,	1, 1.5f,	run_yuyv_to_yvu420p },
+	{ "yuyv_to_yuv420p",		SRC_PACKED,	2, 2.0f,	1, 1.5f,	run_yuyv_to_yuv420p },
+	{ "yuyv_to_yvu422p",		SRC_PACKED,	2, 2.0f,	1, 2.0f,	run_yuyv_to_yvu422p },
+	{ "yuyv_scale",				SRC_PACKED,	2, 2.0f,	2, 0.5f,	run_yuyv_scale },
+	{ "yuyv_fanout",			SRC_PACKED,	2, 2.0f,	1, 3.5f,	run_yuyv_fanout },
+	{ "yuyv_fanout_rot90",		SRC_PACKED,	2, 2.0f,	1, 1.5f,	run_yuyv_fanout_rot90 },
+	{ "yuyv_to_rgb565",			SRC_PACKED,	2, 2.0f,	2, 2.0f,	run_yuyv_to_rgb565 },
+	{ "yuyv_to_rgb24",			SRC_PACKED,	2, 2.0f,	3, 3.0f,	run_yuyv_to_rgb24 },
+	{ "yuyv_to_rgb32",			SRC_PACKED,	2, 2.0f,	4, 4.0f,	run_yuyv_to_rgb32 },
+	{ "yuyv_to_bgr24",			SRC_PACKED,	2, 2.0f,	3, 3.0f,	run_yuyv_to_bgr24 },
+	{ "yuyv_to_bgr32",			SRC_PACKED,	2, 2.0f,	4, 4.0f,	run_yuyv_to_bgr32 },
+	{ "yuyv_to_rgb565_line",	SRC_PACKED,	2, 2.0f,	2, 2.0f,	run_yuyv_to_rgb565_line },
+	{ "yuyv_to_rgb24_line",		SRC_PACKED,	2, 2.0f,	3, 3.0f,	run_yuyv_to_rgb24_line },
+	{ "yuyv_to_rgb32_line",		SRC_PACKED,	2, 2.0f,	4, 4.0f,	run_yuyv_to_rgb32_line },
+	{ "yuyv_to_bgr32_line",		SRC_PACKED,	2, 2.0f,	4, 4.0f,	run_yuyv_to_bgr32_line },
+	{ "yuv420_to_yuyv",			SRC_YUV420P,1, 1.5f,	2, 2.0f,	run_yuv420_to_yuyv },
+	{ "yvu420_to_yuyv",			SRC_YUV420P,1, 1.5f,	2, 2.0f,	run_yvu420_to_yuyv },
+	{ "nv12_to_yuyv",			SRC_NV420,	1, 1.5f,	2, 2.0f,	run_nv12_to_yuyv },
+	{ "nv21_to_yuyv",			SRC_NV420,	1, 1.5f,	2, 2.0f,	run_nv21_to_yuyv },
+	{ "nv16_to_yuyv",			SRC_NV422,	1, 2.0f,	2, 2.0f,	run_nv16_to_yuyv },
+	{ "nv61_to_yuyv",			SRC_NV422,	1, 2.0f,	2, 2.0f,	run_nv61_to_yuyv },
+	{ "y16_to_yuyv",			SRC_PACKED,	2, 2.0f,	2, 2.0f,	run_y16_to_yuyv },
+	{ "yyuv_to_yuyv",			SRC_PACKED,	2, 2.0f,	2, 2.0f,	run_yyuv_to_yuyv },
+	{ "uyvy_to_yuyv",			SRC_PACKED,	2, 2.0f,	2, 2.0f,	run_uyvy_to_yuyv },
+	{ "yvyu_to_yuyv",			SRC_PACKED,	2, 2.0f,	2, 2.0f,	run_yvyu_to_yuyv },
+	{ "y41p_to_yuyv",			SRC_RAW,	0, 1.5f,	2, 2.0f,	run_y41p_to_yuyv },
+	{ "grey_to_yuyv",			SRC_PACKED,	1, 1.0f,	2, 2.0f,	run_grey_to_yuyv },
+	{ "s501_to_yuyv",			SRC_RAW,	0, 1.5f,	2, 2.0f,	run_s501_to_yuyv },
+	{ "s505_to_yuyv",			SRC_RAW,	0, 1.5f,	2, 2.0f,	run_s505_to_yuyv },
+	{ "s508_to_yuyv",			SRC_RAW,	0, 1.5f,	2, 2.0f,	run_s508_to_yuyv },
+	{ "bayer_to_rgb24",			SRC_RAW,	0, 1.0f,	0, 3.0f,	run_bayer_to_rgb24 },
+	{ "rgb_to_yuyv",			SRC_PACKED,	3, 3.0f,	2, 2.0f,	run_rgb_to_yuyv },
+	{ "bgr_to_yuyv",			SRC_PACKED,	3, 3.0f,	2, 2.0f,	run_bgr_to_yuyv },
+	{ "yuyv_to_jpeg",			SRC_PACKED,	2, 2.0f,	0, 0.0f,	run_yuyv_to_jpeg },
+	{ "jpeg_decode",			SRC_JPEG,	0, 0.0f,	2, 2.0f,	run_jpeg_decode },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Fills an area with a smooth pattern plus some noise, so it looks like
+ * a real image to the codecs, and is the same on every run */
+static void fillPattern(uint8_t* p, int stride, int rowBytes, int rows, uint32_t seed)
+{
+	uint32_t r = seed * 2654435761u + 1;
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < rowBytes; x++) {
+			r = r * 1103515245u + 12345u;
+			p[x] = (uint8_t)(((x * 3 + y * 5) >> 2) + ((r >> 16) & 15));
+		}
+		p += stride;
+	}
+}
+
+static int64_t nowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Opens a counter of the CPU cycles spent by this thread in user space,
+ * or returns -1 if the kernel or the CPU does not provide it */
+static int openCycleCounter()
+{
+#if defined(__linux__) && defined(__NR_perf_event_open)
+	struct perf_event_attr pe;
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_CPU_CYCLES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static int64_t readCycles(int fd)
+{
+	int64_t count = 0;
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+	return count;
+}
+
+/* Prepares the source of a kernel into f.src */
+static void setupSource(const BenchKernel& k, BenchFrame& f, int pad, uint8_t* scratch)
+{
+	int w = f.width;
+	int h = f.height;
+	memset(f.planes, 0, sizeof(f.planes));
+	
+	switch (k.srcFmt) {
+		case SRC_PACKED:
+			f.srcStride = w * k.srcPixBytes + pad;
+			fillPattern(f.src, f.srcStride, w * k.srcPixBytes, h, 1);
+			break;
+			
+		case SRC_RAW:
+			f.srcStride = 0;
+			fillPattern(f.src, 0, (int)(w * h * k.srcBpp), 1, 1);
+			break;
+			
+		case SRC_YUV420P:
+			f.srcStride = w + pad;
+			f.planes[0].data = f.src;
+			f.planes[0].stride = f.srcStride;
+			f.planes[1].data = f.planes[0].data + f.srcStride * h;
+			f.planes[1].stride = (w >> 1) + (pad >> 1);
+			f.planes[2].data = f.planes[1].data + f.planes[1].stride * (h >> 1);
+			f.planes[2].stride = f.planes[1].stride;
+			fillPattern(f.planes[0].data, f.planes[0].stride, w, h, 1);
+			fillPattern(f.planes[1].data, f.planes[1].stride, w >> 1, h >> 1, 2);
+			fillPattern(f.planes[2].data, f.planes[2].stride, w >> 1, h >> 1, 3);
+			break;
+			
+		case SRC_NV420:
+		case SRC_NV422: {
+			int ch = (k.srcFmt == SRC_NV420) ? (h >> 1) : h;
+			f.srcStride = w + pad;
+			f.planes[0].data = f.src;
+			f.planes[0].stride = f.srcStride;
+			f.planes[1].data = f.planes[0].data + f.srcStride * h;
+			f.planes[1].stride = f.srcStride;
+			fillPattern(f.planes[0].data, f.planes[0].stride, w, h, 1);
+			fillPattern(f.planes[1].data, f.planes[1].stride, w, ch, 2);
+			break;
+		}
+			
+		case SRC_JPEG:
+			// Compress a YUYV frame, that will be decoded again and again
+			fillPattern(scratch, w * 2, w * 2, h, 1);
+			f.srcStride = 0;
+			f.jpegSize = yuyv_to_jpeg(scratch, f.src, BENCH_BUF_SIZE, w, h, w * 2, 
+									  w, h, BENCH_JPEG_QUALITY, YUYV_ROTATE_0);
+			break;
+	}
+}
+
+/* A result, as stored into the baseline file */
+struct BenchResult {
+	char kernel[64];
+	char size[16];
+	char stride[16];
+	double mpix;
+};
+
+static BenchResult* loadBaseline(const char* path, int& count)
+{
+	count = 0;
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Unable to read baseline %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	
+	int max = 256;
+	BenchResult* res = (BenchResult*)malloc(max * sizeof(BenchResult));
+	char line[256];
+	while (res && fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		BenchResult r;
+		if (sscanf(line, "%63s %15s %15s %lf", r.kernel, r.size, r.stride, &r.mpix) != 4)
+			continue;
+		if (count == max) {
+			max *= 2;
+			res = (BenchResult*)realloc(res, max * sizeof(BenchResult));
+			if (!res)
+				break;
+		}
+		res[count++] = r;
+	}
+	fclose(f);
+	return res;
+}
+
+static const BenchResult* findResult(const BenchResult* res, int count, 
+	const char* kernel, const char* size, const char* stride)
+{
+	for (int i = 0; i < count; i++) {
+		if (!strcmp(res[i].kernel, kernel) && !strcmp(res[i].size, size) &&
+			!strcmp(res[i].stride, stride))
+			return &res[i];
+	}
+	return NULL;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr, 
+		"Usage: %s [options]\n"
+		"  -k <text>   Only run the kernels whose name contains text\n"
+		"  -s <size>   Only run the given size (QCIF, QVGA, CIF, VGA, SVGA, 720p, 1080p)\n"
+		"  -t <ms>     Minimum time to run each measurement (default 100)\n"
+		"  -w <file>   Store the results as a baseline\n"
+		"  -b <file>   Compare the results against a baseline\n"
+		"  -r <pct>    Slowdown against the baseline flagged as a regression (default 10)\n",
+		prog);
+}
+
+int main(int argc, char** argv)
+{
+	const char* kernelFilter = NULL;
+	const char* sizeFilter = NULL;
+	const char* savePath = NULL;
+	const char* basePath = NULL;
+	int minTimeMs = 100;
+	double tolerance = 10.0;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "k:s:t:w:b:r:h")) != -1) {
+		switch (opt) {
+			case 'k': kernelFilter = optarg; break;
+			case 's': sizeFilter = optarg; break;
+			case 't': minTimeMs = atoi(optarg); break;
+			case 'w': savePath = optarg; break;
+			case 'b': basePath = optarg; break;
+			case 'r': tolerance = atof(optarg); break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	
+	BenchResult* base = NULL;
+	int baseCount = 0;
+	if (basePath) {
+		base = loadBaseline(basePath, baseCount);
+		if (!base)
+			return 2;
+	}
+	
+	FILE* save = NULL;
+	if (savePath) {
+		save = fopen(savePath, "w");
+		if (!save) {
+			fprintf(stderr, "Unable to create %s: %s\n", savePath, strerror(errno));
+			return 2;
+		}
+		fprintf(save, "# kernel size stride MPix/s\n");
+	}
+	
+	BenchFrame f;
+	memset(&f, 0, sizeof(f));
+	f.src = (uint8_t*)malloc(BENCH_BUF_SIZE);
+	f.dst = (uint8_t*)malloc(BENCH_BUF_SIZE);
+	f.dst2 = (uint8_t*)malloc(BENCH_BUF_SIZE);
+	uint8_t* scratch = (uint8_t*)malloc(BENCH_BUF_SIZE);
+	if (!f.src || !f.dst || !f.dst2 || !scratch) {
+		fprintf(stderr, "Out of memory\n");
+		return 2;
+	}
+	
+	int cycleFd = openCycleCounter();
+	if (cycleFd < 0)
+		printf("# CPU cycle counter not available: cycles per pixel not reported\n");
+		
+	printf("%-22s %-6s %-7s %9s %6s %8s %9s\n", 
+		"kernel", "size", "stride", "MPix/s", "B/pix", "cyc/pix", "vs base");
+		
+	int regressions = 0;
+	for (unsigned int k = 0; k < ARRAY_SIZE(benchKernels); k++) {
+		const BenchKernel& kern = benchKernels[k];
+		if (kernelFilter && !strstr(kern.name, kernelFilter))
+			continue;
+			
+		for (unsigned int s = 0; s < ARRAY_SIZE(benchSizes); s++) {
+			if (sizeFilter && strcasecmp(sizeFilter, benchSizes[s].name))
+				continue;
+				
+			for (int padded = 0; padded < 2; padded++) {
+				int pad = padded ? BENCH_ROW_PAD : 0;
+				const char* strideName = padded ? "padded" : "packed";
+				
+				// Kernels without strides only run packed
+				if (padded && kern.srcPixBytes == 0 && kern.dstPixBytes == 0)
+					continue;
+				
+				f.width = benchSizes[s].width;
+				f.height = benchSizes[s].height;
+				f.dstStride = f.width * (kern.dstPixBytes ? kern.dstPixBytes : 2) + pad;
+				f.dst2Stride = f.width * 2 + pad;
+				setupSource(kern, f, pad, scratch);
+				
+				// Warm up the caches and the branch predictors
+				kern.run(f);
+				
+				// Run until the minimum time elapses, keeping the best run
+				int64_t best = -1;
+				int64_t total = 0;
+				int iterations = 0;
+				int64_t cycles0 = -1;
+				if (cycleFd >= 0) {
+					ioctl(cycleFd, PERF_EVENT_IOC_RESET, 0);
+					ioctl(cycleFd, PERF_EVENT_IOC_ENABLE, 0);
+					cycles0 = readCycles(cycleFd);
+				}
+				while (iterations < 3 || total < (int64_t)minTimeMs * 1000000LL) {
+					int64_t t0 = nowNs();
+					kern.run(f);
+					int64_t t = nowNs() - t0;
+					if (best < 0 || t < best)
+						best = t;
+					total += t;
+					iterations++;
+				}
+				int64_t cycles = -1;
+				if (cycleFd >= 0) {
+					int64_t cycles1 = readCycles(cycleFd);
+					ioctl(cycleFd, PERF_EVENT_IOC_DISABLE, 0);
+					if (cycles0 >= 0 && cycles1 >= 0)
+						cycles = cycles1 - cycles0;
+				}
+				
+				double pixels = (double)f.width * f.height;
+				double mpix = pixels / (best / 1000.0);
+				
+				// The JPEG traffic depends on how well the image compresses
+				float srcBpp = kern.srcBpp;
+				float dstBpp = kern.dstBpp;
+				if (kern.srcFmt == SRC_JPEG)
+					srcBpp = f.jpegSize / pixels;
+				else if (kern.run == run_yuyv_to_jpeg)
+					dstBpp = f.jpegSize / pixels;
+				
+				char cyc[16] = "-";
+				if (cycles >= 0)
+					snprintf(cyc, sizeof(cyc), "%.2f", cycles / (pixels * iterations));
+					
+				char vs[16] = "";
+				const BenchResult* b = findResult(base, baseCount, kern.name, benchSizes[s].name, strideName);
+				bool regressed = false;
+				if (b && b->mpix > 0) {
+					double delta = (mpix - b->mpix) * 100.0 / b->mpix;
+					snprintf(vs, sizeof(vs), "%+.1f%%", delta);
+					regressed = delta < -tolerance;
+					if (regressed)
+						regressions++;
+				}
+				
+				printf("%-22s %-6s %-7s %9.1f %6.2f %8s %9s%s\n",
+					kern.name, benchSizes[s].name, strideName, mpix, 
+					srcBpp + dstBpp, cyc, vs, regressed ? "  REGRESSION" : "");
+				fflush(stdout);
+				
+				if (save)
+					fprintf(save, "%s %s %s %.2f\n", kern.name, benchSizes[s].name, strideName, mpix);
+			}
+		}
+	}
+	
+	if (save)
+		fclose(save);
+	if (cycleFd >= 0)
+		close(cycleFd);
+	free(base);
+	free(f.src);
+	free(f.dst);
+	free(f.dst2);
+	free(scratch);
+	
+	if (regressions) {
+		printf("%d regressions (slower than the baseline by more than %.0f%%)\n", regressions, tolerance);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,2066 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011 Eduardo Jos� Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+/* Host correctness suite of the pixel format converters and JPEG codecs.
+ *
+ * Every converter is run on synthetic frames (smooth gradients, color bars
+ * and noise) and optionally on real frames taken from recordings made with
+ * debug.camera.raw_dump, at several sizes and with packed, odd and padded
+ * strides. Its output is checked against a reference model of the
+ * conversion, written for clarity and computed in floating point with
+ * proper rounding, within the stated bounds:
+ *
+ *  - Repacking between YUV layouts must be exact.
+ *  - Chroma averaged between rows may be off by one, as the converters
+ *    truncate instead of rounding.
+ *  - YUV to RGB may be off by the error of the 8 bit fixed point matrix.
+ *  - Resampled chroma, demosaiced bayer and JPEG images must stay above 
+ *    a minimum PSNR.
+ *
+ * Destination buffers are surrounded by guard bytes, and every byte outside
+ * the area a converter is expected to write must be left untouched, so
+ * stride, crop and offset errors are caught even when the image is right.
+ */
+
+#define LOG_TAG "CameraVerify"
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <jpeglib.h>
+};
+
+#include "Converter.h"
+#include "Utils.h"
+#include "V4L2Replay.h"
+#include "CameraMotion.h"
+
+#define VERIFY_GUARD		256			// Guard bytes around each destination buffer
+#define VERIFY_CANARY		0xA5		// Value of the untouched bytes
+#define VERIFY_MAX_FRAMES	4			// Frames taken from each recording
+
+/* Synthetic frame sizes. Not all of them suit every converter */
+static const struct {
+	int width;
+	int height;
+} verifySizes[] = {
+	{ 16,	16 },
+	{ 36,	20 },
+	{ 176,	144 },
+	{ 640,	480 },
+};
+
+/* Bytes added to the rows of the sources and destinations */
+static const int verifyPads[] = { 0, 3, 66 };
+
+/* Reference image, full resolution 4:4:4. Both pixels of each horizontal 
+ * pair share their chroma, so it can be stored as YUYV without loss */
+struct RefImage {
+	char name[64];
+	int width;
+	int height;
+	bool smooth;				// Without hard edges, so resampling is predictable
+	uint8_t* y;
+	uint8_t* u;
+	uint8_t* v;
+};
+
+/* Classes of the compared samples */
+enum {
+	CLS_SKIP,					// Padding, not compared
+	CLS_LUMA,
+	CLS_CHROMA,
+	CLS_RGB,
+	CLS_RGB565,					// Compared in units of the 565 component
+	CLS_COUNT
+};
+
+static const char* clsNames[CLS_COUNT] = { "-", "luma", "chroma", "rgb", "rgb565" };
+
+/* Allowed error of each class of samples */
+struct Bounds {
+	int maxErr[CLS_COUNT];		// Maximum absolute error, or -1 for any
+	double minPsnr[CLS_COUNT];	// Minimum PSNR, in dB
+};
+
+/* Exact, but chroma averaged between rows may be off by one */
+static const Bounds exactBounds = {
+	{ 0, 0, 1, 0, 0 },
+	{ 0, 0, 0, 0, 0 }
+};
+
+/* YUV to RGB through the 8 bit fixed point matrix */
+static const Bounds rgbBounds = {
+	{ 0, 0, 1, 3, 1 },
+	{ 0, 0, 0, 45, 0 }
+};
+
+/* Resampled images: luma is sampled exactly, chroma is approximated */
+static const Bounds resampleBounds = {
+	{ 0, 0, -1, -1, -1 },
+	{ 0, 0, 25, 25, 0 }
+};
+
+/* Demosaiced images */
+static const Bounds bayerBounds = {
+	{ 0, -1, -1, -1, -1 },
+	{ 0, 0, 0, 26, 0 }
+};
+
+/* JPEG images, against the source */
+static const Bounds jpegBounds = {
+	{ 0, -1, -1, -1, -1 },
+	{ 0, 34, 30, 0, 0 }
+};
+
+/* JPEG images, against libjpeg decoding the same file */
+static const Bounds decodeBounds = {
+	{ 0, 3, 3, -1, -1 },
+	{ 0, 45, 45, 0, 0 }
+};
+
+/* A buffer surrounded by guard bytes */
+struct Buffer {
+	uint8_t* base;
+	uint8_t* data;
+	int size;
+};
+
+static bool allocBuffer(Buffer& b, int size)
+{
+	b.size = size;
+	b.base = (uint8_t*)malloc(size + 2 * VERIFY_GUARD);
+	if (!b.base) {
+		b.data = NULL;
+		return false;
+	}
+	memset(b.base, VERIFY_CANARY, size + 2 * VERIFY_GUARD);
+	b.data = b.base + VERIFY_GUARD;
+	return true;
+}
+
+static void freeBuffer(Buffer& b)
+{
+	free(b.base);
+	b.base = b.data = NULL;
+}
+
+/* Allocates the output and the expected buffers of a check, or none */
+static bool allocBuffers(Buffer& out, Buffer& exp, int size)
+{
+	if (!allocBuffer(out, size))
+		return false;
+	if (!allocBuffer(exp, size)) {
+		freeBuffer(out);
+		return false;
+	}
+	return true;
+}
+
+/* A rectangular area of a buffer, and the class of each byte of its 
+ * pixels. The pattern is made of Y, U, V (or C), R, G, B, x (padding) 
+ * and 5 (a 16 bit RGB565 pixel) */
+struct Region {
+	int offset;
+	int stride;
+	int rowBytes;
+	int rows;
+	const char* pattern;
+};
+
+#define MAX_REGIONS 4
+
+/* Collects the results of all the checks */
+static int checksRun = 0;
+static int checksFailed = 0;
+static bool verbose = false;
+
+static double psnr(double sse, int count)
+{
+	if (count == 0 || sse == 0)
+		return 99.0;
+	return 10.0 * log10(255.0 * 255.0 * count / sse);
+}
+
+/* Compares the output of a converter against the expected one, and checks
+ * nothing was written outside the regions */
+static bool compare(const char* what, const Buffer& out, const Buffer& exp, 
+					const Region* regions, int count, const Bounds& bounds)
+{
+	double sse[CLS_COUNT];
+	int n[CLS_COUNT];
+	int maxErr[CLS_COUNT];
+	int firstX[CLS_COUNT], firstY[CLS_COUNT], firstR[CLS_COUNT];
+	memset(sse, 0, sizeof(sse));
+	memset(n, 0, sizeof(n));
+	memset(maxErr, 0, sizeof(maxErr));
+	
+	// Bytes of the buffer covered by the regions
+	uint8_t* inside = (uint8_t*)calloc(out.size + 2 * VERIFY_GUARD, 1);
+	if (!inside)
+		return false;
+	
+	for (int r = 0; r < count; r++) {
+		const Region& rg = regions[r];
+		int plen = strlen(rg.pattern);
+		for (int y = 0; y < rg.rows; y++) {
+			int off = rg.offset + y * rg.stride;
+			const uint8_t* a = out.data + off;
+			const uint8_t* e = exp.data + off;
+			memset(inside + VERIFY_GUARD + off, 1, rg.rowBytes);
+			
+			for (int x = 0; x < rg.rowBytes; x++) {
+				int cls, err;
+				switch (rg.pattern[x % plen]) {
+					case 'Y': cls = CLS_LUMA; break;
+					case 'U': case 'V': case 'C': cls = CLS_CHROMA; break;
+					case 'R': case 'G': case 'B': cls = CLS_RGB; break;
+					case '5': cls = CLS_RGB565; break;
+					default: cls = CLS_SKIP; break;
+				}
+				if (cls == CLS_SKIP)
+					continue;
+				
+				if (cls == CLS_RGB565) {
+					// Both bytes of the pixel at once
+					int pa = a[x] | (a[x + 1] << 8);
+					int pe = e[x] | (e[x + 1] << 8);
+					int dr = abs((pa >> 11) - (pe >> 11));
+					int dg = abs(((pa >> 5) & 63) - ((pe >> 5) & 63));
+					int db = abs((pa & 31) - (pe & 31));
+					err = dr > dg ? dr : dg;
+					if (db > err) err = db;
+					x++;
+				} else {
+					err = abs(a[x] - e[x]);
+				}
+				
+				if (err > maxErr[cls]) {
+					if (maxErr[cls] <= bounds.maxErr[cls] || bounds.maxErr[cls] < 0) {
+						firstX[cls] = x;
+						firstY[cls] = y;
+						firstR[cls] = r;
+					}
+					maxErr[cls] = err;
+				}
+				sse[cls] += (double)err * err;
+				n[cls]++;
+			}
+		}
+	}
+	
+	// Everything else must still hold the canary
+	int stray = -1;
+	for (int i = 0; i < out.size + 2 * VERIFY_GUARD; i++) {
+		if (!inside[i] && out.base[i] != VERIFY_CANARY) {
+			stray = i - VERIFY_GUARD;
+			break;
+		}
+	}
+	free(inside);
+	
+	bool ok = true;
+	checksRun++;
+	for (int cls = CLS_LUMA; cls < CLS_COUNT; cls++) {
+		if (!n[cls])
+			continue;
+		double p = psnr(sse[cls], n[cls]);
+		bool bad = (bounds.maxErr[cls] >= 0 && maxErr[cls] > bounds.maxErr[cls]) ||
+				   p < bounds.minPsnr[cls];
+		if (bad) {
+			printf("FAIL %s: %s max error %d (bound %d), PSNR %.1f dB (bound %.1f), "
+				"first at region %d x %d y %d\n", what, clsNames[cls], maxErr[cls], 
+				bounds.maxErr[cls], p, bounds.minPsnr[cls], firstR[cls], firstX[cls], firstY[cls]);
+			ok = false;
+		} else if (verbose) {
+			printf("  ok %s: %s max error %d, PSNR %.1f dB\n", what, clsNames[cls], maxErr[cls], p);
+		}
+	}
+	if (stray >= 0) {
+		printf("FAIL %s: byte %d written outside of the image (%s)\n", what, stray,
+			(stray < 0 || stray >= out.size) ? "guard" : "padding");
+		ok = false;
+	}
+	if (!ok)
+		checksFailed++;
+	return ok;
+}
+
+/* Reference color conversions, JFIF full range YCbCr */
+static inline uint8_t clamp8(double v)
+{
+	v = floor(v + 0.5);
+	return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static void refYuvToRgb(double y, double u, double v, uint8_t* rgb)
+{
+	rgb[0] = clamp8(y + 1.402 * (v - 128));
+	rgb[1] = clamp8(y - 0.344136 * (u - 128) - 0.714136 * (v - 128));
+	rgb[2] = clamp8(y + 1.772 * (u - 128));
+}
+
+static void refRgbToYuv(const uint8_t* rgb, double* y, double* u, double* v)
+{
+	*y =       0.299    * rgb[0] + 0.587    * rgb[1] + 0.114    * rgb[2];
+	*u = 128 - 0.168736 * rgb[0] - 0.331264 * rgb[1] + 0.5      * rgb[2];
+	*v = 128 + 0.5      * rgb[0] - 0.418688 * rgb[1] - 0.081312 * rgb[2];
+}
+
+static uint16_t refRgb565(const uint8_t* rgb)
+{
+	return ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+}
+
+/* Reference images */
+static bool allocImage(RefImage& img, const char* name, int width, int height, bool smooth)
+{
+	snprintf(img.name, sizeof(img.name), "%s", name);
+	img.width = width;
+	img.height = height;
+	img.smooth = smooth;
+	img.y = (uint8_t*)malloc(width * height * 3);
+	img.u = img.y + width * height;
+	img.v = img.u + width * height;
+	return img.y != NULL;
+}
+
+static void freeImage(RefImage& img)
+{
+	free(img.y);
+	img.y = img.u = img.v = NULL;
+}
+
+/* Smooth luma and chroma gradients */
+static void makeGradient(RefImage& img)
+{
+	int w = img.width, h = img.height;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			int i = y * w + x;
+			int cx = x & ~1;
+			img.y[i] = 16 + (219 * (x + y)) / (w + h);
+			img.u[i] = clamp8(128 + 100 * cos(M_PI * cx / w));
+			img.v[i] = clamp8(128 + 100 * sin(M_PI * (y + cx) / (w + h)));
+		}
+	}
+}
+
+/* 8 saturated color bars over a luma ramp, with hard edges */
+static void makeBars(RefImage& img)
+{
+	static const uint8_t bars[8][3] = {
+		{ 255, 255, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 0, 255, 0 },
+		{ 255, 0, 255 }, { 255, 0, 0 }, { 0, 0, 255 }, { 0, 0, 0 }
+	};
+	int w = img.width, h = img.height;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			int i = y * w + x;
+			double yy, u, v;
+			refRgbToYuv(bars[((x & ~1) * 8) / w], &yy, &u, &v);
+			img.y[i] = (y < h / 2) ? clamp8(yy) : (x * 255) / (w - 1);
+			img.u[i] = clamp8(u);
+			img.v[i] = clamp8(v);
+		}
+	}
+}
+
+/* Uniform noise, the worst case for anything that mixes samples */
+static void makeNoise(RefImage& img)
+{
+	int w = img.width, h = img.height;
+	uint32_t r = 12345;
+	for (int i = 0; i < w * h; i++) {
+		r = r * 1103515245u + 12345u;
+		img.y[i] = r >> 24;
+		if (!(i & 1)) {
+			r = r * 1103515245u + 12345u;
+			img.u[i] = img.u[i + 1] = r >> 24;
+			r = r * 1103515245u + 12345u;
+			img.v[i] = img.v[i + 1] = r >> 24;
+		}
+	}
+}
+
+/* Writes a reference image as YUYV */
+static void imageToYuyv(const RefImage& img, uint8_t* dst, int stride)
+{
+	for (int y = 0; y < img.height; y++) {
+		uint8_t* d = dst + y * stride;
+		const int o = y * img.width;
+		for (int x = 0; x < img.width; x += 2) {
+			*d++ = img.y[o + x];
+			*d++ = img.u[o + x];
+			*d++ = img.y[o + x + 1];
+			*d++ = img.v[o + x];
+		}
+	}
+}
+
+/* Chroma of the 2x2 block at x,y (both even) of a reference image, 
+ * averaged between rows and rounded */
+static inline uint8_t refChroma420(const RefImage& img, const uint8_t* c, int x, int y)
+{
+	int i = y * img.width + x;
+	return (c[i] + c[i + img.width] + 1) >> 1;
+}
+
+/* Fills the expected buffer with a reference image written in one of the
+ * fan-out formats, at dx,dy of a destination of the given stride and 
+ * height, and describes the regions it covers */
+static int expectFormat(const RefImage& img, int fmt, Buffer& exp, int dstStride, int dstHeight, 
+						int dx, int dy, Region* rg, Bounds& bounds)
+{
+	int w = img.width, h = img.height;
+	uint8_t* chroma = exp.data + dstStride * dstHeight;
+	int cStride = ((dstStride >> 1) + 15) & (-16);
+	int count = 1;
+	
+	bounds = exactBounds;
+	rg[0].offset = dy * dstStride;
+	rg[0].stride = dstStride;
+	rg[0].rows = h;
+	
+	switch (fmt) {
+		case YUYV_FANOUT_YVU420SP:
+		case YUYV_FANOUT_YVU420P:
+		case YUYV_FANOUT_YUV420P:
+		case YUYV_FANOUT_YVU422P: {
+			rg[0].offset += dx;
+			rg[0].rowBytes = w;
+			rg[0].pattern = "Y";
+			for (int y = 0; y < h; y++)
+				memcpy(exp.data + rg[0].offset + y * dstStride, img.y + y * w, w);
+				
+			if (fmt == YUYV_FANOUT_YVU420SP) {
+				rg[1].offset = chroma - exp.data + (dy >> 1) * dstStride + dx;
+				rg[1].stride = dstStride;
+				rg[1].rowBytes = w;
+				rg[1].rows = h >> 1;
+				rg[1].pattern = "VU";
+				for (int y = 0; y < h; y += 2) {
+					uint8_t* d = exp.data + rg[1].offset + (y >> 1) * dstStride;
+					for (int x = 0; x < w; x += 2) {
+						*d++ = refChroma420(img, img.v, x, y);
+						*d++ = refChroma420(img, img.u, x, y);
+					}
+				}
+				count = 2;
+				break;
+			}
+			
+			// Separate chroma planes, V first except for I420
+			int rows = (fmt == YUYV_FANOUT_YVU422P) ? h : (h >> 1);
+			int planeRows = (fmt == YUYV_FANOUT_YVU422P) ? dstHeight : (dstHeight >> 1);
+			int first = (fmt == YUYV_FANOUT_YVU422P) ? dy : (dy >> 1);
+			const uint8_t* planes[2];
+			planes[0] = (fmt == YUYV_FANOUT_YUV420P) ? img.u : img.v;
+			planes[1] = (fmt == YUYV_FANOUT_YUV420P) ? img.v : img.u;
+			for (int p = 0; p < 2; p++) {
+				rg[1 + p].offset = chroma - exp.data + p * cStride * planeRows + first * cStride + (dx >> 1);
+				rg[1 + p].stride = cStride;
+				rg[1 + p].rowBytes = w >> 1;
+				rg[1 + p].rows = rows;
+				rg[1 + p].pattern = "C";
+				for (int r = 0; r < rows; r++) {
+					uint8_t* d = exp.data + rg[1 + p].offset + r * cStride;
+					for (int x = 0; x < w; x += 2) {
+						*d++ = (fmt == YUYV_FANOUT_YVU422P) ? planes[p][r * w + x] :
+							refChroma420(img, planes[p], x, r << 1);
+					}
+				}
+			}
+			count = 3;
+			break;
+		}
+		
+		case YUYV_FANOUT_YUYV:
+			rg[0].offset += dx << 1;
+			rg[0].rowBytes = w << 1;
+			rg[0].pattern = "YUYV";
+			imageToYuyv(img, exp.data + rg[0].offset, dstStride);
+			break;
+			
+		case YUYV_FANOUT_RGB565:
+		case YUYV_FANOUT_RGB24:
+		case YUYV_FANOUT_RGB32:
+		case YUYV_FANOUT_BGR32: {
+			int bpp = (fmt == YUYV_FANOUT_RGB565) ? 2 : (fmt == YUYV_FANOUT_RGB24) ? 3 : 4;
+			rg[0].offset += dx * bpp;
+			rg[0].rowBytes = w * bpp;
+			rg[0].pattern = (bpp == 2) ? "5x" : (bpp == 3) ? "RGB" : "RGBx";
+			bounds = rgbBounds;
+			for (int y = 0; y < h; y++) {
+				uint8_t* d = exp.data + rg[0].offset + y * dstStride;
+				for (int x = 0; x < w; x++) {
+					int i = y * w + x;
+					uint8_t rgb[3];
+					refYuvToRgb(img.y[i], img.u[i], img.v[i], rgb);
+					if (bpp == 2) {
+						uint16_t p = refRgb565(rgb);
+						d[0] = p & 0xFF;
+						d[1] = p >> 8;
+					} else if (fmt == YUYV_FANOUT_BGR32) {
+						d[0] = rgb[2];
+						d[1] = rgb[1];
+						d[2] = rgb[0];
+					} else {
+						d[0] = rgb[0];
+						d[1] = rgb[1];
+						d[2] = rgb[2];
+					}
+					d += bpp;
+				}
+			}
+			break;
+		}
+	}
+	return count;
+}
+
+/* Copies the area x,y,w,h of a reference image, resampled to ow x oh and
+ * transformed as the fan-out converter does it. Pixels are sampled at 
+ * their centers, and each 2x2 block of the result gets the mean chroma of
+ * its 4 pixels */
+static bool transformImage(const RefImage& src, RefImage& dst, int sx, int sy, int w, int h, 
+						   int ow, int oh, int transform)
+{
+	int tw = (transform & 1) ? oh : ow;
+	int th = (transform & 1) ? ow : oh;
+	if (!allocImage(dst, src.name, tw, th, src.smooth))
+		return false;
+		
+	int W = ow - 1;
+	int H = oh - 1;
+	for (int y = 0; y < th; y++) {
+		for (int x = 0; x < tw; x++) {
+			// Undo the rotation, then the mirroring
+			int px, py;
+			switch (transform & YUYV_ROTATE_MASK) {
+				default:
+				case YUYV_ROTATE_0:		px = x;		py = y;		break;
+				case YUYV_ROTATE_90:	px = y;		py = H - x;	break;
+				case YUYV_ROTATE_180:	px = W - x;	py = H - y;	break;
+				case YUYV_ROTATE_270:	px = W - y;	py = x;		break;
+			}
+			if (transform & YUYV_MIRROR)
+				px = W - px;
+				
+			int qx = sx + ((2 * px + 1) * w) / (2 * ow);
+			int qy = sy + ((2 * py + 1) * h) / (2 * oh);
+			int i = qy * src.width + qx;
+			dst.y[y * tw + x] = src.y[i];
+			dst.u[y * tw + x] = src.u[i];
+			dst.v[y * tw + x] = src.v[i];
+		}
+	}
+	
+	// Average the chroma of each 2x2 block
+	for (int y = 0; y < th; y += 2) {
+		for (int x = 0; x < tw; x += 2) {
+			int i = y * tw + x;
+			int u = (dst.u[i] + dst.u[i + 1] + dst.u[i + tw] + dst.u[i + tw + 1] + 2) >> 2;
+			int v = (dst.v[i] + dst.v[i + 1] + dst.v[i + tw] + dst.v[i + tw + 1] + 2) >> 2;
+			dst.u[i] = dst.u[i + 1] = dst.u[i + tw] = dst.u[i + tw + 1] = u;
+			dst.v[i] = dst.v[i + 1] = dst.v[i + tw] = dst.v[i + tw + 1] = v;
+		}
+	}
+	return true;
+}
+
+/* Copies an area of a reference image */
+static bool cropImage(const RefImage& src, RefImage& dst, int sx, int sy, int w, int h)
+{
+	if (!allocImage(dst, src.name, w, h, src.smooth))
+		return false;
+	for (int y = 0; y < h; y++) {
+		int s = (sy + y) * src.width + sx;
+		memcpy(dst.y + y * w, src.y + s, w);
+		memcpy(dst.u + y * w, src.u + s, w);
+		memcpy(dst.v + y * w, src.v + s, w);
+	}
+	return true;
+}
+
+/* Size of the buffer of a destination in a fan-out format */
+static int formatBytesPerPixel(int fmt)
+{
+	switch (fmt) {
+		case YUYV_FANOUT_YUYV:
+		case YUYV_FANOUT_RGB565:	return 2;
+		case YUYV_FANOUT_RGB24:		return 3;
+		case YUYV_FANOUT_RGB32:
+		case YUYV_FANOUT_BGR32:		return 4;
+		default:					return 1;
+	}
+}
+
+/* Stride of a destination. 16 bit pixels are always kept aligned */
+static int formatStride(int fmt, int width, int pad)
+{
+	if (fmt == YUYV_FANOUT_RGB565)
+		pad &= ~1;
+	return width * formatBytesPerPixel(fmt) + pad;
+}
+
+static int formatBufferSize(int fmt, int stride, int height)
+{
+	int cStride = ((stride >> 1) + 15) & (-16);
+	switch (fmt) {
+		case YUYV_FANOUT_YVU420SP:	return stride * height + stride * (height >> 1);
+		case YUYV_FANOUT_YVU420P:
+		case YUYV_FANOUT_YUV420P:	return stride * height + cStride * height;
+		case YUYV_FANOUT_YVU422P:	return stride * height + 2 * cStride * height;
+		default:					return stride * height;
+	}
+}
+
+static const char* formatName(int fmt)
+{
+	static const char* names[] = { 
+		"yvu420sp", "yvu420p", "yuv420p", "yvu422p", "yuyv", 
+		"rgb565", "rgb24", "rgb32", "bgr32" 
+	};
+	return names[fmt];
+}
+
+/* The YUYV source of a test */
+struct Source {
+	Buffer buf;
+	int stride;
+};
+
+static bool makeYuyvSource(const RefImage& img, int pad, Source& s)
+{
+	s.stride = img.width * 2 + pad;
+	if (!allocBuffer(s.buf, s.stride * img.height))
+		return false;
+	imageToYuyv(img, s.buf.data, s.stride);
+	return true;
+}
+
+/* Checks the direct YUYV to YUV and RGB converters, and the fan-out 
+ * converter writing a single destination of the same format */
+static void testFromYuyv(const RefImage& img, int pad)
+{
+	static const struct {
+		const char* name;
+		int fmt;
+	} kernels[] = {
+		{ "yuyv_to_yvu420sp",	YUYV_FANOUT_YVU420SP },
+		{ "yuyv_to_yvu420p",	YUYV_FANOUT_YVU420P },
+		{ "yuyv_to_yuv420p",	YUYV_FANOUT_YUV420P },
+		{ "yuyv_to_yvu422p",	YUYV_FANOUT_YVU422P },
+		{ "yuyv_to_rgb565",		YUYV_FANOUT_RGB565 },
+		{ "yuyv_to_rgb24",		YUYV_FANOUT_RGB24 },
+		{ "yuyv_to_rgb32",		YUYV_FANOUT_RGB32 },
+		{ "yuyv_to_bgr32",		YUYV_FANOUT_BGR32 },
+	};
+	
+	int w = img.width, h = img.height;
+	Source src;
+	if (!makeYuyvSource(img, pad, src))
+		return;
+		
+	for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+		int fmt = kernels[k].fmt;
+		int stride = formatStride(fmt, w, pad);
+		int size = formatBufferSize(fmt, stride, h);
+		
+		Buffer out, exp;
+		if (!allocBuffer(out, size) || !allocBuffer(exp, size))
+			break;
+			
+		Region rg[MAX_REGIONS];
+		Bounds bounds;
+		int count = expectFormat(img, fmt, exp, stride, h, 0, 0, rg, bounds);
+		
+		char what[160];
+		for (int pass = 0; pass < 3; pass++) {
+			memset(out.base, VERIFY_CANARY, size + 2 * VERIFY_GUARD);
+			const char* name = kernels[k].name;
+			char line[64];
+			
+			if (pass == 0) {
+				// The direct converter
+				switch (fmt) {
+					case YUYV_FANOUT_YVU420SP: yuyv_to_yvu420sp(out.data, stride, h, src.buf.data, src.stride, w, h); break;
+					case YUYV_FANOUT_YVU420P:  yuyv_to_yvu420p(out.data, stride, h, src.buf.data, src.stride, w, h); break;
+					case YUYV_FANOUT_YUV420P:  yuyv_to_yuv420p(out.data, stride, h, src.buf.data, src.stride, w, h); break;
+					case YUYV_FANOUT_YVU422P:  yuyv_to_yvu422p(out.data, stride, h, src.buf.data, src.stride, w, h); break;
+					case YUYV_FANOUT_RGB565:   yuyv_to_rgb565(src.buf.data, src.stride, out.data, stride, w, h); break;
+					case YUYV_FANOUT_RGB24:    yuyv_to_rgb24(src.buf.data, src.stride, out.data, stride, w, h); break;
+					case YUYV_FANOUT_RGB32:    yuyv_to_rgb32(src.buf.data, src.stride, out.data, stride, w, h); break;
+					case YUYV_FANOUT_BGR32:    yuyv_to_bgr32(src.buf.data, src.stride, out.data, stride, w, h); break;
+				}
+			} else if (pass == 1) {
+				// The line converters, where available
+				void (*fn)(uint8_t*, uint8_t*, int) = NULL;
+				switch (fmt) {
+					case YUYV_FANOUT_RGB565: fn = yuyv_to_rgb565_line; break;
+					case YUYV_FANOUT_RGB24:  fn = yuyv_to_rgb24_line; break;
+					case YUYV_FANOUT_RGB32:  fn = yuyv_to_rgb32_line; break;
+					case YUYV_FANOUT_BGR32:  fn = yuyv_to_bgr32_line; break;
+				}
+				if (!fn)
+					continue;
+				for (int y = 0; y < h; y++)
+					fn(src.buf.data + y * src.stride, out.data + y * stride, w);
+				snprintf(line, sizeof(line), "%s_line", name);
+				name = line;
+			} else {
+				// The fan-out converter
+				struct yuyv_fanout_dst d;
+				memset(&d, 0, sizeof(d));
+				d.fmt = fmt;
+				d.dst = out.data;
+				d.dstStride = stride;
+				d.dstHeight = h;
+				d.width = w;
+				d.height = h;
+				yuyv_fanout(src.buf.data, src.stride, w, h, &d, 1);
+				snprintf(line, sizeof(line), "yuyv_fanout(%s)", formatName(fmt));
+				name = line;
+			}
+			
+			snprintf(what, sizeof(what), "%s %s %dx%d pad %d", name, img.name, w, h, pad);
+			compare(what, out, exp, rg, count, bounds);
+		}
+		freeBuffer(out);
+		freeBuffer(exp);
+	}
+	
+	// The BGR24 converter has no fan-out equivalent
+	{
+		int stride = w * 3 + pad;
+		Buffer out, exp;
+		if (allocBuffer(out, stride * h) && allocBuffer(exp, stride * h)) {
+			Region rg = { 0, stride, w * 3, h, "BGR" };
+			for (int y = 0; y < h; y++) {
+				uint8_t* d = exp.data + y * stride;
+				for (int x = 0; x < w; x++) {
+					int i = y * w + x;
+					uint8_t rgb[3];
+					refYuvToRgb(img.y[i], img.u[i], img.v[i], rgb);
+					*d++ = rgb[2];
+					*d++ = rgb[1];
+					*d++ = rgb[0];
+				}
+			}
+			yuyv_to_bgr24(src.buf.data, src.stride, out.data, stride, w, h);
+			char what[160];
+			snprintf(what, sizeof(what), "yuyv_to_bgr24 %s %dx%d pad %d", img.name, w, h, pad);
+			compare(what, out, exp, &rg, 1, rgbBounds);
+		}
+		freeBuffer(out);
+		freeBuffer(exp);
+	}
+	
+	freeBuffer(src.buf);
+}
+
+/* Checks the fan-out converter writing a cropped area of the source at an
+ * offset of each destination, and all of them in the same pass */
+static void testFanoutCrop(const RefImage& img, int pad)
+{
+	int w = img.width, h = img.height;
+	if (w < 8 || h < 8)
+		return;
+		
+	Source src;
+	if (!makeYuyvSource(img, pad, src))
+		return;
+		
+	// Area of the source, and where to place it into the destinations
+	int sx = (w / 4) & ~1;
+	int sy = (h / 4) & ~1;
+	int cw = (w / 2) & ~1;
+	int ch = (h / 2) & ~1;
+	int dx = 2;
+	int dy = 2;
+	int dw = cw + 6;
+	int dh = ch + 4;
+	
+	RefImage area;
+	if (!cropImage(img, area, sx, sy, cw, ch)) {
+		freeBuffer(src.buf);
+		return;
+	}
+	
+	// Each format on its own, then groups of 4 formats at once
+	static const int groups[][YUYV_FANOUT_MAX_DST] = {
+		{ YUYV_FANOUT_YVU420SP, -1 },
+		{ YUYV_FANOUT_YVU420P, -1 },
+		{ YUYV_FANOUT_YUV420P, -1 },
+		{ YUYV_FANOUT_YVU422P, -1 },
+		{ YUYV_FANOUT_YUYV, -1 },
+		{ YUYV_FANOUT_RGB565, -1 },
+		{ YUYV_FANOUT_RGB24, -1 },
+		{ YUYV_FANOUT_RGB32, -1 },
+		{ YUYV_FANOUT_BGR32, -1 },
+		{ YUYV_FANOUT_YVU420SP, YUYV_FANOUT_RGB565, YUYV_FANOUT_YVU420P, YUYV_FANOUT_YUYV },
+		{ YUYV_FANOUT_YUV420P, YUYV_FANOUT_YVU422P, YUYV_FANOUT_RGB24, YUYV_FANOUT_BGR32 },
+	};
+	
+	for (unsigned int g = 0; g < sizeof(groups) / sizeof(groups[0]); g++) {
+		struct yuyv_fanout_dst d[YUYV_FANOUT_MAX_DST];
+		Buffer out[YUYV_FANOUT_MAX_DST], exp[YUYV_FANOUT_MAX_DST];
+		Region rg[YUYV_FANOUT_MAX_DST][MAX_REGIONS];
+		int count[YUYV_FANOUT_MAX_DST];
+		Bounds bounds[YUYV_FANOUT_MAX_DST];
+		int n = 0;
+		bool allocated = true;
+		
+		memset(d, 0, sizeof(d));
+		for (n = 0; n < YUYV_FANOUT_MAX_DST && groups[g][n] >= 0; n++) {
+			int fmt = groups[g][n];
+			
+			// The first destination of a group takes the whole image
+			bool whole = (n == 0 && groups[g][1] >= 0);
+			int stride = formatStride(fmt, whole ? w : dw, pad);
+			int height = whole ? h : dh;
+			int size = formatBufferSize(fmt, stride, height);
+			if (!allocBuffers(out[n], exp[n], size)) {
+				allocated = false;
+				break;
+			}
+			
+			d[n].fmt = fmt;
+			d[n].dst = out[n].data;
+			d[n].dstStride = stride;
+			d[n].dstHeight = height;
+			d[n].dstX = whole ? 0 : dx;
+			d[n].dstY = whole ? 0 : dy;
+			d[n].srcX = whole ? 0 : sx;
+			d[n].srcY = whole ? 0 : sy;
+			d[n].width = whole ? w : cw;
+			d[n].height = whole ? h : ch;
+			count[n] = expectFormat(whole ? img : area, fmt, exp[n], stride, height, 
+									d[n].dstX, d[n].dstY, rg[n], bounds[n]);
+		}
+		if (!allocated) {
+			for (int i = 0; i < n; i++) {
+				freeBuffer(out[i]);
+				freeBuffer(exp[i]);
+			}
+			break;
+		}
+		
+		yuyv_fanout(src.buf.data, src.stride, w, h, d, n);
+		
+		for (int i = 0; i < n; i++) {
+			char what[160];
+			snprintf(what, sizeof(what), "yuyv_fanout(%s%s) %s %dx%d pad %d", 
+				formatName(d[i].fmt), (d[i].width == w) ? "" : ", crop", img.name, w, h, pad);
+			compare(what, out[i], exp[i], rg[i], count[i], bounds[i]);
+			freeBuffer(out[i]);
+			freeBuffer(exp[i]);
+		}
+	}
+	
+	freeImage(area);
+	freeBuffer(src.buf);
+}
+
+/* Checks the fan-out converter rotating, mirroring and scaling, and
+ * yuyv_scale */
+static void testFanoutTransform(const RefImage& img, int pad)
+{
+	static const struct {
+		int transform;
+		int num, den;			// Scale factor
+		int fmt;
+	} cases[] = {
+		{ YUYV_ROTATE_90,					1, 1,	YUYV_FANOUT_YUYV },
+		{ YUYV_ROTATE_180,					1, 1,	YUYV_FANOUT_YUYV },
+		{ YUYV_ROTATE_270,					1, 1,	YUYV_FANOUT_YUYV },
+		{ YUYV_MIRROR,						1, 1,	YUYV_FANOUT_YUYV },
+		{ YUYV_MIRROR | YUYV_ROTATE_90,		1, 1,	YUYV_FANOUT_YVU420SP },
+		{ YUYV_ROTATE_270,					1, 1,	YUYV_FANOUT_RGB565 },
+		{ YUYV_ROTATE_0,					1, 2,	YUYV_FANOUT_YUYV },
+		{ YUYV_ROTATE_0,					3, 2,	YUYV_FANOUT_YVU420SP },
+		{ YUYV_ROTATE_90,					1, 2,	YUYV_FANOUT_YVU420P },
+		{ YUYV_MIRROR | YUYV_ROTATE_180,	3, 4,	YUYV_FANOUT_RGB24 },
+	};
+	
+	int w = img.width, h = img.height;
+	Source src;
+	if (!makeYuyvSource(img, pad, src))
+		return;
+		
+	for (unsigned int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		int ow = (w * cases[c].num / cases[c].den) & ~1;
+		int oh = (h * cases[c].num / cases[c].den) & ~1;
+		if (ow < 2 || oh < 2)
+			continue;
+		bool scaled = (ow != w || oh != h);
+			
+		RefImage t;
+		if (!transformImage(img, t, 0, 0, w, h, ow, oh, cases[c].transform))
+			break;
+		
+		int fmt = cases[c].fmt;
+		int stride = formatStride(fmt, t.width, pad);
+		int size = formatBufferSize(fmt, stride, t.height);
+		Buffer out, exp;
+		if (!allocBuffers(out, exp, size)) {
+			freeImage(t);
+			break;
+		}
+		
+		struct yuyv_fanout_dst d;
+		memset(&d, 0, sizeof(d));
+		d.fmt = fmt;
+		d.dst = out.data;
+		d.dstStride = stride;
+		d.dstHeight = t.height;
+		d.width = w;
+		d.height = h;
+		d.outWidth = ow;
+		d.outHeight = oh;
+		d.transform = cases[c].transform;
+		yuyv_fanout(src.buf.data, src.stride, w, h, &d, 1);
+		
+		Region rg[MAX_REGIONS];
+		Bounds bounds;
+		int count = expectFormat(t, fmt, exp, stride, t.height, 0, 0, rg, bounds);
+		if (scaled) {
+			// Chroma of resampled noise can not be predicted
+			bounds = resampleBounds;
+			if (!img.smooth) {
+				bounds.minPsnr[CLS_CHROMA] = 0;
+				bounds.minPsnr[CLS_RGB] = 0;
+			}
+		} else if (fmt >= YUYV_FANOUT_RGB565) {
+			// Chroma averaged between rows moves the RGB values a bit more
+			bounds.maxErr[CLS_RGB] += 2;
+		}
+		
+		char what[160];
+		snprintf(what, sizeof(what), "yuyv_fanout(%s, transform %d, %dx%d) %s %dx%d pad %d", 
+			formatName(fmt), cases[c].transform, ow, oh, img.name, w, h, pad);
+		compare(what, out, exp, rg, count, bounds);
+		freeBuffer(out);
+		freeBuffer(exp);
+		freeImage(t);
+	}
+	
+	// yuyv_scale, to half and to 3/2 of the size
+	for (int c = 0; c < 2; c++) {
+		int ow = (c ? (w * 3 / 2) : (w / 2)) & ~1;
+		int oh = (c ? (h * 3 / 2) : (h / 2)) & ~1;
+		if (ow < 2 || oh < 2)
+			continue;
+			
+		RefImage t;
+		if (!transformImage(img, t, 0, 0, w, h, ow, oh, YUYV_ROTATE_0))
+			break;
+		
+		int stride = ow * 2 + pad;
+		Buffer out, exp;
+		if (!allocBuffers(out, exp, stride * oh)) {
+			freeImage(t);
+			break;
+		}
+		yuyv_scale(out.data, stride, ow, oh, src.buf.data, src.stride, w, h);
+		
+		Region rg[MAX_REGIONS];
+		Bounds bounds;
+		int count = expectFormat(t, YUYV_FANOUT_YUYV, exp, stride, oh, 0, 0, rg, bounds);
+		bounds = resampleBounds;
+		if (!img.smooth)
+			bounds.minPsnr[CLS_CHROMA] = 0;
+		
+		char what[160];
+		snprintf(what, sizeof(what), "yuyv_scale(%dx%d) %s %dx%d pad %d", ow, oh, img.name, w, h, pad);
+		compare(what, out, exp, rg, count, bounds);
+		freeBuffer(out);
+		freeBuffer(exp);
+		freeImage(t);
+	}
+	
+	freeBuffer(src.buf);
+}
+
+/* Checks the converters to YUYV. Each source is made from the reference
+ * image, subsampling its chroma as the source format requires, and the
+ * converter must restore exactly those samples */
+static void testToYuyv(const RefImage& img, int pad)
+{
+	enum {
+		K_YUV420, K_YVU420, K_NV12, K_NV21, K_NV16, K_NV61,
+		K_Y16, K_YYUV, K_UYVY, K_YVYU, K_Y41P, K_GREY, K_S501, K_S505, K_S508,
+		K_COUNT
+	};
+	static const char* names[K_COUNT] = {
+		"yuv420_to_yuyv", "yvu420_to_yuyv", "nv12_to_yuyv", "nv21_to_yuyv", 
+		"nv16_to_yuyv", "nv61_to_yuyv", "y16_to_yuyv", "yyuv_to_yuyv", 
+		"uyvy_to_yuyv", "yvyu_to_yuyv", "y41p_to_yuyv", "grey_to_yuyv", 
+		"s501_to_yuyv", "s505_to_yuyv", "s508_to_yuyv"
+	};
+	
+	int w = img.width, h = img.height;
+	int cw = w >> 1;
+	
+	// Expected chroma of each pixel, for 4:2:2, 4:2:0 and 4:1:1 sources
+	uint8_t* c422[2];
+	uint8_t* c420[2];
+	uint8_t* c411[2];
+	uint8_t* cbuf = (uint8_t*)malloc(w * h * 6);
+	if (!cbuf)
+		return;
+	for (int p = 0; p < 2; p++) {
+		c422[p] = cbuf + p * w * h;
+		c420[p] = cbuf + (2 + p) * w * h;
+		c411[p] = cbuf + (4 + p) * w * h;
+		const uint8_t* c = p ? img.v : img.u;
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				int i = y * w + x;
+				c422[p][i] = c[i];
+				c420[p][i] = refChroma420(img, c, x & ~1, y & ~1);
+				int x4 = x & ~3;
+				if (x4 + 2 < w)
+					c411[p][i] = (c[y * w + x4] + c[y * w + x4 + 2] + 1) >> 1;
+				else
+					c411[p][i] = c[y * w + x4];
+			}
+		}
+	}
+	
+	for (int k = 0; k < K_COUNT; k++) {
+		// Layouts without strides are only checked packed, and some
+		//  need the width to be a multiple of 4 or 8
+		bool strided = !(k == K_Y41P || k == K_S501 || k == K_S505 || k == K_S508);
+		int spad = strided ? pad : 0;
+		if (k == K_Y16)
+			spad &= ~1;
+		if (k == K_Y41P && (w & 7))
+			continue;
+			
+		Buffer sbuf;
+		struct yuv_plane planes[3];
+		int sstride = 0;
+		if (!allocBuffer(sbuf, (w * 2 + spad) * h * 2))
+			break;
+		uint8_t* s = sbuf.data;
+		const uint8_t** cc = (const uint8_t**)c422;
+		
+		switch (k) {
+			case K_YUV420:
+			case K_YVU420: {
+				cc = (const uint8_t**)c420;
+				planes[0].data = s;
+				planes[0].stride = w + spad;
+				planes[1].data = s + planes[0].stride * h;
+				planes[1].stride = cw + spad;
+				planes[2].data = planes[1].data + planes[1].stride * (h >> 1);
+				planes[2].stride = cw + spad;
+				int first = (k == K_YUV420) ? 0 : 1;
+				for (int y = 0; y < h; y++) {
+					memcpy(planes[0].data + y * planes[0].stride, img.y + y * w, w);
+					if (y & 1)
+						continue;
+					for (int x = 0; x < cw; x++) {
+						planes[1].data[(y >> 1) * planes[1].stride + x] = cc[first][y * w + 2 * x];
+						planes[2].data[(y >> 1) * planes[2].stride + x] = cc[first ^ 1][y * w + 2 * x];
+					}
+				}
+				break;
+			}
+			
+			case K_NV12: case K_NV21: case K_NV16: case K_NV61: {
+				bool is420 = (k == K_NV12 || k == K_NV21);
+				int first = (k == K_NV12 || k == K_NV16) ? 0 : 1;
+				cc = is420 ? (const uint8_t**)c420 : (const uint8_t**)c422;
+				planes[0].data = s;
+				planes[0].stride = w + spad;
+				planes[1].data = s + planes[0].stride * h;
+				planes[1].stride = w + spad;
+				for (int y = 0; y < h; y++) {
+					memcpy(planes[0].data + y * planes[0].stride, img.y + y * w, w);
+					if (is420 && (y & 1))
+						continue;
+					uint8_t* d = planes[1].data + (is420 ? (y >> 1) : y) * planes[1].stride;
+					for (int x = 0; x < w; x += 2) {
+						*d++ = cc[first][y * w + x];
+						*d++ = cc[first ^ 1][y * w + x];
+					}
+				}
+				break;
+			}
+			
+			case K_Y16:
+				sstride = w * 2 + spad;
+				for (int y = 0; y < h; y++) {
+					uint8_t* d = s + y * sstride;
+					for (int x = 0; x < w; x++) {
+						*d++ = (x * 37 + y) & 0xFF;		// Low byte, discarded
+						*d++ = img.y[y * w + x];
+					}
+				}
+				break;
+				
+			case K_YYUV: case K_UYVY: case K_YVYU: {
+				static const char* layouts[] = { "YYUV", "UYVY", "YVYU" };
+				const char* l = layouts[k - K_YYUV];
+				sstride = w * 2 + spad;
+				for (int y = 0; y < h; y++) {
+					uint8_t* d = s + y * sstride;
+					for (int x = 0; x < w; x += 2) {
+						int i = y * w + x;
+						int yn = 0;
+						for (int b = 0; b < 4; b++) {
+							switch (l[b]) {
+								case 'Y': d[b] = img.y[i + yn++]; break;
+								case 'U': d[b] = img.u[i]; break;
+								case 'V': d[b] = img.v[i]; break;
+							}
+						}
+						d += 4;
+					}
+				}
+				break;
+			}
+			
+			case K_Y41P:
+				// U0 Y0 V0 Y1 U4 Y2 V4 Y3 Y4 Y5 Y6 Y7
+				cc = (const uint8_t**)c411;
+				for (int y = 0; y < h; y++) {
+					uint8_t* d = s + y * (w * 3 / 2);
+					for (int x = 0; x < w; x += 8) {
+						const uint8_t* py = img.y + y * w + x;
+						int i = y * w + x;
+						d[0] = cc[0][i];	 d[1] = py[0]; d[2] = cc[1][i];	   d[3] = py[1];
+						d[4] = cc[0][i + 4]; d[5] = py[2]; d[6] = cc[1][i + 4]; d[7] = py[3];
+						d[8] = py[4]; d[9] = py[5]; d[10] = py[6]; d[11] = py[7];
+						d += 12;
+					}
+				}
+				break;
+				
+			case K_GREY:
+				sstride = w + spad;
+				for (int y = 0; y < h; y++)
+					memcpy(s + y * sstride, img.y + y * w, w);
+				break;
+				
+			case K_S501: case K_S505: case K_S508: {
+				// Blocks of 2 rows, with signed samples
+				static const char* layouts[] = { "YUYV", "YYUV", "YUVY" };
+				const char* l = layouts[k - K_S501];
+				cc = (const uint8_t**)c420;
+				uint8_t* d = s;
+				for (int y = 0; y < h; y += 2) {
+					int yn = 0;
+					for (int b = 0; b < 4; b++) {
+						if (l[b] == 'Y') {
+							for (int x = 0; x < w; x++)
+								*d++ = img.y[(y + yn) * w + x] - 0x80;
+							yn++;
+						} else {
+							const uint8_t* c = cc[l[b] == 'U' ? 0 : 1];
+							for (int x = 0; x < w; x += 2)
+								*d++ = c[y * w + x] - 0x80;
+						}
+					}
+				}
+				break;
+			}
+		}
+		
+		// Expected output
+		int stride = w * 2 + pad;
+		Buffer out, exp;
+		if (!allocBuffers(out, exp, stride * h)) {
+			freeBuffer(sbuf);
+			break;
+		}
+		for (int y = 0; y < h; y++) {
+			uint8_t* d = exp.data + y * stride;
+			for (int x = 0; x < w; x += 2) {
+				int i = y * w + x;
+				bool grey = (k == K_Y16 || k == K_GREY);
+				d[0] = img.y[i];
+				d[1] = grey ? 0x80 : cc[0][i];
+				d[2] = img.y[i + 1];
+				d[3] = grey ? 0x80 : cc[1][i];
+				d += 4;
+			}
+		}
+		
+		switch (k) {
+			case K_YUV420: yuv420_to_yuyv(out.data, stride, planes, w, h); break;
+			case K_YVU420: yvu420_to_yuyv(out.data, stride, planes, w, h); break;
+			case K_NV12:   nv12_to_yuyv(out.data, stride, planes, w, h); break;
+			case K_NV21:   nv21_to_yuyv(out.data, stride, planes, w, h); break;
+			case K_NV16:   nv16_to_yuyv(out.data, stride, planes, w, h); break;
+			case K_NV61:   nv61_to_yuyv(out.data, stride, planes, w, h); break;
+			case K_Y16:    y16_to_yuyv(out.data, stride, s, sstride, w, h); break;
+			case K_YYUV:   yyuv_to_yuyv(out.data, stride, s, sstride, w, h); break;
+			case K_UYVY:   uyvy_to_yuyv(out.data, stride, s, sstride, w, h); break;
+			case K_YVYU:   yvyu_to_yuyv(out.data, stride, s, sstride, w, h); break;
+			case K_Y41P:   y41p_to_yuyv(out.data, stride, s, w, h); break;
+			case K_GREY:   grey_to_yuyv(out.data, stride, s, sstride, w, h); break;
+			case K_S501:   s501_to_yuyv(out.data, stride, s, w, h); break;
+			case K_S505:   s505_to_yuyv(out.data, stride, s, w, h); break;
+			case K_S508:   s508_to_yuyv(out.data, stride, s, w, h); break;
+		}
+		
+		Region rg = { 0, stride, w * 2, h, "YUYV" };
+		Bounds bounds = exactBounds;
+		bounds.maxErr[CLS_CHROMA] = 0;
+		char what[160];
+		snprintf(what, sizeof(what), "%s %s %dx%d pad %d", names[k], img.name, w, h, spad);
+		compare(what, out, exp, &rg, 1, bounds);
+		
+		freeBuffer(out);
+		freeBuffer(exp);
+		freeBuffer(sbuf);
+	}
+	free(cbuf);
+}
+
+/* Checks the RGB to YUYV converters and the bayer demosaicing, from an RGB
+ * image made from the reference one */
+static void testFromRgb(const RefImage& img, int pad)
+{
+	int w = img.width, h = img.height;
+	uint8_t* rgb = (uint8_t*)malloc(w * h * 3);
+	if (!rgb)
+		return;
+	for (int i = 0; i < w * h; i++)
+		refYuvToRgb(img.y[i], img.u[i], img.v[i], rgb + i * 3);
+	
+	// RGB24 and BGR24 to YUYV
+	for (int bgr = 0; bgr < 2; bgr++) {
+		int sstride = w * 3 + pad;
+		int stride = w * 2 + pad;
+		Buffer sbuf, out, exp;
+		if (!allocBuffer(sbuf, sstride * h))
+			break;
+		if (!allocBuffers(out, exp, stride * h)) {
+			freeBuffer(sbuf);
+			break;
+		}
+		
+		for (int y = 0; y < h; y++) {
+			uint8_t* s = sbuf.data + y * sstride;
+			uint8_t* d = exp.data + y * stride;
+			for (int x = 0; x < w; x += 2) {
+				const uint8_t* p = rgb + (y * w + x) * 3;
+				double y0, u0, v0, y1, u1, v1;
+				refRgbToYuv(p, &y0, &u0, &v0);
+				refRgbToYuv(p + 3, &y1, &u1, &v1);
+				d[0] = clamp8(y0);
+				d[1] = clamp8((u0 + u1) / 2);
+				d[2] = clamp8(y1);
+				d[3] = clamp8((v0 + v1) / 2);
+				d += 4;
+				for (int i = 0; i < 6; i++)
+					s[i] = bgr ? p[(i / 3) * 3 + 2 - (i % 3)] : p[i];
+				s += 6;
+			}
+		}
+		
+		if (bgr)
+			bgr_to_yuyv(out.data, stride, sbuf.data, sstride, w, h);
+		else
+			rgb_to_yuyv(out.data, stride, sbuf.data, sstride, w, h);
+			
+		Region rg = { 0, stride, w * 2, h, "YUYV" };
+		Bounds bounds = exactBounds;
+		bounds.maxErr[CLS_LUMA] = 1;
+		char what[160];
+		snprintf(what, sizeof(what), "%s %s %dx%d pad %d", bgr ? "bgr_to_yuyv" : "rgb_to_yuyv", img.name, w, h, pad);
+		compare(what, out, exp, &rg, 1, bounds);
+		freeBuffer(sbuf);
+		freeBuffer(out);
+		freeBuffer(exp);
+	}
+	
+	// Bayer, in the 4 pixel orders. Only meaningful on smooth images,
+	//  and without strides
+	if (pad == 0 && img.smooth && w >= 4 && h >= 4) {
+		static const char* orders[4] = { "GBRG", "GRBG", "BGGR", "RGGB" };
+		for (int order = 0; order < 4; order++) {
+			Buffer sbuf, out, exp;
+			if (!allocBuffer(sbuf, w * h))
+				break;
+			if (!allocBuffers(out, exp, w * h * 3)) {
+				freeBuffer(sbuf);
+				break;
+			}
+			memcpy(exp.data, rgb, w * h * 3);
+			
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++) {
+					char c = orders[order][((y & 1) << 1) | (x & 1)];
+					int comp = (c == 'R') ? 0 : (c == 'G') ? 1 : 2;
+					sbuf.data[y * w + x] = rgb[(y * w + x) * 3 + comp];
+				}
+			}
+			bayer_to_rgb24(sbuf.data, out.data, w, h, order);
+			
+			Region rg = { 0, w * 3, w * 3, h, "RGB" };
+			char what[160];
+			snprintf(what, sizeof(what), "bayer_to_rgb24(%s) %s %dx%d", orders[order], img.name, w, h);
+			compare(what, out, exp, &rg, 1, bayerBounds);
+			freeBuffer(sbuf);
+			freeBuffer(out);
+			freeBuffer(exp);
+		}
+	}
+	
+	free(rgb);
+}
+
+/* Memory source of libjpeg */
+static void jpegInitSource(j_decompress_ptr) {}
+static boolean jpegFillInput(j_decompress_ptr cinfo)
+{
+	// Feed an EOI marker if the data ends prematurely
+	static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+	cinfo->src->next_input_byte = eoi;
+	cinfo->src->bytes_in_buffer = 2;
+	return TRUE;
+}
+static void jpegSkipInput(j_decompress_ptr cinfo, long count)
+{
+	if (count > (long)cinfo->src->bytes_in_buffer)
+		count = cinfo->src->bytes_in_buffer;
+	cinfo->src->next_input_byte += count;
+	cinfo->src->bytes_in_buffer -= count;
+}
+static void jpegTermSource(j_decompress_ptr) {}
+
+/* Decodes a JPEG image with libjpeg into a reference image */
+static bool libjpegDecode(const uint8_t* data, int size, RefImage& img)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	struct jpeg_source_mgr src;
+	
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&cinfo);
+	src.init_source = jpegInitSource;
+	src.fill_input_buffer = jpegFillInput;
+	src.skip_input_data = jpegSkipInput;
+	src.resync_to_restart = jpeg_resync_to_restart;
+	src.term_source = jpegTermSource;
+	src.next_input_byte = data;
+	src.bytes_in_buffer = size;
+	cinfo.src = &src;
+	
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = JCS_YCbCr;
+	cinfo.do_fancy_upsampling = FALSE;
+	jpeg_start_decompress(&cinfo);
+	
+	bool ok = allocImage(img, "libjpeg", cinfo.output_width, cinfo.output_height, true);
+	uint8_t* row = (uint8_t*)malloc(cinfo.output_width * 3);
+	while (ok && row && cinfo.output_scanline < cinfo.output_height) {
+		int y = cinfo.output_scanline;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+		for (int x = 0; x < img.width; x++) {
+			img.y[y * img.width + x] = row[x * 3];
+			img.u[y * img.width + x] = row[x * 3 + 1];
+			img.v[y * img.width + x] = row[x * 3 + 2];
+		}
+	}
+	free(row);
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return ok;
+}
+
+/* Memory destination of libjpeg */
+struct JpegMemDest {
+	struct jpeg_destination_mgr pub;
+	uint8_t* buf;
+	int size;
+};
+static void jpegInitDest(j_compress_ptr cinfo)
+{
+	JpegMemDest* d = (JpegMemDest*)cinfo->dest;
+	d->pub.next_output_byte = d->buf;
+	d->pub.free_in_buffer = d->size;
+}
+static boolean jpegEmptyOutput(j_compress_ptr) { return FALSE; }
+static void jpegTermDest(j_compress_ptr) {}
+
+/* Encodes a reference image with libjpeg, with the given luma sampling 
+ * factors (2x2 for 4:2:0, 2x1 for 4:2:2, 1x1 for 4:4:4) */
+static int libjpegEncode(const RefImage& img, uint8_t* buf, int size, int hsamp, int vsamp)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	JpegMemDest dest;
+	
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	dest.pub.init_destination = jpegInitDest;
+	dest.pub.empty_output_buffer = jpegEmptyOutput;
+	dest.pub.term_destination = jpegTermDest;
+	dest.buf = buf;
+	dest.size = size;
+	cinfo.dest = &dest.pub;
+	
+	cinfo.image_width = img.width;
+	cinfo.image_height = img.height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_YCbCr;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+	cinfo.comp_info[0].h_samp_factor = hsamp;
+	cinfo.comp_info[0].v_samp_factor = vsamp;
+	jpeg_set_quality(&cinfo, 95, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	
+	uint8_t* row = (uint8_t*)malloc(img.width * 3);
+	while (row && cinfo.next_scanline < cinfo.image_height) {
+		int y = cinfo.next_scanline;
+		for (int x = 0; x < img.width; x++) {
+			row[x * 3] = img.y[y * img.width + x];
+			row[x * 3 + 1] = img.u[y * img.width + x];
+			row[x * 3 + 2] = img.v[y * img.width + x];
+		}
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	free(row);
+	jpeg_finish_compress(&cinfo);
+	int len = size - dest.pub.free_in_buffer;
+	jpeg_destroy_compress(&cinfo);
+	return len;
+}
+
+/* Checks yuyv_to_jpeg, decoding its output with libjpeg, and jpeg_decode,
+ * against libjpeg decoding the same images */
+static void testJpeg(const RefImage& img, int pad)
+{
+	int w = img.width, h = img.height;
+	if ((w & 15) || (h & 15))
+		return;
+		
+	Source src;
+	if (!makeYuyvSource(img, pad, src))
+		return;
+	int size = w * h * 4 + 4096;
+	uint8_t* jpeg = (uint8_t*)malloc(size);
+	
+	static const struct {
+		int transform;
+		int num, den;
+	} cases[] = {
+		{ YUYV_ROTATE_0,				1, 1 },
+		{ YUYV_ROTATE_90,				1, 1 },
+		{ YUYV_MIRROR | YUYV_ROTATE_180,	1, 1 },
+		{ YUYV_ROTATE_0,				1, 2 },
+	};
+	
+	// Compression artifacts only stay within bounds on smooth images
+	for (unsigned int c = 0; jpeg && img.smooth && c < sizeof(cases) / sizeof(cases[0]); c++) {
+		int ow = (w * cases[c].num / cases[c].den) & ~1;
+		int oh = (h * cases[c].num / cases[c].den) & ~1;
+		if (ow < 16 || oh < 16)
+			continue;
+		int len = yuyv_to_jpeg(src.buf.data, jpeg, size, w, h, src.stride, 
+							   ow, oh, 95, cases[c].transform);
+		
+		// The encoder crops the image to multiples of 16
+		RefImage t, dec;
+		transformImage(img, t, 0, 0, w, h, ow, oh, cases[c].transform);
+		char what[160];
+		snprintf(what, sizeof(what), "yuyv_to_jpeg(transform %d, %dx%d) %s %dx%d pad %d", 
+			cases[c].transform, ow, oh, img.name, w, h, pad);
+		if (len <= 0 || !libjpegDecode(jpeg, len, dec) || 
+			dec.width != (t.width & ~15) || dec.height != (t.height & ~15)) {
+			printf("FAIL %s: unable to decode the image\n", what);
+			checksRun++;
+			checksFailed++;
+		} else {
+			RefImage tc;
+			cropImage(t, tc, 0, 0, dec.width, dec.height);
+			Buffer out, exp;
+			int stride = dec.width * 2;
+			if (allocBuffers(out, exp, stride * dec.height)) {
+				imageToYuyv(dec, out.data, stride);
+				imageToYuyv(tc, exp.data, stride);
+				Region rg = { 0, stride, stride, dec.height, "YUYV" };
+				compare(what, out, exp, &rg, 1, jpegBounds);
+				freeBuffer(out);
+				freeBuffer(exp);
+			}
+			freeImage(tc);
+		}
+		freeImage(t);
+		freeImage(dec);
+	}
+	
+	// jpeg_decode, of 4:2:2 images as made by UVC cameras, and of 4:2:0
+	//  and 4:4:4 ones
+	static const struct {
+		const char* name;
+		int hsamp, vsamp;
+	} samplings[] = {
+		{ "4:2:2", 2, 1 },
+		{ "4:2:0", 2, 2 },
+		{ "4:4:4", 1, 1 },
+	};
+	for (unsigned int c = 0; jpeg && c < sizeof(samplings) / sizeof(samplings[0]); c++) {
+		int len = libjpegEncode(img, jpeg, size, samplings[c].hsamp, samplings[c].vsamp);
+		RefImage dec;
+		if (!libjpegDecode(jpeg, len, dec))
+			continue;
+			
+		int stride = w * 2 + pad;
+		Buffer out, exp;
+		if (!allocBuffers(out, exp, stride * h)) {
+			freeImage(dec);
+			break;
+		}
+		
+		// jpeg_decode keeps the chroma of the first pixel of each pair
+		for (int i = 0; i < w * h; i += 2) {
+			dec.u[i + 1] = dec.u[i];
+			dec.v[i + 1] = dec.v[i];
+		}
+		imageToYuyv(dec, exp.data, stride);
+		
+		char what[160];
+		snprintf(what, sizeof(what), "jpeg_decode(%s) %s %dx%d pad %d", 
+			samplings[c].name, img.name, w, h, pad);
+		int err = jpeg_decode(out.data, stride, jpeg, w, h);
+		if (err) {
+			printf("FAIL %s: error %d\n", what, err);
+			checksRun++;
+			checksFailed++;
+		} else {
+			Region rg = { 0, stride, w * 2, h, "YUYV" };
+			compare(what, out, exp, &rg, 1, decodeBounds);
+		}
+		freeBuffer(out);
+		freeBuffer(exp);
+		freeImage(dec);
+	}
+	
+	free(jpeg);
+	freeBuffer(src.buf);
+}
+
+/* Reference luma stats, sampling the image pixel by pixel */
+static void refStats(const uint8_t* yuyv, int stride, int w, int h, struct yuyv_luma_stats& st)
+{
+	memset(&st, 0, sizeof(st));
+	st.width = w;
+	st.height = h;
+	if (w < YUYV_STATS_GRID * 2 || h < YUYV_STATS_GRID)
+		return;
+		
+	uint64_t sum[YUYV_STATS_GRID * YUYV_STATS_GRID] = { 0 };
+	uint32_t cnt[YUYV_STATS_GRID * YUYV_STATS_GRID] = { 0 };
+	uint64_t bsum[YUYV_STATS_BLOCKS] = { 0 };
+	uint32_t bcnt[YUYV_STATS_BLOCKS] = { 0 };
+	uint64_t total = 0;
+	for (int y = 0; y < h; y += 2) {
+		for (int x = 0; x < (w & (-2)); x += 2) {
+			int gx = YUYV_STATS_GRID - 1;
+			while (((gx * w) / YUYV_STATS_GRID & (-2)) > x)
+				gx--;
+			int b = ((y * YUYV_STATS_GRID) / h) * YUYV_STATS_GRID + gx;
+			int bx = YUYV_STATS_BLOCKS_X - 1;
+			while (((bx * w) / YUYV_STATS_BLOCKS_X & (-2)) > x)
+				bx--;
+			int sb = ((y * YUYV_STATS_BLOCKS_Y) / h) * YUYV_STATS_BLOCKS_X + bx;
+			uint8_t l = yuyv[y * stride + x * 2];
+			sum[b] += l;
+			cnt[b]++;
+			bsum[sb] += l;
+			bcnt[sb]++;
+			total += l;
+			st.hist[l >> 2]++;
+			st.samples++;
+		}
+	}
+	st.mean = st.samples ? (uint32_t)(total / st.samples) : 0;
+	for (int i = 0; i < YUYV_STATS_GRID * YUYV_STATS_GRID; i++)
+		st.grid[i] = cnt[i] ? (uint32_t)(sum[i] / cnt[i]) : 0;
+	for (int i = 0; i < YUYV_STATS_BLOCKS; i++)
+		st.blocks[i] = bcnt[i] ? (uint8_t)(bsum[i] / bcnt[i]) : 0;
+}
+
+static bool compareStats(const char* what, const struct yuyv_luma_stats& got, const struct yuyv_luma_stats& exp)
+{
+	checksRun++;
+	const char* err = NULL;
+	if (got.samples != exp.samples)
+		err = "sample count";
+	else if (got.mean != exp.mean)
+		err = "mean";
+	else if (memcmp(got.hist, exp.hist, sizeof(exp.hist)))
+		err = "histogram";
+	else if (memcmp(got.grid, exp.grid, sizeof(exp.grid)))
+		err = "grid";
+	else if (memcmp(got.blocks, exp.blocks, sizeof(exp.blocks)))
+		err = "blocks";
+	if (err) {
+		printf("FAIL %s: %s mismatch (mean %u, expected %u)\n", what, err, got.mean, exp.mean);
+		checksFailed++;
+		return false;
+	}
+	if (verbose)
+		printf("ok   %s: mean %u\n", what, got.mean);
+	return true;
+}
+
+/* Checks the luma stats gathered while converting match the stats of
+ * the converted image */
+static void testStats(const RefImage& img, int pad)
+{
+	int w = img.width, h = img.height;
+	Source src;
+	if (!makeYuyvSource(img, pad, src))
+		return;
+		
+	char what[160];
+	struct yuyv_luma_stats got, exp;
+	
+	// Gathered from the rows of the image
+	snprintf(what, sizeof(what), "yuyv_stats_rows %s %dx%d pad %d", img.name, w, h, pad);
+	yuyv_stats_begin(&got, w, h);
+	yuyv_stats_rows(&got, src.buf.data, src.stride, 0, h);
+	yuyv_stats_end(&got);
+	refStats(src.buf.data, src.stride, w, h, exp);
+	compareStats(what, got, exp);
+	
+	// Gathered by yuyv_scale, to half and to 3/2 of the size
+	for (int c = 0; c < 2; c++) {
+		int ow = ((c ? w * 3 / 2 : w / 2) + 1) & (-2);
+		int oh = (c ? h * 3 / 2 : h / 2) & (-2);
+		if (ow < 2 || oh < 2)
+			continue;
+		int stride = ow * 2 + pad;
+		Buffer out;
+		if (!allocBuffer(out, stride * oh))
+			break;
+		snprintf(what, sizeof(what), "yuyv_scale stats %s %dx%d->%dx%d pad %d", img.name, w, h, ow, oh, pad);
+		yuyv_stats_begin(&got, ow, oh);
+		yuyv_scale(out.data, stride, ow, oh, src.buf.data, src.stride, w, h, &got);
+		yuyv_stats_end(&got);
+		refStats(out.data, stride, ow, oh, exp);
+		compareStats(what, got, exp);
+		freeBuffer(out);
+	}
+	
+	// Gathered by jpeg_decode, strip by strip
+	if (!(w & 15) && !(h & 15)) {
+		int size = w * h * 4 + 4096;
+		uint8_t* jpeg = (uint8_t*)malloc(size);
+		int stride = w * 2 + pad;
+		Buffer out;
+		if (jpeg && allocBuffer(out, stride * h)) {
+			int len = libjpegEncode(img, jpeg, size, 2, 1);
+			snprintf(what, sizeof(what), "jpeg_decode stats %s %dx%d pad %d", img.name, w, h, pad);
+			yuyv_stats_begin(&got, w, h);
+			if (len > 0 && jpeg_decode(out.data, stride, jpeg, w, h, &got) == 0) {
+				yuyv_stats_end(&got);
+				refStats(out.data, stride, w, h, exp);
+				compareStats(what, got, exp);
+			}
+			freeBuffer(out);
+		}
+		free(jpeg);
+	}
+	
+	// Change detection: A frame never differs from itself, and a patch in
+	//  its center must be noticed
+	snprintf(what, sizeof(what), "yuyv_stats_delta %s %dx%d pad %d", img.name, w, h, pad);
+	yuyv_stats_begin(&got, w, h);
+	yuyv_stats_rows(&got, src.buf.data, src.stride, 0, h);
+	yuyv_stats_end(&got);
+	int same = yuyv_stats_delta(&got, &got);
+	uint8_t patch = (got.mean >= 128) ? 0 : 255;
+	for (int y = h * 3 / 8; y < h * 5 / 8; y++) {
+		for (int x = w * 3 / 8; x < w * 5 / 8; x++)
+			src.buf.data[y * src.stride + x * 2] = patch;
+	}
+	yuyv_stats_begin(&exp, w, h);
+	yuyv_stats_rows(&exp, src.buf.data, src.stride, 0, h);
+	yuyv_stats_end(&exp);
+	int changed = yuyv_stats_delta(&got, &exp);
+	checksRun++;
+	if (same != 0 || changed <= 0) {
+		printf("FAIL %s: delta %d to itself, %d to the patched frame\n", what, same, changed);
+		checksFailed++;
+	} else if (verbose) {
+		printf("ok   %s: delta %d to the patched frame\n", what, changed);
+	}
+	
+	freeBuffer(src.buf);
+}
+
+/* Applies a color effect to a copy of a reference image */
+static bool effectImage(const RefImage& src, RefImage& dst, int effect)
+{
+	if (!cropImage(src, dst, 0, 0, src.width, src.height))
+		return false;
+	for (int i = 0; i < src.width * src.height; i++) {
+		switch (effect) {
+			case YUYV_EFFECT_MONO:
+				dst.u[i] = dst.v[i] = 128;
+				break;
+			case YUYV_EFFECT_SEPIA:
+				dst.u[i] = 108;
+				dst.v[i] = 148;
+				break;
+			case YUYV_EFFECT_NEGATIVE:
+				dst.y[i] = 255 - dst.y[i];
+				dst.u[i] = 255 - dst.u[i];
+				dst.v[i] = 255 - dst.v[i];
+				break;
+			case YUYV_EFFECT_SOLARIZE:
+				if (dst.y[i] >= 128)
+					dst.y[i] = 255 - dst.y[i];
+				break;
+		}
+	}
+	return true;
+}
+
+/* Checks the color effects applied by the fan-out converter, both by 
+ * rows and by tiles, and by the JPEG encoder. The source must never be
+ * modified, as it is shared by all the destinations */
+static void testEffects(const RefImage& img, int pad)
+{
+	static const int fmts[] = { YUYV_FANOUT_YUYV, YUYV_FANOUT_YVU420SP, YUYV_FANOUT_YVU420P };
+	
+	int w = img.width, h = img.height;
+	Source src;
+	if (!makeYuyvSource(img, pad, src))
+		return;
+	Buffer orig;
+	if (!allocBuffer(orig, src.stride * h)) {
+		freeBuffer(src.buf);
+		return;
+	}
+	memcpy(orig.data, src.buf.data, src.stride * h);
+	Region srcRg = { 0, src.stride, w * 2, h, "YUYV" };
+	
+	for (int fx = YUYV_EFFECT_MONO; fx < YUYV_EFFECT_COUNT; fx++) {
+		RefImage e;
+		if (!effectImage(img, e, fx))
+			break;
+		char what[160];
+		
+		// By rows, and by tiles when rotating
+		for (int rot = 0; rot < 2; rot++) {
+			for (unsigned int f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+				// Transforming averages the chroma of each 2x2 block
+				RefImage t;
+				int transform = rot ? YUYV_ROTATE_90 : YUYV_ROTATE_0;
+				if (rot ? !transformImage(e, t, 0, 0, w, h, w, h, transform) 
+						: !cropImage(e, t, 0, 0, w, h))
+					break;
+				
+				int fmt = fmts[f];
+				int stride = formatStride(fmt, t.width, pad);
+				int size = formatBufferSize(fmt, stride, t.height);
+				Buffer out, exp;
+				if (!allocBuffers(out, exp, size)) {
+					freeImage(t);
+					break;
+				}
+				
+				struct yuyv_fanout_dst d;
+				memset(&d, 0, sizeof(d));
+				d.fmt = fmt;
+				d.dst = out.data;
+				d.dstStride = stride;
+				d.dstHeight = t.height;
+				d.width = w;
+				d.height = h;
+				d.transform = transform;
+				d.effect = fx;
+				yuyv_fanout(src.buf.data, src.stride, w, h, &d, 1);
+				
+				Region rg[MAX_REGIONS];
+				Bounds bounds;
+				int count = expectFormat(t, fmt, exp, stride, t.height, 0, 0, rg, bounds);
+				snprintf(what, sizeof(what), "yuyv_fanout(%s, transform %d, effect %d) %s %dx%d pad %d", 
+					formatName(fmt), transform, fx, img.name, w, h, pad);
+				compare(what, out, exp, rg, count, bounds);
+				freeBuffer(out);
+				freeBuffer(exp);
+				freeImage(t);
+			}
+		}
+		
+		snprintf(what, sizeof(what), "yuyv_fanout(effect %d) source %s %dx%d pad %d", fx, img.name, w, h, pad);
+		compare(what, src.buf, orig, &srcRg, 1, exactBounds);
+		
+		// While compressing
+		if (img.smooth && !(w & 15) && !(h & 15)) {
+			int size = w * h * 4 + 4096;
+			uint8_t* jpeg = (uint8_t*)malloc(size);
+			int len = jpeg ? yuyv_to_jpeg(src.buf.data, jpeg, size, w, h, src.stride, w, h, 95, YUYV_ROTATE_0, fx) : 0;
+			RefImage dec;
+			snprintf(what, sizeof(what), "yuyv_to_jpeg(effect %d) %s %dx%d pad %d", fx, img.name, w, h, pad);
+			if (len <= 0 || !libjpegDecode(jpeg, len, dec) || dec.width != w || dec.height != h) {
+				printf("FAIL %s: unable to decode the image\n", what);
+				checksRun++;
+				checksFailed++;
+			} else {
+				Buffer out, exp;
+				int stride = w * 2;
+				if (allocBuffers(out, exp, stride * h)) {
+					imageToYuyv(dec, out.data, stride);
+					imageToYuyv(e, exp.data, stride);
+					Region rg = { 0, stride, stride, h, "YUYV" };
+					compare(what, out, exp, &rg, 1, jpegBounds);
+					freeBuffer(out);
+					freeBuffer(exp);
+				}
+				freeImage(dec);
+			}
+			free(jpeg);
+		}
+		freeImage(e);
+	}
+	
+	freeBuffer(orig);
+	freeBuffer(src.buf);
+}
+
+static void runAll(const RefImage& img)
+{
+	printf("Checking %s %dx%d\n", img.name, img.width, img.height);
+	for (unsigned int p = 0; p < sizeof(verifyPads) / sizeof(verifyPads[0]); p++) {
+		int pad = verifyPads[p];
+		testFromYuyv(img, pad);
+		testFanoutCrop(img, pad);
+		testFanoutTransform(img, pad);
+		testToYuyv(img, pad);
+		testFromRgb(img, pad);
+		testJpeg(img, pad);
+		testStats(img, pad);
+		testEffects(img, pad);
+	}
+}
+
+/* Checks the motion detector on a sequence of frames: A change of the
+ * brightness of the whole scene must be ignored, a bright patch must be 
+ * reported where it is, and its removal must be reported once */
+static void testMotion()
+{
+	const int w = 320, h = 240, stride = w * 2;
+	uint8_t* frame = (uint8_t*)malloc(stride * h);
+	if (!frame)
+		return;
+		
+	android::CameraMotion motion;
+	android::CameraMotion::Region regions[CAMERA_MOTION_MAX_REGIONS];
+	motion.start(0, 0);
+	
+	static const struct {
+		const char* name;
+		int brightness;
+		bool patch;
+		nsecs_t time;			// In ms
+		bool report;
+		int count;
+	} steps[] = {
+		{ "background",			0,	false,	0,		false,	0 },
+		{ "still",				0,	false,	1000,	false,	0 },
+		{ "brighter scene",		30,	false,	2000,	false,	0 },
+		{ "patch",				30,	true,	3000,	true,	1 },
+		{ "patch, too soon",	30,	true,	3100,	false,	0 },
+		{ "patch removed",		30,	false,	4000,	true,	0 },
+		{ "still again",		30,	false,	5000,	false,	0 },
+	};
+	
+	for (unsigned int s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+		// Textured background, with a patch over the blocks 8-11 x 6-9
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				bool inPatch = steps[s].patch && x >= 80 && x < 120 && y >= 60 && y < 100;
+				frame[y * stride + x * 2] = inPatch ? 250 : 60 + ((x + y) & 63) + steps[s].brightness;
+				frame[y * stride + x * 2 + 1] = 128;
+			}
+		}
+		struct yuyv_luma_stats st;
+		yuyv_stats_begin(&st, w, h);
+		yuyv_stats_rows(&st, frame, stride, 0, h);
+		yuyv_stats_end(&st);
+		
+		int count = -1;
+		bool report = motion.update(st, steps[s].time * 1000000LL, regions, count);
+		
+		char what[160];
+		snprintf(what, sizeof(what), "motion detection: %s", steps[s].name);
+		checksRun++;
+		bool ok = report == steps[s].report && (!report || count == steps[s].count);
+		if (ok && report && count == 1) {
+			const android::CameraMotion::Region& r = regions[0];
+			ok = r.left == 64 && r.top == 64 && r.right == 95 && r.bottom == 105 && 
+				 r.blocks == 16 && r.score > 0;
+		}
+		if (!ok) {
+			printf("FAIL %s: report %d with %d regions, expected %d with %d\n", 
+				what, report, count, steps[s].report, steps[s].count);
+			if (report && count > 0) {
+				printf("     first region %d,%d-%d,%d blocks %d score %d\n", regions[0].left, regions[0].top, 
+					regions[0].right, regions[0].bottom, regions[0].blocks, regions[0].score);
+			}
+			checksFailed++;
+		} else if (verbose) {
+			printf("ok   %s\n", what);
+		}
+	}
+	
+	free(frame);
+}
+
+/* Loads the first frames of a YUYV recording, as made by the camera 
+ * when the debug.camera.raw_dump property is set */
+static int loadRecording(const char* path, RefImage* frames, int max)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	
+	struct v4l2_replay_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != V4L2_REPLAY_MAGIC ||
+		hdr.version != V4L2_REPLAY_VERSION) {
+		fprintf(stderr, "%s is not a recording\n", path);
+		fclose(f);
+		return -1;
+	}
+	if (hdr.pixelformat != V4L2_PIX_FMT_YUYV) {
+		fprintf(stderr, "%s: only YUYV recordings can be used\n", path);
+		fclose(f);
+		return -1;
+	}
+	
+	int w = hdr.width & ~15;
+	int h = hdr.height & ~15;
+	int bpl = hdr.bytesperline ? hdr.bytesperline : hdr.width * 2;
+	uint8_t* data = (uint8_t*)malloc(bpl * hdr.height);
+	int count = 0;
+	const char* base = strrchr(path, '/');
+	base = base ? base + 1 : path;
+	
+	struct v4l2_replay_frame fr;
+	while (data && count < max && fread(&fr, sizeof(fr), 1, f) == 1) {
+		if (fr.size < (uint32_t)(bpl * hdr.height) || fread(data, bpl * hdr.height, 1, f) != 1)
+			break;
+		fseek(f, fr.size - bpl * hdr.height, SEEK_CUR);
+		
+		char name[64];
+		snprintf(name, sizeof(name), "%s#%d", base, count);
+		// Real scenes can have any detail, so only the checks that do not
+		//  depend on the content are run on them
+		RefImage& img = frames[count];
+		if (!allocImage(img, name, w, h, false))
+			break;
+		for (int y = 0; y < h; y++) {
+			const uint8_t* s = data + y * bpl;
+			for (int x = 0; x < w; x += 2) {
+				int i = y * w + x;
+				img.y[i] = s[0];
+				img.y[i + 1] = s[2];
+				img.u[i] = img.u[i + 1] = s[1];
+				img.v[i] = img.v[i + 1] = s[3];
+				s += 4;
+			}
+		}
+		count++;
+	}
+	free(data);
+	fclose(f);
+	return count;
+}
+
+static void usage(const char* prog)
+{
+	fprintf(stderr, 
+		"Usage: %s [options] [recording.v4lr ...]\n"
+		"  -v          Show the results of the checks that pass\n"
+		"  -s          Skip the synthetic images\n"
+		"Up to %d frames of each YUYV recording are checked as well\n",
+		prog, VERIFY_MAX_FRAMES);
+}
+
+int main(int argc, char** argv)
+{
+	bool synthetic = true;
+	int opt;
+	while ((opt = getopt(argc, argv, "vsh")) != -1) {
+		switch (opt) {
+			case 'v': verbose = true; break;
+			case 's': synthetic = false; break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	
+	for (int i = optind; i < argc; i++) {
+		RefImage frames[VERIFY_MAX_FRAMES];
+		int count = loadRecording(argv[i], frames, VERIFY_MAX_FRAMES);
+		if (count < 0)
+			return 2;
+		for (int f = 0; f < count; f++) {
+			runAll(frames[f]);
+			freeImage(frames[f]);
+		}
+	}
+	
+	if (synthetic) {
+		for (unsigned int s = 0; s < sizeof(verifySizes) / sizeof(verifySizes[0]); s++) {
+			for (int kind = 0; kind < 3; kind++) {
+				static const char* names[3] = { "gradient", "bars", "noise" };
+				RefImage img;
+				if (!allocImage(img, names[kind], verifySizes[s].width, verifySizes[s].height, kind == 0))
+					return 2;
+				switch (kind) {
+					case 0: makeGradient(img); break;
+					case 1: makeBars(img); break;
+					case 2: makeNoise(img); break;
+				}
+				runAll(img);
+				freeImage(img);
+			}
+		}
+		testMotion();
+	}
+	
+	printf("%d checks, %d failed\n", checksRun, checksFailed);
+	return checksFailed ? 1 : 0;
+}
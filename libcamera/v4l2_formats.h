@@ -93,6 +93,31 @@
 #define V4L2_PIX_FMT_NV61  v4l2_fourcc('N','V','6','1')   /* YUV 4:2:2 Planar (v/u) interleaved */
 #endif
 
+/* Multi-planar variants, each plane in its own memory buffer */
+#ifndef V4L2_PIX_FMT_YUV420M
+#define V4L2_PIX_FMT_YUV420M v4l2_fourcc('Y','M','1','2')   /* YUV 4:2:0 3 planes  */
+#endif
+
+#ifndef V4L2_PIX_FMT_YVU420M
+#define V4L2_PIX_FMT_YVU420M v4l2_fourcc('Y','M','2','1')   /* YVU 4:2:0 3 planes  */
+#endif
+
+#ifndef V4L2_PIX_FMT_NV12M
+#define V4L2_PIX_FMT_NV12M v4l2_fourcc('N','M','1','2')   /* YUV 4:2:0 2 planes (u/v) interleaved */
+#endif
+
+#ifndef V4L2_PIX_FMT_NV21M
+#define V4L2_PIX_FMT_NV21M v4l2_fourcc('N','M','2','1')   /* YUV 4:2:0 2 planes (v/u) interleaved */
+#endif
+
+#ifndef V4L2_PIX_FMT_NV16M
+#define V4L2_PIX_FMT_NV16M v4l2_fourcc('N','M','1','6')   /* YUV 4:2:2 2 planes (u/v) interleaved */
+#endif
+
+#ifndef V4L2_PIX_FMT_NV61M
+#define V4L2_PIX_FMT_NV61M v4l2_fourcc('N','M','6','1')   /* YUV 4:2:2 2 planes (v/u) interleaved */
+#endif
+
 #ifndef V4L2_PIX_FMT_Y41P
 #define V4L2_PIX_FMT_Y41P  v4l2_fourcc('Y','4','1','P')    /* YUV 4:1:1          */
 #endif